@@ -33,6 +33,9 @@
 
 - (NSString *)aliasedGetCMD;
 
+- (NSString *)macroLastNameAlias;
+- (void)setMacroLastNameAlias:(NSString *)lastName;
+
 @end
 
 
@@ -361,6 +364,30 @@
     
 }
 
+- (void)testAliasMacroChecksArgumentsAtCompileTime {
+    
+    STAssertNoThrow(FMS_ALIAS_INSTANCE_METHOD([Person class], lastName, macroLastNameAlias),
+                    @"Matching literal selectors should alias without a runtime check");
+    STAssertNoThrow(FMS_ALIAS_INSTANCE_METHOD([Person class], setLastName:, setMacroLastNameAlias:),
+                    @"Matching literal selectors should alias without a runtime check");
+    
+    [self.p1 setMacroLastNameAlias:@"Brown"];
+    STAssertEqualObjects(self.p1.lastName, @"Brown", @"The setter alias should call the original setter");
+    STAssertEqualObjects([self.p1 macroLastNameAlias], @"Brown", @"The getter alias should call the original getter");
+}
+
+- (void)testAliasArgumentMismatchStillThrowsAtRuntime {
+    
+    STAssertThrows([Person FMS_aliasInstanceMethod:@selector(setLastName:)
+                                       newSelector:@selector(mismatchedLastNameAlias)],
+                   @"Selectors with different argument counts should throw");
+    STAssertThrows([Person FMS_aliasInstanceMethod:@selector(lastName)
+                                       newSelector:@selector(mismatchedLastNameAlias:)],
+                   @"Selectors with different argument counts should throw");
+    STAssertFalse([Person instancesRespondToSelector:@selector(mismatchedLastNameAlias:)],
+                  @"A rejected alias should not be added");
+}
+
 - (void)observeValueForKeyPath:(NSString *)keyPath
                       ofObject:(id)object
                         change:(NSDictionary *)change
@@ -0,0 +1,85 @@
+//
+//  FMSBenchmark.h
+//  FMSSwizzler
+//
+//  Minimal timing harness shared by the FMSSwizzler benchmarks.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * The work done by a single benchmark thread. Each thread is handed its index and
+ * the number of iterations it should perform.
+ */
+typedef void (^FMSBenchmarkBody) (NSUInteger threadIndex, NSUInteger iterations);
+
+/**
+ * Returns a monotonic timestamp in nanoseconds.
+ */
+uint64_t FMSBenchmarkNow(void);
+
+/**
+ * Runs `body` on `threads` threads that are all released at the same moment, waits for
+ * every thread to finish, and logs the wall time and the average nanoseconds per iteration
+ * seen by each thread.
+ *
+ * Returns the average nanoseconds per iteration.
+ */
+double FMSBenchmarkRun(NSString *name, NSUInteger threads, NSUInteger iterations, FMSBenchmarkBody body);
+
+/**
+ * A snapshot of the process's heap. Each count is only meaningful when its `...Available` flag is set: glibc
+ * reports bytes in use but has no count of live allocations, and other platforms may report neither.
+ */
+typedef struct {
+    size_t bytes;
+    size_t blocks;
+    BOOL bytesAvailable;
+    BOOL blocksAvailable;
+} FMSBenchmarkHeapUsage;
+
+FMSBenchmarkHeapUsage FMSBenchmarkCurrentHeapUsage(void);
+
+/**
+ * A single installation (alias, replace, subclass, ...) timed by FMSBenchmarkMeasureInstall().
+ */
+typedef void (^FMSBenchmarkInstallBody) (NSUInteger index);
+
+/**
+ * Calls `install` `count` times on the calling thread, logs the total and per-install cost, and
+ * records the result.
+ *
+ * Returns the average nanoseconds per install.
+ */
+double FMSBenchmarkMeasureInstall(NSString *name, NSUInteger count, FMSBenchmarkInstallBody install);
+
+/**
+ * Adds a result to the report written by FMSBenchmarkWriteJSON(). `metrics` must only contain
+ * JSON-compatible values. FMSBenchmarkRun() and FMSBenchmarkMeasureInstall() record their own results.
+ *
+ * Note: results should only be recorded from the thread that runs the suites.
+ */
+void FMSBenchmarkRecordResult(NSString *name, NSString *kind, NSDictionary *metrics);
+
+/**
+ * Writes every recorded result to `path` as a JSON document, so runs can be compared for regressions.
+ *
+ * Returns NO if the report couldn't be written.
+ */
+BOOL FMSBenchmarkWriteJSON(NSString *path);
+
+
+// Benchmark suites
+
+void FMSRunPseudoPropertyStorageBenchmarks(void);
+void FMSRunPseudoPropertyContentionBenchmarks(void);
+void FMSRunPseudoPropertyStartupBenchmarks(void);
+void FMSRunPseudoPropertyArenaBenchmarks(void);
+void FMSRunInstrumentationBenchmarks(void);
+void FMSRunMethodHookBenchmarks(void);
+void FMSRunSwizzlingBenchmarks(void);
+void FMSRunInstanceOverrideBenchmarks(void);
+void FMSRunSwizzleRecordBenchmarks(void);
+void FMSRunSamplingBenchmarks(void);
+void FMSRunMethodCacheBenchmarks(void);
+void FMSRunHookChainBenchmarks(void);
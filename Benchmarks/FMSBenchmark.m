@@ -0,0 +1,204 @@
+//
+//  FMSBenchmark.m
+//  FMSSwizzler
+//
+//  Minimal timing harness shared by the FMSSwizzler benchmarks.
+//
+
+#import "FMSBenchmark.h"
+#import <pthread.h>
+#import <stdatomic.h>
+#import <time.h>
+
+#if __APPLE__
+#import <malloc/malloc.h>
+#elif __GLIBC__
+#import <malloc.h>
+#endif
+
+typedef struct {
+    __unsafe_unretained FMSBenchmarkBody body;
+    NSUInteger threadIndex;
+    NSUInteger iterations;
+    atomic_uint *readyCount;
+    atomic_bool *go;
+} FMSBenchmarkThreadContext;
+
+static NSMutableArray *FMSBenchmarkResults = nil;
+
+uint64_t FMSBenchmarkNow(void) {
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static void *FMSBenchmarkThreadMain(void *argument) {
+    
+    FMSBenchmarkThreadContext *context = argument;
+    
+    atomic_fetch_add(context->readyCount, 1);
+    while (!atomic_load_explicit(context->go, memory_order_acquire)) {
+        // spin until every thread is ready
+    }
+    
+    @autoreleasepool {
+        context->body(context->threadIndex, context->iterations);
+    }
+    
+    return NULL;
+}
+
+double FMSBenchmarkRun(NSString *name, NSUInteger threads, NSUInteger iterations, FMSBenchmarkBody body) {
+    
+    if (threads == 0 || iterations == 0) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"A benchmark needs at least one thread and one iteration"];
+    }
+    
+    // Warm up caches and lazily created state on the calling thread.
+    @autoreleasepool {
+        body(0, MIN(iterations, (NSUInteger)1000));
+    }
+    
+    atomic_uint readyCount = 0;
+    atomic_bool go = false;
+    
+    pthread_t *handles = calloc(threads, sizeof(pthread_t));
+    FMSBenchmarkThreadContext *contexts = calloc(threads, sizeof(FMSBenchmarkThreadContext));
+    
+    for (NSUInteger index = 0; index < threads; index++) {
+        
+        contexts[index].body = body;
+        contexts[index].threadIndex = index;
+        contexts[index].iterations = iterations;
+        contexts[index].readyCount = &readyCount;
+        contexts[index].go = &go;
+        
+        pthread_create(&handles[index], NULL, FMSBenchmarkThreadMain, &contexts[index]);
+    }
+    
+    while (atomic_load(&readyCount) < threads) {
+        // wait for every thread to reach the starting line
+    }
+    
+    uint64_t start = FMSBenchmarkNow();
+    atomic_store_explicit(&go, true, memory_order_release);
+    
+    for (NSUInteger index = 0; index < threads; index++) {
+        pthread_join(handles[index], NULL);
+    }
+    
+    uint64_t elapsed = FMSBenchmarkNow() - start;
+    
+    free(handles);
+    free(contexts);
+    
+    double nanosecondsPerIteration = (double)elapsed / (double)iterations;
+    
+    printf("%-56s threads:%3lu  wall:%10.3f ms  %10.2f ns/op\n",
+           [name UTF8String],
+           (unsigned long)threads,
+           (double)elapsed / 1.0e6,
+           nanosecondsPerIteration);
+    
+    FMSBenchmarkRecordResult(name, @"throughput", @{@"threads": @(threads),
+                                                    @"iterations": @(iterations),
+                                                    @"wallNanoseconds": @(elapsed),
+                                                    @"nanosecondsPerOperation": @(nanosecondsPerIteration)});
+    
+    return nanosecondsPerIteration;
+}
+
+FMSBenchmarkHeapUsage FMSBenchmarkCurrentHeapUsage(void) {
+    
+    FMSBenchmarkHeapUsage usage = {0, 0, NO, NO};
+    
+#if __APPLE__
+    malloc_statistics_t statistics;
+    malloc_zone_statistics(NULL, &statistics);
+    
+    usage.bytes = statistics.size_in_use;
+    usage.blocks = statistics.blocks_in_use;
+    usage.bytesAvailable = YES;
+    usage.blocksAvailable = YES;
+#elif __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+    // mallinfo() is deprecated and its int fields wrap past 2 GiB. mallinfo2() only counts free chunks, not
+    // live ones, so glibc can't report allocation counts.
+    struct mallinfo2 info = mallinfo2();
+    
+    usage.bytes = info.uordblks + info.hblkhd;
+    usage.bytesAvailable = YES;
+#endif
+#endif
+    
+    return usage;
+}
+
+double FMSBenchmarkMeasureInstall(NSString *name, NSUInteger count, FMSBenchmarkInstallBody install) {
+    
+    if (count == 0) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"An install benchmark needs at least one install"];
+    }
+    
+    uint64_t start = FMSBenchmarkNow();
+    
+    @autoreleasepool {
+        for (NSUInteger index = 0; index < count; index++) {
+            install(index);
+        }
+    }
+    
+    uint64_t elapsed = FMSBenchmarkNow() - start;
+    double nanosecondsPerInstall = (double)elapsed / (double)count;
+    
+    printf("%-56s installs:%6lu  total:%10.3f ms  %10.2f ns/install\n",
+           [name UTF8String],
+           (unsigned long)count,
+           (double)elapsed / 1.0e6,
+           nanosecondsPerInstall);
+    
+    FMSBenchmarkRecordResult(name, @"install", @{@"installs": @(count),
+                                                 @"wallNanoseconds": @(elapsed),
+                                                 @"nanosecondsPerInstall": @(nanosecondsPerInstall)});
+    
+    return nanosecondsPerInstall;
+}
+
+void FMSBenchmarkRecordResult(NSString *name, NSString *kind, NSDictionary *metrics) {
+    
+    if (FMSBenchmarkResults == nil) {
+        FMSBenchmarkResults = [NSMutableArray array];
+    }
+    
+    NSMutableDictionary *result = [metrics mutableCopy];
+    result[@"name"] = name;
+    result[@"kind"] = kind;
+    
+    [FMSBenchmarkResults addObject:result];
+}
+
+BOOL FMSBenchmarkWriteJSON(NSString *path) {
+    
+    NSDictionary *report = @{@"library": @"FMSSwizzler",
+                             @"timestamp": @((uint64_t)[[NSDate date] timeIntervalSince1970]),
+                             @"results": FMSBenchmarkResults ?: @[]};
+    
+    NSError *error = nil;
+    NSData *data = [NSJSONSerialization dataWithJSONObject:report
+                                                   options:NSJSONWritingPrettyPrinted
+                                                     error:&error];
+    
+    if (data == nil || ![data writeToFile:path atomically:YES]) {
+        
+        fprintf(stderr, "Unable to write benchmark results to %s: %s\n",
+                [path UTF8String],
+                [[error localizedDescription] UTF8String] ?: "write failed");
+        return NO;
+    }
+    
+    return YES;
+}
@@ -0,0 +1,164 @@
+//
+//  HookChainBenchmarks.m
+//  FMSSwizzler
+//
+//  Compares calling a method through hook chains of 1, 4 and 16 handlers with the same number of stacked
+//  overrides and stacked hooks, and measures chain dispatch while another thread keeps adding and removing handlers.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+#import <objc/message.h>
+#import <stdatomic.h>
+
+static const NSUInteger FMSHookChainIterations = 2000000;
+
+static atomic_bool FMSHookChainChurnStop = false;
+static atomic_size_t FMSHookChainChurnChanges = 0;
+
+@interface FMSHookChainBenchmarkTarget : NSObject
+- (NSUInteger)increment:(NSUInteger)value;
+@end
+
+@implementation FMSHookChainBenchmarkTarget
+
+- (NSUInteger)increment:(NSUInteger)value {
+    return value + 1;
+}
+
+@end
+
+static Class FMSCreateHookChainClass(NSString *name) {
+    
+    Class cls = objc_allocateClassPair([FMSHookChainBenchmarkTarget class], [name UTF8String], 0);
+    objc_registerClassPair(cls);
+    
+    return cls;
+}
+
+static void FMSMeasureLayeredDispatch(NSString *name, Class cls, NSUInteger threads) {
+    
+    NSMutableArray *targets = [NSMutableArray array];
+    for (NSUInteger thread = 0; thread < threads; thread++) [targets addObject:[[cls alloc] init]];
+    
+    FMSBenchmarkRun(name, threads, FMSHookChainIterations, ^(NSUInteger threadIndex, NSUInteger iterations) {
+        
+        FMSHookChainBenchmarkTarget *target = targets[threadIndex];
+        NSUInteger value = 0;
+        
+        for (NSUInteger i = 0; i < iterations; i++) {
+            value = [target increment:value];
+        }
+        
+        if (value != iterations) {
+            printf("unexpected result %lu\n", (unsigned long)value);
+        }
+    });
+}
+
+/*
+ * Each override layer needs its own alias, and calls the layer below through it. The handlers and hooks below
+ * do no work either, so the numbers are the cost of the layering alone.
+ */
+static Class FMSCreateStackedOverrides(NSUInteger layers) {
+    
+    Class cls = FMSCreateHookChainClass([NSString stringWithFormat:@"FMSStackedOverrideBenchmark%lu", (unsigned long)layers]);
+    
+    for (NSUInteger layer = 0; layer < layers; layer++) {
+        
+        SEL oldSelector = sel_registerName([[NSString stringWithFormat:@"hookChainBenchmarkOld%luIncrement:", (unsigned long)layer] UTF8String]);
+        
+        [cls FMS_overrideInstanceMethod:@selector(increment:)
+                            oldSelector:oldSelector
+                    implementationBlock:^NSUInteger(id _self, NSUInteger value) {
+                        return ((NSUInteger (*)(id, SEL, NSUInteger))objc_msgSend)(_self, oldSelector, value);
+                    }];
+    }
+    
+    return cls;
+}
+
+static Class FMSCreateStackedHooks(NSUInteger layers) {
+    
+    Class cls = FMSCreateHookChainClass([NSString stringWithFormat:@"FMSStackedHookBenchmark%lu", (unsigned long)layers]);
+    
+    for (NSUInteger layer = 0; layer < layers; layer++) {
+        [cls FMS_hookInstanceMethod:@selector(increment:) before:^(id receiver, SEL selector) {} after:nil];
+    }
+    
+    return cls;
+}
+
+static Class FMSCreateChain(NSUInteger layers) {
+    
+    Class cls = FMSCreateHookChainClass([NSString stringWithFormat:@"FMSHookChainBenchmark%lu", (unsigned long)layers]);
+    
+    for (NSUInteger layer = 0; layer < layers; layer++) {
+        [cls FMS_chainInstanceMethod:@selector(increment:) before:^(id receiver, SEL selector) {} after:nil];
+    }
+    
+    return cls;
+}
+
+static void FMSRunLayeringBenchmarks(void) {
+    
+    NSUInteger layerCounts[] = {1, 4, 16};
+    
+    FMSMeasureLayeredDispatch(@"dispatch baseline", [FMSHookChainBenchmarkTarget class], 1);
+    
+    for (NSUInteger index = 0; index < sizeof(layerCounts) / sizeof(layerCounts[0]); index++) {
+        
+        NSUInteger layers = layerCounts[index];
+        
+        FMSMeasureLayeredDispatch([NSString stringWithFormat:@"dispatch %lu stacked overrides", (unsigned long)layers],
+                                  FMSCreateStackedOverrides(layers), 1);
+        FMSMeasureLayeredDispatch([NSString stringWithFormat:@"dispatch %lu stacked hooks", (unsigned long)layers],
+                                  FMSCreateStackedHooks(layers), 1);
+        FMSMeasureLayeredDispatch([NSString stringWithFormat:@"dispatch hook chain (%lu handlers)", (unsigned long)layers],
+                                  FMSCreateChain(layers), 1);
+    }
+}
+
+static void FMSRunChurnBenchmarks(void) {
+    
+    Class cls = FMSCreateHookChainClass(@"FMSHookChainChurnBenchmark");
+    
+    for (NSUInteger layer = 0; layer < 4; layer++) {
+        [cls FMS_chainInstanceMethod:@selector(increment:) before:^(id receiver, SEL selector) {} after:nil];
+    }
+    
+    FMSMeasureLayeredDispatch(@"dispatch hook chain (4 handlers, 4 threads)", cls, 4);
+    
+    // Keep swapping the chain's array on another thread for the whole run.
+    dispatch_group_t group = dispatch_group_create();
+    
+    dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        
+        while (!atomic_load(&FMSHookChainChurnStop)) {
+            
+            FMSHookChainHandler *handler =
+            [cls FMS_chainInstanceMethod:@selector(increment:) around:^(id receiver, SEL selector, FMSHookChainProceedBlock proceed) {
+                proceed();
+            }];
+            
+            [handler remove];
+            atomic_fetch_add(&FMSHookChainChurnChanges, 2);
+        }
+    });
+    
+    FMSMeasureLayeredDispatch(@"dispatch hook chain (4 handlers, 4 threads, churning)", cls, 4);
+    
+    atomic_store(&FMSHookChainChurnStop, true);
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    
+    printf("%-56s changes:%lu\n", "hook chain churn", (unsigned long)atomic_load(&FMSHookChainChurnChanges));
+    
+    FMSBenchmarkRecordResult(@"hook chain churn", @"churn", @{@"changes": @(atomic_load(&FMSHookChainChurnChanges))});
+}
+
+void FMSRunHookChainBenchmarks(void) {
+    
+    FMSRunLayeringBenchmarks();
+    FMSRunChurnBenchmarks();
+}
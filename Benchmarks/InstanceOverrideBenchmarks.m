@@ -0,0 +1,144 @@
+//
+//  InstanceOverrideBenchmarks.m
+//  FMSSwizzler
+//
+//  Compares per-object overrides (FMS_replaceMethod:withImplementationBlock:) with giving each object its own
+//  dynamic subclass: memory and generated classes per object, and the cost of a call.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+
+static const NSUInteger FMSInstanceOverrideObjects = 100000;
+static const NSUInteger FMSDynamicSubclassObjects = 10000;
+static const NSUInteger FMSInstanceOverrideIterations = 2000000;
+
+@interface FMSInstanceOverrideTarget : NSObject
+- (NSUInteger)increment:(NSUInteger)value;
+@end
+
+@implementation FMSInstanceOverrideTarget
+
+- (NSUInteger)increment:(NSUInteger)value {
+    return value + 1;
+}
+
+@end
+
+// Separate classes, so the two approaches don't share any state.
+@interface FMSInstanceOverrideSubclassTarget : FMSInstanceOverrideTarget
+@end
+
+@implementation FMSInstanceOverrideSubclassTarget
+@end
+
+static NSArray *FMSCreateTargets(Class cls, NSUInteger count) {
+    
+    NSMutableArray *targets = [NSMutableArray arrayWithCapacity:count];
+    
+    for (NSUInteger index = 0; index < count; index++) {
+        [targets addObject:[[cls alloc] init]];
+    }
+    
+    return targets;
+}
+
+static void FMSReportOverrideMemory(NSString *name,
+                                    NSUInteger objects,
+                                    uint64_t elapsed,
+                                    NSUInteger classes,
+                                    FMSBenchmarkHeapUsage before,
+                                    FMSBenchmarkHeapUsage after) {
+    
+    BOOL bytesAvailable = before.bytesAvailable && after.bytesAvailable;
+    double bytesPerObject = ((double)after.bytes - (double)before.bytes) / (double)objects;
+    NSString *bytes = bytesAvailable ? [NSString stringWithFormat:@"%8.1f", bytesPerObject] : @"unavailable";
+    
+    printf("%-56s objects:%7lu  total:%10.3f ms  %10.2f ns/object  %s bytes/object  classes:%lu\n",
+           [name UTF8String],
+           (unsigned long)objects,
+           (double)elapsed / 1.0e6,
+           (double)elapsed / (double)objects,
+           [bytes UTF8String],
+           (unsigned long)classes);
+    
+    NSMutableDictionary *metrics = [@{@"installs": @(objects),
+                                      @"wallNanoseconds": @(elapsed),
+                                      @"nanosecondsPerInstall": @((double)elapsed / (double)objects),
+                                      @"generatedClasses": @(classes)} mutableCopy];
+    
+    if (bytesAvailable) {
+        metrics[@"heapBytesPerObject"] = @(bytesPerObject);
+    }
+    
+    FMSBenchmarkRecordResult(name, @"install", metrics);
+}
+
+static void FMSMeasureOverrideCalls(NSString *name, id target) {
+    
+    FMSBenchmarkRun(name, 1, FMSInstanceOverrideIterations, ^(NSUInteger threadIndex, NSUInteger iterations) {
+        
+        NSUInteger value = 0;
+        
+        for (NSUInteger i = 0; i < iterations; i++) {
+            value = [target increment:value];
+        }
+        
+        if (value < iterations) {
+            printf("unexpected result %lu\n", (unsigned long)value);
+        }
+    });
+}
+
+void FMSRunInstanceOverrideBenchmarks(void) {
+    
+    id (^overrideBlock)(void) = ^{
+        return ^NSUInteger(id _self, NSUInteger value) {
+            return value + 2;
+        };
+    };
+    
+    // Create the objects up front, so we only measure the overrides.
+    NSArray *perObject = FMSCreateTargets([FMSInstanceOverrideTarget class], FMSInstanceOverrideObjects);
+    NSArray *perClass = FMSCreateTargets([FMSInstanceOverrideSubclassTarget class], FMSDynamicSubclassObjects);
+    
+    NSUInteger classesBefore = [NSObject FMS_liveGeneratedClassCount];
+    FMSBenchmarkHeapUsage before = FMSBenchmarkCurrentHeapUsage();
+    uint64_t start = FMSBenchmarkNow();
+    
+    @autoreleasepool {
+        for (id target in perObject) {
+            [target FMS_replaceMethod:@selector(increment:) withImplementationBlock:overrideBlock()];
+        }
+    }
+    
+    FMSReportOverrideMemory(@"per-object override (shared dispatch class)", FMSInstanceOverrideObjects,
+                            FMSBenchmarkNow() - start, [NSObject FMS_liveGeneratedClassCount] - classesBefore,
+                            before, FMSBenchmarkCurrentHeapUsage());
+    
+    classesBefore = [NSObject FMS_liveGeneratedClassCount];
+    before = FMSBenchmarkCurrentHeapUsage();
+    start = FMSBenchmarkNow();
+    
+    @autoreleasepool {
+        for (id target in perClass) {
+            [target FMS_dynamiclySubclass];
+            [[target class] FMS_replaceInstanceMethod:@selector(increment:) withImplementationBlock:overrideBlock()];
+        }
+    }
+    
+    FMSReportOverrideMemory(@"per-object override (dynamic subclass each)", FMSDynamicSubclassObjects,
+                            FMSBenchmarkNow() - start, [NSObject FMS_liveGeneratedClassCount] - classesBefore,
+                            before, FMSBenchmarkCurrentHeapUsage());
+    
+    // An object in the dispatching class that doesn't override the method falls through to the original.
+    FMSInstanceOverrideTarget *fallThrough = [[FMSInstanceOverrideTarget alloc] init];
+    [fallThrough FMS_replaceMethod:@selector(description) withImplementationBlock:^(id _self) {
+        return @"fall through";
+    }];
+    
+    FMSMeasureOverrideCalls(@"call baseline", [[FMSInstanceOverrideTarget alloc] init]);
+    FMSMeasureOverrideCalls(@"call per-object override", perObject[0]);
+    FMSMeasureOverrideCalls(@"call through dispatch class (not overridden)", fallThrough);
+    FMSMeasureOverrideCalls(@"call dynamic subclass override", perClass[0]);
+}
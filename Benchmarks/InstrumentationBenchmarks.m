@@ -0,0 +1,118 @@
+//
+//  InstrumentationBenchmarks.m
+//  FMSSwizzler
+//
+//  Measures the per-call overhead of FMS_instrumentInstanceMethod: against an uninstrumented call and
+//  against the hand-written, block-based timing override it replaces.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+#import <stdatomic.h>
+
+@interface FMSInstrumentationBenchmarkTarget : NSObject
+- (NSUInteger)addOne:(NSUInteger)value;
+@end
+
+@implementation FMSInstrumentationBenchmarkTarget
+
+- (NSUInteger)addOne:(NSUInteger)value {
+    return value + 1;
+}
+
+@end
+
+// One subclass per variant, so each one swizzles its own copy of the method.
+@interface FMSUninstrumentedTarget : FMSInstrumentationBenchmarkTarget
+@end
+
+@implementation FMSUninstrumentedTarget
+@end
+
+@interface FMSInstrumentedTarget : FMSInstrumentationBenchmarkTarget
+@end
+
+@implementation FMSInstrumentedTarget
+@end
+
+@interface FMSBlockOverriddenTarget : FMSInstrumentationBenchmarkTarget
+@end
+
+@implementation FMSBlockOverriddenTarget
+@end
+
+// This prevents compiler errors for non-declared methods
+@interface NSObject(InstrumentationBenchmarks)
+- (NSUInteger)benchmarkOldAddOne:(NSUInteger)value;
+@end
+
+static const NSUInteger FMSInstrumentationIterations = 5000000;
+
+// What a typical hand-rolled override records: a shared call counter and total time.
+static atomic_uint_fast64_t FMSBlockOverrideCalls = 0;
+static atomic_uint_fast64_t FMSBlockOverrideNanoseconds = 0;
+
+static double FMSRunCallBenchmark(NSString *name, NSUInteger threads, Class cls) {
+    
+    NSMutableArray *targets = [NSMutableArray array];
+    for (NSUInteger thread = 0; thread < threads; thread++) {
+        [targets addObject:[[cls alloc] init]];
+    }
+    
+    return FMSBenchmarkRun(name, threads, FMSInstrumentationIterations,
+                           ^(NSUInteger threadIndex, NSUInteger iterations) {
+                               
+                               FMSInstrumentationBenchmarkTarget *target = targets[threadIndex];
+                               NSUInteger value = 0;
+                               
+                               for (NSUInteger i = 0; i < iterations; i++) {
+                                   value = [target addOne:value];
+                               }
+                               
+                               if (value != iterations) abort();
+                           });
+}
+
+void FMSRunInstrumentationBenchmarks(void) {
+    
+    [FMSInstrumentedTarget FMS_instrumentInstanceMethod:@selector(addOne:)];
+    
+    [FMSBlockOverriddenTarget
+     FMS_overrideInstanceMethod:@selector(addOne:)
+     oldSelector:@selector(benchmarkOldAddOne:)
+     implementationBlock:^NSUInteger(id _self, NSUInteger value) {
+         
+         uint64_t start = FMSBenchmarkNow();
+         NSUInteger result = [_self benchmarkOldAddOne:value];
+         
+         atomic_fetch_add_explicit(&FMSBlockOverrideCalls, 1, memory_order_relaxed);
+         atomic_fetch_add_explicit(&FMSBlockOverrideNanoseconds, FMSBenchmarkNow() - start, memory_order_relaxed);
+         
+         return result;
+     }];
+    
+    NSUInteger threadCounts[] = {1, 4, 16};
+    
+    for (NSUInteger index = 0; index < sizeof(threadCounts) / sizeof(threadCounts[0]); index++) {
+        
+        NSUInteger threads = threadCounts[index];
+        
+        double baseline = FMSRunCallBenchmark(@"method call (uninstrumented)", threads, [FMSUninstrumentedTarget class]);
+        double instrumented = FMSRunCallBenchmark(@"method call (FMS_instrumentInstanceMethod:)", threads,
+                                                  [FMSInstrumentedTarget class]);
+        double overridden = FMSRunCallBenchmark(@"method call (hand-written block override)", threads,
+                                                [FMSBlockOverriddenTarget class]);
+        
+        printf("%-56s threads:%3lu instrumented:%+8.2f ns/op block override:%+8.2f ns/op\n",
+               "instrumentation overhead vs. uninstrumented", (unsigned long)threads,
+               instrumented - baseline, overridden - baseline);
+    }
+    
+    FMSMethodStatistics *statistics = [FMSInstrumentedTarget FMS_statisticsForInstanceMethod:@selector(addOne:)];
+    printf("%-56s calls:%llu avg:%.1f ns p50:<%llu ns p99:<%llu ns\n",
+           "instrumented addOne: statistics",
+           (unsigned long long)statistics.callCount,
+           statistics.averageNanoseconds,
+           (unsigned long long)[statistics approximateNanosecondsAtPercentile:0.5],
+           (unsigned long long)[statistics approximateNanosecondsAtPercentile:0.99]);
+}
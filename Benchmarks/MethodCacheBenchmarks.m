@@ -0,0 +1,156 @@
+//
+//  MethodCacheBenchmarks.m
+//  FMSSwizzler
+//
+//  Measures the first call to each method of freshly swizzled classes with and without prewarming their method
+//  caches, and compares a hot loop through objc_msgSend with one through an IMP snapshot.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+
+static const NSUInteger FMSMethodCacheClassCount = 2000;
+static const NSUInteger FMSMethodCacheIterations = 10000000;
+
+@interface FMSMethodCacheBenchmarkTarget : NSObject
+- (NSUInteger)stepA:(NSUInteger)value;
+- (NSUInteger)stepB:(NSUInteger)value;
+- (NSUInteger)stepC:(NSUInteger)value;
+- (NSUInteger)stepD:(NSUInteger)value;
+@end
+
+@implementation FMSMethodCacheBenchmarkTarget
+
+- (NSUInteger)stepA:(NSUInteger)value {
+    return value + 1;
+}
+
+- (NSUInteger)stepB:(NSUInteger)value {
+    return value + 2;
+}
+
+- (NSUInteger)stepC:(NSUInteger)value {
+    return value + 3;
+}
+
+- (NSUInteger)stepD:(NSUInteger)value {
+    return value + 4;
+}
+
+@end
+
+/*
+ * The situation prewarming is for: classes generated and swizzled at runtime, whose methods have never been
+ * called. Each class replaces two of the four methods and inherits the other two.
+ */
+static NSArray *FMSCreateMethodCacheClasses(NSString *prefix) {
+    
+    NSMutableArray *classes = [NSMutableArray array];
+    
+    for (NSUInteger index = 0; index < FMSMethodCacheClassCount; index++) {
+        
+        NSString *className = [NSString stringWithFormat:@"%@%lu", prefix, (unsigned long)index];
+        Class cls = objc_allocateClassPair([FMSMethodCacheBenchmarkTarget class], [className UTF8String], 0);
+        objc_registerClassPair(cls);
+        
+        [cls FMS_replaceInstanceMethod:@selector(stepA:) withImplementationBlock:^NSUInteger(id _self, NSUInteger value) {
+            return value + 1;
+        }];
+        [cls FMS_replaceInstanceMethod:@selector(stepC:) withImplementationBlock:^NSUInteger(id _self, NSUInteger value) {
+            return value + 3;
+        }];
+        
+        [classes addObject:cls];
+    }
+    
+    return classes;
+}
+
+static NSUInteger FMSCallEverySteps(FMSMethodCacheBenchmarkTarget *target, NSUInteger value) {
+    return [target stepD:[target stepC:[target stepB:[target stepA:value]]]];
+}
+
+static void FMSRunFirstCallBenchmarks(void) {
+    
+    SEL selectors[] = {@selector(stepA:), @selector(stepB:), @selector(stepC:), @selector(stepD:)};
+    
+    // Allocating the instances (and so running +initialize) is kept out of both measurements.
+    NSArray *coldClasses = FMSCreateMethodCacheClasses(@"FMSColdCacheBenchmark");
+    NSMutableArray *coldTargets = [NSMutableArray array];
+    for (Class cls in coldClasses) [coldTargets addObject:[[cls alloc] init]];
+    
+    FMSBenchmarkMeasureInstall(@"first calls (cold cache)", FMSMethodCacheClassCount, ^(NSUInteger index) {
+        FMSCallEverySteps(coldTargets[index], index);
+    });
+    
+    NSArray *warmClasses = FMSCreateMethodCacheClasses(@"FMSWarmCacheBenchmark");
+    NSMutableArray *warmTargets = [NSMutableArray array];
+    for (Class cls in warmClasses) [warmTargets addObject:[[cls alloc] init]];
+    
+    FMSBenchmarkMeasureInstall(@"prewarm method cache (4 selectors)", FMSMethodCacheClassCount, ^(NSUInteger index) {
+        [warmClasses[index] FMS_prewarmMethodCacheForSelectors:selectors count:4];
+    });
+    
+    FMSBenchmarkMeasureInstall(@"first calls (prewarmed cache)", FMSMethodCacheClassCount, ^(NSUInteger index) {
+        FMSCallEverySteps(warmTargets[index], index);
+    });
+}
+
+static void FMSRunHotLoopBenchmarks(void) {
+    
+    Class cls = FMSCreateMethodCacheClasses(@"FMSHotLoopCacheBenchmark")[0];
+    SEL selectors[] = {@selector(stepA:), @selector(stepB:)};
+    FMSIMPSnapshot *snapshot = [cls FMS_IMPSnapshotForSelectors:selectors count:2];
+    
+    NSUInteger (*stepA)(id, SEL, NSUInteger) = (NSUInteger (*)(id, SEL, NSUInteger))[snapshot implementations][0];
+    NSUInteger (*stepB)(id, SEL, NSUInteger) = (NSUInteger (*)(id, SEL, NSUInteger))[snapshot implementations][1];
+    
+    NSUInteger threadCounts[] = {1, 4};
+    
+    for (NSUInteger index = 0; index < sizeof(threadCounts) / sizeof(threadCounts[0]); index++) {
+        
+        NSUInteger threads = threadCounts[index];
+        NSMutableArray *targets = [NSMutableArray array];
+        for (NSUInteger thread = 0; thread < threads; thread++) [targets addObject:[[cls alloc] init]];
+        
+        FMSBenchmarkRun(@"hot loop objc_msgSend", threads, FMSMethodCacheIterations, ^(NSUInteger threadIndex, NSUInteger iterations) {
+            
+            FMSMethodCacheBenchmarkTarget *target = targets[threadIndex];
+            NSUInteger value = 0;
+            
+            for (NSUInteger i = 0; i < iterations; i++) {
+                value = [target stepB:[target stepA:value]];
+            }
+            
+            if (value != iterations * 3) {
+                printf("unexpected result %lu\n", (unsigned long)value);
+            }
+        });
+        
+        // Checking validity once per run, as a real loop would once per batch of work.
+        FMSBenchmarkRun(@"hot loop IMP snapshot", threads, FMSMethodCacheIterations, ^(NSUInteger threadIndex, NSUInteger iterations) {
+            
+            FMSMethodCacheBenchmarkTarget *target = targets[threadIndex];
+            NSUInteger value = 0;
+            
+            if (![snapshot isValid]) {
+                printf("snapshot was invalidated during the run\n");
+            }
+            
+            for (NSUInteger i = 0; i < iterations; i++) {
+                value = stepB(target, @selector(stepB:), stepA(target, @selector(stepA:), value));
+            }
+            
+            if (value != iterations * 3) {
+                printf("unexpected result %lu\n", (unsigned long)value);
+            }
+        });
+    }
+}
+
+void FMSRunMethodCacheBenchmarks(void) {
+    
+    FMSRunFirstCallBenchmarks();
+    FMSRunHotLoopBenchmarks();
+}
@@ -0,0 +1,134 @@
+//
+//  MethodHookBenchmarks.m
+//  FMSSwizzler
+//
+//  Compares FMS_hookInstanceMethod:before:after: with the two ways of hooking a method without it: a
+//  forwardInvocation:-based generic hook, and a hand-written override block that matches the signature.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+
+static const NSUInteger FMSHookIterations = 2000000;
+
+static NSUInteger FMSHookBenchmarkCalls = 0;
+
+@interface FMSHookBenchmarkTarget : NSObject
+- (double)scale:(double)value by:(NSUInteger)factor;
+@end
+
+@implementation FMSHookBenchmarkTarget
+
+- (double)scale:(double)value by:(NSUInteger)factor {
+    return value * (double)factor;
+}
+
+@end
+
+// One subclass per variant, so each one swizzles its own copy of the method.
+@interface FMSTrampolineHookTarget : FMSHookBenchmarkTarget
+@end
+
+@implementation FMSTrampolineHookTarget
+@end
+
+@interface FMSBlockOverrideHookTarget : FMSHookBenchmarkTarget
+@end
+
+@implementation FMSBlockOverrideHookTarget
+@end
+
+/*
+ * The generic hook the runtime gives us for free: the hooked selector has no implementation, so every call goes
+ * through the forwarding machinery, builds an NSInvocation, and is re-dispatched to the real method.
+ */
+@interface FMSForwardingHookTarget : NSObject
+@end
+
+@implementation FMSForwardingHookTarget
+
+- (double)forwardedScale:(double)value by:(NSUInteger)factor {
+    return value * (double)factor;
+}
+
+- (NSMethodSignature *)methodSignatureForSelector:(SEL)selector {
+    
+    if (selector == @selector(scale:by:)) {
+        return [super methodSignatureForSelector:@selector(forwardedScale:by:)];
+    }
+    
+    return [super methodSignatureForSelector:selector];
+}
+
+- (void)forwardInvocation:(NSInvocation *)invocation {
+    
+    if ([invocation selector] != @selector(scale:by:)) {
+        [super forwardInvocation:invocation];
+        return;
+    }
+    
+    FMSHookBenchmarkCalls++;
+    [invocation setSelector:@selector(forwardedScale:by:)];
+    [invocation invokeWithTarget:self];
+    FMSHookBenchmarkCalls++;
+}
+
+@end
+
+// This prevents compiler errors for non-declared methods
+@interface NSObject(MethodHookBenchmarks)
+- (double)benchmarkOldScale:(double)value by:(NSUInteger)factor;
+@end
+
+static void FMSRunHookBenchmark(NSString *name, NSUInteger threads, NSUInteger callsPerThread, Class cls) {
+    
+    NSMutableArray *targets = [NSMutableArray array];
+    for (NSUInteger thread = 0; thread < threads; thread++) {
+        [targets addObject:[[cls alloc] init]];
+    }
+    
+    FMSBenchmarkRun(name, threads, callsPerThread, ^(NSUInteger threadIndex, NSUInteger iterations) {
+        
+        FMSHookBenchmarkTarget *target = targets[threadIndex];
+        double total = 0.0;
+        
+        for (NSUInteger i = 0; i < iterations; i++) {
+            total += [target scale:1.5 by:i];
+        }
+        
+        if (total < 0.0) abort();
+    });
+}
+
+void FMSRunMethodHookBenchmarks(void) {
+    
+    // The hooks only bump a counter, so the numbers show the cost of the hooking mechanism itself. The counter is
+    // shared and unsynchronized; its value doesn't matter.
+    [FMSTrampolineHookTarget FMS_hookInstanceMethod:@selector(scale:by:)
+                                             before:^(id receiver, SEL selector) {
+                                                 FMSHookBenchmarkCalls++;
+                                             }
+                                              after:^(id receiver, SEL selector) {
+                                                  FMSHookBenchmarkCalls++;
+                                              }];
+    
+    [FMSBlockOverrideHookTarget
+     FMS_overrideInstanceMethod:@selector(scale:by:)
+     oldSelector:@selector(benchmarkOldScale:by:)
+     implementationBlock:^double(id _self, double value, NSUInteger factor) {
+         
+         FMSHookBenchmarkCalls++;
+         double result = [_self benchmarkOldScale:value by:factor];
+         FMSHookBenchmarkCalls++;
+         
+         return result;
+     }];
+    
+    FMSRunHookBenchmark(@"hooked call (no hook)", 1, FMSHookIterations, [FMSHookBenchmarkTarget class]);
+    FMSRunHookBenchmark(@"hooked call (FMS_hookInstanceMethod:)", 1, FMSHookIterations, [FMSTrampolineHookTarget class]);
+    FMSRunHookBenchmark(@"hooked call (hand-written block override)", 1, FMSHookIterations,
+                        [FMSBlockOverrideHookTarget class]);
+    
+    // Forwarding is orders of magnitude slower; fewer iterations keep the run short.
+    FMSRunHookBenchmark(@"hooked call (forwardInvocation:)", 1, FMSHookIterations / 20, [FMSForwardingHookTarget class]);
+}
@@ -0,0 +1,97 @@
+//
+//  PseudoPropertyArenaBenchmarks.m
+//  FMSSwizzler
+//
+//  Measures object churn (create, write several pseudo properties, read them, destroy) with slabs on the heap
+//  and with slabs carved out of a pseudo property arena.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+
+@interface FMSArenaBenchmarkRequest : NSObject
+@end
+
+@implementation FMSArenaBenchmarkRequest
+@end
+
+// This prevents compiler errors for non-declared methods
+@interface NSObject(PseudoPropertyArenaBenchmarks)
+
+@property (assign, nonatomic) double churnStart;
+@property (assign, nonatomic) NSInteger churnStatus;
+@property (assign, nonatomic) NSRange churnRange;
+@property (assign, nonatomic) BOOL churnCached;
+
+@end
+
+static const NSUInteger FMSArenaChurnIterations = 1000000;
+
+// Objects per scope, standing in for the objects created while handling one request.
+static const NSUInteger FMSArenaChurnBatch = 1000;
+
+static NSInteger FMSChurnBatch(NSUInteger first, NSUInteger count) {
+    
+    NSInteger checksum = 0;
+    NSMutableArray *requests = [NSMutableArray arrayWithCapacity:count];
+    
+    for (NSUInteger index = first; index < first + count; index++) {
+        
+        FMSArenaBenchmarkRequest *request = [[FMSArenaBenchmarkRequest alloc] init];
+        request.churnStart = (double)index;
+        request.churnStatus = (NSInteger)index;
+        request.churnRange = NSMakeRange(index, 1);
+        request.churnCached = (index & 1) != 0;
+        
+        [requests addObject:request];
+    }
+    
+    for (FMSArenaBenchmarkRequest *request in requests) {
+        checksum += request.churnStatus + (NSInteger)request.churnRange.length + (request.churnCached ? 1 : 0);
+    }
+    
+    return checksum;
+}
+
+static void FMSMeasureChurn(NSString *name, NSUInteger threads, BOOL useArena) {
+    
+    FMSBenchmarkRun(name, threads, FMSArenaChurnIterations, ^(NSUInteger threadIndex, NSUInteger iterations) {
+        
+        __block NSInteger checksum = 0;
+        
+        for (NSUInteger first = 0; first < iterations; first += FMSArenaChurnBatch) {
+            
+            NSUInteger count = MIN(FMSArenaChurnBatch, iterations - first);
+            
+            if (useArena) {
+                [NSObject FMS_performWithPseudoPropertyArena:^{
+                    checksum += FMSChurnBatch(first, count);
+                }];
+            } else {
+                @autoreleasepool {
+                    checksum += FMSChurnBatch(first, count);
+                }
+            }
+        }
+        
+        if (checksum == 0 && iterations > 1) abort();
+    });
+}
+
+void FMSRunPseudoPropertyArenaBenchmarks(void) {
+    
+    [FMSArenaBenchmarkRequest FMS_generatePseudoPropertyAdderForType:FMSDouble](@"churnStart");
+    [FMSArenaBenchmarkRequest FMS_generatePseudoPropertyAdderForType:FMSInteger](@"churnStatus");
+    [FMSArenaBenchmarkRequest FMS_generatePseudoPropertyAdderForType:FMSRange](@"churnRange");
+    [FMSArenaBenchmarkRequest FMS_generatePseudoPropertyAdderForType:FMSBool](@"churnCached");
+    
+    NSUInteger threadCounts[] = {1, 4, 16};
+    
+    for (NSUInteger index = 0; index < sizeof(threadCounts) / sizeof(threadCounts[0]); index++) {
+        
+        NSUInteger threads = threadCounts[index];
+        
+        FMSMeasureChurn(@"pseudo-property object churn (heap slabs)", threads, NO);
+        FMSMeasureChurn(@"pseudo-property object churn (arena)", threads, YES);
+    }
+}
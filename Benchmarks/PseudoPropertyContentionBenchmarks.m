@@ -0,0 +1,119 @@
+//
+//  PseudoPropertyContentionBenchmarks.m
+//  FMSSwizzler
+//
+//  Compares atomic pseudo properties against nonatomic ones wrapped in @synchronized, with every thread
+//  hammering the same object.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+
+@interface FMSContentionBenchmarkModel : NSObject
+@end
+
+@implementation FMSContentionBenchmarkModel
+@end
+
+// This prevents compiler errors for non-declared methods
+@interface NSObject(PseudoPropertyContentionBenchmarks)
+
+@property (assign) NSInteger atomicInteger;
+@property (strong) id atomicObject;
+@property (assign, nonatomic) NSInteger lockedInteger;
+@property (strong, nonatomic) id lockedObject;
+@property (assign) NSInteger ivarAtomicInteger;
+@property (strong) id ivarAtomicObject;
+
+@end
+
+static const NSUInteger FMSContentionIterations = 200000;
+
+void FMSRunPseudoPropertyContentionBenchmarks(void) {
+    
+    [FMSContentionBenchmarkModel FMS_addPseudoProperties:@{@"atomicInteger": @(FMSIntegerAtomic),
+                                                           @"atomicObject": @(FMSObjectRetainAtomic),
+                                                           @"lockedInteger": @(FMSInteger),
+                                                           @"lockedObject": @(FMSObjectRetain)}];
+    
+    Class ivarClass =
+    [FMSContentionBenchmarkModel FMS_allocateSubclassWithPseudoProperties:@{@"ivarAtomicInteger": @(FMSIntegerAtomic),
+                                                                            @"ivarAtomicObject": @(FMSObjectRetainAtomic)}];
+    
+    NSUInteger threadCounts[] = {1, 2, 4, 8, 16, 32};
+    
+    for (NSUInteger index = 0; index < sizeof(threadCounts) / sizeof(threadCounts[0]); index++) {
+        
+        NSUInteger threads = threadCounts[index];
+        
+        // Every thread shares one object, so this measures contention on the property itself.
+        FMSContentionBenchmarkModel *model = [[FMSContentionBenchmarkModel alloc] init];
+        id ivarModel = [[ivarClass alloc] init];
+        id value = [[NSObject alloc] init];
+        
+        FMSBenchmarkRun(@"contended integer get/set (atomic)", threads, FMSContentionIterations,
+                        ^(NSUInteger threadIndex, NSUInteger iterations) {
+                            
+                            for (NSUInteger i = 0; i < iterations; i++) {
+                                model.atomicInteger = model.atomicInteger + 1;
+                            }
+                        });
+        
+        FMSBenchmarkRun(@"contended integer get/set (atomic ivar)", threads, FMSContentionIterations,
+                        ^(NSUInteger threadIndex, NSUInteger iterations) {
+                            
+                            for (NSUInteger i = 0; i < iterations; i++) {
+                                [ivarModel setIvarAtomicInteger:[ivarModel ivarAtomicInteger] + 1];
+                            }
+                        });
+        
+        FMSBenchmarkRun(@"contended integer get/set (@synchronized)", threads, FMSContentionIterations,
+                        ^(NSUInteger threadIndex, NSUInteger iterations) {
+                            
+                            for (NSUInteger i = 0; i < iterations; i++) {
+                                
+                                NSInteger current;
+                                @synchronized(model) {
+                                    current = model.lockedInteger;
+                                }
+                                
+                                @synchronized(model) {
+                                    model.lockedInteger = current + 1;
+                                }
+                            }
+                        });
+        
+        FMSBenchmarkRun(@"contended object get/set (atomic)", threads, FMSContentionIterations,
+                        ^(NSUInteger threadIndex, NSUInteger iterations) {
+                            
+                            for (NSUInteger i = 0; i < iterations; i++) {
+                                model.atomicObject = value;
+                                (void)model.atomicObject;
+                            }
+                        });
+        
+        FMSBenchmarkRun(@"contended object get/set (atomic ivar)", threads, FMSContentionIterations,
+                        ^(NSUInteger threadIndex, NSUInteger iterations) {
+                            
+                            for (NSUInteger i = 0; i < iterations; i++) {
+                                [ivarModel setIvarAtomicObject:value];
+                                (void)[ivarModel ivarAtomicObject];
+                            }
+                        });
+        
+        FMSBenchmarkRun(@"contended object get/set (@synchronized)", threads, FMSContentionIterations,
+                        ^(NSUInteger threadIndex, NSUInteger iterations) {
+                            
+                            for (NSUInteger i = 0; i < iterations; i++) {
+                                
+                                @synchronized(model) {
+                                    model.lockedObject = value;
+                                }
+                                
+                                @synchronized(model) {
+                                    (void)model.lockedObject;
+                                }
+                            }
+                        });
+    }
+}
@@ -0,0 +1,114 @@
+//
+//  PseudoPropertyStartupBenchmarks.m
+//  FMSSwizzler
+//
+//  Measures the cost of adding many pseudo properties, as a schema-driven model layer does at launch.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+
+static const NSUInteger FMSStartupClassCount = 500;
+static const NSUInteger FMSStartupPropertiesPerClass = 20;
+
+static NSArray *FMSCreateStartupClasses(NSString *prefix) {
+    
+    NSMutableArray *classes = [NSMutableArray array];
+    
+    for (NSUInteger index = 0; index < FMSStartupClassCount; index++) {
+        
+        NSString *className = [NSString stringWithFormat:@"%@%lu", prefix, (unsigned long)index];
+        Class cls = objc_allocateClassPair([NSObject class], [className UTF8String], 0);
+        objc_registerClassPair(cls);
+        
+        [classes addObject:cls];
+    }
+    
+    return classes;
+}
+
+static NSString *FMSStartupHeapDelta(BOOL available, size_t before, size_t after) {
+    return available ? [NSString stringWithFormat:@"%+ld", (long)after - (long)before] : @"unavailable";
+}
+
+static void FMSReportStartup(NSString *name, uint64_t elapsed, FMSBenchmarkHeapUsage before, FMSBenchmarkHeapUsage after) {
+    
+    NSUInteger propertyCount = FMSStartupClassCount * FMSStartupPropertiesPerClass;
+    NSString *bytes = FMSStartupHeapDelta(before.bytesAvailable && after.bytesAvailable, before.bytes, after.bytes);
+    NSString *blocks = FMSStartupHeapDelta(before.blocksAvailable && after.blocksAvailable, before.blocks, after.blocks);
+    
+    printf("%-56s properties:%6lu  total:%10.3f ms  %10.2f ns/property  heap:%s bytes  blocks:%s\n",
+           [name UTF8String],
+           (unsigned long)propertyCount,
+           (double)elapsed / 1.0e6,
+           (double)elapsed / (double)propertyCount,
+           [bytes UTF8String],
+           [blocks UTF8String]);
+    
+    NSMutableDictionary *metrics = [@{@"installs": @(propertyCount),
+                                      @"wallNanoseconds": @(elapsed),
+                                      @"nanosecondsPerInstall": @((double)elapsed / (double)propertyCount)} mutableCopy];
+    
+    // Counts the platform can't report are left out rather than recorded as 0.
+    if (before.bytesAvailable && after.bytesAvailable) {
+        metrics[@"heapBytes"] = @((long)after.bytes - (long)before.bytes);
+    }
+    
+    if (before.blocksAvailable && after.blocksAvailable) {
+        metrics[@"heapBlocks"] = @((long)after.blocks - (long)before.blocks);
+    }
+    
+    FMSBenchmarkRecordResult(name, @"install", metrics);
+}
+
+void FMSRunPseudoPropertyStartupBenchmarks(void) {
+    
+    // Create the classes up front so we only measure property creation.
+    NSArray *adderClasses = FMSCreateStartupClasses(@"FMSStartupBenchmarkModel");
+    NSArray *batchClasses = FMSCreateStartupClasses(@"FMSStartupBenchmarkBatchModel");
+    
+    // Property names repeat across classes, like the shared fields of a model layer.
+    FMSPseudoPropertyType types[] = {FMSObjectRetain, FMSInteger, FMSDouble, FMSBool};
+    NSUInteger typeCount = sizeof(types) / sizeof(types[0]);
+    
+    NSMutableArray *names = [NSMutableArray array];
+    NSMutableDictionary *schema = [NSMutableDictionary dictionary];
+    
+    for (NSUInteger index = 0; index < FMSStartupPropertiesPerClass; index++) {
+        
+        NSString *name = [NSString stringWithFormat:@"field%lu", (unsigned long)index];
+        
+        [names addObject:name];
+        schema[name] = @(types[index % typeCount]);
+    }
+    
+    FMSBenchmarkHeapUsage before = FMSBenchmarkCurrentHeapUsage();
+    uint64_t start = FMSBenchmarkNow();
+    
+    @autoreleasepool {
+        
+        for (Class cls in adderClasses) {
+            
+            for (NSUInteger index = 0; index < FMSStartupPropertiesPerClass; index++) {
+                [cls FMS_generatePseudoPropertyAdderForType:types[index % typeCount]](names[index]);
+            }
+        }
+    }
+    
+    FMSReportStartup(@"pseudo-property startup registration (adder)", FMSBenchmarkNow() - start,
+                     before, FMSBenchmarkCurrentHeapUsage());
+    
+    before = FMSBenchmarkCurrentHeapUsage();
+    start = FMSBenchmarkNow();
+    
+    @autoreleasepool {
+        
+        for (Class cls in batchClasses) {
+            [cls FMS_addPseudoProperties:schema];
+        }
+    }
+    
+    FMSReportStartup(@"pseudo-property startup registration (batch)", FMSBenchmarkNow() - start,
+                     before, FMSBenchmarkCurrentHeapUsage());
+}
@@ -0,0 +1,93 @@
+//
+//  PseudoPropertyStorageBenchmarks.m
+//  FMSSwizzler
+//
+//  Compares association-backed and ivar-backed pseudo properties.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+
+@interface FMSStorageBenchmarkModel : NSObject
+@end
+
+@implementation FMSStorageBenchmarkModel
+@end
+
+// This prevents compiler errors for non-declared methods
+@interface NSObject(PseudoPropertyStorageBenchmarks)
+
+@property (assign, nonatomic) double associatedDouble;
+@property (strong, nonatomic) id associatedObject;
+@property (assign, nonatomic) double ivarDouble;
+@property (strong, nonatomic) id ivarObject;
+
+@end
+
+static const NSUInteger FMSStorageIterations = 1000000;
+
+void FMSRunPseudoPropertyStorageBenchmarks(void) {
+    
+    [FMSStorageBenchmarkModel FMS_generatePseudoPropertyAdderForType:FMSDouble](@"associatedDouble");
+    [FMSStorageBenchmarkModel FMS_generatePseudoPropertyAdderForType:FMSObjectRetain](@"associatedObject");
+    
+    Class ivarClass =
+    [FMSStorageBenchmarkModel FMS_allocateSubclassWithPseudoProperties:@{@"ivarDouble": @(FMSDouble),
+                                                                         @"ivarObject": @(FMSObjectRetain)}];
+    
+    NSUInteger threadCounts[] = {1, 4, 16};
+    
+    for (NSUInteger index = 0; index < sizeof(threadCounts) / sizeof(threadCounts[0]); index++) {
+        
+        NSUInteger threads = threadCounts[index];
+        
+        // Each thread works on its own object; any slowdown comes from shared runtime state.
+        NSMutableArray *associatedModels = [NSMutableArray array];
+        NSMutableArray *ivarModels = [NSMutableArray array];
+        
+        for (NSUInteger thread = 0; thread < threads; thread++) {
+            [associatedModels addObject:[[FMSStorageBenchmarkModel alloc] init]];
+            [ivarModels addObject:[[ivarClass alloc] init]];
+        }
+        
+        FMSBenchmarkRun(@"pseudo-property double get/set (association)", threads, FMSStorageIterations,
+                        ^(NSUInteger threadIndex, NSUInteger iterations) {
+                            
+                            FMSStorageBenchmarkModel *model = associatedModels[threadIndex];
+                            for (NSUInteger i = 0; i < iterations; i++) {
+                                model.associatedDouble = model.associatedDouble + 1.0;
+                            }
+                        });
+        
+        FMSBenchmarkRun(@"pseudo-property double get/set (ivar)", threads, FMSStorageIterations,
+                        ^(NSUInteger threadIndex, NSUInteger iterations) {
+                            
+                            id model = ivarModels[threadIndex];
+                            for (NSUInteger i = 0; i < iterations; i++) {
+                                [model setIvarDouble:[model ivarDouble] + 1.0];
+                            }
+                        });
+        
+        FMSBenchmarkRun(@"pseudo-property object get/set (association)", threads, FMSStorageIterations,
+                        ^(NSUInteger threadIndex, NSUInteger iterations) {
+                            
+                            FMSStorageBenchmarkModel *model = associatedModels[threadIndex];
+                            for (NSUInteger i = 0; i < iterations; i++) {
+                                model.associatedObject = model;
+                                (void)model.associatedObject;
+                            }
+                            model.associatedObject = nil;
+                        });
+        
+        FMSBenchmarkRun(@"pseudo-property object get/set (ivar)", threads, FMSStorageIterations,
+                        ^(NSUInteger threadIndex, NSUInteger iterations) {
+                            
+                            id model = ivarModels[threadIndex];
+                            for (NSUInteger i = 0; i < iterations; i++) {
+                                [model setIvarObject:model];
+                                (void)[model ivarObject];
+                            }
+                            [model setIvarObject:nil];
+                        });
+    }
+}
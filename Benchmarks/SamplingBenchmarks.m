@@ -0,0 +1,127 @@
+//
+//  SamplingBenchmarks.m
+//  FMSSwizzler
+//
+//  Measures the per-call overhead of sampled hooks and sampled instrumentation at rates of 1, 100 and 10,000,
+//  against an unhooked call and the unsampled versions. The rate is changed on one installed hook between runs.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+
+@interface FMSSamplingBenchmarkTarget : NSObject
+- (NSUInteger)addOne:(NSUInteger)value;
+@end
+
+@implementation FMSSamplingBenchmarkTarget
+
+- (NSUInteger)addOne:(NSUInteger)value {
+    return value + 1;
+}
+
+@end
+
+static const NSUInteger FMSSamplingIterations = 5000000;
+
+// Stands in for the work a real hook does, without a shared cache line to skew the multi-threaded runs.
+static _Thread_local NSUInteger FMSSampledHookCalls = 0;
+
+// One subclass per variant, so each one swizzles its own copy of the method.
+static Class FMSCreateSamplingClass(NSString *name) {
+    
+    Class cls = objc_allocateClassPair([FMSSamplingBenchmarkTarget class], [name UTF8String], 0);
+    objc_registerClassPair(cls);
+    
+    return cls;
+}
+
+static double FMSRunSamplingCallBenchmark(NSString *name, NSUInteger threads, Class cls) {
+    
+    NSMutableArray *targets = [NSMutableArray array];
+    for (NSUInteger thread = 0; thread < threads; thread++) {
+        [targets addObject:[[cls alloc] init]];
+    }
+    
+    return FMSBenchmarkRun(name, threads, FMSSamplingIterations, ^(NSUInteger threadIndex, NSUInteger iterations) {
+        
+        FMSSamplingBenchmarkTarget *target = targets[threadIndex];
+        NSUInteger value = 0;
+        
+        for (NSUInteger i = 0; i < iterations; i++) {
+            value = [target addOne:value];
+        }
+        
+        if (value != iterations) abort();
+    });
+}
+
+void FMSRunSamplingBenchmarks(void) {
+    
+    FMSMethodHookBlock hook = ^(id receiver, SEL selector) {
+        FMSSampledHookCalls++;
+    };
+    
+    Class baselineClass = FMSCreateSamplingClass(@"FMSSamplingBaselineTarget");
+    
+    Class hookedClass = FMSCreateSamplingClass(@"FMSSamplingHookedTarget");
+    [hookedClass FMS_hookInstanceMethod:@selector(addOne:) before:hook after:hook];
+    
+    Class instrumentedClass = FMSCreateSamplingClass(@"FMSSamplingInstrumentedTarget");
+    [instrumentedClass FMS_instrumentInstanceMethod:@selector(addOne:)];
+    
+    Class sampledHookClass = FMSCreateSamplingClass(@"FMSSampledHookTarget");
+    FMSSampler *hookSampler = [sampledHookClass FMS_hookInstanceMethod:@selector(addOne:)
+                                                          samplingRate:1
+                                                                before:hook
+                                                                 after:hook];
+    
+    Class sampledInstrumentationClass = FMSCreateSamplingClass(@"FMSSampledInstrumentationTarget");
+    FMSSampler *instrumentationSampler = [sampledInstrumentationClass FMS_instrumentInstanceMethod:@selector(addOne:)
+                                                                                      samplingRate:1];
+    
+    NSUInteger threadCounts[] = {1, 4};
+    NSUInteger rates[] = {1, 100, 10000};
+    
+    for (NSUInteger threadIndex = 0; threadIndex < sizeof(threadCounts) / sizeof(threadCounts[0]); threadIndex++) {
+        
+        NSUInteger threads = threadCounts[threadIndex];
+        
+        double baseline = FMSRunSamplingCallBenchmark(@"method call (unhooked)", threads, baselineClass);
+        double hooked = FMSRunSamplingCallBenchmark(@"method call (FMS_hookInstanceMethod:)", threads, hookedClass);
+        double instrumented = FMSRunSamplingCallBenchmark(@"method call (FMS_instrumentInstanceMethod:)", threads,
+                                                          instrumentedClass);
+        
+        printf("%-56s threads:%3lu hook:%+8.2f ns/op instrumentation:%+8.2f ns/op\n",
+               "unsampled overhead vs. unhooked", (unsigned long)threads, hooked - baseline, instrumented - baseline);
+        
+        for (NSUInteger rateIndex = 0; rateIndex < sizeof(rates) / sizeof(rates[0]); rateIndex++) {
+            
+            NSUInteger rate = rates[rateIndex];
+            
+            // The same hooks throughout: only the rate changes.
+            hookSampler.samplingRate = rate;
+            instrumentationSampler.samplingRate = rate;
+            
+            NSString *hookName = [NSString stringWithFormat:@"method call (sampled hook, 1 in %lu)", (unsigned long)rate];
+            NSString *instrumentationName = [NSString stringWithFormat:@"method call (sampled instrumentation, 1 in %lu)",
+                                             (unsigned long)rate];
+            
+            double sampledHook = FMSRunSamplingCallBenchmark(hookName, threads, sampledHookClass);
+            double sampledInstrumentation = FMSRunSamplingCallBenchmark(instrumentationName, threads,
+                                                                        sampledInstrumentationClass);
+            
+            printf("%-56s threads:%3lu rate:%6lu hook:%+8.2f ns/op instrumentation:%+8.2f ns/op\n",
+                   "sampled overhead vs. unhooked", (unsigned long)threads, (unsigned long)rate,
+                   sampledHook - baseline, sampledInstrumentation - baseline);
+            
+            FMSBenchmarkRecordResult(@"sampling overhead", @"overhead",
+                                     @{@"threads": @(threads),
+                                       @"samplingRate": @(rate),
+                                       @"hookOverheadNanoseconds": @(sampledHook - baseline),
+                                       @"instrumentationOverheadNanoseconds": @(sampledInstrumentation - baseline),
+                                       @"unsampledHookOverheadNanoseconds": @(hooked - baseline),
+                                       @"unsampledInstrumentationOverheadNanoseconds": @(instrumented - baseline)});
+        }
+    }
+}
@@ -0,0 +1,110 @@
+//
+//  SwizzleRecordBenchmarks.m
+//  FMSSwizzler
+//
+//  Measures the cost of exporting the swizzle records, and checks that exporting them on another
+//  thread doesn't slow down calls through a swizzled method.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+#import <pthread.h>
+#import <stdatomic.h>
+
+static const NSUInteger FMSRecordClassCount = 1000;
+static const NSUInteger FMSRecordExportCount = 20;
+static const NSUInteger FMSRecordDispatchIterations = 2000000;
+
+@interface FMSRecordBenchmarkTarget : NSObject
+- (NSUInteger)increment:(NSUInteger)value;
+@end
+
+@implementation FMSRecordBenchmarkTarget
+
+- (NSUInteger)increment:(NSUInteger)value {
+    return value + 1;
+}
+
+@end
+
+static atomic_bool FMSRecordExporterRunning;
+
+static void *FMSRecordExporterMain(void *unused) {
+    
+    while (atomic_load(&FMSRecordExporterRunning)) {
+        
+        @autoreleasepool {
+            (void)[NSObject FMS_swizzleRecordSnapshot];
+        }
+    }
+    
+    return NULL;
+}
+
+static void FMSMeasureRecordDispatch(NSString *name, id target) {
+    
+    FMSBenchmarkRun(name, 1, FMSRecordDispatchIterations, ^(NSUInteger threadIndex, NSUInteger iterations) {
+        
+        NSUInteger value = 0;
+        
+        for (NSUInteger i = 0; i < iterations; i++) {
+            value = [target increment:value];
+        }
+        
+        if (value != iterations) {
+            printf("unexpected result %lu\n", (unsigned long)value);
+        }
+    });
+}
+
+void FMSRunSwizzleRecordBenchmarks(void) {
+    
+    // Fill the records with a realistic number of swizzles.
+    Class replaced = Nil;
+    
+    for (NSUInteger index = 0; index < FMSRecordClassCount; index++) {
+        
+        NSString *className = [NSString stringWithFormat:@"FMSRecordBenchmark%lu", (unsigned long)index];
+        Class cls = objc_allocateClassPair([FMSRecordBenchmarkTarget class], [className UTF8String], 0);
+        objc_registerClassPair(cls);
+        
+        [cls FMS_replaceInstanceMethod:@selector(increment:) withImplementationBlock:^NSUInteger(id _self, NSUInteger value) {
+            return value + 1;
+        }];
+        
+        replaced = cls;
+    }
+    
+    FMSBenchmarkMeasureInstall(@"export records (objects)", FMSRecordExportCount, ^(NSUInteger index) {
+        @autoreleasepool {
+            (void)[NSObject FMS_activeSwizzleRecords];
+        }
+    });
+    
+    FMSBenchmarkMeasureInstall(@"export records (JSON)", FMSRecordExportCount, ^(NSUInteger index) {
+        @autoreleasepool {
+            (void)[NSObject FMS_swizzleRecordsJSON];
+        }
+    });
+    
+    FMSBenchmarkMeasureInstall(@"export records (binary)", FMSRecordExportCount, ^(NSUInteger index) {
+        @autoreleasepool {
+            (void)[NSObject FMS_swizzleRecordSnapshot];
+        }
+    });
+    
+    id target = [[replaced alloc] init];
+    
+    FMSMeasureRecordDispatch(@"dispatch replace (records idle)", target);
+    
+    // Dispatch never reads the records, so a busy exporter should only cost what a busy core does.
+    pthread_t exporter;
+    atomic_store(&FMSRecordExporterRunning, true);
+    pthread_create(&exporter, NULL, FMSRecordExporterMain, NULL);
+    
+    FMSMeasureRecordDispatch(@"dispatch replace (exporting concurrently)", target);
+    
+    atomic_store(&FMSRecordExporterRunning, false);
+    pthread_join(exporter, NULL);
+}
@@ -0,0 +1,227 @@
+//
+//  SwizzlingBenchmarks.m
+//  FMSSwizzler
+//
+//  Measures the install cost and per-call dispatch overhead of alias, replace, override and dynamic subclassing,
+//  and compares installing overrides one at a time with installing them as a batch.
+//
+
+#import "FMSBenchmark.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+
+static const NSUInteger FMSSwizzleInstallCount = 2000;
+static const NSUInteger FMSSwizzleIterations = 2000000;
+
+@interface FMSSwizzleBenchmarkTarget : NSObject
+- (NSUInteger)increment:(NSUInteger)value;
+@end
+
+@implementation FMSSwizzleBenchmarkTarget
+
+- (NSUInteger)increment:(NSUInteger)value {
+    return value + 1;
+}
+
+@end
+
+// This prevents compiler errors for non-declared methods
+@interface NSObject(SwizzlingBenchmarks)
+
+- (NSUInteger)aliasedIncrement:(NSUInteger)value;
+- (NSUInteger)oldIncrement:(NSUInteger)value;
+
+@end
+
+/*
+ * Every install needs a class that hasn't been touched yet, otherwise we'd be measuring the cost of
+ * stacking swizzles. Create them all up front so class creation isn't part of the measurement.
+ */
+static NSArray *FMSCreateSwizzleClasses(NSString *prefix, NSUInteger count) {
+    
+    NSMutableArray *classes = [NSMutableArray array];
+    
+    for (NSUInteger index = 0; index < count; index++) {
+    
+        NSString *className = [NSString stringWithFormat:@"%@%lu", prefix, (unsigned long)index];
+        Class cls = objc_allocateClassPair([FMSSwizzleBenchmarkTarget class], [className UTF8String], 0);
+        objc_registerClassPair(cls);
+        
+        [classes addObject:cls];
+    }
+    
+    return classes;
+}
+
+static void FMSMeasureDispatch(NSString *name, NSArray *targets) {
+    
+    FMSBenchmarkRun(name, [targets count], FMSSwizzleIterations, ^(NSUInteger threadIndex, NSUInteger iterations) {
+    
+        FMSSwizzleBenchmarkTarget *target = targets[threadIndex];
+        NSUInteger value = 0;
+        
+        for (NSUInteger i = 0; i < iterations; i++) {
+            value = [target increment:value];
+        }
+        
+        if (value != iterations && value != iterations * 2) {
+            printf("unexpected result %lu\n", (unsigned long)value);
+        }
+    });
+}
+
+static void FMSMeasureAliasDispatch(NSString *name, NSArray *targets) {
+    
+    FMSBenchmarkRun(name, [targets count], FMSSwizzleIterations, ^(NSUInteger threadIndex, NSUInteger iterations) {
+    
+        id target = targets[threadIndex];
+        NSUInteger value = 0;
+        
+        for (NSUInteger i = 0; i < iterations; i++) {
+            value = [target aliasedIncrement:value];
+        }
+        
+        if (value != iterations) {
+            printf("unexpected result %lu\n", (unsigned long)value);
+        }
+    });
+}
+
+static NSArray *FMSInstancesOfClass(Class cls, NSUInteger count) {
+    
+    NSMutableArray *instances = [NSMutableArray array];
+    
+    for (NSUInteger index = 0; index < count; index++) {
+        [instances addObject:[[cls alloc] init]];
+    }
+    
+    return instances;
+}
+
+static void FMSRunSwizzlingInstallBenchmarks(void) {
+    
+    NSArray *aliasClasses = FMSCreateSwizzleClasses(@"FMSAliasInstallBenchmark", FMSSwizzleInstallCount);
+    NSArray *replaceClasses = FMSCreateSwizzleClasses(@"FMSReplaceInstallBenchmark", FMSSwizzleInstallCount);
+    NSArray *overrideClasses = FMSCreateSwizzleClasses(@"FMSOverrideInstallBenchmark", FMSSwizzleInstallCount);
+    
+    FMSBenchmarkMeasureInstall(@"install alias", FMSSwizzleInstallCount, ^(NSUInteger index) {
+        [aliasClasses[index] FMS_aliasInstanceMethod:@selector(increment:) newSelector:@selector(aliasedIncrement:)];
+    });
+    
+    FMSBenchmarkMeasureInstall(@"install replace", FMSSwizzleInstallCount, ^(NSUInteger index) {
+        [replaceClasses[index] FMS_replaceInstanceMethod:@selector(increment:)
+                                 withImplementationBlock:^NSUInteger(id _self, NSUInteger value) {
+                                     return value + 1;
+                                 }];
+    });
+    
+    FMSBenchmarkMeasureInstall(@"install override", FMSSwizzleInstallCount, ^(NSUInteger index) {
+        [overrideClasses[index] FMS_overrideInstanceMethod:@selector(increment:)
+                                               oldSelector:@selector(oldIncrement:)
+                                       implementationBlock:^NSUInteger(id _self, NSUInteger value) {
+                                           return [_self oldIncrement:value] + 1;
+                                       }];
+    });
+    
+    // The same overrides as above, applied as a single batch.
+    NSArray *batchClasses = FMSCreateSwizzleClasses(@"FMSBatchInstallBenchmark", FMSSwizzleInstallCount);
+    uint64_t start = FMSBenchmarkNow();
+    
+    FMSSwizzleBatchResult *result = [NSObject FMS_performSwizzleBatch:^(FMSSwizzleBatch *batch) {
+        
+        for (Class cls in batchClasses) {
+            [batch overrideInstanceMethod:@selector(increment:)
+                                  ofClass:cls
+                              oldSelector:@selector(oldIncrement:)
+                      implementationBlock:^NSUInteger(id _self, NSUInteger value) {
+                          return [_self oldIncrement:value] + 1;
+                      }];
+        }
+    }];
+    
+    uint64_t elapsed = FMSBenchmarkNow() - start;
+    
+    printf("%-56s installs:%6lu  total:%10.3f ms  %10.2f ns/install  methods:%lu  apply:%10.3f ms\n",
+           "install override (batch)",
+           (unsigned long)FMSSwizzleInstallCount,
+           (double)elapsed / 1.0e6,
+           (double)elapsed / (double)FMSSwizzleInstallCount,
+           (unsigned long)[result methodsTouched],
+           (double)[result wallNanoseconds] / 1.0e6);
+    
+    FMSBenchmarkRecordResult(@"install override (batch)", @"install",
+                             @{@"installs": @(FMSSwizzleInstallCount),
+                               @"wallNanoseconds": @(elapsed),
+                               @"nanosecondsPerInstall": @((double)elapsed / (double)FMSSwizzleInstallCount),
+                               @"methodsTouched": @([result methodsTouched]),
+                               @"applyNanoseconds": @([result wallNanoseconds])});
+    
+    NSArray *subclassed = FMSInstancesOfClass([FMSSwizzleBenchmarkTarget class], FMSSwizzleInstallCount);
+    
+    FMSBenchmarkMeasureInstall(@"install dynamic subclass (per object)", FMSSwizzleInstallCount, ^(NSUInteger index) {
+        [subclassed[index] FMS_dynamiclySubclass];
+    });
+    
+    // Identically configured objects share a cached subclass, so only the first install creates a class.
+    NSArray *shared = FMSInstancesOfClass([FMSSwizzleBenchmarkTarget class], FMSSwizzleInstallCount);
+    
+    FMSBenchmarkMeasureInstall(@"install dynamic subclass (shared signature)", FMSSwizzleInstallCount, ^(NSUInteger index) {
+        [shared[index] FMS_dynamiclySubclassWithSignature:@"benchmarkIncrement" configuration:^(Class cls) {
+            [cls FMS_overrideInstanceMethod:@selector(increment:)
+                                oldSelector:@selector(oldIncrement:)
+                        implementationBlock:^NSUInteger(id _self, NSUInteger value) {
+                            return [_self oldIncrement:value] + 1;
+                        }];
+        }];
+    });
+}
+
+static void FMSRunSwizzlingDispatchBenchmarks(void) {
+    
+    Class aliasClass = FMSCreateSwizzleClasses(@"FMSAliasDispatchBenchmark", 1)[0];
+    [aliasClass FMS_aliasInstanceMethod:@selector(increment:) newSelector:@selector(aliasedIncrement:)];
+    
+    Class replaceClass = FMSCreateSwizzleClasses(@"FMSReplaceDispatchBenchmark", 1)[0];
+    [replaceClass FMS_replaceInstanceMethod:@selector(increment:)
+                    withImplementationBlock:^NSUInteger(id _self, NSUInteger value) {
+                        return value + 1;
+                    }];
+    
+    // The override does twice the work of the original, so the loop result doubles.
+    Class overrideClass = FMSCreateSwizzleClasses(@"FMSOverrideDispatchBenchmark", 1)[0];
+    [overrideClass FMS_overrideInstanceMethod:@selector(increment:)
+                                  oldSelector:@selector(oldIncrement:)
+                          implementationBlock:^NSUInteger(id _self, NSUInteger value) {
+                              return [_self oldIncrement:value] + 1;
+                          }];
+    
+    NSUInteger threadCounts[] = {1, 4};
+    
+    for (NSUInteger index = 0; index < sizeof(threadCounts) / sizeof(threadCounts[0]); index++) {
+    
+        NSUInteger threads = threadCounts[index];
+        
+        NSArray *subclassed = FMSInstancesOfClass([FMSSwizzleBenchmarkTarget class], threads);
+        for (id target in subclassed) {
+        
+            [target FMS_dynamiclySubclass];
+            [[target class] FMS_overrideInstanceMethod:@selector(increment:)
+                                           oldSelector:@selector(oldIncrement:)
+                                   implementationBlock:^NSUInteger(id _self, NSUInteger value) {
+                                       return [_self oldIncrement:value] + 1;
+                                   }];
+        }
+        
+        FMSMeasureDispatch(@"dispatch baseline", FMSInstancesOfClass([FMSSwizzleBenchmarkTarget class], threads));
+        FMSMeasureAliasDispatch(@"dispatch alias", FMSInstancesOfClass(aliasClass, threads));
+        FMSMeasureDispatch(@"dispatch replace", FMSInstancesOfClass(replaceClass, threads));
+        FMSMeasureDispatch(@"dispatch override (calls original)", FMSInstancesOfClass(overrideClass, threads));
+        FMSMeasureDispatch(@"dispatch dynamic subclass override", subclassed);
+    }
+}
+
+void FMSRunSwizzlingBenchmarks(void) {
+    
+    FMSRunSwizzlingInstallBenchmarks();
+    FMSRunSwizzlingDispatchBenchmarks();
+}
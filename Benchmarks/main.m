@@ -0,0 +1,48 @@
+//
+//  main.m
+//  FMSSwizzler
+//
+//  Runs the FMSSwizzler benchmark suites. Pass `--json <path>` to also write the results as JSON.
+//
+
+#import <Foundation/Foundation.h>
+#import "FMSBenchmark.h"
+
+int main(int argc, const char *argv[]) {
+    
+    int status = 0;
+    
+    @autoreleasepool {
+        
+        NSString *jsonPath = nil;
+        
+        for (int index = 1; index < argc; index++) {
+            
+            if (strcmp(argv[index], "--json") == 0 && index + 1 < argc) {
+                jsonPath = [NSString stringWithUTF8String:argv[++index]];
+            } else {
+                fprintf(stderr, "usage: %s [--json <path>]\n", argv[0]);
+                return 1;
+            }
+        }
+        
+        FMSRunSwizzlingBenchmarks();
+        FMSRunInstanceOverrideBenchmarks();
+        FMSRunPseudoPropertyStartupBenchmarks();
+        FMSRunPseudoPropertyStorageBenchmarks();
+        FMSRunPseudoPropertyContentionBenchmarks();
+        FMSRunPseudoPropertyArenaBenchmarks();
+        FMSRunInstrumentationBenchmarks();
+        FMSRunMethodHookBenchmarks();
+        FMSRunSwizzleRecordBenchmarks();
+        FMSRunSamplingBenchmarks();
+        FMSRunMethodCacheBenchmarks();
+        FMSRunHookChainBenchmarks();
+        
+        if (jsonPath != nil && !FMSBenchmarkWriteJSON(jsonPath)) {
+            status = 1;
+        }
+    }
+    
+    return status;
+}
@@ -9,6 +9,7 @@
 #import "DynamicSubclassingTests.h"
 #import "Person.h"
 #import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
 
 @interface NSObject(DynamicSubclassing)
 
@@ -274,6 +275,152 @@
 
 }
 
+- (void)testSharedDynamicSubclasses {
+    
+    __block NSUInteger configurationCount = 0;
+    __block NSUInteger callCount = 0;
+    
+    FMSDynamicSubclassConfiguration configuration = ^(Class cls) {
+        
+        configurationCount++;
+        
+        [cls FMS_overrideInstanceMethod:@selector(setFirstName:)
+                            oldSelector:@selector(oldSetFirstName:)
+                    implementationBlock:^(Person *_self, NSString *name) {
+                        
+                        callCount++;
+                        [_self oldSetFirstName:name];
+                    }];
+    };
+    
+    Class first = [self.p1 FMS_dynamiclySubclassWithSignature:@"countSetFirstName" configuration:configuration];
+    Class second = [self.p2 FMS_dynamiclySubclassWithSignature:@"countSetFirstName" configuration:configuration];
+    
+    STAssertEquals(first, second, @"Objects with the same signature should share a subclass");
+    STAssertEquals([self.p1 class], first, @"The object should have been moved into the subclass");
+    STAssertEquals(configurationCount, (NSUInteger)1, @"The subclass should only be configured once");
+    STAssertTrue([first isSubclassOfClass:[Person class]], @"The shared class should be a subclass of Person");
+    
+    self.p1.firstName = @"Tom";
+    self.p2.firstName = @"Jane";
+    
+    STAssertEquals(callCount, (NSUInteger)2, @"Our method should be called for both objects");
+    STAssertEqualObjects(self.p1.firstName, @"Tom", @"The accessor should return the name we set.");
+    STAssertEqualObjects(self.p2.firstName, @"Jane", @"The accessor should return the name we set.");
+    
+    Person *other = [Person personWithFirstName:@"Al" lastName:@"Green" age:50];
+    Class third = [other FMS_dynamiclySubclassWithSignature:@"somethingElse" configuration:nil];
+    
+    STAssertFalse(first == third, @"A different signature should get a different subclass");
+    
+//    STFail(@"Finish writing test cases");
+}
+
+- (void)testSharedDynamicSubclassesAreDisposed {
+    
+    NSUInteger cachedCount = [NSObject FMS_cachedDynamicSubclassCount];
+    NSUInteger liveCount = [NSObject FMS_liveGeneratedClassCount];
+    
+    @autoreleasepool {
+        
+        Person *person = [Person personWithFirstName:@"Temporary" lastName:@"Person" age:20];
+        [person FMS_dynamiclySubclassWithSignature:@"disposable" configuration:nil];
+        
+        STAssertEquals([NSObject FMS_cachedDynamicSubclassCount], cachedCount + 1,
+                       @"The new subclass should be in the cache");
+        STAssertEquals([NSObject FMS_liveGeneratedClassCount], liveCount + 1,
+                       @"The new subclass should be counted as live");
+        
+        person = nil;
+    }
+    
+    // The class is retired once the last instance is gone, and disposed of after the grace period.
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while ([NSObject FMS_cachedDynamicSubclassCount] > cachedCount && [timeout timeIntervalSinceNow] > 0.0) {
+        [NSObject FMS_reclaimRetiredImplementations];
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    
+    STAssertEquals([NSObject FMS_cachedDynamicSubclassCount], cachedCount,
+                   @"The subclass should be removed from the cache");
+    STAssertEquals([NSObject FMS_liveGeneratedClassCount], liveCount,
+                   @"The subclass should have been disposed of");
+}
+
+- (void)testMovingBetweenSharedDynamicSubclasses {
+    
+    NSUInteger cachedCount = [NSObject FMS_cachedDynamicSubclassCount];
+    
+    Class first = [self.p1 FMS_dynamiclySubclassWithSignature:@"movingFirst" configuration:nil];
+    Class second = [self.p1 FMS_dynamiclySubclassWithSignature:@"movingSecond" configuration:nil];
+    
+    STAssertEquals(class_getSuperclass(first), [Person class], @"Shared subclasses should be based on the original class");
+    STAssertEquals(class_getSuperclass(second), [Person class], @"Moving should not subclass the old shared class");
+    
+    // The first class has lost its only instance, so it is disposed of while p1 keeps using the second.
+    NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:2.0];
+    while ([NSObject FMS_cachedDynamicSubclassCount] > cachedCount + 1 && [timeout timeIntervalSinceNow] > 0.0) {
+        [NSObject FMS_reclaimRetiredImplementations];
+        [NSThread sleepForTimeInterval:0.01];
+    }
+    
+    STAssertEquals([NSObject FMS_cachedDynamicSubclassCount], cachedCount + 1, @"Only the second class should be cached");
+    
+    self.p1.firstName = @"Moved";
+    STAssertEqualObjects(self.p1.firstName, @"Moved", @"The object should still work after its old class is gone");
+    
+    [self.p2 FMS_dynamiclySubclass];
+    
+    STAssertThrows([self.p2 FMS_dynamiclySubclassWithSignature:@"movingFirst" configuration:nil],
+                   @"Objects in other generated classes can't be moved into a shared subclass");
+}
+
+- (void)testOverridingAnObjectKeepsItsSharedSubclass {
+    
+    NSUInteger cachedCount = [NSObject FMS_cachedDynamicSubclassCount];
+    
+    @autoreleasepool {
+        
+        Person *person = [Person personWithFirstName:@"Overridden" lastName:@"Person" age:20];
+        [person FMS_dynamiclySubclassWithSignature:@"pinnedByOverride" configuration:nil];
+        [person FMS_replaceMethod:@selector(fullName) withImplementationBlock:^(Person *_self) {
+            return @"Override";
+        }];
+        
+        person = nil;
+    }
+    
+    // The dispatching class is a subclass of the shared one, so the shared class must outlive its instances.
+    [NSThread sleepForTimeInterval:0.1];
+    [NSObject FMS_reclaimRetiredImplementations];
+    [NSObject FMS_reclaimRetiredImplementations];
+    
+    STAssertEquals([NSObject FMS_cachedDynamicSubclassCount], cachedCount + 1,
+                   @"The shared subclass should stay in the cache");
+    
+    Person *other = [Person personWithFirstName:@"Another" lastName:@"Person" age:30];
+    [other FMS_dynamiclySubclassWithSignature:@"pinnedByOverride" configuration:nil];
+    [other FMS_replaceMethod:@selector(fullName) withImplementationBlock:^(Person *_self) {
+        return @"Another override";
+    }];
+    
+    STAssertEqualObjects([other fullName], @"Another override", @"The dispatching class should still work");
+}
+
+- (void)testConfigurationsCanShareDynamicSubclasses {
+    
+    Person *inner = [Person personWithFirstName:@"Inner" lastName:@"Person" age:10];
+    __block Class innerClass = Nil;
+    
+    Class outerClass = [self.p1 FMS_dynamiclySubclassWithSignature:@"outerConfiguration" configuration:^(Class cls) {
+        innerClass = [inner FMS_dynamiclySubclassWithSignature:@"innerConfiguration" configuration:nil];
+    }];
+    
+    STAssertNotNil(innerClass, @"A configuration should be able to share subclasses itself");
+    STAssertFalse(innerClass == outerClass, @"Different signatures should get different subclasses");
+    STAssertEquals([inner class], innerClass, @"The inner object should have been moved");
+}
+
 - (void)observeValueForKeyPath:(NSString *)keyPath
                       ofObject:(id)object
                         change:(NSDictionary *)change
@@ -0,0 +1,93 @@
+//
+//  FMSHookChain.h
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * @file FMSHookChain.h
+ * Hook chains: any number of handlers on one selector behind a single trampoline. See `FMS_chainInstanceMethod:before:after:`.
+ */
+
+#import <Foundation/Foundation.h>
+
+@class FMSSwizzleToken;
+
+/**
+ * @brief The handlers added to one method of one class, and the trampoline that runs them.
+ *
+ * A chain is created, and its trampoline installed, when the first handler is added to the method. Every call runs
+ * the `before` handlers in the order they were added, then the `around` handlers (the first added outermost), then
+ * the original implementation, then the `after` handlers in the reverse order. The handlers are kept in one
+ * contiguous array and called directly, so each one costs a block call rather than a message send and an alias.
+ *
+ * Adding or removing a handler builds a new array and swaps it in. Calls already running keep the array they
+ * started with, and the old array is freed once no call can still be using it, so calls never wait for a change.
+ * A handler added or removed on one thread is seen by calls that start on other threads after the change returns.
+ *
+ * The trampoline stays installed after the last handler is removed, and costs a few loads per call, so that
+ * removing a handler never frees code another thread might be running. Restore `token` to remove the chain
+ * itself, which removes all of its handlers. The next handler added to the method starts a new chain. Like any
+ * restored swizzle, the trampoline, the chain's arrays and the handlers' blocks are only freed once the calls that
+ * started before the restore have returned.
+ */
+@interface FMSHookChain : NSObject
+
+/** The class the chain's trampoline is installed on. */
+@property (strong, nonatomic, readonly) Class targetClass;
+
+/** The selector the chain's trampoline is installed for. */
+@property (assign, nonatomic, readonly) SEL selector;
+
+/** The number of handlers currently in the chain. */
+@property (assign, nonatomic, readonly) NSUInteger handlerCount;
+
+/** The token that removes the chain's trampoline. */
+@property (strong, nonatomic, readonly) FMSSwizzleToken *token;
+
+@end
+
+/**
+ * @brief One handler in an `FMSHookChain`, returned when it is added.
+ */
+@interface FMSHookChainHandler : NSObject
+
+/** The chain the handler was added to. */
+@property (strong, nonatomic, readonly) FMSHookChain *chain;
+
+/** `NO` once the handler has been removed, or its chain's token has been restored. */
+@property (assign, nonatomic, readonly, getter = isActive) BOOL active;
+
+/**
+ * @brief Removes the handler from its chain. Calls that have already started may still run it.
+ *
+ * Removing a handler twice does nothing. It is safe to remove a handler from inside any handler, including itself.
+ */
+- (void)remove;
+
+@end
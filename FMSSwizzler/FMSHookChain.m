@@ -0,0 +1,483 @@
+//
+//  FMSHookChain.m
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#import "FMSSwizzlerInternal.h"
+#import <pthread.h>
+#import <stdatomic.h>
+
+#if !__has_feature(objc_arc)
+#error FMSSwizzler must be built with ARC.
+// You can turn on ARC for only FMSSwizzler files by adding -fobjc-arc to the build phase for each of its files.
+#endif
+
+#pragma mark - Reader Counts
+
+/*
+ * A handler array can't be freed while a call is still walking it. Instead of a lock, every call counts itself
+ * as a reader of its chain, in the chain's current epoch (0 or 1), for as long as it uses the array it loaded.
+ *
+ * A writer swaps in a new array and puts the old one on the chain's pending list. Then, if nobody is reading in
+ * the other epoch, it frees the waiting list, moves the pending list to waiting, and flips the epoch. Calls that
+ * start after the flip count themselves in the new epoch, so the old one drains even while the method is called
+ * nonstop, and by the next change the arrays that were pending when it flipped can go. Nothing waits: if the
+ * other epoch still has readers, the arrays stay where they are until a later change (or until the chain is
+ * deallocated). Readers never wait for writers, and writers never wait for readers.
+ *
+ * One counter shared by every thread would bounce its cache line between cores on every call, so each chain has
+ * a small table of padded counters and each thread always uses the same one. A writer adds them all up.
+ */
+#define FMSHookChainReaderStripeCount 16
+
+typedef struct {
+    _Atomic uintptr_t readers[2];
+    char padding[64 - 2 * sizeof(uintptr_t)];
+} FMSHookChainReaderStripe;
+
+static atomic_uint FMSNextHookChainStripe = 0;
+
+// The thread's stripe plus one, or 0 before the thread first calls a chained method.
+static _Thread_local unsigned int FMSThreadHookChainStripe = 0;
+
+@interface FMSHookChain () {
+@public
+    FMSHookChainReaderStripe _stripes[FMSHookChainReaderStripeCount];
+    _Atomic(FMSHookChainHandlers *) _handlers;
+    atomic_uint _epoch;
+    
+    // Everything below is guarded by the lock for `_targetClass`. Removed handlers' blocks are kept with the
+    // arrays that may still call them.
+    FMSHookChainHandlers *_pendingHandlers;
+    FMSHookChainHandlers *_waitingHandlers;
+    NSMutableArray *_pendingBlocks;
+    NSMutableArray *_waitingBlocks;
+    NSMutableArray *_entries;
+    Class _targetClass;
+    SEL _selector;
+    FMSSwizzleToken *_token;
+}
+@end
+
+@interface FMSHookChainHandler () {
+@public
+    FMSHookChain *_chain;
+    FMSMethodHookBlock _before;
+    FMSHookChainAroundBlock _around;
+    FMSMethodHookBlock _after;
+    BOOL _removed;
+}
+@end
+
+static inline FMSHookChainReaderStripe *FMSHookChainThreadStripe(__unsafe_unretained FMSHookChain *chain) {
+    
+    unsigned int stripe = FMSThreadHookChainStripe;
+    
+    if (__builtin_expect(stripe == 0, 0)) {
+        stripe = atomic_fetch_add_explicit(&FMSNextHookChainStripe, 1, memory_order_relaxed) % FMSHookChainReaderStripeCount + 1;
+        FMSThreadHookChainStripe = stripe;
+    }
+    
+    return &chain->_stripes[stripe - 1];
+}
+
+static uintptr_t FMSHookChainReaderCount(__unsafe_unretained FMSHookChain *chain, unsigned int epoch) {
+    
+    uintptr_t readers = 0;
+    
+    for (NSUInteger index = 0; index < FMSHookChainReaderStripeCount; index++) {
+        readers += atomic_load_explicit(&chain->_stripes[index].readers[epoch], memory_order_seq_cst);
+    }
+    
+    return readers;
+}
+
+#pragma mark - Calling Handlers
+
+/*
+ * The reader count is raised before the array is loaded, and both are sequentially consistent, as are the
+ * writer's swap and its reads of the counts. So a call that loaded an array before the writer swapped it out
+ * raised its count before the writer looked, and the writer sees it. A call that read the epoch just before a
+ * flip counts itself in the old epoch but loads an array that is still current, which only delays freeing.
+ */
+const FMSHookChainHandlers *FMSEnterHookChain(void *context, void *receiver, SEL selector, unsigned int *epoch) {
+    
+    __unsafe_unretained FMSHookChain *chain = (__bridge FMSHookChain *)context;
+    
+    *epoch = atomic_load_explicit(&chain->_epoch, memory_order_relaxed);
+    atomic_fetch_add_explicit(&FMSHookChainThreadStripe(chain)->readers[*epoch], 1, memory_order_seq_cst);
+    
+    const FMSHookChainHandlers *handlers = atomic_load_explicit(&chain->_handlers, memory_order_seq_cst);
+    
+    for (NSUInteger index = 0; index < handlers->beforeCount; index++) {
+        ((__bridge FMSMethodHookBlock)handlers->blocks[index])((__bridge id)receiver, selector);
+    }
+    
+    return handlers;
+}
+
+/*
+ * If a handler or the original implementation throws, the call is never uncounted. Its chain then keeps its
+ * retired arrays until it is deallocated, which wastes memory but never frees an array too early.
+ */
+void FMSExitHookChain(void *context, const FMSHookChainHandlers *handlers, unsigned int epoch, void *receiver, SEL selector) {
+    
+    __unsafe_unretained FMSHookChain *chain = (__bridge FMSHookChain *)context;
+    
+    NSUInteger first = handlers->beforeCount + handlers->aroundCount;
+    
+    for (NSUInteger index = first; index < first + handlers->afterCount; index++) {
+        ((__bridge FMSMethodHookBlock)handlers->blocks[index])((__bridge id)receiver, selector);
+    }
+    
+    atomic_fetch_sub_explicit(&FMSHookChainThreadStripe(chain)->readers[epoch], 1, memory_order_release);
+}
+
+/*
+ * Each level hands the next one a stack block, so running around handlers allocates nothing unless a handler
+ * copies its `proceed` block. The blocks are unretained here: the array's blocks are kept alive by the chain,
+ * and `original` by the trampoline's stack frame.
+ */
+static void FMSRunHookChainAround(const FMSHookChainHandlers *handlers,
+                                  NSUInteger index,
+                                  void *receiver,
+                                  SEL selector,
+                                  __unsafe_unretained FMSHookChainProceedBlock original) {
+    
+    if (index == handlers->aroundCount) {
+        original();
+        return;
+    }
+    
+    __unsafe_unretained FMSHookChainAroundBlock around =
+    (__bridge FMSHookChainAroundBlock)handlers->blocks[handlers->beforeCount + index];
+    
+    around((__bridge id)receiver, selector, ^{
+        FMSRunHookChainAround(handlers, index + 1, receiver, selector, original);
+    });
+}
+
+void FMSRunHookChainArounds(const FMSHookChainHandlers *handlers,
+                            void *receiver,
+                            SEL selector,
+                            __unsafe_unretained FMSHookChainProceedBlock original) {
+    
+    FMSRunHookChainAround(handlers, 0, receiver, selector, original);
+}
+
+#pragma mark - Publishing Handlers
+
+static FMSHookChainHandlers *FMSCreateHookChainHandlers(NSArray *entries) {
+    
+    NSUInteger beforeCount = 0;
+    NSUInteger aroundCount = 0;
+    NSUInteger afterCount = 0;
+    
+    for (FMSHookChainHandler *entry in entries) {
+        
+        if (entry->_before != nil) beforeCount++;
+        if (entry->_around != nil) aroundCount++;
+        if (entry->_after != nil) afterCount++;
+    }
+    
+    NSUInteger count = beforeCount + aroundCount + afterCount;
+    FMSHookChainHandlers *handlers = malloc(sizeof(FMSHookChainHandlers) + count * sizeof(void *));
+    
+    if (handlers == NULL) {
+        [NSException raise:NSMallocException format:@"Could not allocate a hook chain"];
+    }
+    
+    handlers->beforeCount = beforeCount;
+    handlers->aroundCount = aroundCount;
+    handlers->afterCount = afterCount;
+    handlers->nextRetired = NULL;
+    
+    NSUInteger before = 0;
+    NSUInteger around = beforeCount;
+    NSUInteger after = count;
+    
+    // After blocks are stored back to front, so the trampoline can walk every part of the array forwards.
+    for (FMSHookChainHandler *entry in entries) {
+        
+        if (entry->_before != nil) handlers->blocks[before++] = (__bridge void *)entry->_before;
+        if (entry->_around != nil) handlers->blocks[around++] = (__bridge void *)entry->_around;
+        if (entry->_after != nil) handlers->blocks[--after] = (__bridge void *)entry->_after;
+    }
+    
+    return handlers;
+}
+
+static void FMSFreeHookChainHandlerList(FMSHookChainHandlers *handlers) {
+    
+    while (handlers != NULL) {
+        
+        FMSHookChainHandlers *next = handlers->nextRetired;
+        free(handlers);
+        handlers = next;
+    }
+}
+
+// Must be called while holding the lock for the chain's class.
+static void FMSAdvanceHookChain(__unsafe_unretained FMSHookChain *chain) {
+    
+    unsigned int epoch = atomic_load_explicit(&chain->_epoch, memory_order_relaxed);
+    
+    if (FMSHookChainReaderCount(chain, epoch ^ 1) != 0) return;
+    
+    FMSFreeHookChainHandlerList(chain->_waitingHandlers);
+    chain->_waitingHandlers = chain->_pendingHandlers;
+    chain->_pendingHandlers = NULL;
+    
+    NSMutableArray *freedBlocks = chain->_waitingBlocks;
+    [freedBlocks removeAllObjects];
+    chain->_waitingBlocks = chain->_pendingBlocks;
+    chain->_pendingBlocks = freedBlocks;
+    
+    atomic_store_explicit(&chain->_epoch, epoch ^ 1, memory_order_seq_cst);
+}
+
+// Must be called while holding the lock for the chain's class.
+static void FMSPublishHookChainHandlers(__unsafe_unretained FMSHookChain *chain) {
+    
+    FMSHookChainHandlers *handlers = FMSCreateHookChainHandlers(chain->_entries);
+    FMSHookChainHandlers *previous = atomic_exchange_explicit(&chain->_handlers, handlers, memory_order_seq_cst);
+    
+    previous->nextRetired = chain->_pendingHandlers;
+    chain->_pendingHandlers = previous;
+    
+    FMSAdvanceHookChain(chain);
+}
+
+// Must be called while holding the lock for the chain's class, before the array without the handler is published.
+static void FMSRemoveHookChainEntry(__unsafe_unretained FMSHookChain *chain, FMSHookChainHandler *entry) {
+    
+    entry->_removed = YES;
+    
+    if (entry->_before != nil) [chain->_pendingBlocks addObject:entry->_before];
+    if (entry->_around != nil) [chain->_pendingBlocks addObject:entry->_around];
+    if (entry->_after != nil) [chain->_pendingBlocks addObject:entry->_after];
+}
+
+#pragma mark - Hook Chain Registry
+
+static pthread_mutex_t FMSHookChainLock = PTHREAD_MUTEX_INITIALIZER;
+static NSMutableDictionary *FMSHookChains = nil;
+
+static NSString *FMSHookChainKey(Class cls, SEL selector) {
+    return [NSString stringWithFormat:@"%p %s", (__bridge void *)cls, sel_getName(selector)];
+}
+
+// Returns the chain for the method if its trampoline is still installed.
+FMSHookChain *FMSHookChainForMethod(Class cls, SEL selector) {
+    
+    pthread_mutex_lock(&FMSHookChainLock);
+    FMSHookChain *chain = FMSHookChains[FMSHookChainKey(cls, selector)];
+    pthread_mutex_unlock(&FMSHookChainLock);
+    
+    return (chain != nil && [chain->_token isActive]) ? chain : nil;
+}
+
+static void FMSRegisterHookChain(FMSHookChain *chain) {
+    
+    pthread_mutex_lock(&FMSHookChainLock);
+    
+    if (FMSHookChains == nil) {
+        FMSHookChains = [[NSMutableDictionary alloc] init];
+    }
+    
+    FMSHookChains[FMSHookChainKey(chain->_targetClass, chain->_selector)] = chain;
+    
+    pthread_mutex_unlock(&FMSHookChainLock);
+}
+
+static void FMSUnregisterHookChain(FMSHookChain *chain) {
+    
+    NSString *key = FMSHookChainKey(chain->_targetClass, chain->_selector);
+    
+    pthread_mutex_lock(&FMSHookChainLock);
+    
+    if (FMSHookChains[key] == chain) {
+        [FMSHookChains removeObjectForKey:key];
+    }
+    
+    pthread_mutex_unlock(&FMSHookChainLock);
+}
+
+FMSHookChainHandler *FMSAddHookChainHandler(Class cls,
+                                            SEL selector,
+                                            FMSMethodHookBlock before,
+                                            FMSHookChainAroundBlock around,
+                                            FMSMethodHookBlock after) {
+    
+    if (before == nil && around == nil && after == nil) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"A hook chain handler needs at least one block"];
+    }
+    
+    FMSHookChain *chain = FMSHookChainForMethod(cls, selector);
+    
+    if (chain == nil) {
+        
+        chain = [[FMSHookChain alloc] init];
+        chain->_targetClass = cls;
+        chain->_selector = selector;
+        chain->_token = FMSInstallHookChainTrampoline(cls, selector, chain);
+        
+        FMSRegisterHookChain(chain);
+    }
+    
+    FMSHookChainHandler *entry = [[FMSHookChainHandler alloc] init];
+    entry->_chain = chain;
+    entry->_before = [before copy];
+    entry->_around = [around copy];
+    entry->_after = [after copy];
+    
+    [chain->_entries addObject:entry];
+    FMSPublishHookChainHandlers(chain);
+    
+    return entry;
+}
+
+/*
+ * Called by the chain's token as it is restored, while holding the lock for the chain's class. The handlers are
+ * removed and an empty array is published, like removing each handler would, and the chain is forgotten. Nothing
+ * publishes to the chain after this, so it advances its epochs once more straight away: unless a call is still
+ * walking the old array, that frees it and the handlers' blocks now. Otherwise they go with the chain itself.
+ */
+void FMSDetachHookChain(FMSHookChain *chain) {
+    
+    for (FMSHookChainHandler *entry in chain->_entries) {
+        FMSRemoveHookChainEntry(chain, entry);
+    }
+    
+    [chain->_entries removeAllObjects];
+    FMSPublishHookChainHandlers(chain);
+    FMSAdvanceHookChain(chain);
+    
+    FMSUnregisterHookChain(chain);
+}
+
+#pragma mark - Hook Chains
+
+@implementation FMSHookChain
+
+- (id)init {
+    
+    self = [super init];
+    
+    if (self) {
+        
+        _entries = [[NSMutableArray alloc] init];
+        _pendingBlocks = [[NSMutableArray alloc] init];
+        _waitingBlocks = [[NSMutableArray alloc] init];
+        atomic_init(&_handlers, FMSCreateHookChainHandlers(@[]));
+    }
+    
+    return self;
+}
+
+/*
+ * A chain is only released once its restored trampoline has been freed (the retired IMP holds it), which waits
+ * until no call can still be inside the trampoline. So nothing can be reading the arrays or the reader counts by
+ * now. Usually FMSDetachHookChain() has freed the arrays already; this frees whatever calls still held on to.
+ */
+- (void)dealloc {
+    
+    free(atomic_load_explicit(&_handlers, memory_order_relaxed));
+    
+    FMSFreeHookChainHandlerList(_pendingHandlers);
+    FMSFreeHookChainHandlerList(_waitingHandlers);
+}
+
+- (Class)targetClass {
+    return _targetClass;
+}
+
+- (SEL)selector {
+    return _selector;
+}
+
+- (FMSSwizzleToken *)token {
+    return _token;
+}
+
+- (NSUInteger)handlerCount {
+    
+    __block NSUInteger count = 0;
+    
+    FMSPerformLocked(_targetClass, ^{
+        count = [self->_entries count];
+    });
+    
+    return count;
+}
+
+- (NSString *)description {
+    
+    return [NSString stringWithFormat:@"<%@: %p %c[%@ %@] handlers:%lu>",
+            NSStringFromClass([self class]), (__bridge void *)self,
+            class_isMetaClass(_targetClass) ? '+' : '-',
+            NSStringFromClass(_targetClass), NSStringFromSelector(_selector),
+            (unsigned long)[self handlerCount]];
+}
+
+@end
+
+@implementation FMSHookChainHandler
+
+- (FMSHookChain *)chain {
+    return _chain;
+}
+
+- (BOOL)isActive {
+    
+    __block BOOL active = NO;
+    
+    FMSPerformLocked(_chain->_targetClass, ^{
+        active = !self->_removed;
+    });
+    
+    return active;
+}
+
+- (void)remove {
+    
+    FMSHookChain *chain = _chain;
+    
+    FMSPerformLocked(chain->_targetClass, ^{
+        
+        if (self->_removed) return;
+        
+        FMSRemoveHookChainEntry(chain, self);
+        [chain->_entries removeObjectIdenticalTo:self];
+        FMSPublishHookChainHandlers(chain);
+    });
+}
+
+@end
@@ -0,0 +1,84 @@
+//
+//  FMSIMPSnapshot.h
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * @file FMSIMPSnapshot.h
+ * Frozen selector to `IMP` tables for hot loops. See `FMS_IMPSnapshotForSelectors:count:`.
+ */
+
+#import <Foundation/Foundation.h>
+#import <objc/runtime.h>
+
+/**
+ * @brief A table of the implementations a class had for a set of selectors at one moment.
+ *
+ * A hot loop can call the implementations directly, skipping `objc_msgSend()` (cast the `IMP` to a function
+ * pointer with the method's exact signature, and pass the receiver and selector as the first two arguments).
+ *
+ * The table doesn't change once it is made. Any change FMSSwizzler makes to any class (a swizzle, a restore, a
+ * new pseudo property, a batch) makes every snapshot invalid, since the change might be to a superclass the
+ * snapshot's class inherits from. Check `valid` where it is cheap to do so (once per batch of work, for example)
+ * and use `refreshedSnapshot` when it comes back `NO`. Changes made without FMSSwizzler (`method_setImplementation()`,
+ * a category loaded from a bundle) aren't noticed; call `FMS_invalidateIMPSnapshots` after making them.
+ *
+ * Note: Calling an implementation from an invalid snapshot still works, as long as it hasn't been freed by
+ * restoring its token. It just may not be the implementation `objc_msgSend()` would find now.
+ */
+@interface FMSIMPSnapshot : NSObject
+
+/** The class whose implementations were looked up. */
+@property (strong, nonatomic, readonly) Class targetClass;
+
+/** The number of selectors in the snapshot. */
+@property (assign, nonatomic, readonly) NSUInteger count;
+
+/** The selectors, in the order they were passed in (or, for a snapshot of every method, sorted by address). */
+@property (assign, nonatomic, readonly) const SEL *selectors;
+
+/** The implementation for each entry in `selectors`, or `NULL` if instances of the class don't respond to it. */
+@property (assign, nonatomic, readonly) const IMP *implementations;
+
+/** `NO` once FMSSwizzler has changed a method since the snapshot was taken. */
+@property (assign, nonatomic, readonly, getter = isValid) BOOL valid;
+
+/**
+ * @brief Returns the implementation for `selector`, or `NULL` if it isn't in the snapshot or isn't implemented.
+ *
+ * This is a binary search. Inside a loop, index into `implementations` instead.
+ */
+- (IMP)implementationForSelector:(SEL)selector;
+
+/**
+ * @brief Returns the receiver if it is still valid, or a new snapshot of the same selectors otherwise.
+ */
+- (FMSIMPSnapshot *)refreshedSnapshot;
+
+@end
@@ -0,0 +1,402 @@
+//
+//  FMSInstanceOverrides.m
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#import "FMSSwizzlerInternal.h"
+#import <pthread.h>
+#import <stdatomic.h>
+
+#if !__has_feature(objc_arc)
+#error FMSSwizzler must be built with ARC.
+// You can turn on ARC for only FMSSwizzler files by adding -fobjc-arc to the build phase for each of its files.
+#endif
+
+#pragma mark - Dispatching Subclasses
+
+/*
+ * Objects with their own overrides don't get a class each. Instead, every such object is moved into one shared
+ * subclass of its original class (its dispatcher's class). Each selector that any of those objects overrides
+ * gets a dispatching trampoline on the shared class and a slot number. The objects keep a small table of IMPs
+ * indexed by slot, attached as a single associated object keyed by the dispatcher (just like pseudo property
+ * slabs), so memory grows with the number of overridden selectors rather than the number of objects.
+ *
+ * Objects that don't override a selector fall through to the original class's current implementation, so
+ * later swizzles of the original class still show through. Dispatchers live for the life of the process, and
+ * so does the original class: if it is a shared dynamic subclass, the dispatcher pins it in the cache.
+ */
+@interface FMSInstanceDispatcher : NSObject {
+@public
+    Class _baseClass;
+    Class _dispatchClass;
+    NSMutableDictionary *_slots;
+    NSMutableDictionary *_aliases;
+    NSUInteger _slotCount;
+}
+@end
+
+@implementation FMSInstanceDispatcher
+@end
+
+/*
+ * The context for one dispatching trampoline. For overridden selectors, `_selector` is the selector itself and
+ * `_index` is its slot. For old selectors, `_selector` is the selector they alias.
+ */
+@interface FMSInstanceDispatchSlot : NSObject {
+@public
+    __unsafe_unretained FMSInstanceDispatcher *_dispatcher;
+    Class _baseClass;
+    SEL _selector;
+    NSUInteger _index;
+}
+@end
+
+@implementation FMSInstanceDispatchSlot
+@end
+
+/*
+ * An object's IMPs, indexed by slot. Dispatching calls read it without a lock, so it is never resized in place:
+ * a bigger copy is swapped in and the old one is retired, and the count always matches the array it's read with.
+ */
+typedef struct {
+    NSUInteger count;
+    _Atomic(IMP) implementations[];
+} FMSInstanceOverrideIMPs;
+
+/*
+ * A single object's overrides. Owns the block IMPs, and retires whatever is left when the object goes away.
+ * `_records` has the same count as `_implementations`, and is only used while holding the dispatcher's class lock.
+ */
+@interface FMSInstanceOverrideTable : NSObject {
+@public
+    _Atomic(FMSInstanceOverrideIMPs *) _implementations;
+    FMSSwizzleRecordHandle *_records;
+}
+@end
+
+@implementation FMSInstanceOverrideTable
+
+- (void)dealloc {
+    
+    FMSInstanceOverrideIMPs *implementations = atomic_load_explicit(&_implementations, memory_order_relaxed);
+    
+    if (implementations == NULL) return;
+    
+    for (NSUInteger index = 0; index < implementations->count; index++) {
+        
+        IMP implementation = atomic_load_explicit(&implementations->implementations[index], memory_order_relaxed);
+        
+        if (implementation != NULL) {
+            
+            // The object may be going away from inside one of its own overrides (dealloc, say).
+            FMSRetireImplementation(^{
+                imp_removeBlock(implementation);
+            });
+            
+            FMSRetireSwizzleRecord(_records[index]);
+        }
+    }
+    
+    // Nothing can dispatch through the table once its object has let go of it.
+    free(implementations);
+    free(_records);
+}
+
+@end
+
+static pthread_mutex_t FMSInstanceDispatcherLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Both map a class to its FMSInstanceDispatcher: one by the original class, one by the shared dispatching class.
+static NSMutableDictionary *FMSDispatchersByBaseClass = nil;
+static NSMutableDictionary *FMSDispatchersByDispatchClass = nil;
+
+static FMSInstanceDispatcher *FMSDispatcherForObject(id obj) {
+    
+    Class cls = [obj class];
+    
+    pthread_mutex_lock(&FMSInstanceDispatcherLock);
+    
+    if (FMSDispatchersByBaseClass == nil) {
+        FMSDispatchersByBaseClass = [NSMutableDictionary dictionary];
+        FMSDispatchersByDispatchClass = [NSMutableDictionary dictionary];
+    }
+    
+    // The object may already have been moved into a dispatching class.
+    FMSInstanceDispatcher *dispatcher = FMSDispatchersByDispatchClass[cls] ?: FMSDispatchersByBaseClass[cls];
+    
+    if (dispatcher == nil) {
+        
+        @try {
+            
+            dispatcher = [[FMSInstanceDispatcher alloc] init];
+            dispatcher->_baseClass = cls;
+            dispatcher->_dispatchClass = [cls allocateDynamicSubclass];
+            FMSPinDynamicSubclass(obj, cls);
+            dispatcher->_slots = [[NSMutableDictionary alloc] init];
+            dispatcher->_aliases = [[NSMutableDictionary alloc] init];
+        }
+        @catch (NSException *exception) {
+            
+            pthread_mutex_unlock(&FMSInstanceDispatcherLock);
+            @throw;
+        }
+        
+        FMSDispatchersByBaseClass[(id <NSCopying>)cls] = dispatcher;
+        FMSDispatchersByDispatchClass[(id <NSCopying>)dispatcher->_dispatchClass] = dispatcher;
+    }
+    
+    pthread_mutex_unlock(&FMSInstanceDispatcherLock);
+    
+    return dispatcher;
+}
+
+#pragma mark - Dispatch
+
+static IMP FMSResolveInstanceOverride(void *context, void *receiver, SEL selector) {
+    
+    __unsafe_unretained FMSInstanceDispatchSlot *slot = (__bridge FMSInstanceDispatchSlot *)context;
+    __unsafe_unretained FMSInstanceOverrideTable *table =
+    objc_getAssociatedObject((__bridge id)receiver, (__bridge const void *)slot->_dispatcher);
+    
+    if (table != nil) {
+        
+        FMSInstanceOverrideIMPs *implementations = atomic_load_explicit(&table->_implementations, memory_order_acquire);
+        
+        if (implementations != NULL && slot->_index < implementations->count) {
+            
+            IMP implementation = atomic_load_explicit(&implementations->implementations[slot->_index],
+                                                      memory_order_acquire);
+            if (implementation != NULL) return implementation;
+        }
+    }
+    
+    return class_getMethodImplementation(slot->_baseClass, selector);
+}
+
+static IMP FMSResolveInstanceAlias(void *context, void *receiver, SEL selector) {
+    
+    __unsafe_unretained FMSInstanceDispatchSlot *slot = (__bridge FMSInstanceDispatchSlot *)context;
+    return class_getMethodImplementation(slot->_baseClass, slot->_selector);
+}
+
+#pragma mark - Installing Overrides
+
+// Must be called while holding the lock for the dispatcher's class.
+static FMSInstanceDispatchSlot *FMSDispatchSlotForSelector(FMSInstanceDispatcher *dispatcher, SEL selector) {
+    
+    NSString *name = NSStringFromSelector(selector);
+    FMSInstanceDispatchSlot *slot = dispatcher->_slots[name];
+    
+    if (slot != nil) return slot;
+    
+    if (dispatcher->_aliases[name] != nil) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"%@ is an old selector for another override, and can't be overridden itself", name];
+    }
+    
+    slot = [[FMSInstanceDispatchSlot alloc] init];
+    slot->_dispatcher = dispatcher;
+    slot->_baseClass = dispatcher->_baseClass;
+    slot->_selector = selector;
+    slot->_index = dispatcher->_slotCount;
+    
+    FMSInstallDispatchTrampoline(dispatcher->_dispatchClass, selector, slot, FMSResolveInstanceOverride);
+    
+    dispatcher->_slots[name] = slot;
+    dispatcher->_slotCount++;
+    
+    return slot;
+}
+
+// Must be called while holding the lock for the dispatcher's class.
+static void FMSAddInstanceAlias(FMSInstanceDispatcher *dispatcher, Method originalMethod, SEL selector, SEL oldSelector) {
+    
+    FMSCheckAliasArguments(originalMethod, oldSelector);
+    
+    NSString *name = NSStringFromSelector(oldSelector);
+    FMSInstanceDispatchSlot *existing = dispatcher->_aliases[name];
+    
+    // Objects that override the same selector can share an old selector.
+    if (existing != nil && existing->_selector == selector) return;
+    
+    if (existing != nil || class_getInstanceMethod(dispatcher->_dispatchClass, oldSelector) != NULL) {
+        [NSException
+         raise:NSInvalidArgumentException
+         format:@"The selector %@ is already being used.", name];
+    }
+    
+    FMSInstanceDispatchSlot *slot = [[FMSInstanceDispatchSlot alloc] init];
+    slot->_dispatcher = dispatcher;
+    slot->_baseClass = dispatcher->_baseClass;
+    slot->_selector = selector;
+    slot->_index = NSNotFound;
+    
+    // The alias also dispatches, so it keeps reaching the original class's current implementation.
+    class_addMethod(dispatcher->_dispatchClass,
+                    oldSelector,
+                    method_getImplementation(originalMethod),
+                    method_getTypeEncoding(originalMethod));
+    
+    FMSInstallDispatchTrampoline(dispatcher->_dispatchClass, oldSelector, slot, FMSResolveInstanceAlias);
+    
+    dispatcher->_aliases[name] = slot;
+}
+
+// Must be called while holding the lock for the dispatcher's class.
+static FMSInstanceOverrideTable *FMSOverrideTableForObject(id obj, FMSInstanceDispatcher *dispatcher, NSUInteger index) {
+    
+    const void *key = (__bridge const void *)dispatcher;
+    FMSInstanceOverrideTable *table = objc_getAssociatedObject(obj, key);
+    
+    if (table == nil) {
+        
+        table = [[FMSInstanceOverrideTable alloc] init];
+        objc_setAssociatedObject(obj, key, table, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    }
+    
+    FMSInstanceOverrideIMPs *implementations = atomic_load_explicit(&table->_implementations, memory_order_relaxed);
+    NSUInteger oldCount = (implementations != NULL) ? implementations->count : 0;
+    
+    if (index < oldCount) return table;
+    
+    // Size the table for every selector the dispatcher currently knows about, so this happens rarely.
+    NSUInteger count = MAX(dispatcher->_slotCount, index + 1);
+    FMSInstanceOverrideIMPs *grown = calloc(1, sizeof(FMSInstanceOverrideIMPs) + count * sizeof(_Atomic(IMP)));
+    grown->count = count;
+    
+    for (NSUInteger slot = 0; slot < oldCount; slot++) {
+        atomic_init(&grown->implementations[slot],
+                    atomic_load_explicit(&implementations->implementations[slot], memory_order_relaxed));
+    }
+    
+    FMSSwizzleRecordHandle *records = realloc(table->_records, count * sizeof(FMSSwizzleRecordHandle));
+    memset(records + oldCount, 0, (count - oldCount) * sizeof(FMSSwizzleRecordHandle));
+    table->_records = records;
+    
+    atomic_store_explicit(&table->_implementations, grown, memory_order_release);
+    
+    // Calls on other threads may still be reading the old array.
+    if (implementations != NULL) {
+        FMSRetireImplementation(^{
+            free(implementations);
+        });
+    }
+    
+    return table;
+}
+
+FMSSwizzleToken *FMSInstallInstanceOverride(id obj, SEL selector, SEL oldSelector, id block) {
+    
+    if (block == nil) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"An override needs an implementation block"];
+    }
+    
+    FMSInstanceDispatcher *dispatcher = FMSDispatcherForObject(obj);
+    Class dispatchClass = dispatcher->_dispatchClass;
+    __block FMSSwizzleToken *token = nil;
+    
+    FMSPerformLocked(dispatchClass, ^{
+        
+        Method originalMethod = class_getInstanceMethod(dispatcher->_baseClass, selector);
+        
+        if (originalMethod == NULL) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"The original method does not exist"];
+        }
+        
+        if (oldSelector != NULL) {
+            FMSAddInstanceAlias(dispatcher, originalMethod, selector, oldSelector);
+        }
+        
+        FMSInstanceDispatchSlot *slot = FMSDispatchSlotForSelector(dispatcher, selector);
+        FMSInstanceOverrideTable *table = FMSOverrideTableForObject(obj, dispatcher, slot->_index);
+        FMSInstanceOverrideIMPs *implementations = atomic_load_explicit(&table->_implementations, memory_order_relaxed);
+        
+        if (atomic_load_explicit(&implementations->implementations[slot->_index], memory_order_relaxed) != NULL) {
+            [NSException
+             raise:NSInvalidArgumentException
+             format:@"This object already overrides %@. Restore its token first.", NSStringFromSelector(selector)];
+        }
+        
+        IMP implementation = imp_implementationWithBlock(block);
+        atomic_store_explicit(&implementations->implementations[slot->_index], implementation, memory_order_release);
+        
+        token = [[FMSSwizzleToken alloc] init];
+        token->_targetClass = dispatchClass;
+        token->_selector = selector;
+        token->_aliasSelector = oldSelector;
+        token->_kind = FMSSwizzleTokenInstance;
+        token->_previousImplementation = method_getImplementation(originalMethod);
+        token->_installedImplementation = implementation;
+        token->_active = YES;
+        token->_context = slot;
+        token->_instanceTable = table;
+        token->_record = FMSRecordSwizzle(FMSSwizzleRecordInstance,
+                                          dispatchClass,
+                                          selector,
+                                          method_getTypeEncoding(originalMethod),
+                                          token->_previousImplementation,
+                                          implementation,
+                                          dispatcher->_baseClass);
+        
+        // The object may go away without the token being restored; its table retires the record then.
+        table->_records[slot->_index] = token->_record;
+        
+        // Only move the object once its table is ready, so it never dispatches to a half-installed override.
+        if (object_getClass(obj) != dispatchClass) {
+            object_setClass(obj, dispatchClass);
+        }
+    });
+    
+    return token;
+}
+
+void FMSRestoreInstanceOverride(FMSSwizzleToken *token) {
+    
+    FMSInstanceOverrideTable *table = token->_instanceTable;
+    FMSInstanceDispatchSlot *slot = token->_context;
+    
+    // If the object is gone, its table has already retired the IMP.
+    if (table == nil) return;
+    
+    FMSInstanceOverrideIMPs *implementations = atomic_load_explicit(&table->_implementations, memory_order_relaxed);
+    IMP implementation = token->_installedImplementation;
+    
+    if (atomic_load_explicit(&implementations->implementations[slot->_index], memory_order_relaxed) == implementation) {
+        
+        atomic_store_explicit(&implementations->implementations[slot->_index], NULL, memory_order_release);
+        
+        // Another thread may have resolved the override just before it was cleared, and still be running it.
+        FMSRetireImplementation(^{
+            imp_removeBlock(implementation);
+        });
+    }
+}
@@ -0,0 +1,328 @@
+//
+//  FMSInstrumentation.m
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#import "FMSSwizzlerInternal.h"
+#import <pthread.h>
+#import <stdatomic.h>
+#import <time.h>
+
+#if !__has_feature(objc_arc)
+#error FMSSwizzler must be built with ARC.
+// You can turn on ARC for only FMSSwizzler files by adding -fobjc-arc to the build phase for each of its files.
+#endif
+
+#pragma mark - Per-Thread Counters
+
+/*
+ * Every instrumented method gets a slot number. Each thread keeps a table, indexed by slot, of pointers to
+ * its own counters for that method. Only the owning thread ever writes a set of counters, so updates are plain
+ * relaxed loads and stores--no locked instructions and no shared cache lines. Readers add up every thread's
+ * counters on demand.
+ *
+ * Counters are linked into their method's list the first time a thread calls it, and are never freed, so
+ * calls made by threads that have since exited are still counted.
+ */
+typedef struct FMSInstrumentationCounters {
+    _Atomic uint64_t calls;
+    _Atomic uint64_t totalNanoseconds;
+    _Atomic uint64_t buckets[FMSLatencyBucketCount];
+    struct FMSInstrumentationCounters *next;
+} FMSInstrumentationCounters;
+
+@interface FMSInstrumentationRecord : NSObject {
+@public
+    Class _targetClass;
+    SEL _selector;
+    size_t _slot;
+    _Atomic(FMSInstrumentationCounters *) _threadCounters;
+    FMSSwizzleToken *_token;
+}
+@end
+
+@implementation FMSInstrumentationRecord
+@end
+
+static atomic_size_t FMSNextInstrumentationSlot = 0;
+
+static _Thread_local FMSInstrumentationCounters **FMSThreadCounterTable = NULL;
+static _Thread_local size_t FMSThreadCounterCapacity = 0;
+
+static pthread_key_t FMSThreadCounterTableKey;
+static pthread_once_t FMSThreadCounterTableKeyOnce = PTHREAD_ONCE_INIT;
+
+// Frees the thread's table (but not the counters, which belong to their methods) when the thread exits.
+static void FMSCreateThreadCounterTableKey(void) {
+    pthread_key_create(&FMSThreadCounterTableKey, free);
+}
+
+static inline uint64_t FMSInstrumentationNow(void) {
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static FMSInstrumentationCounters *FMSCreateThreadCounters(__unsafe_unretained FMSInstrumentationRecord *record) {
+    
+    size_t slot = record->_slot;
+    
+    if (slot >= FMSThreadCounterCapacity) {
+        
+        pthread_once(&FMSThreadCounterTableKeyOnce, FMSCreateThreadCounterTableKey);
+        
+        size_t capacity = MAX(FMSThreadCounterCapacity * 2, (size_t)16);
+        while (capacity <= slot) capacity *= 2;
+        
+        FMSInstrumentationCounters **table = realloc(FMSThreadCounterTable, capacity * sizeof(*table));
+        if (table == NULL) {
+            [NSException raise:NSMallocException format:@"Could not grow the instrumentation counter table"];
+        }
+        
+        memset(table + FMSThreadCounterCapacity, 0, (capacity - FMSThreadCounterCapacity) * sizeof(*table));
+        
+        FMSThreadCounterTable = table;
+        FMSThreadCounterCapacity = capacity;
+        pthread_setspecific(FMSThreadCounterTableKey, table);
+    }
+    
+    FMSInstrumentationCounters *counters = calloc(1, sizeof(FMSInstrumentationCounters));
+    if (counters == NULL) {
+        [NSException raise:NSMallocException format:@"Could not allocate instrumentation counters"];
+    }
+    
+    // Publish the counters to readers. This happens once per thread per method.
+    FMSInstrumentationCounters *head = atomic_load_explicit(&record->_threadCounters, memory_order_relaxed);
+    do {
+        counters->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&record->_threadCounters, &head, counters,
+                                                    memory_order_release, memory_order_relaxed));
+    
+    FMSThreadCounterTable[slot] = counters;
+    return counters;
+}
+
+static inline NSUInteger FMSLatencyBucket(uint64_t nanoseconds) {
+    
+    if (nanoseconds == 0) return 0;
+    
+    NSUInteger bucket = 64 - (NSUInteger)__builtin_clzll(nanoseconds);
+    return MIN(bucket, (NSUInteger)FMSLatencyBucketCount - 1);
+}
+
+// Single writer: a relaxed load and store is enough, and avoids a locked read-modify-write.
+static inline void FMSBumpCounter(_Atomic uint64_t *counter, uint64_t amount) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static inline void FMSRecordCall(__unsafe_unretained FMSInstrumentationRecord *record, uint64_t start) {
+    
+    uint64_t elapsed = FMSInstrumentationNow() - start;
+    
+    size_t slot = record->_slot;
+    FMSInstrumentationCounters *counters =
+    (slot < FMSThreadCounterCapacity) ? FMSThreadCounterTable[slot] : NULL;
+    
+    if (__builtin_expect(counters == NULL, 0)) {
+        counters = FMSCreateThreadCounters(record);
+    }
+    
+    FMSBumpCounter(&counters->calls, 1);
+    FMSBumpCounter(&counters->totalNanoseconds, elapsed);
+    FMSBumpCounter(&counters->buckets[FMSLatencyBucket(elapsed)], 1);
+}
+
+#pragma mark - Trampoline Callbacks
+
+static uint64_t FMSInstrumentationBefore(void *context, void *receiver, SEL selector) {
+    return FMSInstrumentationNow();
+}
+
+static void FMSInstrumentationAfter(void *context, void *receiver, SEL selector, uint64_t start) {
+    FMSRecordCall((__bridge FMSInstrumentationRecord *)context, start);
+}
+
+#pragma mark - Instrumentation Registry
+
+static pthread_mutex_t FMSInstrumentationLock = PTHREAD_MUTEX_INITIALIZER;
+static NSMutableDictionary *FMSInstrumentationRecords = nil;
+
+static NSString *FMSInstrumentationKey(Class cls, SEL selector) {
+    return [NSString stringWithFormat:@"%p %s", (__bridge void *)cls, sel_getName(selector)];
+}
+
+static FMSInstrumentationRecord *FMSLookupInstrumentationRecord(Class cls, SEL selector, BOOL create) {
+    
+    pthread_mutex_lock(&FMSInstrumentationLock);
+    
+    NSString *key = FMSInstrumentationKey(cls, selector);
+    FMSInstrumentationRecord *record = FMSInstrumentationRecords[key];
+    
+    if (record == nil && create) {
+        
+        if (FMSInstrumentationRecords == nil) {
+            FMSInstrumentationRecords = [[NSMutableDictionary alloc] init];
+        }
+        
+        record = [[FMSInstrumentationRecord alloc] init];
+        record->_targetClass = cls;
+        record->_selector = selector;
+        record->_slot = atomic_fetch_add(&FMSNextInstrumentationSlot, 1);
+        FMSInstrumentationRecords[key] = record;
+    }
+    
+    pthread_mutex_unlock(&FMSInstrumentationLock);
+    
+    return record;
+}
+
+FMSSwizzleToken *FMSInstrumentMethod(Class cls, SEL selector, FMSSampler *sampler) {
+    
+    Method method = class_getInstanceMethod(cls, selector);
+    
+    if (method == NULL) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"The original method does not exist"];
+    }
+    
+    // Re-instrumenting after the token was restored keeps adding to the same statistics.
+    FMSInstrumentationRecord *record = FMSLookupInstrumentationRecord(cls, selector, YES);
+    
+    if (record->_token != nil && [record->_token isActive]) {
+        [NSException
+         raise:NSInvalidArgumentException
+         format:@"%@ is already instrumented on %@.", NSStringFromSelector(selector), NSStringFromClass(cls)];
+    }
+    
+    if (sampler != nil) {
+        record->_token = FMSInstallSampledTrampoline(cls, selector, sampler, record,
+                                                     FMSInstrumentationBefore, FMSInstrumentationAfter);
+    } else {
+        record->_token = FMSInstallTrampoline(cls, selector, record, FMSInstrumentationBefore, FMSInstrumentationAfter);
+    }
+    
+    return record->_token;
+}
+
+#pragma mark - Statistics
+
+@interface FMSMethodStatistics () {
+    uint64_t _buckets[FMSLatencyBucketCount];
+}
+
+@property (strong, nonatomic, readwrite) Class targetClass;
+@property (assign, nonatomic, readwrite) SEL selector;
+@property (assign, nonatomic, readwrite) uint64_t callCount;
+@property (assign, nonatomic, readwrite) uint64_t totalNanoseconds;
+
+@end
+
+FMSMethodStatistics *FMSStatisticsForMethod(Class cls, SEL selector) {
+    
+    FMSInstrumentationRecord *record = FMSLookupInstrumentationRecord(cls, selector, NO);
+    
+    if (record == nil) return nil;
+    
+    FMSMethodStatistics *statistics = [[FMSMethodStatistics alloc] init];
+    statistics.targetClass = cls;
+    statistics.selector = selector;
+    
+    uint64_t calls = 0;
+    uint64_t totalNanoseconds = 0;
+    
+    for (FMSInstrumentationCounters *counters = atomic_load_explicit(&record->_threadCounters, memory_order_acquire);
+         counters != NULL;
+         counters = counters->next) {
+        
+        calls += atomic_load_explicit(&counters->calls, memory_order_relaxed);
+        totalNanoseconds += atomic_load_explicit(&counters->totalNanoseconds, memory_order_relaxed);
+        
+        for (NSUInteger bucket = 0; bucket < FMSLatencyBucketCount; bucket++) {
+            statistics->_buckets[bucket] += atomic_load_explicit(&counters->buckets[bucket], memory_order_relaxed);
+        }
+    }
+    
+    statistics.callCount = calls;
+    statistics.totalNanoseconds = totalNanoseconds;
+    
+    return statistics;
+}
+
+@implementation FMSMethodStatistics
+
+- (double)averageNanoseconds {
+    
+    if (self.callCount == 0) return 0.0;
+    return (double)self.totalNanoseconds / (double)self.callCount;
+}
+
+- (uint64_t)callCountForLatencyBucket:(NSUInteger)bucket {
+    
+    if (bucket >= FMSLatencyBucketCount) {
+        [NSException raise:NSRangeException format:@"Latency bucket %lu is out of range", (unsigned long)bucket];
+    }
+    
+    return _buckets[bucket];
+}
+
++ (uint64_t)lowerBoundForLatencyBucket:(NSUInteger)bucket {
+    
+    if (bucket >= FMSLatencyBucketCount) {
+        [NSException raise:NSRangeException format:@"Latency bucket %lu is out of range", (unsigned long)bucket];
+    }
+    
+    return (bucket == 0) ? 0 : (1ULL << (bucket - 1));
+}
+
+- (uint64_t)approximateNanosecondsAtPercentile:(double)percentile {
+    
+    uint64_t total = 0;
+    for (NSUInteger bucket = 0; bucket < FMSLatencyBucketCount; bucket++) {
+        total += _buckets[bucket];
+    }
+    
+    if (total == 0) return 0;
+    
+    uint64_t target = (uint64_t)ceil(MAX(0.0, MIN(percentile, 1.0)) * (double)total);
+    uint64_t seen = 0;
+    
+    for (NSUInteger bucket = 0; bucket < FMSLatencyBucketCount; bucket++) {
+        
+        seen += _buckets[bucket];
+        if (seen >= target && seen > 0) {
+            return 1ULL << bucket;
+        }
+    }
+    
+    return 1ULL << (FMSLatencyBucketCount - 1);
+}
+
+@end
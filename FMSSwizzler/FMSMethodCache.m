@@ -0,0 +1,260 @@
+//
+//  FMSMethodCache.m
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#import "FMSSwizzlerInternal.h"
+#import <stdatomic.h>
+
+#if !__has_feature(objc_arc)
+#error FMSSwizzler must be built with ARC.
+// You can turn on ARC for only FMSSwizzler files by adding -fobjc-arc to the build phase for each of its files.
+#endif
+
+#pragma mark - Snapshot Generations
+
+/*
+ * Bumped after every change FMSSwizzler makes to a method list. A snapshot remembers the generation it was
+ * taken in (read before it looks anything up), so a change that lands while it is being taken makes it invalid
+ * straight away rather than leaving a stale IMP behind a valid snapshot.
+ */
+static _Atomic uint64_t FMSIMPSnapshotGeneration = 0;
+
+void FMSInvalidateIMPSnapshots(void) {
+    atomic_fetch_add_explicit(&FMSIMPSnapshotGeneration, 1, memory_order_release);
+}
+
+#pragma mark - Method Lists
+
+// NSObject (or whichever root the class has) has hundreds of methods that no hot loop needs cached.
+static BOOL FMSIsRootClass(Class cls) {
+    
+    Class superclass = class_getSuperclass(cls);
+    return superclass == Nil || class_isMetaClass(cls) != class_isMetaClass(superclass);
+}
+
+static int FMSCompareSelectors(const void *first, const void *second) {
+    
+    uintptr_t a = (uintptr_t)*(const SEL *)first;
+    uintptr_t b = (uintptr_t)*(const SEL *)second;
+    
+    return (a < b) ? -1 : (a > b) ? 1 : 0;
+}
+
+/*
+ * Every selector implemented by `cls` or by an ancestor below the root class, sorted by address with duplicates
+ * (overrides) removed. The caller frees the result.
+ */
+static SEL *FMSCopyEveryMethodSelector(Class cls, NSUInteger *count) {
+    
+    NSUInteger capacity = 0;
+    NSUInteger length = 0;
+    SEL *selectors = NULL;
+    
+    for (Class current = cls; current != Nil && !FMSIsRootClass(current); current = class_getSuperclass(current)) {
+        
+        unsigned int methodCount = 0;
+        Method *methods = class_copyMethodList(current, &methodCount);
+        
+        if (length + methodCount > capacity) {
+            
+            capacity = MAX(capacity * 2, length + methodCount);
+            selectors = realloc(selectors, capacity * sizeof(SEL));
+        }
+        
+        for (unsigned int index = 0; index < methodCount; index++) {
+            selectors[length++] = method_getName(methods[index]);
+        }
+        
+        free(methods);
+    }
+    
+    if (length > 1) {
+        
+        qsort(selectors, length, sizeof(SEL), FMSCompareSelectors);
+        
+        NSUInteger unique = 1;
+        for (NSUInteger index = 1; index < length; index++) {
+            if (selectors[index] != selectors[unique - 1]) {
+                selectors[unique++] = selectors[index];
+            }
+        }
+        
+        length = unique;
+    }
+    
+    *count = length;
+    return selectors;
+}
+
+#pragma mark - Prewarming
+
+/*
+ * class_getMethodImplementation() goes through the same lookup as a first message send: it runs +initialize
+ * if needed, searches the class and its superclasses, and fills the class's method cache with the result.
+ * Checking class_getInstanceMethod() first keeps selectors the class doesn't implement out of the cache.
+ */
+static IMP FMSResolveImplementation(Class cls, SEL selector) {
+    
+    if (class_getInstanceMethod(cls, selector) == NULL) {
+        return NULL;
+    }
+    
+    return class_getMethodImplementation(cls, selector);
+}
+
+NSUInteger FMSPrewarmMethodCache(Class cls, const SEL *selectors, NSUInteger count) {
+    
+    SEL *everySelector = NULL;
+    
+    if (selectors == NULL) {
+        everySelector = FMSCopyEveryMethodSelector(cls, &count);
+        selectors = everySelector;
+    }
+    
+    NSUInteger resolved = 0;
+    
+    for (NSUInteger index = 0; index < count; index++) {
+        if (FMSResolveImplementation(cls, selectors[index]) != NULL) {
+            resolved++;
+        }
+    }
+    
+    free(everySelector);
+    
+    return resolved;
+}
+
+#pragma mark - Snapshots
+
+typedef struct {
+    SEL selector;
+    IMP implementation;
+} FMSIMPSnapshotEntry;
+
+@interface FMSIMPSnapshot () {
+    Class _targetClass;
+    NSUInteger _count;
+    SEL *_selectors;
+    IMP *_implementations;
+    FMSIMPSnapshotEntry *_sortedEntries;
+    uint64_t _generation;
+    BOOL _everyMethod;
+}
+@end
+
+static int FMSCompareSnapshotEntries(const void *first, const void *second) {
+    return FMSCompareSelectors(&((const FMSIMPSnapshotEntry *)first)->selector,
+                               &((const FMSIMPSnapshotEntry *)second)->selector);
+}
+
+FMSIMPSnapshot *FMSTakeIMPSnapshot(Class cls, const SEL *selectors, NSUInteger count) {
+    
+    FMSIMPSnapshot *snapshot = [[FMSIMPSnapshot alloc] init];
+    snapshot->_targetClass = cls;
+    snapshot->_generation = atomic_load_explicit(&FMSIMPSnapshotGeneration, memory_order_acquire);
+    
+    if (selectors == NULL) {
+        snapshot->_everyMethod = YES;
+        snapshot->_selectors = FMSCopyEveryMethodSelector(cls, &count);
+    } else {
+        snapshot->_selectors = malloc(MAX(count, (NSUInteger)1) * sizeof(SEL));
+        memcpy(snapshot->_selectors, selectors, count * sizeof(SEL));
+    }
+    
+    snapshot->_count = count;
+    snapshot->_implementations = calloc(MAX(count, (NSUInteger)1), sizeof(IMP));
+    snapshot->_sortedEntries = calloc(MAX(count, (NSUInteger)1), sizeof(FMSIMPSnapshotEntry));
+    
+    for (NSUInteger index = 0; index < count; index++) {
+        
+        IMP implementation = FMSResolveImplementation(cls, snapshot->_selectors[index]);
+        
+        snapshot->_implementations[index] = implementation;
+        snapshot->_sortedEntries[index] = (FMSIMPSnapshotEntry){snapshot->_selectors[index], implementation};
+    }
+    
+    qsort(snapshot->_sortedEntries, count, sizeof(FMSIMPSnapshotEntry), FMSCompareSnapshotEntries);
+    
+    return snapshot;
+}
+
+@implementation FMSIMPSnapshot
+
+- (void)dealloc {
+    
+    free(_selectors);
+    free(_implementations);
+    free(_sortedEntries);
+}
+
+- (Class)targetClass {
+    return _targetClass;
+}
+
+- (NSUInteger)count {
+    return _count;
+}
+
+- (const SEL *)selectors {
+    return _selectors;
+}
+
+- (const IMP *)implementations {
+    return _implementations;
+}
+
+- (BOOL)isValid {
+    return atomic_load_explicit(&FMSIMPSnapshotGeneration, memory_order_acquire) == _generation;
+}
+
+- (IMP)implementationForSelector:(SEL)selector {
+    
+    FMSIMPSnapshotEntry key = {selector, NULL};
+    FMSIMPSnapshotEntry *entry = bsearch(&key, _sortedEntries, _count, sizeof(FMSIMPSnapshotEntry), FMSCompareSnapshotEntries);
+    
+    return (entry == NULL) ? NULL : entry->implementation;
+}
+
+- (FMSIMPSnapshot *)refreshedSnapshot {
+    
+    if ([self isValid]) return self;
+    
+    // A snapshot of every method looks the list up again, since the change may have added methods.
+    return FMSTakeIMPSnapshot(_targetClass, _everyMethod ? NULL : _selectors, _count);
+}
+
+- (NSString *)description {
+    
+    return [NSString stringWithFormat:@"<%@: %p class:%@ count:%lu%@>",
+            NSStringFromClass([self class]), (__bridge void *)self,
+            NSStringFromClass(_targetClass), (unsigned long)_count, [self isValid] ? @"" : @" invalid"];
+}
+
+@end
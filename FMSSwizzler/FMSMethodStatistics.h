@@ -0,0 +1,94 @@
+//
+//  FMSMethodStatistics.h
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * @file FMSMethodStatistics.h
+ * Call counts and latency histograms gathered by `FMS_instrumentInstanceMethod:`.
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+ * The number of buckets in an `FMSMethodStatistics` latency histogram.
+ */
+#define FMSLatencyBucketCount 32
+
+/**
+ * @brief A snapshot of the calls made to an instrumented method.
+ *
+ * Each thread records its calls in its own counters, so instrumented calls never contend with each other.
+ * A statistics object is built by adding up every thread's counters at the moment you ask for it. It does not
+ * change afterwards. Calls that are in progress on other threads while the snapshot is taken may or may not
+ * be included.
+ *
+ * Latencies are recorded in a base-2 histogram. Bucket 0 counts calls that took less than one nanosecond.
+ * Bucket `n` counts calls that took at least 2^(n-1) and less than 2^n nanoseconds. The last bucket also
+ * counts every call that took longer (roughly a second or more).
+ */
+@interface FMSMethodStatistics : NSObject
+
+/** The class whose method was instrumented. */
+@property (strong, nonatomic, readonly) Class targetClass;
+
+/** The instrumented selector. */
+@property (assign, nonatomic, readonly) SEL selector;
+
+/** The number of calls that have completed. */
+@property (assign, nonatomic, readonly) uint64_t callCount;
+
+/** The total time spent in completed calls, in nanoseconds. */
+@property (assign, nonatomic, readonly) uint64_t totalNanoseconds;
+
+/** The average time per call in nanoseconds, or 0 if the method has not been called. */
+@property (assign, nonatomic, readonly) double averageNanoseconds;
+
+/**
+ * @brief Returns the number of calls that fell into the given histogram bucket.
+ *
+ * @param bucket A bucket index, from 0 to `FMSLatencyBucketCount - 1`.
+ */
+- (uint64_t)callCountForLatencyBucket:(NSUInteger)bucket;
+
+/**
+ * @brief Returns the smallest latency (in nanoseconds) that falls into the given bucket.
+ */
++ (uint64_t)lowerBoundForLatencyBucket:(NSUInteger)bucket;
+
+/**
+ * @brief Returns an estimate of the latency below which the given fraction of calls completed.
+ *
+ * @param percentile A value between 0 and 1 (e.g. 0.99 for the 99th percentile).
+ *
+ * The estimate is the upper bound of the bucket that contains the percentile, so it may be up to twice the true value.
+ */
+- (uint64_t)approximateNanosecondsAtPercentile:(double)percentile;
+
+@end
@@ -0,0 +1,74 @@
+//
+//  FMSSampler.h
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * @file FMSSampler.h
+ * Controls for sampled hooks and sampled instrumentation. See `FMS_hookInstanceMethod:samplingRate:before:after:`.
+ */
+
+#import <Foundation/Foundation.h>
+
+@class FMSSwizzleToken;
+
+/**
+ * @brief Decides which calls to a sampled method run its hook, and lets you change that while the hook is installed.
+ *
+ * A sampled method keeps a countdown for each thread. Calls that don't reach the end of the countdown go straight
+ * to the original implementation: the only extra work is one trampoline, a thread-local decrement and a compare.
+ * The call that reaches zero runs the full hook (or is timed, for sampled instrumentation) and restarts the countdown.
+ *
+ * With a rate of `N`, every `N`th call on each thread is sampled. In randomized mode each countdown is drawn at
+ * random between 1 and `2N - 1`, so one call in `N` is sampled on average, but calls that happen at a fixed
+ * period can't line up with the samples. A rate of 1 samples every call, and a rate of 0 samples none.
+ *
+ * Changing the rate takes effect on each thread's next call to the method. Nothing is reinstalled, so it is safe
+ * to change it from any thread while the method is being called.
+ *
+ * Note: Each thread counts on its own, so with `T` threads calling the method the first sample may take up to
+ * `N` calls per thread.
+ */
+@interface FMSSampler : NSObject
+
+/** The number of calls per sample on each thread. 0 turns sampling off without removing the hook. Rates above `UINT32_MAX` are clamped. */
+@property (assign, atomic) NSUInteger samplingRate;
+
+/** `YES` if the countdown is drawn at random, averaging `samplingRate` calls per sample. */
+@property (assign, atomic, getter = isRandomized) BOOL randomized;
+
+/** The token that removes the sampled hook. */
+@property (strong, nonatomic, readonly) FMSSwizzleToken *token;
+
+/**
+ * @brief Changes the rate and mode together, so no thread sees one without the other.
+ */
+- (void)setSamplingRate:(NSUInteger)samplingRate randomized:(BOOL)randomized;
+
+@end
@@ -0,0 +1,297 @@
+//
+//  FMSSampler.m
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#import "FMSSwizzlerInternal.h"
+#import <pthread.h>
+#import <stdatomic.h>
+#import <time.h>
+
+#if !__has_feature(objc_arc)
+#error FMSSwizzler must be built with ARC.
+// You can turn on ARC for only FMSSwizzler files by adding -fobjc-arc to the build phase for each of its files.
+#endif
+
+#pragma mark - Sampler Configuration
+
+/*
+ * The rate and mode share one word, so the fast path reads both with a single relaxed load and a thread can tell
+ * that either has changed by comparing it with the word its countdown was started from. The top bits hold the
+ * sampler's generation, which never changes, so a countdown left behind by an earlier owner of the same slot
+ * never matches.
+ */
+#define FMSSamplingRateMask 0xFFFFFFFFULL
+#define FMSSamplingRandomizedFlag (1ULL << 32)
+#define FMSSamplingGenerationShift 33
+#define FMSSamplingGenerationMask (~0ULL << FMSSamplingGenerationShift)
+
+static inline uint64_t FMSSamplingConfiguration(uint64_t current, NSUInteger rate, BOOL randomized) {
+    return ((current & FMSSamplingGenerationMask) |
+            MIN((uint64_t)rate, FMSSamplingRateMask) |
+            (randomized ? FMSSamplingRandomizedFlag : 0));
+}
+
+#pragma mark - Per-Thread Countdowns
+
+/*
+ * Every sampler gets a slot number, and each thread keeps a table of countdowns indexed by slot, the same way
+ * instrumentation keeps its counters. A countdown is only ever touched by its own thread, so it is plain memory.
+ *
+ * A sampler's slot is given back when it is deallocated (which is only once its trampoline has been reclaimed),
+ * and new samplers take the lowest free slot, so the tables only grow as large as the most samplers alive at
+ * once. Every sampler also gets a new generation, so a countdown its slot's last owner left behind is restarted.
+ *
+ * `remaining` counts the calls up to and including the next sampled one. It is 0 when sampling is off.
+ */
+typedef struct {
+    uint64_t remaining;
+    uint64_t configuration;
+} FMSSampleCountdown;
+
+static pthread_mutex_t FMSSamplerSlotLock = PTHREAD_MUTEX_INITIALIZER;
+static size_t FMSNextSamplerSlot = 0;
+static uint64_t FMSNextSamplerGeneration = 1;
+static NSMutableIndexSet *FMSFreeSamplerSlots = nil;
+
+static _Thread_local FMSSampleCountdown *FMSThreadCountdownTable = NULL;
+static _Thread_local size_t FMSThreadCountdownCapacity = 0;
+static _Thread_local uint64_t FMSThreadSampleRandomState = 0;
+
+static pthread_key_t FMSThreadCountdownTableKey;
+static pthread_once_t FMSThreadCountdownTableKeyOnce = PTHREAD_ONCE_INIT;
+
+static void FMSCreateThreadCountdownTableKey(void) {
+    pthread_key_create(&FMSThreadCountdownTableKey, free);
+}
+
+static size_t FMSTakeSamplerSlot(uint64_t *generation) {
+    
+    pthread_mutex_lock(&FMSSamplerSlotLock);
+    
+    *generation = FMSNextSamplerGeneration << FMSSamplingGenerationShift;
+    
+    // Generation 0 would match a zeroed countdown, so it is skipped when the counter wraps.
+    if (++FMSNextSamplerGeneration >> (64 - FMSSamplingGenerationShift) != 0) {
+        FMSNextSamplerGeneration = 1;
+    }
+    
+    size_t slot;
+    
+    if ([FMSFreeSamplerSlots count] > 0) {
+        slot = [FMSFreeSamplerSlots firstIndex];
+        [FMSFreeSamplerSlots removeIndex:slot];
+    } else {
+        slot = FMSNextSamplerSlot++;
+    }
+    
+    pthread_mutex_unlock(&FMSSamplerSlotLock);
+    
+    return slot;
+}
+
+static void FMSReturnSamplerSlot(size_t slot) {
+    
+    pthread_mutex_lock(&FMSSamplerSlotLock);
+    
+    if (FMSFreeSamplerSlots == nil) {
+        FMSFreeSamplerSlots = [[NSMutableIndexSet alloc] init];
+    }
+    
+    [FMSFreeSamplerSlots addIndex:slot];
+    
+    pthread_mutex_unlock(&FMSSamplerSlotLock);
+}
+
+static FMSSampleCountdown *FMSGrowThreadCountdownTable(size_t slot) {
+    
+    pthread_once(&FMSThreadCountdownTableKeyOnce, FMSCreateThreadCountdownTableKey);
+    
+    size_t capacity = MAX(FMSThreadCountdownCapacity * 2, (size_t)16);
+    while (capacity <= slot) capacity *= 2;
+    
+    FMSSampleCountdown *table = realloc(FMSThreadCountdownTable, capacity * sizeof(*table));
+    if (table == NULL) {
+        [NSException raise:NSMallocException format:@"Could not grow the sampling countdown table"];
+    }
+    
+    // A zeroed countdown never matches a sampler that is switched on, so it is restarted on first use.
+    memset(table + FMSThreadCountdownCapacity, 0, (capacity - FMSThreadCountdownCapacity) * sizeof(*table));
+    
+    FMSThreadCountdownTable = table;
+    FMSThreadCountdownCapacity = capacity;
+    pthread_setspecific(FMSThreadCountdownTableKey, table);
+    
+    return &table[slot];
+}
+
+// xorshift64*, seeded per thread. Only used to pick randomized countdowns, so it just needs to be cheap and uncorrelated.
+static uint64_t FMSNextSampleRandom(void) {
+    
+    uint64_t state = FMSThreadSampleRandomState;
+    
+    if (state == 0) {
+        
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        
+        state = ((uint64_t)(uintptr_t)&FMSThreadSampleRandomState ^ (uint64_t)now.tv_nsec) * 0x9E3779B97F4A7C15ULL;
+        if (state == 0) state = 1;
+    }
+    
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    FMSThreadSampleRandomState = state;
+    
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t FMSSampleInterval(uint64_t configuration) {
+    
+    uint64_t rate = configuration & FMSSamplingRateMask;
+    
+    if (rate <= 1 || (configuration & FMSSamplingRandomizedFlag) == 0) return rate;
+    
+    // Uniform between 1 and 2N - 1, which averages N.
+    return 1 + FMSNextSampleRandom() % (2 * rate - 1);
+}
+
+#pragma mark - Resolving Calls
+
+static IMP __attribute__((noinline)) FMSResolveSampledCall(__unsafe_unretained FMSSampler *sampler,
+                                                           FMSSampleCountdown *countdown,
+                                                           uint64_t configuration) {
+    
+    IMP previousImplementation = sampler->_installedToken->_previousImplementation;
+    
+    // First call on this thread, or the rate has changed since the countdown started.
+    if (countdown->configuration != configuration) {
+        countdown->configuration = configuration;
+        countdown->remaining = FMSSampleInterval(configuration);
+    }
+    
+    if (countdown->remaining == 0) return previousImplementation;
+    
+    if (countdown->remaining > 1) {
+        countdown->remaining--;
+        return previousImplementation;
+    }
+    
+    countdown->remaining = FMSSampleInterval(configuration);
+    return sampler->_sampledImplementation;
+}
+
+IMP FMSSamplerResolve(void *context, void *receiver, SEL selector) {
+    
+    __unsafe_unretained FMSSampler *sampler = (__bridge FMSSampler *)context;
+    
+    uint64_t configuration = atomic_load_explicit(&sampler->_configuration, memory_order_relaxed);
+    size_t slot = sampler->_slot;
+    
+    FMSSampleCountdown *countdown =
+    (slot < FMSThreadCountdownCapacity) ? &FMSThreadCountdownTable[slot] : FMSGrowThreadCountdownTable(slot);
+    
+    // Most calls stop here and go straight to the original implementation.
+    if (__builtin_expect(countdown->configuration == configuration && countdown->remaining > 1, 1)) {
+        countdown->remaining--;
+        return sampler->_installedToken->_previousImplementation;
+    }
+    
+    return FMSResolveSampledCall(sampler, countdown, configuration);
+}
+
+#pragma mark - FMSSampler
+
+@implementation FMSSampler
+
+- (id)init {
+    
+    self = [super init];
+    
+    if (self) {
+        uint64_t generation;
+        _slot = FMSTakeSamplerSlot(&generation);
+        atomic_init(&_configuration, FMSSamplingConfiguration(generation, 1, NO));
+    }
+    
+    return self;
+}
+
+- (void)dealloc {
+    FMSReturnSamplerSlot(_slot);
+}
+
+- (NSUInteger)samplingRate {
+    return (NSUInteger)(atomic_load(&_configuration) & FMSSamplingRateMask);
+}
+
+- (void)setSamplingRate:(NSUInteger)samplingRate {
+    
+    uint64_t configuration = atomic_load(&_configuration);
+    uint64_t updated;
+    
+    do {
+        updated = FMSSamplingConfiguration(configuration, samplingRate, (configuration & FMSSamplingRandomizedFlag) != 0);
+    } while (!atomic_compare_exchange_weak(&_configuration, &configuration, updated));
+}
+
+- (BOOL)isRandomized {
+    return (atomic_load(&_configuration) & FMSSamplingRandomizedFlag) != 0;
+}
+
+- (void)setRandomized:(BOOL)randomized {
+    
+    uint64_t configuration = atomic_load(&_configuration);
+    uint64_t updated;
+    
+    do {
+        updated = FMSSamplingConfiguration(configuration, (NSUInteger)(configuration & FMSSamplingRateMask), randomized);
+    } while (!atomic_compare_exchange_weak(&_configuration, &configuration, updated));
+}
+
+- (void)setSamplingRate:(NSUInteger)samplingRate randomized:(BOOL)randomized {
+    
+    // The generation never changes, so only the rate and mode need replacing.
+    uint64_t configuration = atomic_load(&_configuration);
+    atomic_store(&_configuration, FMSSamplingConfiguration(configuration, samplingRate, randomized));
+}
+
+- (FMSSwizzleToken *)token {
+    return _token;
+}
+
+- (NSString *)description {
+    
+    return [NSString stringWithFormat:@"<%@: %p rate:%lu%@ token:%@>",
+            NSStringFromClass([self class]), (__bridge void *)self,
+            (unsigned long)self.samplingRate, self.randomized ? @" randomized" : @"", _token];
+}
+
+@end
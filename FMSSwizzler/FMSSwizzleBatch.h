@@ -0,0 +1,102 @@
+//
+//  FMSSwizzleBatch.h
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+
+/**
+ * @file FMSSwizzleBatch.h
+ * Collects many aliases, replacements and overrides, and applies them together. See
+ * `FMS_performSwizzleBatch:`.
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+ * @brief A list of swizzles to apply together.
+ *
+ * You never create a batch yourself. `FMS_performSwizzleBatch:` hands you an empty one, you describe the
+ * swizzles you want, and they are applied once your block returns. Each method works like the `FMS_` method
+ * with the same name: `aliasInstanceMethod:ofClass:newSelector:` is
+ * `[cls FMS_aliasInstanceMethod:newSelector:]`, and so on.
+ *
+ * Later swizzles may build on earlier ones. For example, you can alias a method and then override the alias.
+ * Swizzles are checked and applied in the order you add them, even across a class and its superclasses, so
+ * aliasing an inherited method and then replacing it on the superclass leaves the alias calling the original.
+ */
+@interface FMSSwizzleBatch : NSObject
+
+/** @brief Adds `[cls FMS_aliasInstanceMethod:originalSelector newSelector:newSelector]` to the batch. */
+- (void)aliasInstanceMethod:(SEL)originalSelector ofClass:(Class)cls newSelector:(SEL)newSelector;
+
+/** @brief Adds `[cls FMS_replaceInstanceMethod:selector withImplementationBlock:block]` to the batch. */
+- (void)replaceInstanceMethod:(SEL)selector ofClass:(Class)cls withImplementationBlock:(id)block;
+
+/** @brief Adds `[cls FMS_overrideInstanceMethod:selector oldSelector:oldSelector implementationBlock:block]` to the batch. */
+- (void)overrideInstanceMethod:(SEL)selector ofClass:(Class)cls oldSelector:(SEL)oldSelector implementationBlock:(id)block;
+
+/** @brief Adds `[cls FMS_aliasClassMethod:originalSelector newSelector:newSelector]` to the batch. */
+- (void)aliasClassMethod:(SEL)originalSelector ofClass:(Class)cls newSelector:(SEL)newSelector;
+
+/** @brief Adds `[cls FMS_replaceClassMethod:selector withImplementationBlock:block]` to the batch. */
+- (void)replaceClassMethod:(SEL)selector ofClass:(Class)cls withImplementationBlock:(id)block;
+
+/** @brief Adds `[cls FMS_overrideClassMethod:selector oldSelector:oldSelector implementationBlock:block]` to the batch. */
+- (void)overrideClassMethod:(SEL)selector ofClass:(Class)cls oldSelector:(SEL)oldSelector implementationBlock:(id)block;
+
+/** @brief The number of swizzles in the batch so far. */
+@property (assign, nonatomic, readonly) NSUInteger count;
+
+@end
+
+/**
+ * @brief What an applied batch did, so it can be compared with applying the same swizzles one at a time.
+ */
+@interface FMSSwizzleBatchResult : NSObject
+
+/**
+ * @brief One `FMSSwizzleToken` for each swizzle, in the order they were added to the batch.
+ *
+ * Restoring these works just as it does for tokens returned by the individual `FMS_` methods.
+ */
+@property (strong, nonatomic, readonly) NSArray *tokens;
+
+/** @brief The number of distinct classes (or, for class methods, metaclasses) that were changed. */
+@property (assign, nonatomic, readonly) NSUInteger classCount;
+
+/**
+ * @brief The number of methods written to the runtime.
+ *
+ * Each method is written once, however many swizzles in the batch touch it. Applying the swizzles one at a
+ * time writes one method per alias or replacement, and two per override.
+ */
+@property (assign, nonatomic, readonly) NSUInteger methodsTouched;
+
+/** @brief The time taken to check and apply the batch, in nanoseconds. This doesn't include building it. */
+@property (assign, nonatomic, readonly) uint64_t wallNanoseconds;
+
+@end
@@ -0,0 +1,463 @@
+//
+//  FMSSwizzleBatch.m
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#import "FMSSwizzlerInternal.h"
+#import <time.h>
+
+#if !__has_feature(objc_arc)
+#error FMSSwizzler must be built with ARC.
+// You can turn on ARC for only FMSSwizzler files by adding -fobjc-arc to the build phase for each of its files.
+#endif
+
+#pragma mark - Batch Operations
+
+/*
+ * A single swizzle waiting in a batch. Class methods are recorded against the metaclass, so from here on
+ * instance and class methods are handled identically.
+ */
+@interface FMSSwizzleBatchOperation : NSObject {
+@public
+    FMSSwizzleTokenKind _kind;
+    Class _targetClass;
+    SEL _selector;
+    SEL _aliasSelector;
+    id _block;
+}
+@end
+
+@implementation FMSSwizzleBatchOperation
+@end
+
+@interface FMSSwizzleBatch () {
+@public
+    NSMutableArray *_operations;
+    BOOL _sealed;
+}
+@end
+
+@interface FMSSwizzleBatchResult ()
+
+@property (strong, nonatomic, readwrite) NSArray *tokens;
+@property (assign, nonatomic, readwrite) NSUInteger classCount;
+@property (assign, nonatomic, readwrite) NSUInteger methodsTouched;
+@property (assign, nonatomic, readwrite) uint64_t wallNanoseconds;
+
+@end
+
+@implementation FMSSwizzleBatch
+
+- (id)init {
+    
+    self = [super init];
+    
+    if (self) {
+        _operations = [[NSMutableArray alloc] init];
+    }
+    
+    return self;
+}
+
+- (NSUInteger)count {
+    return [_operations count];
+}
+
+- (void)addOperation:(FMSSwizzleTokenKind)kind
+         targetClass:(Class)cls
+            selector:(SEL)selector
+       aliasSelector:(SEL)aliasSelector
+               block:(id)block {
+    
+    if (_sealed) {
+        [NSException raise:NSInternalInconsistencyException
+                    format:@"Swizzles can't be added to a batch once it has been applied"];
+    }
+    
+    if (cls == Nil || selector == NULL || (kind != FMSSwizzleTokenReplace && aliasSelector == NULL)) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"Swizzle batch operation %lu needs a class and selectors", (unsigned long)[_operations count]];
+    }
+    
+    if (kind != FMSSwizzleTokenAlias && block == nil) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"Swizzle batch operation %lu needs an implementation block", (unsigned long)[_operations count]];
+    }
+    
+    FMSSwizzleBatchOperation *operation = [[FMSSwizzleBatchOperation alloc] init];
+    operation->_kind = kind;
+    operation->_targetClass = cls;
+    operation->_selector = selector;
+    operation->_aliasSelector = aliasSelector;
+    operation->_block = [block copy];
+    
+    [_operations addObject:operation];
+}
+
+- (void)aliasInstanceMethod:(SEL)originalSelector ofClass:(Class)cls newSelector:(SEL)newSelector {
+    
+    [self addOperation:FMSSwizzleTokenAlias targetClass:cls selector:originalSelector aliasSelector:newSelector block:nil];
+}
+
+- (void)replaceInstanceMethod:(SEL)selector ofClass:(Class)cls withImplementationBlock:(id)block {
+    
+    [self addOperation:FMSSwizzleTokenReplace targetClass:cls selector:selector aliasSelector:NULL block:block];
+}
+
+- (void)overrideInstanceMethod:(SEL)selector ofClass:(Class)cls oldSelector:(SEL)oldSelector implementationBlock:(id)block {
+    
+    [self addOperation:FMSSwizzleTokenOverride targetClass:cls selector:selector aliasSelector:oldSelector block:block];
+}
+
+- (void)aliasClassMethod:(SEL)originalSelector ofClass:(Class)cls newSelector:(SEL)newSelector {
+    
+    [self aliasInstanceMethod:originalSelector ofClass:object_getClass(cls) newSelector:newSelector];
+}
+
+- (void)replaceClassMethod:(SEL)selector ofClass:(Class)cls withImplementationBlock:(id)block {
+    
+    [self replaceInstanceMethod:selector ofClass:object_getClass(cls) withImplementationBlock:block];
+}
+
+- (void)overrideClassMethod:(SEL)selector ofClass:(Class)cls oldSelector:(SEL)oldSelector implementationBlock:(id)block {
+    
+    [self overrideInstanceMethod:selector ofClass:object_getClass(cls) oldSelector:oldSelector implementationBlock:block];
+}
+
+@end
+
+@implementation FMSSwizzleBatchResult
+@end
+
+#pragma mark - Validation
+
+static inline id FMSClassKey(Class cls) {
+    return [NSValue valueWithPointer:(__bridge const void *)cls];
+}
+
+/*
+ * Looks a selector up as the batch will see it when its operation is applied: either it already exists, or an
+ * earlier operation adds it to the class or one of its superclasses. Returns the number of arguments it takes,
+ * or NSNotFound if it doesn't exist.
+ */
+static NSUInteger FMSBatchArgumentCount(NSDictionary *added, Class cls, SEL selector) {
+    
+    Method method = class_getInstanceMethod(cls, selector);
+    
+    if (method != NULL) {
+        return method_getNumberOfArguments(method) - 2;
+    }
+    
+    NSString *name = NSStringFromSelector(selector);
+    
+    for (Class current = cls; current != Nil; current = class_getSuperclass(current)) {
+        
+        NSNumber *count = added[FMSClassKey(current)][name];
+        if (count != nil) return [count unsignedIntegerValue];
+    }
+    
+    return NSNotFound;
+}
+
+/*
+ * Checks every operation against the runtime as it will look when that operation runs, without changing
+ * anything. Must be called while holding the locks for every class in the batch.
+ */
+static void FMSValidateBatch(NSArray *operations) {
+    
+    // Class key -> selector name -> argument count, for every alias an earlier operation adds.
+    NSMutableDictionary *added = [NSMutableDictionary dictionary];
+    
+    [operations enumerateObjectsUsingBlock:^(FMSSwizzleBatchOperation *operation, NSUInteger index, BOOL *stop) {
+        
+        Class cls = operation->_targetClass;
+        NSUInteger argumentCount = FMSBatchArgumentCount(added, cls, operation->_selector);
+        
+        if (argumentCount == NSNotFound) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"Swizzle batch operation %lu: the original method %@ does not exist on %@",
+             (unsigned long)index, NSStringFromSelector(operation->_selector), NSStringFromClass(cls)];
+        }
+        
+        if (operation->_kind == FMSSwizzleTokenReplace) return;
+        
+        SEL aliasSelector = operation->_aliasSelector;
+        NSUInteger aliasArgumentCount = FMSSelectorArgumentCount(aliasSelector);
+        
+        if (argumentCount != aliasArgumentCount) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"Swizzle batch operation %lu: the selectors must have the same number of arguments, had %d and %d",
+             (unsigned long)index, (int)argumentCount, (int)aliasArgumentCount];
+        }
+        
+        BOOL inUse = FMSBatchArgumentCount(added, cls, aliasSelector) != NSNotFound;
+        
+        // A retired alias may be reused, unless an earlier operation in this batch has already reused it.
+        if (inUse && FMSIsRetiredAlias(cls, aliasSelector) && added[FMSClassKey(cls)][NSStringFromSelector(aliasSelector)] == nil) {
+            inUse = NO;
+        }
+        
+        if (inUse) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"Swizzle batch operation %lu: the selector %@ is already being used.",
+             (unsigned long)index, NSStringFromSelector(aliasSelector)];
+        }
+        
+        NSMutableDictionary *classAliases = added[FMSClassKey(cls)];
+        
+        if (classAliases == nil) {
+            classAliases = [NSMutableDictionary dictionary];
+            added[FMSClassKey(cls)] = classAliases;
+        }
+        
+        classAliases[NSStringFromSelector(aliasSelector)] = @(argumentCount);
+    }];
+}
+
+#pragma mark - Applying Batches
+
+/*
+ * The methods a class has changed but not yet written to the runtime. Operations are applied in the order they were
+ * added, exactly as if they had been made one at a time, but only to these pending tables. Each selector is then
+ * written once, with its final implementation. Selectors are written in the order they were last changed, so an
+ * override's alias is always in place before the implementation that calls it.
+ */
+@interface FMSPendingMethods : NSObject {
+@public
+    Class _targetClass;
+    NSMutableArray *_order;
+    NSMutableDictionary *_implementations;
+    NSMutableDictionary *_typeEncodings;
+}
+@end
+
+@implementation FMSPendingMethods
+@end
+
+/*
+ * The implementation `selector` has on the class at this point in the batch: the class's own pending change if it
+ * has one, otherwise whatever it inherits, including changes earlier operations made to its superclasses.
+ */
+static IMP FMSPendingImplementation(FMSPendingMethods *pending,
+                                    NSDictionary *allPending,
+                                    SEL selector,
+                                    const char **typeEncoding) {
+    
+    NSString *name = NSStringFromSelector(selector);
+    
+    for (Class current = pending->_targetClass; current != Nil; current = class_getSuperclass(current)) {
+        
+        // Only classes in the batch have pending tables. The rest are read from the runtime as they are.
+        FMSPendingMethods *currentPending = allPending[FMSClassKey(current)];
+        
+        if (currentPending != nil) {
+            
+            NSValue *implementation = currentPending->_implementations[name];
+            
+            if (implementation != nil) {
+                *typeEncoding = [currentPending->_typeEncodings[name] pointerValue];
+                return (IMP)[implementation pointerValue];
+            }
+        }
+        
+        if (!FMSClassInheritsMethod(current, selector) && class_getInstanceMethod(current, selector) != NULL) {
+            
+            Method method = class_getInstanceMethod(current, selector);
+            *typeEncoding = method_getTypeEncoding(method);
+            
+            return method_getImplementation(method);
+        }
+    }
+    
+    // Validation guarantees the method exists by the time its operation runs.
+    *typeEncoding = NULL;
+    return NULL;
+}
+
+static void FMSSetPendingImplementation(FMSPendingMethods *pending, SEL selector, IMP implementation, const char *typeEncoding) {
+    
+    NSString *name = NSStringFromSelector(selector);
+    
+    [pending->_order removeObject:name];
+    [pending->_order addObject:name];
+    
+    pending->_implementations[name] = [NSValue valueWithPointer:(const void *)implementation];
+    pending->_typeEncodings[name] = [NSValue valueWithPointer:typeEncoding];
+}
+
+static FMSSwizzleToken *FMSApplyBatchOperation(FMSSwizzleBatchOperation *operation, NSDictionary *allPending) {
+    
+    Class cls = operation->_targetClass;
+    FMSPendingMethods *pending = allPending[FMSClassKey(cls)];
+    const char *typeEncoding = NULL;
+    
+    // Only the batch's first change to an inherited method adds it to the class.
+    BOOL addedMethod = (pending->_implementations[NSStringFromSelector(operation->_selector)] == nil &&
+                        FMSClassInheritsMethod(cls, operation->_selector));
+    IMP currentImp = FMSPendingImplementation(pending, allPending, operation->_selector, &typeEncoding);
+    
+    if (operation->_kind != FMSSwizzleTokenReplace) {
+        
+        if (FMSIsRetiredAlias(cls, operation->_aliasSelector)) {
+            FMSReviveAlias(cls, operation->_aliasSelector);
+        }
+        
+        FMSSetPendingImplementation(pending, operation->_aliasSelector, currentImp, typeEncoding);
+        
+        if (operation->_kind == FMSSwizzleTokenAlias) {
+            return FMSRecordAlias(cls, operation->_aliasSelector, currentImp);
+        }
+    }
+    
+    BOOL counted = NO;
+    IMP newImp = FMSImplementationWithBlock(class_getInstanceMethod(cls, operation->_selector), operation->_block, &counted);
+    FMSSetPendingImplementation(pending, operation->_selector, newImp, typeEncoding);
+    
+    SEL aliasSelector = (operation->_kind == FMSSwizzleTokenOverride) ? operation->_aliasSelector : NULL;
+    FMSSwizzleToken *token = FMSRecordReplacement(cls, operation->_selector, aliasSelector, currentImp, newImp, addedMethod);
+    token->_uncountedImplementation = !counted;
+    
+    return token;
+}
+
+static NSUInteger FMSWritePendingMethods(FMSPendingMethods *pending) {
+    
+    for (NSString *name in pending->_order) {
+        
+        class_replaceMethod(pending->_targetClass,
+                            NSSelectorFromString(name),
+                            (IMP)[pending->_implementations[name] pointerValue],
+                            [pending->_typeEncodings[name] pointerValue]);
+    }
+    
+    // The batch's records were made before its methods were written, so they went out too early to count.
+    FMSInvalidateIMPSnapshots();
+    
+    return [pending->_order count];
+}
+
+static NSUInteger FMSClassDepth(Class cls) {
+    
+    NSUInteger depth = 0;
+    
+    for (Class current = class_getSuperclass(cls); current != Nil; current = class_getSuperclass(current)) {
+        depth++;
+    }
+    
+    return depth;
+}
+
+static inline uint64_t FMSBatchNow(void) {
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+FMSSwizzleBatchResult *FMSPerformSwizzleBatch(FMSSwizzleBatchBlock batchBlock) {
+    
+    if (batchBlock == nil) {
+        [NSException raise:NSInvalidArgumentException format:@"A swizzle batch needs a block"];
+    }
+    
+    FMSSwizzleBatch *batch = [[FMSSwizzleBatch alloc] init];
+    batchBlock(batch);
+    batch->_sealed = YES;
+    
+    NSArray *operations = [batch->_operations copy];
+    uint64_t start = FMSBatchNow();
+    
+    // Every class the batch changes, each once.
+    NSMutableArray *classes = [NSMutableArray array];
+    NSMutableSet *seenClasses = [NSMutableSet set];
+    
+    for (FMSSwizzleBatchOperation *operation in operations) {
+        
+        id key = FMSClassKey(operation->_targetClass);
+        
+        if (![seenClasses containsObject:key]) {
+            [seenClasses addObject:key];
+            [classes addObject:operation->_targetClass];
+        }
+    }
+    
+    // Superclasses are written first, so a subclass never calls through to a half-written superclass.
+    [classes sortWithOptions:NSSortStable usingComparator:^NSComparisonResult(Class first, Class second) {
+        
+        NSUInteger firstDepth = FMSClassDepth(first);
+        NSUInteger secondDepth = FMSClassDepth(second);
+        
+        if (firstDepth == secondDepth) return NSOrderedSame;
+        return (firstDepth < secondDepth) ? NSOrderedAscending : NSOrderedDescending;
+    }];
+    
+    NSMutableArray *tokens = [NSMutableArray arrayWithCapacity:[operations count]];
+    for (NSUInteger index = 0; index < [operations count]; index++) {
+        [tokens addObject:[NSNull null]];
+    }
+    
+    __block NSUInteger methodsTouched = 0;
+    
+    FMSPerformLockedClasses(classes, ^{
+        
+        FMSValidateBatch(operations);
+        
+        NSMutableDictionary *allPending = [NSMutableDictionary dictionary];
+        
+        for (Class cls in classes) {
+            
+            FMSPendingMethods *pending = [[FMSPendingMethods alloc] init];
+            pending->_targetClass = cls;
+            pending->_order = [NSMutableArray array];
+            pending->_implementations = [NSMutableDictionary dictionary];
+            pending->_typeEncodings = [NSMutableDictionary dictionary];
+            
+            allPending[FMSClassKey(cls)] = pending;
+        }
+        
+        // Apply in the order validated, so each operation sees exactly what it would have seen on its own.
+        [operations enumerateObjectsUsingBlock:^(FMSSwizzleBatchOperation *operation, NSUInteger index, BOOL *stop) {
+            tokens[index] = FMSApplyBatchOperation(operation, allPending);
+        }];
+        
+        for (Class cls in classes) {
+            methodsTouched += FMSWritePendingMethods(allPending[FMSClassKey(cls)]);
+        }
+    });
+    
+    FMSSwizzleBatchResult *result = [[FMSSwizzleBatchResult alloc] init];
+    result.tokens = tokens;
+    result.classCount = [classes count];
+    result.methodsTouched = methodsTouched;
+    result.wallNanoseconds = FMSBatchNow() - start;
+    
+    return result;
+}
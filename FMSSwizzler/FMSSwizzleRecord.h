@@ -0,0 +1,108 @@
+//
+//  FMSSwizzleRecord.h
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+
+/**
+
+/**
+ * @file FMSSwizzleRecord.h
+ * A process-wide record of every swizzle, pseudo property and generated class FMSSwizzler has installed.
+ * See `FMS_activeSwizzleRecords`.
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Identifies what an `FMSSwizzleRecord` describes.
+ */
+enum swizzleRecordKind {
+    
+    FMSSwizzleRecordAlias,          /**< A method alias. The selector is the new (alias) selector. */
+    FMSSwizzleRecordReplace,        /**< A replaced method. */
+    FMSSwizzleRecordOverride,       /**< An overridden method. The previous implementation is reachable through an alias. */
+    FMSSwizzleRecordTrampoline,     /**< A method wrapped in a trampoline by a hook, by instrumentation or by single-object dispatch. */
+    FMSSwizzleRecordInstance,       /**< A single-object override. The class is the shared dispatching subclass. */
+    FMSSwizzleRecordPseudoProperty, /**< A pseudo property. The selector is the getter and the type encoding is the property's type. */
+    FMSSwizzleRecordGeneratedClass  /**< A class generated by FMSSwizzler. There is no selector. */
+};
+
+/**
+ * Used to identify what an `FMSSwizzleRecord` describes.
+ */
+typedef enum swizzleRecordKind FMSSwizzleRecordKind;
+
+/**
+ * @brief Describes one change FMSSwizzler made to the runtime.
+ *
+ * Records are snapshots. They don't change after they are created, and they don't keep anything they
+ * describe alive.
+ */
+@interface FMSSwizzleRecord : NSObject
+
+/** What this record describes. */
+@property (assign, nonatomic, readonly) FMSSwizzleRecordKind kind;
+
+/** The name of the class that was changed (or generated). For class methods this is the metaclass, which has the same name. */
+@property (copy, nonatomic, readonly) NSString *className;
+
+/** For generated classes and single-object overrides, the name of the class they were created from. Otherwise `nil`. */
+@property (copy, nonatomic, readonly) NSString *baseClassName;
+
+/** `YES` if the change was made to the metaclass (i.e. to a class method). */
+@property (assign, nonatomic, readonly, getter = isClassMethod) BOOL classMethod;
+
+/** The selector that was changed or added, or `NULL` for generated classes. */
+@property (assign, nonatomic, readonly) SEL selector;
+
+/** The method's type encoding, or `nil` for generated classes. */
+@property (copy, nonatomic, readonly) NSString *typeEncoding;
+
+/** When the change was made, in nanoseconds since 1970 (UTC). */
+@property (assign, nonatomic, readonly) uint64_t installNanoseconds;
+
+/** The implementation that was replaced, or `NULL` if nothing was (aliases, pseudo properties and generated classes). */
+@property (assign, nonatomic, readonly) IMP originalImplementation;
+
+/** The implementation that was installed, or `NULL` for generated classes. */
+@property (assign, nonatomic, readonly) IMP installedImplementation;
+
+/** A name for `kind`, as used in the JSON export (e.g. `"replace"`). */
+@property (copy, nonatomic, readonly) NSString *kindName;
+
+@end
+
+/**
+ * The first four bytes of a binary snapshot from `FMS_swizzleRecordSnapshot`.
+ */
+#define FMSSwizzleRecordSnapshotMagic "FMSR"
+
+/**
+ * The version of the binary snapshot format written by this build.
+ */
+#define FMSSwizzleRecordSnapshotVersion 1
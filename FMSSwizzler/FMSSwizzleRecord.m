@@ -0,0 +1,484 @@
+//
+//  FMSSwizzleRecord.m
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#import "FMSSwizzlerInternal.h"
+#import <pthread.h>
+#import <stdatomic.h>
+#import <time.h>
+
+#if !__has_feature(objc_arc)
+#error FMSSwizzler must be built with ARC.
+#endif
+
+#pragma mark - Record Storage
+
+/*
+ * Every install appends an entry to a list of fixed-size chunks. Chunks are never freed or moved, so a reader
+ * can walk them without a lock while installs carry on. Entries retired by restoring a token (or disposing of
+ * a class) go on a free list and are reused by later installs, so toggling a swizzle doesn't grow the list.
+ *
+ * Writers hold FMSSwizzleRecordLock. Readers never take it: each entry has a sequence number that is odd while
+ * the entry is being written, and a reader keeps a copy only if the number was even and unchanged across the
+ * copy (a seqlock). Nothing here is touched when a swizzled method is called.
+ */
+#define FMSSwizzleRecordChunkSize 256
+
+struct FMSSwizzleRecordEntry {
+    atomic_uint sequence;
+    FMSSwizzleRecordKind kind;
+    BOOL active;
+    BOOL classMethod;
+    const void *classPointer;
+    const char *className;
+    const char *baseClassName;
+    SEL selector;
+    const char *typeEncoding;
+    uint64_t installNanoseconds;
+    IMP originalImplementation;
+    IMP installedImplementation;
+    struct FMSSwizzleRecordEntry *nextFree;
+};
+
+typedef struct FMSSwizzleRecordChunk {
+    FMSSwizzleRecordEntry entries[FMSSwizzleRecordChunkSize];
+    struct FMSSwizzleRecordChunk *_Atomic next;
+} FMSSwizzleRecordChunk;
+
+static pthread_mutex_t FMSSwizzleRecordLock = PTHREAD_MUTEX_INITIALIZER;
+static FMSSwizzleRecordChunk FMSSwizzleRecordFirstChunk;
+static FMSSwizzleRecordChunk *FMSSwizzleRecordLastChunk = &FMSSwizzleRecordFirstChunk;
+static atomic_size_t FMSSwizzleRecordCount = 0;
+static FMSSwizzleRecordEntry *FMSSwizzleRecordFreeList = NULL;
+
+// Class names and type encodings are copied once, since classes can be disposed of while their records live on.
+static NSMutableDictionary *FMSSwizzleRecordStrings = nil;
+
+static const char *FMSInternRecordString(const char *string) {
+    
+    if (string == NULL) {
+        return NULL;
+    }
+    
+    if (FMSSwizzleRecordStrings == nil) {
+        FMSSwizzleRecordStrings = [[NSMutableDictionary alloc] init];
+    }
+    
+    NSData *key = [NSData dataWithBytesNoCopy:(void *)string length:strlen(string) freeWhenDone:NO];
+    NSValue *interned = FMSSwizzleRecordStrings[key];
+    
+    if (interned == nil) {
+        
+        char *copy = strdup(string);
+        interned = [NSValue valueWithPointer:copy];
+        FMSSwizzleRecordStrings[[NSData dataWithBytes:copy length:strlen(copy)]] = interned;
+    }
+    
+    return [interned pointerValue];
+}
+
+static uint64_t FMSRecordTimestamp(void) {
+    
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static FMSSwizzleRecordEntry *FMSTakeRecordEntry(BOOL *isNewEntry) {
+    
+    if (FMSSwizzleRecordFreeList != NULL) {
+        
+        FMSSwizzleRecordEntry *entry = FMSSwizzleRecordFreeList;
+        FMSSwizzleRecordFreeList = entry->nextFree;
+        
+        *isNewEntry = NO;
+        return entry;
+    }
+    
+    *isNewEntry = YES;
+    
+    size_t index = atomic_load_explicit(&FMSSwizzleRecordCount, memory_order_relaxed);
+    
+    if (index > 0 && index % FMSSwizzleRecordChunkSize == 0) {
+        
+        FMSSwizzleRecordChunk *chunk = calloc(1, sizeof(FMSSwizzleRecordChunk));
+        atomic_store_explicit(&FMSSwizzleRecordLastChunk->next, chunk, memory_order_release);
+        FMSSwizzleRecordLastChunk = chunk;
+    }
+    
+    return &FMSSwizzleRecordLastChunk->entries[index % FMSSwizzleRecordChunkSize];
+}
+
+FMSSwizzleRecordHandle FMSRecordSwizzle(FMSSwizzleRecordKind kind,
+                                        Class cls,
+                                        SEL selector,
+                                        const char *typeEncoding,
+                                        IMP originalImplementation,
+                                        IMP installedImplementation,
+                                        Class baseClass) {
+    
+    if (typeEncoding == NULL && selector != NULL) {
+        
+        Method method = class_getInstanceMethod(cls, selector);
+        typeEncoding = (method != NULL) ? method_getTypeEncoding(method) : NULL;
+    }
+    
+    uint64_t timestamp = FMSRecordTimestamp();
+    
+    pthread_mutex_lock(&FMSSwizzleRecordLock);
+    
+    BOOL isNewEntry;
+    FMSSwizzleRecordEntry *entry = FMSTakeRecordEntry(&isNewEntry);
+    
+    uint32_t sequence = atomic_load_explicit(&entry->sequence, memory_order_relaxed);
+    atomic_store_explicit(&entry->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    entry->kind = kind;
+    entry->active = YES;
+    entry->classMethod = class_isMetaClass(cls);
+    entry->classPointer = (__bridge const void *)cls;
+    entry->className = FMSInternRecordString(class_getName(cls));
+    entry->baseClassName = (baseClass != Nil) ? FMSInternRecordString(class_getName(baseClass)) : NULL;
+    entry->selector = selector;
+    entry->typeEncoding = FMSInternRecordString(typeEncoding);
+    entry->installNanoseconds = timestamp;
+    entry->originalImplementation = originalImplementation;
+    entry->installedImplementation = installedImplementation;
+    entry->nextFree = NULL;
+    
+    atomic_store_explicit(&entry->sequence, sequence + 2, memory_order_release);
+    
+    // Publish brand new entries only once they're filled in.
+    if (isNewEntry) {
+        atomic_fetch_add_explicit(&FMSSwizzleRecordCount, 1, memory_order_release);
+    }
+    
+    pthread_mutex_unlock(&FMSSwizzleRecordLock);
+    
+    // Records are made once the change is in place, which is when snapshots taken before it go stale.
+    FMSInvalidateIMPSnapshots();
+    
+    return (FMSSwizzleRecordHandle){entry, sequence + 2};
+}
+
+// Must be called while holding FMSSwizzleRecordLock.
+static void FMSRetireRecordEntry(FMSSwizzleRecordEntry *entry) {
+    
+    uint32_t sequence = atomic_load_explicit(&entry->sequence, memory_order_relaxed);
+    atomic_store_explicit(&entry->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    
+    entry->active = NO;
+    
+    atomic_store_explicit(&entry->sequence, sequence + 2, memory_order_release);
+    
+    entry->nextFree = FMSSwizzleRecordFreeList;
+    FMSSwizzleRecordFreeList = entry;
+}
+
+void FMSRetireSwizzleRecord(FMSSwizzleRecordHandle handle) {
+    
+    FMSInvalidateIMPSnapshots();
+    
+    if (handle.entry == NULL) {
+        return;
+    }
+    
+    pthread_mutex_lock(&FMSSwizzleRecordLock);
+    
+    // If the entry has changed since it was handed out, it was already retired (and maybe reused).
+    if (atomic_load_explicit(&handle.entry->sequence, memory_order_relaxed) == handle.sequence) {
+        FMSRetireRecordEntry(handle.entry);
+    }
+    
+    pthread_mutex_unlock(&FMSSwizzleRecordLock);
+}
+
+void FMSRetireSwizzleRecordsForClass(Class cls) {
+    
+    const void *classPointer = (__bridge const void *)cls;
+    const void *metaclassPointer = (__bridge const void *)object_getClass(cls);
+    
+    pthread_mutex_lock(&FMSSwizzleRecordLock);
+    
+    size_t count = atomic_load_explicit(&FMSSwizzleRecordCount, memory_order_relaxed);
+    FMSSwizzleRecordChunk *chunk = &FMSSwizzleRecordFirstChunk;
+    
+    for (size_t index = 0; index < count; index++) {
+        
+        if (index > 0 && index % FMSSwizzleRecordChunkSize == 0) {
+            chunk = atomic_load_explicit(&chunk->next, memory_order_relaxed);
+        }
+        
+        FMSSwizzleRecordEntry *entry = &chunk->entries[index % FMSSwizzleRecordChunkSize];
+        
+        if (entry->active && (entry->classPointer == classPointer || entry->classPointer == metaclassPointer)) {
+            FMSRetireRecordEntry(entry);
+        }
+    }
+    
+    pthread_mutex_unlock(&FMSSwizzleRecordLock);
+    
+    FMSInvalidateIMPSnapshots();
+}
+
+/*
+ * Copies every active entry into `buffer` (which the caller frees) without taking the writer lock. An entry
+ * that is being rewritten is retried; one that keeps changing is skipped, since it wasn't stable anyway.
+ */
+static size_t FMSCopyActiveRecordEntries(FMSSwizzleRecordEntry **buffer) {
+    
+    size_t count = atomic_load_explicit(&FMSSwizzleRecordCount, memory_order_acquire);
+    FMSSwizzleRecordEntry *copies = malloc(MAX(count, 1) * sizeof(FMSSwizzleRecordEntry));
+    size_t copied = 0;
+    
+    FMSSwizzleRecordChunk *chunk = &FMSSwizzleRecordFirstChunk;
+    
+    for (size_t index = 0; index < count; index++) {
+        
+        if (index > 0 && index % FMSSwizzleRecordChunkSize == 0) {
+            chunk = atomic_load_explicit(&chunk->next, memory_order_acquire);
+        }
+        
+        FMSSwizzleRecordEntry *entry = &chunk->entries[index % FMSSwizzleRecordChunkSize];
+        
+        for (NSUInteger attempt = 0; attempt < 64; attempt++) {
+            
+            uint32_t before = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+            
+            if (before % 2 != 0) {
+                continue;
+            }
+            
+            memcpy(&copies[copied], (const void *)entry, sizeof(FMSSwizzleRecordEntry));
+            atomic_thread_fence(memory_order_acquire);
+            
+            if (atomic_load_explicit(&entry->sequence, memory_order_relaxed) == before) {
+                
+                if (copies[copied].active) {
+                    copied++;
+                }
+                
+                break;
+            }
+        }
+    }
+    
+    *buffer = copies;
+    return copied;
+}
+
+#pragma mark - Records
+
+@interface FMSSwizzleRecord () {
+    FMSSwizzleRecordEntry _entry;
+}
+@end
+
+static NSString *FMSSwizzleRecordKindName(FMSSwizzleRecordKind kind) {
+    
+    switch (kind) {
+        case FMSSwizzleRecordAlias:          return @"alias";
+        case FMSSwizzleRecordReplace:        return @"replace";
+        case FMSSwizzleRecordOverride:       return @"override";
+        case FMSSwizzleRecordTrampoline:     return @"trampoline";
+        case FMSSwizzleRecordInstance:       return @"instance";
+        case FMSSwizzleRecordPseudoProperty: return @"pseudoProperty";
+        case FMSSwizzleRecordGeneratedClass: return @"generatedClass";
+    }
+    
+    return @"unknown";
+}
+
+static NSString *FMSRecordString(const char *string) {
+    return (string != NULL) ? [NSString stringWithUTF8String:string] : nil;
+}
+
+@implementation FMSSwizzleRecord
+
+- (FMSSwizzleRecordKind)kind {
+    return _entry.kind;
+}
+
+- (NSString *)className {
+    return FMSRecordString(_entry.className);
+}
+
+- (NSString *)baseClassName {
+    return FMSRecordString(_entry.baseClassName);
+}
+
+- (BOOL)isClassMethod {
+    return _entry.classMethod;
+}
+
+- (SEL)selector {
+    return _entry.selector;
+}
+
+- (NSString *)typeEncoding {
+    return FMSRecordString(_entry.typeEncoding);
+}
+
+- (uint64_t)installNanoseconds {
+    return _entry.installNanoseconds;
+}
+
+- (IMP)originalImplementation {
+    return _entry.originalImplementation;
+}
+
+- (IMP)installedImplementation {
+    return _entry.installedImplementation;
+}
+
+- (NSString *)kindName {
+    return FMSSwizzleRecordKindName(_entry.kind);
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: %@ %@%@ %@>",
+            [self class],
+            [self kindName],
+            _entry.classMethod ? @"+" : @"-",
+            [self className],
+            _entry.selector != NULL ? NSStringFromSelector(_entry.selector) : @""];
+}
+
+@end
+
+#pragma mark - Export
+
+NSArray *FMSActiveSwizzleRecords(void) {
+    
+    FMSSwizzleRecordEntry *entries;
+    size_t count = FMSCopyActiveRecordEntries(&entries);
+    
+    NSMutableArray *records = [NSMutableArray arrayWithCapacity:count];
+    
+    for (size_t index = 0; index < count; index++) {
+        
+        FMSSwizzleRecord *record = [[FMSSwizzleRecord alloc] init];
+        memcpy(&record->_entry, &entries[index], sizeof(FMSSwizzleRecordEntry));
+        [records addObject:record];
+    }
+    
+    free(entries);
+    
+    return records;
+}
+
+NSData *FMSSwizzleRecordsJSON(void) {
+    
+    NSArray *records = FMSActiveSwizzleRecords();
+    NSMutableArray *objects = [NSMutableArray arrayWithCapacity:[records count]];
+    
+    for (FMSSwizzleRecord *record in records) {
+        
+        NSMutableDictionary *object = [NSMutableDictionary dictionary];
+        object[@"kind"] = [record kindName];
+        object[@"class"] = [record className];
+        object[@"classMethod"] = @([record isClassMethod]);
+        object[@"installNanoseconds"] = @([record installNanoseconds]);
+        object[@"originalImplementation"] = [NSString stringWithFormat:@"%p", (void *)[record originalImplementation]];
+        object[@"installedImplementation"] = [NSString stringWithFormat:@"%p", (void *)[record installedImplementation]];
+        
+        if ([record baseClassName] != nil) {
+            object[@"baseClass"] = [record baseClassName];
+        }
+        
+        if ([record selector] != NULL) {
+            object[@"selector"] = NSStringFromSelector([record selector]);
+        }
+        
+        if ([record typeEncoding] != nil) {
+            object[@"typeEncoding"] = [record typeEncoding];
+        }
+        
+        [objects addObject:object];
+    }
+    
+    return [NSJSONSerialization dataWithJSONObject:@{@"version": @(FMSSwizzleRecordSnapshotVersion),
+                                                     @"records": objects}
+                                           options:NSJSONWritingPrettyPrinted
+                                             error:NULL];
+}
+
+static void FMSAppendSnapshotString(NSMutableData *data, const char *string) {
+    
+    uint16_t length = (string != NULL) ? (uint16_t)MIN(strlen(string), UINT16_MAX) : 0;
+    
+    [data appendBytes:&length length:sizeof(length)];
+    [data appendBytes:string length:length];
+}
+
+NSData *FMSSwizzleRecordSnapshot(void) {
+    
+    FMSSwizzleRecordEntry *entries;
+    size_t count = FMSCopyActiveRecordEntries(&entries);
+    
+    NSMutableData *data = [NSMutableData dataWithCapacity:16 + count * 64];
+    
+    uint32_t version = FMSSwizzleRecordSnapshotVersion;
+    uint32_t recordCount = (uint32_t)count;
+    
+    [data appendBytes:FMSSwizzleRecordSnapshotMagic length:4];
+    [data appendBytes:&version length:sizeof(version)];
+    [data appendBytes:&recordCount length:sizeof(recordCount)];
+    
+    for (size_t index = 0; index < count; index++) {
+        
+        FMSSwizzleRecordEntry *entry = &entries[index];
+        
+        uint8_t kind = (uint8_t)entry->kind;
+        uint8_t classMethod = entry->classMethod ? 1 : 0;
+        uint64_t installNanoseconds = entry->installNanoseconds;
+        uint64_t original = (uint64_t)(uintptr_t)entry->originalImplementation;
+        uint64_t installed = (uint64_t)(uintptr_t)entry->installedImplementation;
+        
+        [data appendBytes:&kind length:sizeof(kind)];
+        [data appendBytes:&classMethod length:sizeof(classMethod)];
+        [data appendBytes:&installNanoseconds length:sizeof(installNanoseconds)];
+        [data appendBytes:&original length:sizeof(original)];
+        [data appendBytes:&installed length:sizeof(installed)];
+        
+        FMSAppendSnapshotString(data, entry->className);
+        FMSAppendSnapshotString(data, entry->baseClassName);
+        FMSAppendSnapshotString(data, entry->selector != NULL ? sel_getName(entry->selector) : NULL);
+        FMSAppendSnapshotString(data, entry->typeEncoding);
+    }
+    
+    free(entries);
+    
+    return data;
+}
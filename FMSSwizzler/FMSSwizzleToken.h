@@ -0,0 +1,111 @@
+//
+//  FMSSwizzleToken.h
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+/**
+ * @file FMSSwizzleToken.h
+ * Tokens returned by FMSSwizzler's alias, replace and override methods.
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Identifies the kind of change an `FMSSwizzleToken` can undo.
+ */
+enum swizzleTokenKind {
+    
+    FMSSwizzleTokenAlias,       /**< Created by `FMS_aliasInstanceMethod:newSelector:` or `FMS_aliasClassMethod:newSelector:`. */
+    FMSSwizzleTokenReplace,     /**< Created by `FMS_replaceInstanceMethod:withImplementationBlock:` or `FMS_replaceClassMethod:withImplementationBlock:`. */
+    FMSSwizzleTokenOverride,    /**< Created by `FMS_overrideInstanceMethod:oldSelector:implementationBlock:` or `FMS_overrideClassMethod:oldSelector:implementationBlock:`. */
+    FMSSwizzleTokenInstance     /**< Created by `FMS_replaceMethod:withImplementationBlock:` or `FMS_overrideMethod:oldSelector:implementationBlock:` on a single object. */
+};
+
+/**
+ * Used to identify the kind of change an `FMSSwizzleToken` can undo.
+ */
+typedef enum swizzleTokenKind FMSSwizzleTokenKind;
+
+/**
+ * @brief Records a single swizzle, and lets you undo it.
+ *
+ * Every alias, replace and override returns a token. The token remembers the `IMP` it replaced, so calling
+ * `restore` puts that `IMP` back in constant time. It also retires the alias selector (if any) so it can be
+ * reused, and retires the block trampoline that was created for the replacement, which is freed once no call
+ * can still be running it.
+ *
+ * Replacements and overrides of the same selector on the same class stack up. Restoring the most recent one
+ * puts the previous hook back in place. You can also restore a hook from the middle of the stack: the hook
+ * above it is rewired to call the hook below it, and the rest of the stack keeps working.
+ *
+ * You don't need to keep the token. If you throw it away, the swizzle simply stays in place.
+ *
+ * Restoring is safe while other threads are calling the method: calls that are already running the replacement
+ * finish normally. Every call into a replacement counts itself while it runs, and the replacement's block is only
+ * freed after a short grace period, once the calls that started before the restore have returned. A replacement
+ * block for a signature FMSSwizzler has no precompiled trampoline for can't be counted, so restoring leaves it
+ * allocated for good.
+ *
+ * Note: If the method was inherited when it was replaced, restoring it makes the class defer to its superclass
+ * again, so later changes to the superclass's method show through just as they did before the swizzle. The
+ * runtime cannot remove methods, so the class keeps a small method that calls the superclass's current `IMP`.
+ * For signatures FMSSwizzler has no precompiled trampoline for, the superclass's `IMP` is copied instead.
+ */
+@interface FMSSwizzleToken : NSObject
+
+/** The class that was modified. For class methods this is the metaclass, and for single objects the shared dispatching subclass. */
+@property (strong, nonatomic, readonly) Class targetClass;
+
+/** The selector whose implementation was changed (for aliases, the new selector). */
+@property (assign, nonatomic, readonly) SEL selector;
+
+/** The selector used to reach the previous implementation, or `NULL` if this is not an override. */
+@property (assign, nonatomic, readonly) SEL aliasSelector;
+
+/** The kind of change this token records. */
+@property (assign, nonatomic, readonly) FMSSwizzleTokenKind kind;
+
+/** The implementation that `restore` will put back. For aliases this is `NULL`. */
+@property (assign, nonatomic, readonly) IMP previousImplementation;
+
+/** The implementation that was installed. */
+@property (assign, nonatomic, readonly) IMP installedImplementation;
+
+/** `YES` until the token has been restored. */
+@property (assign, nonatomic, readonly, getter = isActive) BOOL active;
+
+/**
+ * @brief Undoes the swizzle.
+ *
+ * Calling `restore` on a token that has already been restored does nothing. Throws an
+ * `NSInternalInconsistencyException` if the method has since been changed by something other than FMSSwizzler.
+ */
+- (void)restore;
+
+@end
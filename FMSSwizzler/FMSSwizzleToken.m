@@ -0,0 +1,550 @@
+//
+//  FMSSwizzleToken.m
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+#import "FMSSwizzlerInternal.h"
+#import <pthread.h>
+#import <stdatomic.h>
+#import <time.h>
+
+#if !__has_feature(objc_arc)
+#error FMSSwizzler must be built with ARC.
+// You can turn on ARC for only FMSSwizzler files by adding -fobjc-arc to the build phase for each of its files.
+#endif
+
+#pragma mark - Swizzle Registry
+
+/*
+ * Each class that has been swizzled keeps a small registry (as an associated object on the class). It maps
+ * each replaced selector to the topmost token in its stack, remembers which aliases have been retired, and
+ * keeps the IMPs that hand restored methods back to the superclass (see FMSMakeInheritingImplementation()),
+ * so toggling a swizzle doesn't make a new one each time. The registry is only touched while holding the
+ * class's lock.
+ *
+ * Tokens in a stack form a doubly linked list, so any token can be unlinked in constant time: the
+ * topmost token restores the method itself, while a token further down only has to rewire the alias of the
+ * token directly above it.
+ *
+ * A stack that is left behind, because something outside FMSSwizzler changed the method, stays in
+ * `_abandonedTokens`. Its tokens' IMPs may still be installed further up (as the previous implementation of
+ * whatever replaced them), and trampolines read their tokens unretained, so they must never be freed.
+ */
+@interface FMSSwizzleRegistry : NSObject {
+@public
+    NSMutableDictionary *_topTokens;
+    NSMutableSet *_retiredAliases;
+    NSMutableDictionary *_inheritingImplementations;
+    NSMutableArray *_abandonedTokens;
+}
+@end
+
+@implementation FMSSwizzleRegistry
+@end
+
+static char FMSSwizzleRegistryKey;
+
+static FMSSwizzleRegistry *FMSRegistryForClass(Class cls, BOOL create) {
+    
+    FMSSwizzleRegistry *registry = objc_getAssociatedObject(cls, &FMSSwizzleRegistryKey);
+    
+    if (registry == nil && create) {
+        
+        registry = [[FMSSwizzleRegistry alloc] init];
+        registry->_topTokens = [[NSMutableDictionary alloc] init];
+        registry->_retiredAliases = [[NSMutableSet alloc] init];
+        registry->_inheritingImplementations = [[NSMutableDictionary alloc] init];
+        registry->_abandonedTokens = [[NSMutableArray alloc] init];
+        objc_setAssociatedObject(cls, &FMSSwizzleRegistryKey, registry, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    }
+    
+    return registry;
+}
+
+// Installed in place of a retired alias. It is never meant to return: calling a retired alias is an error.
+static void FMSRetiredAliasImplementation(id self, SEL _cmd) {
+    
+    [self doesNotRecognizeSelector:_cmd];
+}
+
+static void FMSRetireAlias(Class cls, SEL aliasSelector) {
+    
+    Method method = class_getInstanceMethod(cls, aliasSelector);
+    class_replaceMethod(cls, aliasSelector, (IMP)FMSRetiredAliasImplementation, method_getTypeEncoding(method));
+    [FMSRegistryForClass(cls, YES)->_retiredAliases addObject:NSStringFromSelector(aliasSelector)];
+}
+
+BOOL FMSIsRetiredAlias(Class cls, SEL selector) {
+    
+    FMSSwizzleRegistry *registry = FMSRegistryForClass(cls, NO);
+    return registry != nil && [registry->_retiredAliases containsObject:NSStringFromSelector(selector)];
+}
+
+void FMSReviveAlias(Class cls, SEL selector) {
+    
+    [FMSRegistryForClass(cls, NO)->_retiredAliases removeObject:NSStringFromSelector(selector)];
+}
+
+BOOL FMSClassInheritsMethod(Class cls, SEL selector) {
+    
+    Method method = class_getInstanceMethod(cls, selector);
+    Class superclass = class_getSuperclass(cls);
+    
+    return method != NULL && superclass != Nil && class_getInstanceMethod(superclass, selector) == method;
+}
+
+#pragma mark - Retired Implementations
+
+/*
+ * Another thread may have entered a swizzled method just before it was restored, and still be running the old
+ * IMP (and reading the token and context it refers to). So restoring retires everything that has to be freed, and
+ * it is freed after a grace period, using the same two-epoch reader counts as hook chains (see FMSHookChain.m),
+ * shared by every IMP FMSSwizzler can retire.
+ *
+ * Each of those IMPs counts itself as a reader in the current epoch for as long as it runs (FMSEnterSwizzledCall()).
+ * Retiring adds to the pending list. Then, if nobody is reading in the other epoch, the waiting list is freed, the
+ * pending list moves to waiting, and the epoch flips. Whatever was retired is freed at the second flip after it,
+ * once every call that counted itself while it was installed has returned. Nothing waits: when the other epoch
+ * still has readers, the lists stay put until the next retire or FMSReclaimRetiredImplementations().
+ *
+ * A call only counts itself once its IMP starts running, a few instructions after the runtime looked the IMP up.
+ * A thread stopped in between wouldn't be seen, so the waiting list is also kept for at least
+ * FMSRetirementGracePeriod after it was retired, which is far longer than those few instructions take.
+ */
+#define FMSRetirementReaderStripeCount 16
+#define FMSRetirementGracePeriod (20 * 1000000ull)
+
+typedef struct {
+    _Atomic uintptr_t readers[2];
+    char padding[64 - 2 * sizeof(uintptr_t)];
+} FMSRetirementReaderStripe;
+
+static FMSRetirementReaderStripe FMSRetirementReaderStripes[FMSRetirementReaderStripeCount];
+static atomic_uint FMSRetirementEpoch = 0;
+static atomic_uint FMSNextRetirementStripe = 0;
+
+// The thread's stripe plus one, or 0 before the thread first calls a swizzled method.
+static _Thread_local unsigned int FMSThreadRetirementStripe = 0;
+
+static pthread_mutex_t FMSRetiredImplementationLock = PTHREAD_MUTEX_INITIALIZER;
+static NSMutableArray *FMSPendingRetirements = nil;
+static NSMutableArray *FMSWaitingRetirements = nil;
+static uint64_t FMSWaitingRetirementsSince = 0;
+
+static inline _Atomic uintptr_t *FMSRetirementReaders(unsigned int epoch) {
+    
+    unsigned int stripe = FMSThreadRetirementStripe;
+    
+    if (__builtin_expect(stripe == 0, 0)) {
+        stripe = atomic_fetch_add_explicit(&FMSNextRetirementStripe, 1, memory_order_relaxed) % FMSRetirementReaderStripeCount + 1;
+        FMSThreadRetirementStripe = stripe;
+    }
+    
+    return &FMSRetirementReaderStripes[stripe - 1].readers[epoch];
+}
+
+unsigned int FMSEnterSwizzledCall(void) {
+    
+    unsigned int epoch = atomic_load_explicit(&FMSRetirementEpoch, memory_order_relaxed);
+    atomic_fetch_add_explicit(FMSRetirementReaders(epoch), 1, memory_order_seq_cst);
+    
+    return epoch;
+}
+
+void FMSExitSwizzledCall(const unsigned int *epoch) {
+    
+    atomic_fetch_sub_explicit(FMSRetirementReaders(*epoch), 1, memory_order_release);
+}
+
+static uintptr_t FMSRetirementReaderCount(unsigned int epoch) {
+    
+    uintptr_t readers = 0;
+    
+    for (NSUInteger index = 0; index < FMSRetirementReaderStripeCount; index++) {
+        readers += atomic_load_explicit(&FMSRetirementReaderStripes[index].readers[epoch], memory_order_seq_cst);
+    }
+    
+    return readers;
+}
+
+static inline uint64_t FMSRetirementNow(void) {
+    
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+// Must be called while holding FMSRetiredImplementationLock. Returns the blocks that can now be run.
+static NSArray *FMSAdvanceRetirements(void) {
+    
+    unsigned int epoch = atomic_load_explicit(&FMSRetirementEpoch, memory_order_relaxed);
+    uint64_t now = FMSRetirementNow();
+    
+    if ([FMSPendingRetirements count] == 0 && [FMSWaitingRetirements count] == 0) return nil;
+    if (FMSRetirementReaderCount(epoch ^ 1) != 0) return nil;
+    if ([FMSWaitingRetirements count] > 0 && now - FMSWaitingRetirementsSince < FMSRetirementGracePeriod) return nil;
+    
+    NSArray *freed = FMSWaitingRetirements;
+    FMSWaitingRetirements = FMSPendingRetirements;
+    FMSWaitingRetirementsSince = now;
+    FMSPendingRetirements = nil;
+    
+    atomic_store_explicit(&FMSRetirementEpoch, epoch ^ 1, memory_order_seq_cst);
+    
+    return freed;
+}
+
+// Outside the lock, since freeing a context may restore (and so retire) something else.
+static NSUInteger FMSRunRetirements(NSArray *retired) {
+    
+    for (void (^dispose)(void) in retired) {
+        dispose();
+    }
+    
+    return [retired count];
+}
+
+void FMSRetireImplementation(void (^dispose)(void)) {
+    
+    pthread_mutex_lock(&FMSRetiredImplementationLock);
+    
+    if (FMSPendingRetirements == nil) {
+        FMSPendingRetirements = [[NSMutableArray alloc] init];
+    }
+    
+    [FMSPendingRetirements addObject:[dispose copy]];
+    NSArray *freed = FMSAdvanceRetirements();
+    
+    pthread_mutex_unlock(&FMSRetiredImplementationLock);
+    
+    FMSRunRetirements(freed);
+}
+
+NSUInteger FMSReclaimRetiredImplementations(void) {
+    
+    pthread_mutex_lock(&FMSRetiredImplementationLock);
+    NSArray *freed = FMSAdvanceRetirements();
+    pthread_mutex_unlock(&FMSRetiredImplementationLock);
+    
+    return FMSRunRetirements(freed);
+}
+
+NSUInteger FMSRetiredImplementationCount(void) {
+    
+    pthread_mutex_lock(&FMSRetiredImplementationLock);
+    NSUInteger count = [FMSPendingRetirements count] + [FMSWaitingRetirements count];
+    pthread_mutex_unlock(&FMSRetiredImplementationLock);
+    
+    return count;
+}
+
+#pragma mark - Swizzle Tokens
+
+FMSSwizzleToken *FMSRecordAlias(Class cls, SEL aliasSelector, IMP implementation) {
+    
+    FMSSwizzleToken *token = [[FMSSwizzleToken alloc] init];
+    token->_targetClass = cls;
+    token->_selector = aliasSelector;
+    token->_kind = FMSSwizzleTokenAlias;
+    token->_installedImplementation = implementation;
+    token->_active = YES;
+    token->_record = FMSRecordSwizzle(FMSSwizzleRecordAlias, cls, aliasSelector, NULL, NULL, implementation, Nil);
+    
+    return token;
+}
+
+static void FMSPushReplacementToken(FMSSwizzleToken *token) {
+    
+    FMSSwizzleRegistry *registry = FMSRegistryForClass(token->_targetClass, YES);
+    NSString *key = NSStringFromSelector(token->_selector);
+    FMSSwizzleToken *below = registry->_topTokens[key];
+    
+    // Only stack on top of the previous token if it is really what we replaced. If something outside FMSSwizzler
+    // changed the method in between, the old stack is left behind; restoring its top will then throw rather than
+    // clobber the newer implementation.
+    if (below != nil && below->_installedImplementation == token->_previousImplementation) {
+        token->_below = below;
+        below->_above = token;
+    } else if (below != nil) {
+        [registry->_abandonedTokens addObject:below];
+    }
+    
+    registry->_topTokens[key] = token;
+}
+
+FMSSwizzleToken *FMSRecordReplacement(Class cls,
+                                      SEL selector,
+                                      SEL aliasSelector,
+                                      IMP previousImplementation,
+                                      IMP installedImplementation,
+                                      BOOL addedMethod) {
+    
+    FMSSwizzleToken *token = [[FMSSwizzleToken alloc] init];
+    token->_targetClass = cls;
+    token->_selector = selector;
+    token->_aliasSelector = aliasSelector;
+    token->_kind = (aliasSelector == NULL) ? FMSSwizzleTokenReplace : FMSSwizzleTokenOverride;
+    token->_previousImplementation = previousImplementation;
+    token->_installedImplementation = installedImplementation;
+    token->_addedMethod = addedMethod;
+    token->_active = YES;
+    token->_record = FMSRecordSwizzle((aliasSelector == NULL) ? FMSSwizzleRecordReplace : FMSSwizzleRecordOverride,
+                                      cls,
+                                      selector,
+                                      NULL,
+                                      previousImplementation,
+                                      installedImplementation,
+                                      Nil);
+    
+    FMSPushReplacementToken(token);
+    
+    return token;
+}
+
+FMSSwizzleToken *FMSInstallReplacement(Class cls, SEL selector, IMP (^makeImplementation)(FMSSwizzleToken *token)) {
+    
+    Method originalMethod = class_getInstanceMethod(cls, selector);
+    
+    if (originalMethod == NULL) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"The original method does not exist"];
+    }
+    
+    // We hold the class lock, so nothing else in FMSSwizzler can change the method between reading it here and
+    // replacing it below. The token is filled in before the new IMP is published.
+    FMSSwizzleToken *token = [[FMSSwizzleToken alloc] init];
+    token->_targetClass = cls;
+    token->_selector = selector;
+    token->_kind = FMSSwizzleTokenReplace;
+    token->_previousImplementation = method_getImplementation(originalMethod);
+    token->_installedImplementation = makeImplementation(token);
+    token->_addedMethod = FMSClassInheritsMethod(cls, selector);
+    token->_active = YES;
+    
+    class_replaceMethod(cls, selector, token->_installedImplementation, method_getTypeEncoding(originalMethod));
+    FMSPushReplacementToken(token);
+    
+    token->_record = FMSRecordSwizzle(FMSSwizzleRecordTrampoline,
+                                      cls,
+                                      selector,
+                                      method_getTypeEncoding(originalMethod),
+                                      token->_previousImplementation,
+                                      token->_installedImplementation,
+                                      Nil);
+    
+    return token;
+}
+
+@implementation FMSSwizzleToken
+
+- (Class)targetClass {
+    return _targetClass;
+}
+
+- (SEL)selector {
+    return _selector;
+}
+
+- (SEL)aliasSelector {
+    return _aliasSelector;
+}
+
+- (FMSSwizzleTokenKind)kind {
+    return _kind;
+}
+
+- (IMP)previousImplementation {
+    return _previousImplementation;
+}
+
+- (IMP)installedImplementation {
+    return _installedImplementation;
+}
+
+- (BOOL)isActive {
+    return _active;
+}
+
+- (void)restore {
+    
+    FMSPerformLocked(_targetClass, ^{
+        [self performRestore];
+    });
+}
+
+#pragma mark - Private Methods
+
+- (void)performRestore {
+    
+    if (!_active) return;
+    
+    if (_kind == FMSSwizzleTokenInstance) {
+        
+        FMSRestoreInstanceOverride(self);
+        FMSRetireSwizzleRecord(_record);
+        
+        _context = nil;
+        _active = NO;
+        return;
+    }
+    
+    Method method = class_getInstanceMethod(_targetClass, _selector);
+    const char *typeEncoding = method_getTypeEncoding(method);
+    
+    if (_kind == FMSSwizzleTokenAlias) {
+        
+        [self checkIsCurrentImplementation:method];
+        FMSRetireAlias(_targetClass, _selector);
+        FMSRetireSwizzleRecord(_record);
+        
+        _active = NO;
+        return;
+    }
+    
+    if (_above == nil) {
+        
+        // Topmost: put the previous implementation back, and let the token below us become the top.
+        [self checkIsCurrentImplementation:method];
+        class_replaceMethod(_targetClass, _selector, [self implementationToRestore], typeEncoding);
+        
+        FMSSwizzleRegistry *registry = FMSRegistryForClass(_targetClass, NO);
+        NSString *key = NSStringFromSelector(_selector);
+        
+        if (registry->_topTokens[key] == self) {
+            
+            if (_below != nil) {
+                registry->_topTokens[key] = _below;
+            } else {
+                [registry->_topTokens removeObjectForKey:key];
+            }
+        }
+        
+    } else {
+        
+        // Further down: the token above us reaches us through its alias (if it has one). Point it past us.
+        FMSSwizzleToken *above = _above;
+        above->_previousImplementation = _previousImplementation;
+        above->_addedMethod = above->_addedMethod || _addedMethod;
+        
+        if (above->_aliasSelector != NULL) {
+            class_replaceMethod(_targetClass, above->_aliasSelector, _previousImplementation, typeEncoding);
+        }
+        
+        above->_below = _below;
+    }
+    
+    if (_below != nil) {
+        _below->_above = _above;
+    }
+    
+    _above = nil;
+    _below = nil;
+    
+    if (_aliasSelector != NULL) {
+        FMSRetireAlias(_targetClass, _aliasSelector);
+    }
+    
+    if (_detachContext != nil) {
+        _detachContext();
+    }
+    
+    IMP implementation = _installedImplementation;
+    void (^dispose)(void) = _disposeImplementation;
+    id context = _context;
+    FMSSwizzleToken *token = self;
+    
+    // Calls that are already inside the IMP may still read the token and its context, so those go along with it.
+    // An IMP whose calls aren't counted can't be known to be finished with, so it is never freed.
+    if (!_uncountedImplementation) {
+        
+        FMSRetireImplementation(^{
+            
+            if (dispose != nil) {
+                dispose();
+            } else {
+                imp_removeBlock(implementation);
+            }
+            
+            (void)context;
+            (void)token;
+        });
+    }
+    
+    FMSRetireSwizzleRecord(_record);
+    
+    _disposeImplementation = nil;
+    _detachContext = nil;
+    _context = nil;
+    _active = NO;
+}
+
+/*
+ * Restoring the bottom of a stack that added the method to the class makes the class defer to its superclass
+ * again, so later changes to the superclass show through as they did before the swizzle. The runtime can't
+ * remove a method, so this installs one that looks up the superclass's IMP on every call. For signatures without a
+ * precompiled trampoline, the superclass's current IMP is copied instead.
+ */
+- (IMP)implementationToRestore {
+    
+    if (!_addedMethod) {
+        return _previousImplementation;
+    }
+    
+    FMSSwizzleRegistry *registry = FMSRegistryForClass(_targetClass, YES);
+    NSString *key = NSStringFromSelector(_selector);
+    NSValue *inheriting = registry->_inheritingImplementations[key];
+    
+    if (inheriting == nil) {
+        
+        IMP implementation = FMSMakeInheritingImplementation(_targetClass, _selector);
+        
+        if (implementation == NULL) {
+            return class_getMethodImplementation(class_getSuperclass(_targetClass), _selector);
+        }
+        
+        inheriting = [NSValue valueWithPointer:(const void *)implementation];
+        registry->_inheritingImplementations[key] = inheriting;
+    }
+    
+    return (IMP)[inheriting pointerValue];
+}
+
+- (void)checkIsCurrentImplementation:(Method)method {
+    
+    if (method_getImplementation(method) != _installedImplementation) {
+        [NSException
+         raise:NSInternalInconsistencyException
+         format:@"%@ on %@ has been changed outside FMSSwizzler since it was swizzled, and cannot be restored.",
+         NSStringFromSelector(_selector), NSStringFromClass(_targetClass)];
+    }
+}
+
+@end
@@ -0,0 +1,323 @@
+//
+//  FMSSwizzlerInternal.h
+//  FMSSwizzler
+//
+//  Private declarations shared between FMSSwizzler's source files. Not part of the public interface.
+//
+
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+
+/*
+ * The geometry types behind FMSPoint, FMSSize and FMSRect.
+ */
+#if TARGET_OS_IPHONE
+#import <CoreGraphics/CoreGraphics.h>
+typedef CGPoint FMSPointValue;
+typedef CGSize FMSSizeValue;
+typedef CGRect FMSRectValue;
+#else
+typedef NSPoint FMSPointValue;
+typedef NSSize FMSSizeValue;
+typedef NSRect FMSRectValue;
+#endif
+
+/*
+ * Runs `block` while holding the mutation lock for `cls`. Every change FMSSwizzler makes to a class (or,
+ * for class methods, its metaclass) happens inside one of these.
+ */
+void FMSPerformLocked(Class cls, void (^block)(void));
+
+/*
+ * Runs `block` while holding the mutation locks for every class in `classes`, so a batch can check and change
+ * several classes without anyone else getting in between.
+ */
+void FMSPerformLockedClasses(NSArray *classes, void (^block)(void));
+
+/*
+ * The number of arguments `selector` takes (not counting self and _cmd). FMSCheckAliasArguments() throws
+ * NSInvalidArgumentException unless `newSelector` takes as many arguments as `originalMethod`.
+ */
+NSUInteger FMSSelectorArgumentCount(SEL selector);
+void FMSCheckAliasArguments(Method originalMethod, SEL newSelector);
+
+/*
+ * Swizzle records (FMSSwizzleRecord.m). Every install calls FMSRecordSwizzle(), and keeps the handle so it can
+ * retire the record when it is undone. Retiring a handle twice is harmless. `typeEncoding` may be NULL, in which
+ * case it is looked up from `cls` and `selector`. `baseClass` is only set for generated classes and single-object
+ * overrides. FMSRetireSwizzleRecordsForClass() must be called before a generated class is disposed of.
+ */
+typedef struct FMSSwizzleRecordEntry FMSSwizzleRecordEntry;
+
+typedef struct {
+    FMSSwizzleRecordEntry *entry;
+    uint32_t sequence;
+} FMSSwizzleRecordHandle;
+
+FMSSwizzleRecordHandle FMSRecordSwizzle(FMSSwizzleRecordKind kind,
+                                        Class cls,
+                                        SEL selector,
+                                        const char *typeEncoding,
+                                        IMP originalImplementation,
+                                        IMP installedImplementation,
+                                        Class baseClass);
+void FMSRetireSwizzleRecord(FMSSwizzleRecordHandle handle);
+void FMSRetireSwizzleRecordsForClass(Class cls);
+
+NSArray *FMSActiveSwizzleRecords(void);
+NSData *FMSSwizzleRecordsJSON(void);
+NSData *FMSSwizzleRecordSnapshot(void);
+
+/*
+ * Swizzle tokens. The ivars are exposed so generated trampolines can read `_previousImplementation` directly;
+ * it is rewired when a token lower in the stack is restored.
+ */
+@interface FMSSwizzleToken () {
+@public
+    Class _targetClass;
+    SEL _selector;
+    SEL _aliasSelector;
+    FMSSwizzleTokenKind _kind;
+    IMP _previousImplementation;
+    IMP _installedImplementation;
+    BOOL _active;
+    
+    // Set when the installed IMP is not a block trampoline. Called instead of imp_removeBlock() once the restored
+    // IMP is reclaimed.
+    void (^_disposeImplementation)(void);
+    
+    // Set when calls into the installed IMP aren't counted (see FMSImplementationWithBlock()). Restoring then
+    // leaves the IMP and everything it refers to allocated for good.
+    BOOL _uncountedImplementation;
+    
+    // Called on restore, while holding the lock for the class, for context that must stop being used straight
+    // away. Anything a call already inside the IMP may still read has to wait for `_disposeImplementation`.
+    void (^_detachContext)(void);
+    
+    // Kept alive for as long as the installed IMP may run, and released on restore.
+    id _context;
+    
+    // For single-object overrides: the object's override table, which owns the installed IMP until it is restored.
+    __weak id _instanceTable;
+    
+    // This swizzle's entry in the process-wide record, retired on restore.
+    FMSSwizzleRecordHandle _record;
+    
+    // Set when the class inherited the method before the swizzle added it. Restoring the bottom of the stack then
+    // defers to the superclass again, rather than leaving a copy of its old IMP in the class.
+    BOOL _addedMethod;
+    
+    // Neighbours in the selector's stack. The stack owns its tokens from the top down.
+    __unsafe_unretained FMSSwizzleToken *_above;
+    FMSSwizzleToken *_below;
+}
+@end
+
+/*
+ * These must be called while holding the lock for `cls`. Pass `addedMethod` when `cls` only inherited `selector`
+ * before the replacement was installed.
+ */
+FMSSwizzleToken *FMSRecordAlias(Class cls, SEL aliasSelector, IMP implementation);
+FMSSwizzleToken *FMSRecordReplacement(Class cls,
+                                      SEL selector,
+                                      SEL aliasSelector,
+                                      IMP previousImplementation,
+                                      IMP installedImplementation,
+                                      BOOL addedMethod);
+
+/*
+ * Returns YES if `cls` responds to `selector` only through a superclass.
+ */
+BOOL FMSClassInheritsMethod(Class cls, SEL selector);
+
+/*
+ * Restored IMPs can't be freed straight away, since another thread may still be running them. Pass everything an
+ * IMP needs freeing (and everything it refers to) to FMSRetireImplementation() as a block. The block runs after a
+ * grace period, once every call that was counted while the IMP was installed has returned; it may run on any thread
+ * that later retires something or calls FMSReclaimRetiredImplementations(). Both are safe to call at any time, with
+ * or without class locks held.
+ *
+ * Every IMP FMSSwizzler may retire has to count its calls: declare FMS_SWIZZLED_CALL_SCOPE before doing anything
+ * else, which calls FMSEnterSwizzledCall() and calls FMSExitSwizzledCall() however the call ends.
+ */
+void FMSRetireImplementation(void (^dispose)(void));
+NSUInteger FMSReclaimRetiredImplementations(void);
+NSUInteger FMSRetiredImplementationCount(void);
+
+unsigned int FMSEnterSwizzledCall(void);
+void FMSExitSwizzledCall(const unsigned int *epoch);
+
+#define FMS_SWIZZLED_CALL_SCOPE \
+    __attribute__((cleanup(FMSExitSwizzledCall), unused)) const unsigned int FMSSwizzledCallEpoch = FMSEnterSwizzledCall()
+
+/*
+ * Makes the IMP for a replacement block. When the method has a precompiled trampoline shape, the block is wrapped
+ * in one that counts its calls. Otherwise (or when `method` is NULL) this returns the block's own IMP and sets `*counted` to NO, and the IMP
+ * must never be freed (set the token's `_uncountedImplementation`).
+ */
+IMP FMSImplementationWithBlock(Method method, id block, BOOL *counted);
+
+/*
+ * Replaces `selector` with the IMP returned by `makeImplementation`. The token passed to `makeImplementation`
+ * already records the previous implementation, so the new IMP may refer to it (unretained; the token lives as
+ * long as the swizzle is active). If the IMP is not a block trampoline, set the token's `_disposeImplementation`.
+ */
+FMSSwizzleToken *FMSInstallReplacement(Class cls, SEL selector, IMP (^makeImplementation)(FMSSwizzleToken *token));
+
+/*
+ * Returns YES if `selector` is an alias on `cls` that was retired by restoring its token. Retired
+ * aliases may be reused. Call FMSReviveAlias() once the selector has been given a new implementation.
+ */
+BOOL FMSIsRetiredAlias(Class cls, SEL selector);
+void FMSReviveAlias(Class cls, SEL selector);
+
+/*
+ * Creates and registers a new, empty subclass of the receiver for dynamic subclassing.
+ */
+@interface NSObject (FMS_DynamicSubclassCache)
++ (Class)allocateDynamicSubclass;
+@end
+
+/*
+ * If `cls` is the shared dynamic subclass `obj` is leased into, keeps it from ever being disposed of. For classes
+ * that something permanent (like another generated class) is built on.
+ */
+void FMSPinDynamicSubclass(id obj, Class cls);
+
+/*
+ * Single-object overrides (FMSInstanceOverrides.m). FMSInstallInstanceOverride() takes the locks it needs.
+ * FMSRestoreInstanceOverride() undoes an FMSSwizzleTokenInstance token, and must be called while holding the
+ * lock for the token's class.
+ */
+FMSSwizzleToken *FMSInstallInstanceOverride(id obj, SEL selector, SEL oldSelector, id block);
+void FMSRestoreInstanceOverride(FMSSwizzleToken *token);
+
+/*
+ * Swizzle batches (FMSSwizzleBatch.m). Takes the locks for every class in the batch itself.
+ */
+FMSSwizzleBatchResult *FMSPerformSwizzleBatch(FMSSwizzleBatchBlock batchBlock);
+
+/*
+ * Trampolines (FMSTrampolines.m). Wraps any method in a pair of C callbacks, choosing a precompiled trampoline
+ * from the method's type encoding (or a libffi closure, when built with FMS_USE_LIBFFI=1). `before` runs ahead of
+ * the original implementation and its result is handed to `after`. `context` is passed to both callbacks, and is
+ * kept alive by the returned token. Must be called while holding the lock for `cls`.
+ */
+typedef uint64_t (*FMSTrampolineBefore)(void *context, void *receiver, SEL selector);
+typedef void (*FMSTrampolineAfter)(void *context, void *receiver, SEL selector, uint64_t state);
+
+FMSSwizzleToken *FMSInstallTrampoline(Class cls,
+                                      SEL selector,
+                                      id context,
+                                      FMSTrampolineBefore before,
+                                      FMSTrampolineAfter after);
+
+/*
+ * Installs a trampoline that calls whatever implementation `resolve` returns for each receiver, passing the
+ * arguments straight through. Must be called while holding the lock for `cls`.
+ */
+typedef IMP (*FMSTrampolineResolve)(void *context, void *receiver, SEL selector);
+
+FMSSwizzleToken *FMSInstallDispatchTrampoline(Class cls, SEL selector, id context, FMSTrampolineResolve resolve);
+
+/*
+ * Returns an IMP for `selector` on `cls` that calls the superclass's current implementation, looked up on every
+ * call, or NULL if the method's signature has no precompiled trampoline. Installing it is the closest the runtime
+ * allows to removing a method from a class. Must be called while holding the lock for `cls`.
+ */
+IMP FMSMakeInheritingImplementation(Class cls, SEL selector);
+
+FMSSwizzleToken *FMSInstallMethodHook(Class cls, SEL selector, FMSMethodHookBlock before, FMSMethodHookBlock after);
+
+/*
+ * Sampling (FMSSampler.m). A sampled trampoline is a dispatching trampoline whose resolve callback,
+ * FMSSamplerResolve(), counts down per thread and returns either the token's previous implementation or
+ * `_sampledImplementation`: an ordinary before/after trampoline around the same previous implementation, built
+ * alongside it but never installed. FMSInstallSampledTrampoline() fills in the sampler and sets its token, which
+ * keeps the sampler (and through it `context`) alive. Must be called while holding the lock for `cls`.
+ */
+@interface FMSSampler () {
+@public
+    _Atomic uint64_t _configuration;
+    size_t _slot;
+    IMP _sampledImplementation;
+    id _context;
+    
+    // The token's stack owns it; this is only read by FMSSamplerResolve() while the swizzle is active.
+    __unsafe_unretained FMSSwizzleToken *_installedToken;
+    FMSSwizzleToken *_token;
+}
+@end
+
+IMP FMSSamplerResolve(void *context, void *receiver, SEL selector);
+
+FMSSwizzleToken *FMSInstallSampledTrampoline(Class cls,
+                                             SEL selector,
+                                             FMSSampler *sampler,
+                                             id context,
+                                             FMSTrampolineBefore before,
+                                             FMSTrampolineAfter after);
+
+FMSSwizzleToken *FMSInstallSampledMethodHook(Class cls,
+                                             SEL selector,
+                                             FMSSampler *sampler,
+                                             FMSMethodHookBlock before,
+                                             FMSMethodHookBlock after);
+
+/*
+ * Instrumentation (FMSInstrumentation.m). FMSInstrumentMethod() must be called while holding the lock for `cls`.
+ * Pass a sampler to time only the calls it samples, or nil to time every call.
+ */
+FMSSwizzleToken *FMSInstrumentMethod(Class cls, SEL selector, FMSSampler *sampler);
+FMSMethodStatistics *FMSStatisticsForMethod(Class cls, SEL selector);
+
+/*
+ * Method cache prewarming and IMP snapshots (FMSMethodCache.m). Every change FMSSwizzler makes to a method list
+ * calls FMSInvalidateIMPSnapshots() once the change is visible. Pass NULL selectors for every method the class
+ * implements below its root class.
+ */
+void FMSInvalidateIMPSnapshots(void);
+NSUInteger FMSPrewarmMethodCache(Class cls, const SEL *selectors, NSUInteger count);
+FMSIMPSnapshot *FMSTakeIMPSnapshot(Class cls, const SEL *selectors, NSUInteger count);
+
+/*
+ * Hook chains (FMSHookChain.m). A chain publishes its handlers as one immutable FMSHookChainHandlers array: the
+ * before blocks in the order they were added, then the around blocks, then the after blocks in reverse order.
+ * The chain trampoline (FMSTrampolines.m) brackets every call with FMSEnterHookChain(), which counts the call as
+ * a reader of the current array and runs the before blocks, and FMSExitHookChain(), which runs the after blocks
+ * and stops counting it (in the reader epoch FMSEnterHookChain() returned). It only calls FMSRunHookChainArounds()
+ * when there are around blocks, passing a block that calls the previous implementation.
+ */
+typedef struct FMSHookChainHandlers {
+    NSUInteger beforeCount;
+    NSUInteger aroundCount;
+    NSUInteger afterCount;
+    struct FMSHookChainHandlers *nextRetired;
+    void *blocks[];
+} FMSHookChainHandlers;
+
+const FMSHookChainHandlers *FMSEnterHookChain(void *chain, void *receiver, SEL selector, unsigned int *epoch);
+void FMSExitHookChain(void *chain, const FMSHookChainHandlers *handlers, unsigned int epoch, void *receiver, SEL selector);
+void FMSRunHookChainArounds(const FMSHookChainHandlers *handlers,
+                            void *receiver,
+                            SEL selector,
+                            __unsafe_unretained FMSHookChainProceedBlock original);
+
+/*
+ * Installs the trampoline for a new chain. The token keeps the chain alive until the restored trampoline has been
+ * freed. Restoring it calls FMSDetachHookChain(), which frees the handlers through the chain's own epochs. Must be
+ * called while holding the lock for `cls`.
+ */
+FMSSwizzleToken *FMSInstallHookChainTrampoline(Class cls, SEL selector, FMSHookChain *chain);
+void FMSDetachHookChain(FMSHookChain *chain);
+
+/*
+ * Adds a handler to the chain for `selector` on `cls`, creating the chain first if there isn't an active one.
+ * Must be called while holding the lock for `cls`.
+ */
+FMSHookChainHandler *FMSAddHookChainHandler(Class cls,
+                                            SEL selector,
+                                            FMSMethodHookBlock before,
+                                            FMSHookChainAroundBlock around,
+                                            FMSMethodHookBlock after);
+FMSHookChain *FMSHookChainForMethod(Class cls, SEL selector);
@@ -0,0 +1,1013 @@
+//
+//  FMSTrampolines.m
+//  FMSSwizzler
+//
+//    Copyright (c) 2012, Richard Warren
+//    All rights reserved.
+//
+//    Redistribution and use in source and binary forms, with or without modification,
+//    are permitted provided that the following conditions are met:
+//
+//        * Redistributions of source code must retain the above copyright notice, this
+//          list of conditions and the following disclaimer.
+//
+//        * Redistributions in binary form must reproduce the above copyright notice,
+//          this list of conditions and the following disclaimer in the documentation
+//          and/or other materials provided with the distribution.
+//
+//        * Neither the name of the <ORGANIZATION> nor the names of its contributors may
+//          be used to endorse or promote products derived from this software without
+//            specific prior written permission.
+//
+//    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+//    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+//    OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT
+//    SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+//    INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+//    PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+//    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+//    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+//    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#import "FMSSwizzlerInternal.h"
+
+#if FMS_USE_LIBFFI
+#if __has_include(<ffi/ffi.h>)
+#import <ffi/ffi.h>
+#else
+#import <ffi.h>
+#endif
+#endif
+
+#if !__has_feature(objc_arc)
+#error FMSSwizzler must be built with ARC.
+// You can turn on ARC for only FMSSwizzler files by adding -fobjc-arc to the build phase for each of its files.
+#endif
+
+#pragma mark - Signature Shapes
+
+/*
+ * A trampoline wraps a method of any signature in a before callback and an after callback. The signature is
+ * read from the method's type encoding once, at install time, and reduced to a "shape": how many arguments
+ * travel in general-purpose registers, whether any travel in floating point registers, and what kind of value
+ * comes back.
+ *
+ * Each shape has a precompiled block that declares every general-purpose argument as `void *` and (if needed)
+ * eight `double` arguments. The arguments are never inspected, only handed on to the original implementation,
+ * so the block stands in for every method with the same register usage, and ARC never touches them. On x86_64
+ * and arm64, integer and floating point arguments are assigned to their registers independently, so declaring
+ * the floating point arguments after the integer ones passes them through regardless of their order in the real
+ * signature. Other architectures only get the integer-only shapes.
+ *
+ * Signatures without a shape (struct arguments, long doubles, too many arguments) use a libffi closure when
+ * FMSSwizzler is built with FMS_USE_LIBFFI=1, and are rejected otherwise.
+ */
+#if defined(__x86_64__) || defined(__arm64__) || defined(__aarch64__)
+#define FMS_TRAMPOLINE_FLOATING_POINT_ARGUMENTS 1
+#else
+#define FMS_TRAMPOLINE_FLOATING_POINT_ARGUMENTS 0
+#endif
+
+#define FMSMaxTrampolineWordArguments 6
+#define FMSMaxTrampolineFloatingPointArguments 8
+
+typedef enum {
+    FMSReturnsVoid,
+    FMSReturnsWord,
+    FMSReturnsDouble,
+    FMSReturnsFloat,
+    FMSReturnsRange,
+    FMSReturnsPoint,
+    FMSReturnsSize,
+    FMSReturnsRect,
+    FMSReturnsUnsupported
+} FMSTrampolineReturnKind;
+
+typedef struct {
+    FMSTrampolineReturnKind returnKind;
+    NSUInteger wordArguments;
+    BOOL floatingPointArguments;
+} FMSTrampolineShape;
+
+// Skips the method type qualifiers (const, in, inout, out, bycopy, byref, oneway).
+static const char *FMSSkipTypeQualifiers(const char *type) {
+    
+    while (*type != '\0' && strchr("rnNoORV", *type) != NULL) type++;
+    return type;
+}
+
+// Integers, BOOLs, objects, classes, selectors and pointers that fit in a single general-purpose register.
+static BOOL FMSIsWordType(const char *type) {
+    
+    type = FMSSkipTypeQualifiers(type);
+    
+    if (*type == '\0' || strchr("cislqCISLQB@#:*^", *type) == NULL) return NO;
+    
+    NSUInteger size = 0;
+    NSGetSizeAndAlignment(type, &size, NULL);
+    
+    return size <= sizeof(void *);
+}
+
+static BOOL FMSIsFloatingPointType(const char *type) {
+    
+    type = FMSSkipTypeQualifiers(type);
+    return FMS_TRAMPOLINE_FLOATING_POINT_ARGUMENTS && (*type == 'f' || *type == 'd');
+}
+
+static FMSTrampolineReturnKind FMSReturnKindForType(const char *type) {
+    
+    type = FMSSkipTypeQualifiers(type);
+    
+    if (*type == 'v') return FMSReturnsVoid;
+    if (*type == 'd') return FMSReturnsDouble;
+    if (*type == 'f') return FMSReturnsFloat;
+    if (FMSIsWordType(type)) return FMSReturnsWord;
+    
+    if (strcmp(type, @encode(NSRange)) == 0) return FMSReturnsRange;
+    if (strcmp(type, @encode(FMSPointValue)) == 0) return FMSReturnsPoint;
+    if (strcmp(type, @encode(FMSSizeValue)) == 0) return FMSReturnsSize;
+    if (strcmp(type, @encode(FMSRectValue)) == 0) return FMSReturnsRect;
+    
+    return FMSReturnsUnsupported;
+}
+
+static BOOL FMSGetTrampolineShape(Method method, FMSTrampolineShape *shape) {
+    
+    char returnType[256];
+    method_getReturnType(method, returnType, sizeof(returnType));
+    
+    shape->returnKind = FMSReturnKindForType(returnType);
+    shape->wordArguments = 0;
+    shape->floatingPointArguments = NO;
+    
+    if (shape->returnKind == FMSReturnsUnsupported) return NO;
+    
+    NSUInteger floatingPointArguments = 0;
+    unsigned int argumentCount = method_getNumberOfArguments(method);
+    
+    // Skip self and _cmd.
+    for (unsigned int index = 2; index < argumentCount; index++) {
+        
+        char argumentType[256];
+        method_getArgumentType(method, index, argumentType, sizeof(argumentType));
+        
+        if (FMSIsWordType(argumentType)) {
+            shape->wordArguments++;
+        } else if (FMSIsFloatingPointType(argumentType)) {
+            floatingPointArguments++;
+        } else {
+            return NO;
+        }
+    }
+    
+    shape->floatingPointArguments = (floatingPointArguments > 0);
+    
+    return (shape->wordArguments <= FMSMaxTrampolineWordArguments &&
+            floatingPointArguments <= FMSMaxTrampolineFloatingPointArguments);
+}
+
+#pragma mark - Precompiled Trampolines
+
+#define FMS_PARAMS_0
+#define FMS_PARAMS_1 , void *a1
+#define FMS_PARAMS_2 FMS_PARAMS_1, void *a2
+#define FMS_PARAMS_3 FMS_PARAMS_2, void *a3
+#define FMS_PARAMS_4 FMS_PARAMS_3, void *a4
+#define FMS_PARAMS_5 FMS_PARAMS_4, void *a5
+#define FMS_PARAMS_6 FMS_PARAMS_5, void *a6
+
+#define FMS_ARGS_0
+#define FMS_ARGS_1 , a1
+#define FMS_ARGS_2 FMS_ARGS_1, a2
+#define FMS_ARGS_3 FMS_ARGS_2, a3
+#define FMS_ARGS_4 FMS_ARGS_3, a4
+#define FMS_ARGS_5 FMS_ARGS_4, a5
+#define FMS_ARGS_6 FMS_ARGS_5, a6
+
+#define FMS_FP_PARAMS_0
+#define FMS_FP_PARAMS_8 , double d0, double d1, double d2, double d3, double d4, double d5, double d6, double d7
+
+#define FMS_FP_ARGS_0
+#define FMS_FP_ARGS_8 , d0, d1, d2, d3, d4, d5, d6, d7
+
+/*
+ * Every trampoline counts itself as a swizzled call while it runs (FMS_SWIZZLED_CALL_SCOPE), so it is only freed
+ * once restored and no call can still be inside it.
+ *
+ * The original implementation is read from the token on every call, since restoring a token lower in the
+ * selector's stack rewires it.
+ */
+#define FMS_VOID_TRAMPOLINE(TYPE, PARAMS, ARGS) \
+    ^(void *receiver PARAMS) { \
+        FMS_SWIZZLED_CALL_SCOPE; \
+        uint64_t state = before(context, receiver, selector); \
+        ((void (*)(void *, SEL PARAMS))token->_previousImplementation)(receiver, selector ARGS); \
+        after(context, receiver, selector, state); \
+    }
+
+#define FMS_VALUE_TRAMPOLINE(TYPE, PARAMS, ARGS) \
+    ^TYPE (void *receiver PARAMS) { \
+        FMS_SWIZZLED_CALL_SCOPE; \
+        uint64_t state = before(context, receiver, selector); \
+        TYPE result = ((TYPE (*)(void *, SEL PARAMS))token->_previousImplementation)(receiver, selector ARGS); \
+        after(context, receiver, selector, state); \
+        return result; \
+    }
+
+/*
+ * Dispatching trampolines have no callbacks around the call. Instead they ask `resolve` which implementation
+ * should handle this receiver, and tail into it.
+ */
+#define FMS_VOID_DISPATCH(TYPE, PARAMS, ARGS) \
+    ^(void *receiver PARAMS) { \
+        FMS_SWIZZLED_CALL_SCOPE; \
+        ((void (*)(void *, SEL PARAMS))resolve(context, receiver, selector))(receiver, selector ARGS); \
+    }
+
+#define FMS_VALUE_DISPATCH(TYPE, PARAMS, ARGS) \
+    ^TYPE (void *receiver PARAMS) { \
+        FMS_SWIZZLED_CALL_SCOPE; \
+        return ((TYPE (*)(void *, SEL PARAMS))resolve(context, receiver, selector))(receiver, selector ARGS); \
+    }
+
+/*
+ * Hook chain trampolines run the chain's before and after handlers on either side of the previous implementation.
+ * Around handlers need the call wrapped in a block they can invoke; that block stays on the stack, and is only
+ * built when the chain has around handlers. If none of them proceeds, the result is zero.
+ */
+#define FMS_VOID_CHAIN(TYPE, PARAMS, ARGS) \
+    ^(void *receiver PARAMS) { \
+        FMS_SWIZZLED_CALL_SCOPE; \
+        unsigned int epoch; \
+        const FMSHookChainHandlers *handlers = FMSEnterHookChain(chain, receiver, selector, &epoch); \
+        if (__builtin_expect(handlers->aroundCount == 0, 1)) { \
+            ((void (*)(void *, SEL PARAMS))token->_previousImplementation)(receiver, selector ARGS); \
+        } else { \
+            FMSRunHookChainArounds(handlers, receiver, selector, ^{ \
+                ((void (*)(void *, SEL PARAMS))token->_previousImplementation)(receiver, selector ARGS); \
+            }); \
+        } \
+        FMSExitHookChain(chain, handlers, epoch, receiver, selector); \
+    }
+
+#define FMS_VALUE_CHAIN(TYPE, PARAMS, ARGS) \
+    ^TYPE (void *receiver PARAMS) { \
+        FMS_SWIZZLED_CALL_SCOPE; \
+        unsigned int epoch; \
+        const FMSHookChainHandlers *handlers = FMSEnterHookChain(chain, receiver, selector, &epoch); \
+        TYPE result; \
+        if (__builtin_expect(handlers->aroundCount == 0, 1)) { \
+            result = ((TYPE (*)(void *, SEL PARAMS))token->_previousImplementation)(receiver, selector ARGS); \
+        } else { \
+            TYPE *resultAddress = &result; \
+            memset(resultAddress, 0, sizeof(TYPE)); \
+            FMSRunHookChainArounds(handlers, receiver, selector, ^{ \
+                *resultAddress = ((TYPE (*)(void *, SEL PARAMS))token->_previousImplementation)(receiver, selector ARGS); \
+            }); \
+        } \
+        FMSExitHookChain(chain, handlers, epoch, receiver, selector); \
+        return result; \
+    }
+
+/*
+ * Counting trampolines stand in for a replacement block, so calls into it can be counted too. They call the block's
+ * invoke function the way imp_implementationWithBlock() would, with the receiver in place of the selector.
+ */
+#define FMS_VOID_COUNTED(TYPE, PARAMS, ARGS) \
+    ^(void *receiver PARAMS) { \
+        FMS_SWIZZLED_CALL_SCOPE; \
+        ((void (*)(void *, void * PARAMS))invoke)((__bridge void *)block, receiver ARGS); \
+    }
+
+#define FMS_VALUE_COUNTED(TYPE, PARAMS, ARGS) \
+    ^TYPE (void *receiver PARAMS) { \
+        FMS_SWIZZLED_CALL_SCOPE; \
+        return ((TYPE (*)(void *, void * PARAMS))invoke)((__bridge void *)block, receiver ARGS); \
+    }
+
+// The parameter lists contain commas, so they must only be expanded by the macro that finally uses them.
+#define FMS_TRAMPOLINE_FOR_COUNT(MAKE_BLOCK, TYPE, COUNT, FP) \
+    switch (COUNT) { \
+        case 0: return [MAKE_BLOCK(TYPE, FMS_PARAMS_0 FMS_FP_PARAMS_##FP, FMS_ARGS_0 FMS_FP_ARGS_##FP) copy]; \
+        case 1: return [MAKE_BLOCK(TYPE, FMS_PARAMS_1 FMS_FP_PARAMS_##FP, FMS_ARGS_1 FMS_FP_ARGS_##FP) copy]; \
+        case 2: return [MAKE_BLOCK(TYPE, FMS_PARAMS_2 FMS_FP_PARAMS_##FP, FMS_ARGS_2 FMS_FP_ARGS_##FP) copy]; \
+        case 3: return [MAKE_BLOCK(TYPE, FMS_PARAMS_3 FMS_FP_PARAMS_##FP, FMS_ARGS_3 FMS_FP_ARGS_##FP) copy]; \
+        case 4: return [MAKE_BLOCK(TYPE, FMS_PARAMS_4 FMS_FP_PARAMS_##FP, FMS_ARGS_4 FMS_FP_ARGS_##FP) copy]; \
+        case 5: return [MAKE_BLOCK(TYPE, FMS_PARAMS_5 FMS_FP_PARAMS_##FP, FMS_ARGS_5 FMS_FP_ARGS_##FP) copy]; \
+        case 6: return [MAKE_BLOCK(TYPE, FMS_PARAMS_6 FMS_FP_PARAMS_##FP, FMS_ARGS_6 FMS_FP_ARGS_##FP) copy]; \
+        default: return nil; \
+    }
+
+#if FMS_TRAMPOLINE_FLOATING_POINT_ARGUMENTS
+#define FMS_TRAMPOLINE_FOR_SHAPE(MAKE_BLOCK, TYPE) \
+    if (shape.floatingPointArguments) { \
+        FMS_TRAMPOLINE_FOR_COUNT(MAKE_BLOCK, TYPE, shape.wordArguments, 8) \
+    } else { \
+        FMS_TRAMPOLINE_FOR_COUNT(MAKE_BLOCK, TYPE, shape.wordArguments, 0) \
+    }
+#else
+#define FMS_TRAMPOLINE_FOR_SHAPE(MAKE_BLOCK, TYPE) \
+    FMS_TRAMPOLINE_FOR_COUNT(MAKE_BLOCK, TYPE, shape.wordArguments, 0)
+#endif
+
+static id FMSMakeTrampolineBlock(FMSTrampolineShape shape,
+                                 SEL selector,
+                                 __unsafe_unretained FMSSwizzleToken *token,
+                                 void *context,
+                                 FMSTrampolineBefore before,
+                                 FMSTrampolineAfter after) {
+    
+    switch (shape.returnKind) {
+            
+        case FMSReturnsVoid:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VOID_TRAMPOLINE, void);
+            
+        case FMSReturnsWord:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_TRAMPOLINE, void *);
+            
+        case FMSReturnsDouble:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_TRAMPOLINE, double);
+            
+        case FMSReturnsFloat:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_TRAMPOLINE, float);
+            
+        case FMSReturnsRange:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_TRAMPOLINE, NSRange);
+            
+        case FMSReturnsPoint:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_TRAMPOLINE, FMSPointValue);
+            
+        case FMSReturnsSize:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_TRAMPOLINE, FMSSizeValue);
+            
+        case FMSReturnsRect:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_TRAMPOLINE, FMSRectValue);
+            
+        default:
+            return nil;
+    }
+}
+
+static id FMSMakeDispatchBlock(FMSTrampolineShape shape, SEL selector, void *context, FMSTrampolineResolve resolve) {
+    
+    switch (shape.returnKind) {
+            
+        case FMSReturnsVoid:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VOID_DISPATCH, void);
+            
+        case FMSReturnsWord:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_DISPATCH, void *);
+            
+        case FMSReturnsDouble:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_DISPATCH, double);
+            
+        case FMSReturnsFloat:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_DISPATCH, float);
+            
+        case FMSReturnsRange:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_DISPATCH, NSRange);
+            
+        case FMSReturnsPoint:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_DISPATCH, FMSPointValue);
+            
+        case FMSReturnsSize:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_DISPATCH, FMSSizeValue);
+            
+        case FMSReturnsRect:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_DISPATCH, FMSRectValue);
+            
+        default:
+            return nil;
+    }
+}
+
+static id FMSMakeHookChainBlock(FMSTrampolineShape shape,
+                                SEL selector,
+                                __unsafe_unretained FMSSwizzleToken *token,
+                                void *chain) {
+    
+    switch (shape.returnKind) {
+            
+        case FMSReturnsVoid:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VOID_CHAIN, void);
+            
+        case FMSReturnsWord:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_CHAIN, void *);
+            
+        case FMSReturnsDouble:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_CHAIN, double);
+            
+        case FMSReturnsFloat:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_CHAIN, float);
+            
+        case FMSReturnsRange:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_CHAIN, NSRange);
+            
+        case FMSReturnsPoint:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_CHAIN, FMSPointValue);
+            
+        case FMSReturnsSize:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_CHAIN, FMSSizeValue);
+            
+        case FMSReturnsRect:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_CHAIN, FMSRectValue);
+            
+        default:
+            return nil;
+    }
+}
+
+// The start of every block's memory layout, as laid out by the compiler.
+typedef struct {
+    void *isa;
+    int flags;
+    int reserved;
+    void *invoke;
+} FMSBlockLayout;
+
+static id FMSMakeCountedBlock(FMSTrampolineShape shape, id block) {
+    
+    void *invoke = ((__bridge FMSBlockLayout *)block)->invoke;
+    
+    switch (shape.returnKind) {
+            
+        case FMSReturnsVoid:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VOID_COUNTED, void);
+            
+        case FMSReturnsWord:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_COUNTED, void *);
+            
+        case FMSReturnsDouble:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_COUNTED, double);
+            
+        case FMSReturnsFloat:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_COUNTED, float);
+            
+        case FMSReturnsRange:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_COUNTED, NSRange);
+            
+        case FMSReturnsPoint:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_COUNTED, FMSPointValue);
+            
+        case FMSReturnsSize:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_COUNTED, FMSSizeValue);
+            
+        case FMSReturnsRect:
+            FMS_TRAMPOLINE_FOR_SHAPE(FMS_VALUE_COUNTED, FMSRectValue);
+            
+        default:
+            return nil;
+    }
+}
+
+#pragma mark - libffi Fallback
+
+#if FMS_USE_LIBFFI
+
+/*
+ * Owns everything a libffi closure needs: the call interface, the ffi_type descriptions built from the type
+ * encoding, and the closure itself. The swizzle token keeps it alive while the closure is installed.
+ */
+@interface FMSFFITrampoline : NSObject {
+@public
+    ffi_cif _cif;
+    ffi_closure *_closure;
+    void *_code;
+    NSMutableArray *_typeStorage;
+    
+    SEL _selector;
+    __unsafe_unretained FMSSwizzleToken *_token;
+    id _contextObject;
+    void *_context;
+    FMSTrampolineBefore _before;
+    FMSTrampolineAfter _after;
+    FMSTrampolineResolve _resolve;
+}
+@end
+
+@implementation FMSFFITrampoline
+@end
+
+static ffi_type *FMSFFITypeForEncoding(const char **cursor, NSMutableArray *storage);
+
+// Keeps a copy of `bytes` alive in `storage`, and returns a stable pointer to it.
+static void *FMSStoreFFIBytes(NSMutableArray *storage, const void *bytes, size_t length) {
+    
+    NSMutableData *data = [NSMutableData dataWithBytes:bytes length:length];
+    [storage addObject:data];
+    
+    return [data mutableBytes];
+}
+
+// Arrays only appear inside structs. libffi has no array type, but a run of identical elements has the same layout.
+static BOOL FMSAppendFFIElements(const char **cursor, NSMutableArray *storage, ffi_type ***elements, size_t *count, size_t *capacity) {
+    
+    const char *type = *cursor;
+    size_t repeat = 1;
+    
+    if (*type == '[') {
+        
+        type++;
+        repeat = 0;
+        while (*type >= '0' && *type <= '9') {
+            repeat = repeat * 10 + (size_t)(*type - '0');
+            type++;
+        }
+    }
+    
+    ffi_type *element = FMSFFITypeForEncoding(&type, storage);
+    if (element == NULL || repeat == 0) return NO;
+    
+    if (**cursor == '[') {
+        if (*type != ']') return NO;
+        type++;
+    }
+    
+    for (size_t index = 0; index < repeat; index++) {
+        
+        if (*count + 1 >= *capacity) {
+            *capacity = MAX(*capacity * 2, (size_t)8);
+            *elements = realloc(*elements, *capacity * sizeof(ffi_type *));
+        }
+        
+        (*elements)[(*count)++] = element;
+    }
+    
+    *cursor = type;
+    return YES;
+}
+
+static ffi_type *FMSFFITypeForEncoding(const char **cursor, NSMutableArray *storage) {
+    
+    const char *type = FMSSkipTypeQualifiers(*cursor);
+    ffi_type *result = NULL;
+    
+    switch (*type) {
+        case 'c': result = &ffi_type_schar; type++; break;
+        case 'C': result = &ffi_type_uchar; type++; break;
+        case 'B': result = &ffi_type_uint8; type++; break;
+        case 's': result = &ffi_type_sshort; type++; break;
+        case 'S': result = &ffi_type_ushort; type++; break;
+        case 'i': result = &ffi_type_sint; type++; break;
+        case 'I': result = &ffi_type_uint; type++; break;
+        case 'l': result = &ffi_type_sint32; type++; break;
+        case 'L': result = &ffi_type_uint32; type++; break;
+        case 'q': result = &ffi_type_sint64; type++; break;
+        case 'Q': result = &ffi_type_uint64; type++; break;
+        case 'f': result = &ffi_type_float; type++; break;
+        case 'd': result = &ffi_type_double; type++; break;
+        case 'D': result = &ffi_type_longdouble; type++; break;
+        case 'v': result = &ffi_type_void; type++; break;
+            
+        case '#':
+        case ':':
+        case '*':
+            result = &ffi_type_pointer;
+            type++;
+            break;
+            
+        case '@':
+            result = &ffi_type_pointer;
+            type++;
+            if (*type == '?') {
+                type++;
+            } else if (*type == '"') {
+                const char *end = strchr(type + 1, '"');
+                type = (end != NULL) ? end + 1 : type;
+            }
+            break;
+            
+        case '^':
+            result = &ffi_type_pointer;
+            type = NSGetSizeAndAlignment(type + 1, NULL, NULL);
+            break;
+            
+        case '{': {
+            
+            // Skip the struct's name.
+            while (*type != '\0' && *type != '=' && *type != '}') type++;
+            if (*type == '=') type++;
+            
+            ffi_type **elements = NULL;
+            size_t count = 0;
+            size_t capacity = 0;
+            
+            while (*type != '}' && *type != '\0') {
+                
+                // Field names appear in some encodings.
+                if (*type == '"') {
+                    const char *end = strchr(type + 1, '"');
+                    if (end == NULL) break;
+                    type = end + 1;
+                }
+                
+                if (!FMSAppendFFIElements(&type, storage, &elements, &count, &capacity)) {
+                    free(elements);
+                    return NULL;
+                }
+            }
+            
+            if (*type != '}' || count == 0) {
+                free(elements);
+                return NULL;
+            }
+            
+            type++;
+            elements[count] = NULL;
+            
+            ffi_type structType = {0};
+            structType.type = FFI_TYPE_STRUCT;
+            structType.elements = FMSStoreFFIBytes(storage, elements, (count + 1) * sizeof(ffi_type *));
+            free(elements);
+            
+            result = FMSStoreFFIBytes(storage, &structType, sizeof(structType));
+            break;
+        }
+            
+        default:
+            // Unions, bitfields and anything we don't recognize.
+            return NULL;
+    }
+    
+    *cursor = type;
+    return result;
+}
+
+static void FMSFFITrampolineHandler(ffi_cif *cif, void *result, void **arguments, void *userData) {
+    
+    FMS_SWIZZLED_CALL_SCOPE;
+    
+    __unsafe_unretained FMSFFITrampoline *trampoline = (__bridge FMSFFITrampoline *)userData;
+    void *receiver = *(void **)arguments[0];
+    
+    if (trampoline->_resolve != NULL) {
+        ffi_call(cif, FFI_FN(trampoline->_resolve(trampoline->_context, receiver, trampoline->_selector)), result, arguments);
+        return;
+    }
+    
+    uint64_t state = trampoline->_before(trampoline->_context, receiver, trampoline->_selector);
+    ffi_call(cif, FFI_FN(trampoline->_token->_previousImplementation), result, arguments);
+    trampoline->_after(trampoline->_context, receiver, trampoline->_selector, state);
+}
+
+static IMP FMSMakeFFITrampoline(Method method,
+                                SEL selector,
+                                FMSSwizzleToken *token,
+                                id context,
+                                FMSTrampolineBefore before,
+                                FMSTrampolineAfter after,
+                                FMSTrampolineResolve resolve) {
+    
+    FMSFFITrampoline *trampoline = [[FMSFFITrampoline alloc] init];
+    trampoline->_typeStorage = [[NSMutableArray alloc] init];
+    trampoline->_selector = selector;
+    trampoline->_token = token;
+    trampoline->_contextObject = context;
+    trampoline->_context = (__bridge void *)context;
+    trampoline->_before = before;
+    trampoline->_after = after;
+    trampoline->_resolve = resolve;
+    
+    unsigned int argumentCount = method_getNumberOfArguments(method);
+    ffi_type **argumentTypes = calloc(argumentCount, sizeof(ffi_type *));
+    
+    for (unsigned int index = 0; index < argumentCount; index++) {
+        
+        char *encoding = method_copyArgumentType(method, index);
+        const char *cursor = encoding;
+        argumentTypes[index] = FMSFFITypeForEncoding(&cursor, trampoline->_typeStorage);
+        free(encoding);
+        
+        if (argumentTypes[index] == NULL) {
+            free(argumentTypes);
+            return NULL;
+        }
+    }
+    
+    char *returnEncoding = method_copyReturnType(method);
+    const char *cursor = returnEncoding;
+    ffi_type *returnType = FMSFFITypeForEncoding(&cursor, trampoline->_typeStorage);
+    free(returnEncoding);
+    
+    if (returnType == NULL) {
+        free(argumentTypes);
+        return NULL;
+    }
+    
+    void *storedArgumentTypes = FMSStoreFFIBytes(trampoline->_typeStorage, argumentTypes, argumentCount * sizeof(ffi_type *));
+    free(argumentTypes);
+    
+    if (ffi_prep_cif(&trampoline->_cif, FFI_DEFAULT_ABI, argumentCount, returnType, storedArgumentTypes) != FFI_OK) {
+        return NULL;
+    }
+    
+    trampoline->_closure = ffi_closure_alloc(sizeof(ffi_closure), &trampoline->_code);
+    if (trampoline->_closure == NULL) return NULL;
+    
+    if (ffi_prep_closure_loc(trampoline->_closure,
+                             &trampoline->_cif,
+                             FMSFFITrampolineHandler,
+                             (__bridge void *)trampoline,
+                             trampoline->_code) != FFI_OK) {
+        
+        ffi_closure_free(trampoline->_closure);
+        return NULL;
+    }
+    
+    ffi_closure *closure = trampoline->_closure;
+    token->_disposeImplementation = ^{
+        ffi_closure_free(closure);
+    };
+    
+    // The token owns the trampoline (which owns the context); the closure only holds it unretained.
+    token->_context = trampoline;
+    
+    return (IMP)trampoline->_code;
+}
+
+#endif
+
+#pragma mark - Installing Trampolines
+
+FMSSwizzleToken *FMSInstallTrampoline(Class cls,
+                                      SEL selector,
+                                      id context,
+                                      FMSTrampolineBefore before,
+                                      FMSTrampolineAfter after) {
+    
+    Method method = class_getInstanceMethod(cls, selector);
+    
+    if (method == NULL) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"The original method does not exist"];
+    }
+    
+    FMSTrampolineShape shape;
+    BOOL hasShape = FMSGetTrampolineShape(method, &shape);
+    
+#if !FMS_USE_LIBFFI
+    if (!hasShape) {
+        [NSException
+         raise:NSInvalidArgumentException
+         format:@"%@ has a signature (%s) that FMSSwizzler cannot wrap. Build with FMS_USE_LIBFFI=1 to support it.",
+         NSStringFromSelector(selector), method_getTypeEncoding(method)];
+    }
+#endif
+    
+    void *contextPointer = (__bridge void *)context;
+    
+    return FMSInstallReplacement(cls, selector, ^IMP(FMSSwizzleToken *token) {
+        
+        if (hasShape) {
+            token->_context = context;
+            return imp_implementationWithBlock(FMSMakeTrampolineBlock(shape, selector, token, contextPointer, before, after));
+        }
+        
+#if FMS_USE_LIBFFI
+        IMP implementation = FMSMakeFFITrampoline(method, selector, token, context, before, after, NULL);
+        
+        if (implementation == NULL) {
+            [NSException
+             raise:NSInvalidArgumentException
+             format:@"%@ has a signature (%s) that FMSSwizzler cannot wrap.",
+             NSStringFromSelector(selector), method_getTypeEncoding(method)];
+        }
+        
+        return implementation;
+#else
+        return NULL;
+#endif
+    });
+}
+
+FMSSwizzleToken *FMSInstallDispatchTrampoline(Class cls, SEL selector, id context, FMSTrampolineResolve resolve) {
+    
+    Method method = class_getInstanceMethod(cls, selector);
+    
+    if (method == NULL) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"The original method does not exist"];
+    }
+    
+    FMSTrampolineShape shape;
+    BOOL hasShape = FMSGetTrampolineShape(method, &shape);
+    
+#if !FMS_USE_LIBFFI
+    if (!hasShape) {
+        [NSException
+         raise:NSInvalidArgumentException
+         format:@"%@ has a signature (%s) that FMSSwizzler cannot dispatch. Build with FMS_USE_LIBFFI=1 to support it.",
+         NSStringFromSelector(selector), method_getTypeEncoding(method)];
+    }
+#endif
+    
+    void *contextPointer = (__bridge void *)context;
+    
+    return FMSInstallReplacement(cls, selector, ^IMP(FMSSwizzleToken *token) {
+        
+        if (hasShape) {
+            token->_context = context;
+            return imp_implementationWithBlock(FMSMakeDispatchBlock(shape, selector, contextPointer, resolve));
+        }
+        
+#if FMS_USE_LIBFFI
+        IMP implementation = FMSMakeFFITrampoline(method, selector, token, context, NULL, NULL, resolve);
+        
+        if (implementation == NULL) {
+            [NSException
+             raise:NSInvalidArgumentException
+             format:@"%@ has a signature (%s) that FMSSwizzler cannot dispatch.",
+             NSStringFromSelector(selector), method_getTypeEncoding(method)];
+        }
+        
+        return implementation;
+#else
+        return NULL;
+#endif
+    });
+}
+
+IMP FMSImplementationWithBlock(Method method, id block, BOOL *counted) {
+    
+    FMSTrampolineShape shape;
+    *counted = (method != NULL && FMSGetTrampolineShape(method, &shape));
+    
+    if (!*counted) {
+        return imp_implementationWithBlock(block);
+    }
+    
+    // The counting trampoline keeps the (copied) block alive, and imp_removeBlock() releases both.
+    return imp_implementationWithBlock(FMSMakeCountedBlock(shape, [block copy]));
+}
+
+static IMP FMSResolveInheritedImplementation(void *context, void *receiver, SEL selector) {
+    return class_getMethodImplementation(class_getSuperclass((__bridge Class)context), selector);
+}
+
+IMP FMSMakeInheritingImplementation(Class cls, SEL selector) {
+    
+    FMSTrampolineShape shape;
+    
+    if (!FMSGetTrampolineShape(class_getInstanceMethod(cls, selector), &shape)) {
+        return NULL;
+    }
+    
+    // Only instances of `cls` (or its subclasses) can reach the IMP, so `cls` is alive whenever it runs.
+    return imp_implementationWithBlock(FMSMakeDispatchBlock(shape,
+                                                            selector,
+                                                            (__bridge void *)cls,
+                                                            FMSResolveInheritedImplementation));
+}
+
+FMSSwizzleToken *FMSInstallSampledTrampoline(Class cls,
+                                             SEL selector,
+                                             FMSSampler *sampler,
+                                             id context,
+                                             FMSTrampolineBefore before,
+                                             FMSTrampolineAfter after) {
+    
+    Method method = class_getInstanceMethod(cls, selector);
+    
+    if (method == NULL) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"The original method does not exist"];
+    }
+    
+    // The sampled path needs two precompiled trampolines of the same shape, so libffi closures aren't used here.
+    FMSTrampolineShape shape;
+    
+    if (!FMSGetTrampolineShape(method, &shape)) {
+        [NSException
+         raise:NSInvalidArgumentException
+         format:@"%@ has a signature (%s) that FMSSwizzler cannot sample.",
+         NSStringFromSelector(selector), method_getTypeEncoding(method)];
+    }
+    
+    void *contextPointer = (__bridge void *)context;
+    void *samplerPointer = (__bridge void *)sampler;
+    
+    FMSSwizzleToken *token = FMSInstallReplacement(cls, selector, ^IMP(FMSSwizzleToken *token) {
+        
+        IMP sampledImplementation =
+        imp_implementationWithBlock(FMSMakeTrampolineBlock(shape, selector, token, contextPointer, before, after));
+        IMP dispatchImplementation =
+        imp_implementationWithBlock(FMSMakeDispatchBlock(shape, selector, samplerPointer, FMSSamplerResolve));
+        
+        sampler->_sampledImplementation = sampledImplementation;
+        sampler->_installedToken = token;
+        sampler->_context = context;
+        
+        token->_context = sampler;
+        token->_disposeImplementation = ^{
+            imp_removeBlock(dispatchImplementation);
+            imp_removeBlock(sampledImplementation);
+        };
+        
+        return dispatchImplementation;
+    });
+    
+    sampler->_token = token;
+    
+    return token;
+}
+
+FMSSwizzleToken *FMSInstallHookChainTrampoline(Class cls, SEL selector, FMSHookChain *chain) {
+    
+    Method method = class_getInstanceMethod(cls, selector);
+    
+    if (method == NULL) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"The original method does not exist"];
+    }
+    
+    // Around handlers need the call wrapped in a block, which only the precompiled trampolines can build.
+    FMSTrampolineShape shape;
+    
+    if (!FMSGetTrampolineShape(method, &shape)) {
+        [NSException
+         raise:NSInvalidArgumentException
+         format:@"%@ has a signature (%s) that FMSSwizzler cannot chain.",
+         NSStringFromSelector(selector), method_getTypeEncoding(method)];
+    }
+    
+    void *chainPointer = (__bridge void *)chain;
+    
+    return FMSInstallReplacement(cls, selector, ^IMP(FMSSwizzleToken *token) {
+        
+        IMP implementation = imp_implementationWithBlock(FMSMakeHookChainBlock(shape, selector, token, chainPointer));
+        
+        // Calls already inside the trampoline keep reading the chain's reader counts, so the chain goes along with
+        // the restored IMP (as the token's context). Detaching frees its handlers sooner, through its own epochs.
+        token->_context = chain;
+        token->_detachContext = ^{
+            FMSDetachHookChain(chain);
+        };
+        
+        return implementation;
+    });
+}
+
+#pragma mark - Method Hooks
+
+@interface FMSMethodHook : NSObject {
+@public
+    FMSMethodHookBlock _before;
+    FMSMethodHookBlock _after;
+}
+@end
+
+@implementation FMSMethodHook
+@end
+
+static uint64_t FMSMethodHookBefore(void *context, void *receiver, SEL selector) {
+    
+    __unsafe_unretained FMSMethodHook *hook = (__bridge FMSMethodHook *)context;
+    
+    if (hook->_before != nil) {
+        hook->_before((__bridge id)receiver, selector);
+    }
+    
+    return 0;
+}
+
+static void FMSMethodHookAfter(void *context, void *receiver, SEL selector, uint64_t state) {
+    
+    __unsafe_unretained FMSMethodHook *hook = (__bridge FMSMethodHook *)context;
+    
+    if (hook->_after != nil) {
+        hook->_after((__bridge id)receiver, selector);
+    }
+}
+
+FMSSwizzleToken *FMSInstallMethodHook(Class cls, SEL selector, FMSMethodHookBlock before, FMSMethodHookBlock after) {
+    
+    if (before == nil && after == nil) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"A hook needs a before block, an after block, or both"];
+    }
+    
+    FMSMethodHook *hook = [[FMSMethodHook alloc] init];
+    hook->_before = [before copy];
+    hook->_after = [after copy];
+    
+    return FMSInstallTrampoline(cls, selector, hook, FMSMethodHookBefore, FMSMethodHookAfter);
+}
+
+FMSSwizzleToken *FMSInstallSampledMethodHook(Class cls,
+                                             SEL selector,
+                                             FMSSampler *sampler,
+                                             FMSMethodHookBlock before,
+                                             FMSMethodHookBlock after) {
+    
+    if (before == nil && after == nil) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"A hook needs a before block, an after block, or both"];
+    }
+    
+    FMSMethodHook *hook = [[FMSMethodHook alloc] init];
+    hook->_before = [before copy];
+    hook->_after = [after copy];
+    
+    return FMSInstallSampledTrampoline(cls, selector, sampler, hook, FMSMethodHookBefore, FMSMethodHookAfter);
+}
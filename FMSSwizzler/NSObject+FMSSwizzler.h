@@ -56,9 +56,24 @@
  */
 
 #import <Foundation/Foundation.h>
+#import "FMSSwizzleToken.h"
+#import "FMSMethodStatistics.h"
+#import "FMSSwizzleBatch.h"
+#import "FMSSwizzleRecord.h"
+#import "FMSSampler.h"
+#import "FMSIMPSnapshot.h"
+#import "FMSHookChain.h"
 
 /**
- * Used to set the property type for dynamicly added pseudo-properties. All properties are nonatomic.
+ * Used to set the property type for dynamicly added pseudo-properties. Properties are nonatomic unless
+ * their type name ends in `Atomic`.
+ *
+ * Scalar and struct values are stored unboxed. They are never wrapped in `NSNumber` or `NSValue` objects.
+ *
+ * Atomic scalars are read and written with C11 atomic loads and stores, so they never take a lock. Atomic
+ * objects are guarded by a small table of striped spinlocks, so unrelated properties rarely contend with
+ * each other. The fastest atomic accessors come from `FMS_allocateSubclassWithPseudoProperties:`, where
+ * the value lives in an instance variable and the getter is a single atomic load.
  */
 
 enum pseudoPropertyType {
@@ -70,7 +85,18 @@ enum pseudoPropertyType {
     FMSInteger,             /**< Used for scalar `NSInteger` values */
     FMSUnsignedInteger,     /**< Used for scalar `NSUInteger` values */
     FMSFloat,               /**< Used for scalar `float` values */
-    FMSDouble               /**< Used for scalar `double` values */
+    FMSDouble,              /**< Used for scalar `double` values */
+    FMSRange,               /**< Used for `NSRange` struct values */
+    FMSPoint,               /**< Used for `CGPoint` struct values (`NSPoint` on OS X and GNUstep) */
+    FMSSize,                /**< Used for `CGSize` struct values (`NSSize` on OS X and GNUstep) */
+    FMSRect,                /**< Used for `CGRect` struct values (`NSRect` on OS X and GNUstep) */
+    FMSObjectWeak,          /**< Used for objects that should be held as a zeroing weak reference. */
+    FMSObjectRetainAtomic,  /**< Used for objects that should be retained, with atomic accessors. */
+    FMSBoolAtomic,          /**< Used for scalar `BOOL` values, with atomic accessors */
+    FMSIntegerAtomic,       /**< Used for scalar `NSInteger` values, with atomic accessors */
+    FMSUnsignedIntegerAtomic, /**< Used for scalar `NSUInteger` values, with atomic accessors */
+    FMSFloatAtomic,         /**< Used for scalar `float` values, with atomic accessors */
+    FMSDoubleAtomic         /**< Used for scalar `double` values, with atomic accessors */
 };
 
 /** 
@@ -85,6 +111,63 @@ typedef enum pseudoPropertyType FMSPseudoPropertyType;
  */
 typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
 
+/**
+ * Computes the first value of a lazy pseudo property for the given object. Object properties use the returned
+ * object directly. Scalar properties unwrap an `NSNumber`, and struct properties unwrap an `NSValue`, once, when
+ * the value is stored. Returning `nil` stores `nil` or zero.
+ */
+typedef id (^FMSPseudoPropertyInitializer) (id _self);
+
+/**
+ * A block that can add a lazy property of the given property name to its class. The initializer computes the
+ * property's value on first access. If `invalidationSelector` is not `NULL`, a method with that selector is also
+ * added; calling it makes the next read run the initializer again.
+ */
+typedef void (^FMSLazyPseudoPropertyAdder) (NSString *propertyName,
+                                            FMSPseudoPropertyInitializer initializer,
+                                            SEL invalidationSelector);
+
+/**
+ * A block that configures a newly created, shared dynamic subclass. See
+ * `FMS_dynamiclySubclassWithSignature:configuration:`.
+ */
+typedef void (^FMSDynamicSubclassConfiguration) (Class cls);
+
+/**
+ * A block that is called before or after a hooked method. See `FMS_hookInstanceMethod:before:after:`.
+ */
+typedef void (^FMSMethodHookBlock) (id receiver, SEL selector);
+
+/**
+ * Runs the rest of a hook chain: the around handlers inside this one, then the original implementation. See
+ * `FMS_chainInstanceMethod:around:`.
+ */
+typedef void (^FMSHookChainProceedBlock) (void);
+
+/**
+ * A block that is called around a method in a hook chain. It runs the method by calling `proceed`. See
+ * `FMS_chainInstanceMethod:around:`.
+ */
+typedef void (^FMSHookChainAroundBlock) (id receiver, SEL selector, FMSHookChainProceedBlock proceed);
+
+/**
+ * A block that describes a batch of swizzles. See `FMS_performSwizzleBatch:`.
+ */
+typedef void (^FMSSwizzleBatchBlock) (FMSSwizzleBatch *batch);
+
+/**
+ * A block that runs inside a pseudo property arena scope. See `FMS_performWithPseudoPropertyArena:`.
+ */
+typedef void (^FMSPseudoPropertyArenaBlock) (void);
+
+/**
+ * Describes a single pseudo property for `FMS_addPseudoPropertyDescriptors:count:`.
+ */
+typedef struct {
+    __unsafe_unretained NSString *name;     /**< The property name. The string must stay alive until the call returns. */
+    FMSPseudoPropertyType type;             /**< The property's type. */
+} FMSPseudoPropertyDescriptor;
+
 
 /**
  * @brief FMSSwizzler's public methods.
@@ -94,12 +177,29 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  */
 @interface NSObject (FMS_Swizzler)
 
+/**
+ * @brief Turns FMSSwizzler's diagnostic logging on or off.
+ *
+ * @param enabled `YES` to log each pseudo property as it is created, `NO` to stay quiet. Logging is off by default.
+ *
+ * The setting is global. It is not tied to the class you call it on.
+ */
+
++ (void)FMS_setLoggingEnabled:(BOOL)enabled;
+
+/**
+ * @brief Returns `YES` if FMSSwizzler's diagnostic logging is turned on.
+ */
+
++ (BOOL)FMS_isLoggingEnabled;
+
 /**
  * @brief adds a new instance method using the same implementation as the original selector
  *
  * @param originalSelector This is the original selector whose implementation we wish to alias. This must be an instance method that is currently defined either by the current class or by one of its ancestors.
  *
  * @param newSelector This is the selector for the new method we will create. This instance method must not yet exist either in the current class or in any of its ancestors. Additionally, this must have the same number of arguments as `originalSelector`.
+ * @return A token that can remove the alias again. Restoring the token retires `newSelector`, so it may be reused by a later alias.
  *
  * This method creates a new method using the `newSelector` and the implementation from the `originalSelector`. 
  * We then have two methods that both use the same implementation. This is particularly useful if you wish to replace
@@ -125,13 +225,27 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  * may no longer function properly. This should be rare, however.
  */
 
-+ (void)FMS_aliasInstanceMethod:(SEL)originalSelector newSelector:(SEL)newSelector;
++ (FMSSwizzleToken *)FMS_aliasInstanceMethod:(SEL)originalSelector newSelector:(SEL)newSelector;
+
+/**
+ * @brief Same as `FMS_aliasInstanceMethod:newSelector:`, but can skip the argument count check.
+ *
+ * @param verified `YES` if the caller has already checked that `newSelector` takes as many arguments as the original method.
+ *
+ * You normally won't call this directly. The `FMS_ALIAS_INSTANCE_METHOD()` macro checks literal selectors at compile
+ * time, and passes `YES` when they match.
+ */
+
++ (FMSSwizzleToken *)FMS_aliasInstanceMethod:(SEL)originalSelector
+                                 newSelector:(SEL)newSelector
+                      argumentCountsVerified:(BOOL)verified;
 
 /**
  * @brief Replaces the specified method with the given block.
  *
  * @param methodSelector The selector for the method we wish to replace.
  * @param block A block containing our new implementation. This block must start with an argument for the current object (the equivilant of the `self` argument--note that we do not need to include the `_cmd` argument). Next, we  need to match all the method's arguments exactly. If you do not, it could cause the applicaiton to crash at runtime. Finally, the block needs to return the same type of data as the original method.
+ * @return A token that puts the previous implementation back and frees the block.
  *
  * This method replaces the specified method's current `IMP` with a new `IMP` created from the provided block. 
  * Our block must return the same data type as the original implementation. It must also take a number of 
@@ -163,7 +277,7 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  * if you end up not changing the underlying values.
  */
 
-+ (void)FMS_replaceInstanceMethod:(SEL)methodSelector withImplementationBlock:(id)block;
++ (FMSSwizzleToken *)FMS_replaceInstanceMethod:(SEL)methodSelector withImplementationBlock:(id)block;
 
 /**
  * @brief Allows you to replace the implementation of an existing method, while still providing access to the original implementation.
@@ -171,6 +285,7 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  * @param selector This is the selector for the method you wish to override.
  * @param oldSelector This is the selector that will be used for accessing the old implementation. This must have the same number of arguments as the original `selector`.
  * @param block A block containing our new implementation. This block must start with an argument for the current object (the equivilant of the `self` argument--note that we do not need to include the `_cmd` argument). Next, we  need to match all the method's arguments exactly. If you do not, it could cause the applicaiton to crash at runtime. Finally, the block needs to return the same type of data as the original method.
+ * @return A token that removes the override. The previous implementation is put back, the block is freed, and `oldSelector` is retired so it may be reused by a later override.
  *
  * This method starts by creating an alias of the specified method using the `oldSelector` argument. Then it 
  * replaces the method's current `IMP` with a new `IMP` created from the provided block. This leaves us with
@@ -205,7 +320,20 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  * may no longer function properly. This should be rare, however.
  */
 
-+ (void)FMS_overrideInstanceMethod:(SEL)selector oldSelector:(SEL)oldSelector implementationBlock:(id)block;
++ (FMSSwizzleToken *)FMS_overrideInstanceMethod:(SEL)selector oldSelector:(SEL)oldSelector implementationBlock:(id)block;
+
+/**
+ * @brief Same as `FMS_overrideInstanceMethod:oldSelector:implementationBlock:`, but can skip the argument count check.
+ *
+ * @param verified `YES` if the caller has already checked that `oldSelector` takes as many arguments as the original method.
+ *
+ * You normally won't call this directly. Use the `FMS_OVERRIDE_INSTANCE_METHOD()` macro instead.
+ */
+
++ (FMSSwizzleToken *)FMS_overrideInstanceMethod:(SEL)selector
+                                    oldSelector:(SEL)oldSelector
+                         argumentCountsVerified:(BOOL)verified
+                            implementationBlock:(id)block;
 
 /**
  * @brief adds a new class method using the same implementation as the original selector
@@ -213,6 +341,7 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  * @param originalSelector This is the original selector whose implementation we wish to alias. This must be a class method that is currently defined either by the current class or by one of its ancestors.
  *
  * @param newSelector This is the selector for the new class method we will create. This method must not yet exist either in the current class or in any of its ancestors. Additionally, this must have the same number of arguments as `originalSelector`.
+ * @return A token that can remove the alias again. Restoring the token retires `newSelector`, so it may be reused by a later alias.
  *
  * This method creates a new class method using the `newSelector` and the implementation from the `originalSelector`.
  * We then have two methods that both use the same implementation. This is particularly useful if you wish to replace
@@ -223,13 +352,26 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  * may no longer function properly. This should be rare, however.
  */
 
-+ (void)FMS_aliasClassMethod:(SEL)originalSelector newSelector:(SEL)newSelector;
++ (FMSSwizzleToken *)FMS_aliasClassMethod:(SEL)originalSelector newSelector:(SEL)newSelector;
+
+/**
+ * @brief Same as `FMS_aliasClassMethod:newSelector:`, but can skip the argument count check.
+ *
+ * @param verified `YES` if the caller has already checked that `newSelector` takes as many arguments as the original method.
+ *
+ * You normally won't call this directly. Use the `FMS_ALIAS_CLASS_METHOD()` macro instead.
+ */
+
++ (FMSSwizzleToken *)FMS_aliasClassMethod:(SEL)originalSelector
+                              newSelector:(SEL)newSelector
+                   argumentCountsVerified:(BOOL)verified;
 
 /**
  * @brief Replaces the specified class method with the given block.
  *
  * @param methodSelector The selector for the class method we wish to replace.
  * @param block A block containing our new implementation. This block must start with an argument for the current class (the equivilant of the `self` argument in other class methods--note that we do not need to include the `_cmd` argument). Next, we  need to match all the class method's arguments exactly. If you do not, it could cause the applicaiton to crash at runtime. Finally, the block needs to return the same type of data as the original method.
+ * @return A token that puts the previous implementation back and frees the block.
  *
  * This method replaces the specified class method's current `IMP` with a new `IMP` created from the provided block.
  * Our block must return the same data type as the original implementation. It must also take a number of
@@ -241,7 +383,7 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  *
  */
 
-+ (void)FMS_replaceClassMethod:(SEL)methodSelector withImplementationBlock:(id)block;
++ (FMSSwizzleToken *)FMS_replaceClassMethod:(SEL)methodSelector withImplementationBlock:(id)block;
 
 /**
  * @brief Allows you to replace the implementation of an existing class method, while still providing access to the original implementation.
@@ -249,6 +391,7 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  * @param selector This is the selector for the class method you wish to override.
  * @param oldSelector This is the selector that will be used for accessing the old implementation. This must have the same number of arguments as the original `selector`.
  * @param block A block containing our new implementation. This block must start with an argument for the current object (the equivilant of the `self` argument--note that we do not need to include the `_cmd` argument). Next, we  need to match all the method's arguments exactly. If you do not, it could cause the applicaiton to crash at runtime. Finally, the block needs to return the same type of data as the original method.
+ * @return A token that removes the override. The previous implementation is put back, the block is freed, and `oldSelector` is retired so it may be reused by a later override.
  *
  * This method starts by creating an alias of the specified class method using the `oldSelector` argument. Then it
  * replaces the method's current `IMP` with a new `IMP` created from the provided block. This leaves us with
@@ -271,7 +414,256 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  * may no longer function properly. This should be rare, however.
  */
 
-+ (void)FMS_overrideClassMethod:(SEL)selector oldSelector:(SEL)oldSelector implementationBlock:(id)block;
++ (FMSSwizzleToken *)FMS_overrideClassMethod:(SEL)selector oldSelector:(SEL)oldSelector implementationBlock:(id)block;
+
+/**
+ * @brief Same as `FMS_overrideClassMethod:oldSelector:implementationBlock:`, but can skip the argument count check.
+ *
+ * @param verified `YES` if the caller has already checked that `oldSelector` takes as many arguments as the original method.
+ *
+ * You normally won't call this directly. Use the `FMS_OVERRIDE_CLASS_METHOD()` macro instead.
+ */
+
++ (FMSSwizzleToken *)FMS_overrideClassMethod:(SEL)selector
+                                 oldSelector:(SEL)oldSelector
+                      argumentCountsVerified:(BOOL)verified
+                         implementationBlock:(id)block;
+
+/**
+ * @brief Applies many aliases, replacements and overrides, possibly across many classes, in one go.
+ *
+ * @param batchBlock A block that adds the swizzles to the batch it is given. Nothing changes while it runs.
+ * @return What the batch did: a token for each swizzle, the number of methods written, and how long it took.
+ *
+ * This is meant for code that installs hundreds of hooks at launch. Every swizzle is checked first. If any of
+ * them would fail, an `NSInvalidArgumentException` naming its position in the batch is thrown, and no class is
+ * changed. Otherwise the swizzles are grouped by class and applied while holding the locks for every class
+ * involved. Each method is written to the runtime only once, with its final implementation, so overriding or
+ * replacing the same method several times costs a single write (and a single method cache flush).
+ *
+ * The swizzles for a single class are applied in the order they were added. Superclasses are applied before
+ * their subclasses, so a subclass that swizzles an inherited method sees any change the batch makes to it.
+ *
+ * Note: Don't call other `FMS_` methods from inside `batchBlock`. They take effect immediately, and the batch
+ * is checked against whatever they leave behind.
+ */
+
++ (FMSSwizzleBatchResult *)FMS_performSwizzleBatch:(FMSSwizzleBatchBlock)batchBlock;
+
+/**
+ * @brief Wraps an instance method so that every call is counted and timed.
+ *
+ * @param selector The selector for the method we wish to instrument. The method must be defined either by the current class or by one of its ancestors.
+ * @return A token that removes the instrumentation again. The statistics gathered so far are kept.
+ *
+ * This is the built-in equivalent of overriding a method with a block that reads the clock before and after
+ * calling the original. You don't need to write a block that matches the method's signature: the wrapper is
+ * chosen from the method's type encoding. Use `FMS_statisticsForInstanceMethod:` to read the results.
+ *
+ * Each thread records its calls in its own counters, so instrumented calls never take a lock or contend with
+ * calls on other threads. The counters are only added up when you ask for statistics.
+ *
+ * The overhead budget is two reads of the monotonic clock plus a few uncontended loads and stores per call.
+ * `FMSRunInstrumentationBenchmarks()` (in the Benchmarks folder) measures it against an uninstrumented call and
+ * a hand-written override.
+ *
+ * Note: The method's signature must be one that `FMS_hookInstanceMethod:before:after:` can wrap. Anything else
+ * throws an `NSInvalidArgumentException`.
+ *
+ * Note: Calls that end by throwing an exception are not recorded.
+ *
+ * Note: Instrumenting the same method on the same class twice throws an `NSInvalidArgumentException`. If you restore
+ * the token and then instrument the method again, the new calls are added to the existing statistics.
+ */
+
++ (FMSSwizzleToken *)FMS_instrumentInstanceMethod:(SEL)selector;
+
+/**
+ * @brief Wraps an instance method so that one in every `samplingRate` calls is counted and timed.
+ *
+ * @param selector The selector for the method we wish to instrument. The method must be defined either by the current class or by one of its ancestors.
+ * @param samplingRate The number of calls per sample on each thread. 1 times every call, and 0 none.
+ * @return A sampler that changes the rate while the method is instrumented. Its `token` removes the instrumentation again.
+ *
+ * Works like `FMS_instrumentInstanceMethod:`, but calls that aren't sampled skip the clock reads and counters and
+ * go straight to the original implementation. See `FMS_hookInstanceMethod:samplingRate:before:after:`.
+ *
+ * Note: The statistics only include the sampled calls. Multiply `callCount` by the rate for an estimate of the
+ * total, bearing in mind that the estimate is only as good as the rate has been steady.
+ *
+ * Note: A method can only be instrumented once at a time, sampled or not.
+ */
+
++ (FMSSampler *)FMS_instrumentInstanceMethod:(SEL)selector samplingRate:(NSUInteger)samplingRate;
+
+/**
+ * @brief Returns the call count and latency histogram for an instrumented instance method.
+ *
+ * @param selector The selector that was passed to `FMS_instrumentInstanceMethod:` on this class.
+ * @return A snapshot of the calls made so far, or `nil` if the method was never instrumented on this class.
+ */
+
++ (FMSMethodStatistics *)FMS_statisticsForInstanceMethod:(SEL)selector;
+
+/**
+ * @brief Runs blocks before and after every call to an instance method, without writing a signature-matching block.
+ *
+ * @param selector The selector for the method we wish to hook. The method must be defined either by the current class or by one of its ancestors.
+ * @param before A block that is called with the receiver and selector before the original implementation runs. May be `nil`.
+ * @param after A block that is called with the receiver and selector after the original implementation returns. May be `nil`.
+ * @return A token that removes the hook again.
+ *
+ * `FMS_overrideInstanceMethod:oldSelector:implementationBlock:` needs a block whose signature exactly matches the
+ * method. The only generic alternative the runtime offers is `forwardInvocation:`, which builds an `NSInvocation`
+ * on every call. This method reads the method's type encoding once, when the hook is installed, and picks a
+ * precompiled trampoline for that signature. The trampoline calls your blocks and the original `IMP` directly,
+ * passing the arguments and return value through untouched.
+ *
+ * Precompiled trampolines cover methods with up to six arguments that are objects, classes, selectors, pointers,
+ * integers or BOOLs, plus (on x86_64 and arm64) up to eight float or double arguments in any order. The method
+ * may return nothing, any of those types, an `NSRange`, or a point, size or rectangle. Other signatures (struct
+ * arguments, for example) need FMSSwizzler to be built with `FMS_USE_LIBFFI=1` and linked against libffi, in
+ * which case a libffi closure is used instead. Without libffi they throw an `NSInvalidArgumentException`.
+ *
+ * Example:
+ * `[[Person class] FMS_hookInstanceMethod:@selector(setFirstName:) before:^(id receiver, SEL selector){ NSLog(@"about to change the name"); } after:nil];`
+ *
+ * Note: The blocks cannot see or change the method's arguments or return value. Use
+ * `FMS_overrideInstanceMethod:oldSelector:implementationBlock:` for that.
+ *
+ * Note: If the original implementation throws an exception, the `after` block is not called.
+ */
+
++ (FMSSwizzleToken *)FMS_hookInstanceMethod:(SEL)selector before:(FMSMethodHookBlock)before after:(FMSMethodHookBlock)after;
+
+/**
+ * @brief Runs blocks before and after every call to a class method, without writing a signature-matching block.
+ *
+ * @param selector The selector for the class method we wish to hook.
+ * @param before A block that is called with the class and selector before the original implementation runs. May be `nil`.
+ * @param after A block that is called with the class and selector after the original implementation returns. May be `nil`.
+ * @return A token that removes the hook again.
+ *
+ * This is the class method equivalent of `FMS_hookInstanceMethod:before:after:`, and supports the same signatures.
+ */
+
++ (FMSSwizzleToken *)FMS_hookClassMethod:(SEL)selector before:(FMSMethodHookBlock)before after:(FMSMethodHookBlock)after;
+
+/**
+ * @brief Runs blocks before and after one in every `samplingRate` calls to an instance method.
+ *
+ * @param selector The selector for the method we wish to hook. The method must be defined either by the current class or by one of its ancestors.
+ * @param samplingRate The number of calls per sample on each thread. 1 runs the blocks on every call, and 0 on none.
+ * @param before A block that is called with the receiver and selector before the original implementation runs. May be `nil`.
+ * @param after A block that is called with the receiver and selector after the original implementation returns. May be `nil`.
+ * @return A sampler that changes the rate while the hook is installed. Its `token` removes the hook again.
+ *
+ * `FMS_hookInstanceMethod:before:after:` pays for the blocks on every call, which is too much for a method that
+ * is called millions of times a second. A sampled hook keeps a countdown for each thread instead. Calls that don't
+ * reach the end of the countdown are passed straight to the original implementation; only the sampled calls go
+ * through the full hook. See `FMSSampler` for the randomized mode.
+ *
+ * `FMSRunSamplingBenchmarks()` (in the Benchmarks folder) measures the overhead at rates of 1, 100 and 10,000.
+ *
+ * Note: Sampled hooks support the signatures that have a precompiled trampoline (see
+ * `FMS_hookInstanceMethod:before:after:`), even when FMSSwizzler is built with libffi. Anything else throws an
+ * `NSInvalidArgumentException`.
+ */
+
++ (FMSSampler *)FMS_hookInstanceMethod:(SEL)selector
+                          samplingRate:(NSUInteger)samplingRate
+                                before:(FMSMethodHookBlock)before
+                                 after:(FMSMethodHookBlock)after;
+
+/**
+ * @brief Runs blocks before and after one in every `samplingRate` calls to a class method.
+ *
+ * This is the class method equivalent of `FMS_hookInstanceMethod:samplingRate:before:after:`.
+ */
+
++ (FMSSampler *)FMS_hookClassMethod:(SEL)selector
+                       samplingRate:(NSUInteger)samplingRate
+                             before:(FMSMethodHookBlock)before
+                              after:(FMSMethodHookBlock)after;
+
+/**
+ * @brief Adds blocks to run before and after every call to an instance method, to the method's hook chain.
+ *
+ * @param selector The selector for the method we wish to hook. The method must be defined either by the current class or by one of its ancestors.
+ * @param before A block that is called with the receiver and selector before the original implementation runs. May be `nil`.
+ * @param after A block that is called with the receiver and selector after the original implementation returns. May be `nil`.
+ * @return The handler, which can be removed again without disturbing any other handler in the chain.
+ *
+ * Stacking overrides needs a new alias selector for each layer, and each layer costs a message send to the one
+ * below. A hook chain installs a single trampoline for the method instead, the first time a handler is added to
+ * it, and keeps every handler added after that in one array. A call runs the handlers one after another from the
+ * array and then calls the original implementation directly, so no aliases are added and no layer costs a
+ * message send. Handlers can be added and removed at any time, from any thread, without blocking calls that are
+ * already running. See `FMSHookChain` for the order handlers run in.
+ *
+ * `FMSRunHookChainBenchmarks()` (in the Benchmarks folder) compares chains of 1, 4 and 16 handlers with the same
+ * number of stacked overrides.
+ *
+ * Note: Hook chains support the signatures that have a precompiled trampoline (see
+ * `FMS_hookInstanceMethod:before:after:`), even when FMSSwizzler is built with libffi. Anything else throws an
+ * `NSInvalidArgumentException`.
+ *
+ * Note: Like `FMS_hookInstanceMethod:before:after:`, the blocks cannot see or change the arguments or return value.
+ */
+
++ (FMSHookChainHandler *)FMS_chainInstanceMethod:(SEL)selector
+                                          before:(FMSMethodHookBlock)before
+                                           after:(FMSMethodHookBlock)after;
+
+/**
+ * @brief Adds a block that runs around every call to an instance method, to the method's hook chain.
+ *
+ * @param selector The selector for the method we wish to hook. The method must be defined either by the current class or by one of its ancestors.
+ * @param around A block that is called with the receiver, the selector and a `proceed` block. Calling `proceed` runs the around handlers added after this one, and then the original implementation.
+ * @return The handler, which can be removed again without disturbing any other handler in the chain.
+ *
+ * An around handler can do work on both sides of the call in one place (hold a lock, open an autorelease pool,
+ * catch an exception) or decide not to call the method at all. If any around handler returns without calling
+ * `proceed`, the method isn't called and the caller gets zero (or `nil`) back.
+ *
+ * Example:
+ * `[[Person class] FMS_chainInstanceMethod:@selector(fullName) around:^(id receiver, SEL selector, FMSHookChainProceedBlock proceed){ @autoreleasepool { proceed(); } }];`
+ *
+ * Note: `proceed` must be called at most once, and before the around block returns. It lives on the stack, so
+ * copy it if you need to keep it in another block, but don't call it after the around block has returned.
+ */
+
++ (FMSHookChainHandler *)FMS_chainInstanceMethod:(SEL)selector around:(FMSHookChainAroundBlock)around;
+
+/**
+ * @brief Adds blocks to run before and after every call to a class method, to the method's hook chain.
+ *
+ * This is the class method equivalent of `FMS_chainInstanceMethod:before:after:`.
+ */
+
++ (FMSHookChainHandler *)FMS_chainClassMethod:(SEL)selector
+                                       before:(FMSMethodHookBlock)before
+                                        after:(FMSMethodHookBlock)after;
+
+/**
+ * @brief Adds a block that runs around every call to a class method, to the method's hook chain.
+ *
+ * This is the class method equivalent of `FMS_chainInstanceMethod:around:`.
+ */
+
++ (FMSHookChainHandler *)FMS_chainClassMethod:(SEL)selector around:(FMSHookChainAroundBlock)around;
+
+/**
+ * @brief Returns the hook chain for an instance method of this class, or `nil` if it doesn't have one.
+ */
+
++ (FMSHookChain *)FMS_hookChainForInstanceMethod:(SEL)selector;
+
+/**
+ * @brief Returns the hook chain for a class method of this class, or `nil` if it doesn't have one.
+ */
+
++ (FMSHookChain *)FMS_hookChainForClassMethod:(SEL)selector;
 
 /**
  * @brief Generates a `FMSPseudoPropertyAdder` block for the specified class and property type.
@@ -283,10 +675,129 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  * a single `NSString` argument. The adder will dynamically create getter and setter methods using the string as
  * the property name. The adder will use `objc_getAssociatedObject()` and `objc_setAssociatedObject()` as the data
  * storage for the property.
+ *
+ * Object properties are stored directly as associated objects. Scalar and struct properties are stored unboxed
+ * in a per-object block of memory (a slab), which is itself stored as one associated object. Slots in the slab
+ * are laid out in the order the properties are added, so setting and getting a scalar or struct property never
+ * allocates once the object's slab exists. A slab never moves: properties added to a class after an object's
+ * slab was created get a new segment of their own on first write.
  */
 
 + (FMSPseudoPropertyAdder)FMS_generatePseudoPropertyAdderForType:(FMSPseudoPropertyType)type;
 
+/**
+ * @brief Generates a `FMSLazyPseudoPropertyAdder` block for the specified class and property type.
+ *
+ * @param type A `FMSPseudoPropertyType` indicating the type of properties the returned adder should create. `FMSObjectWeak` and `FMSObjectAssignUnsafe` can't be cached, and throw an exception.
+ * @return The `FMSLazyPseudoPropertyAdder` for the calling class that creates lazy pseudo properties of the type specified in the `type` parameter.
+ *
+ * Lazy pseudo properties are meant for derived values that are expensive to compute. Rather than every caller
+ * doing "get, check for nil, compute, set", the getter runs the initializer block the first time it is called on
+ * each object and caches the result in the property's storage. Later calls return the cached value without
+ * taking a lock.
+ *
+ * The initializer runs at most once per object, even when several threads read the property at the same time;
+ * the others wait for the first one to finish. The initializer must not read the property it is initializing.
+ *
+ * Calling the setter stores a value just like a normal pseudo property, and the initializer is skipped. Calling
+ * the invalidation method (e.g. `[model invalidateTotal]`) discards the cached value, so the next read computes
+ * it again. It never runs the initializer itself.
+ *
+ * Note: Lazy object properties are always atomic. Scalar and struct properties are only atomic for the `Atomic`
+ * types; for the others, the first computed value is published safely, but setting or invalidating the property
+ * while another thread is reading it is not.
+ */
+
++ (FMSLazyPseudoPropertyAdder)FMS_generateLazyPseudoPropertyAdderForType:(FMSPseudoPropertyType)type;
+
+/**
+ * @brief Adds several pseudo properties to the class in a single pass.
+ *
+ * @param properties A dictionary whose keys are the property names (`NSString`) and whose values are the `FMSPseudoPropertyType` for each property, wrapped in an `NSNumber` (e.g. `@{@"firstName": @(FMSObjectCopy), @"age": @(FMSUnsignedInteger)}`).
+ *
+ * This creates the same accessors as calling a `FMSPseudoPropertyAdder` once for each property, but every
+ * name and type is validated, and every accessor is checked against a single snapshot of the class's methods
+ * (taken with `class_copyMethodList()`), before any methods are added. If any entry is invalid an exception
+ * is thrown and none of the properties are added, so the class is never left half-installed.
+ */
+
++ (void)FMS_addPseudoProperties:(NSDictionary *)properties;
+
+/**
+ * @brief Adds several pseudo properties to the class in a single pass.
+ *
+ * @param descriptors A C array of `FMSPseudoPropertyDescriptor` structs, one for each property.
+ * @param count The number of descriptors in the array.
+ *
+ * This behaves exactly like `FMS_addPseudoProperties:`, but avoids building a dictionary. It is useful for
+ * static, schema-driven models, e.g.:
+ *
+ * `static const FMSPseudoPropertyDescriptor fields[] = {{@"identifier", FMSObjectCopy}, {@"score", FMSDouble}};`
+ * `[Model FMS_addPseudoPropertyDescriptors:fields count:2];`
+ */
+
++ (void)FMS_addPseudoPropertyDescriptors:(const FMSPseudoPropertyDescriptor *)descriptors count:(NSUInteger)count;
+
+/**
+ * @brief Creates a new subclass whose pseudo properties are stored in real instance variables.
+ *
+ * @param properties A dictionary whose keys are the property names (`NSString`) and whose values are the `FMSPseudoPropertyType` for each property, wrapped in an `NSNumber` (e.g. `@{@"counter": @(FMSDouble)}`).
+ * @return The newly created and registered subclass.
+ *
+ * Pseudo properties created by `FMS_generatePseudoPropertyAdderForType:` store their values with
+ * `objc_getAssociatedObject()` and `objc_setAssociatedObject()`, which take the runtime's global association
+ * lock and perform a hash lookup on every access. This method instead allocates a subclass of the calling class,
+ * adds an instance variable for each property (using `class_addIvar()`) before registering the class, and then
+ * creates accessors that load and store directly at the instance variable's offset. There is no locking and no
+ * hashing on access, except for `FMSObjectRetainAtomic` properties, which take one of the striped spinlocks.
+ *
+ * All property names are validated before the class is allocated. If any name is invalid, or if any of the
+ * accessors already exist, an exception is thrown and no class is created.
+ *
+ * Objects must be created from the returned class (e.g. `[[cls alloc] init]`). Instance variables cannot be added
+ * to objects that already exist, so this storage mode cannot be applied to instances that have been dynamically
+ * subclassed with `FMS_dynamiclySubclass`. Use `FMS_generatePseudoPropertyAdderForType:` for those.
+ */
+
++ (Class)FMS_allocateSubclassWithPseudoProperties:(NSDictionary *)properties;
+
+/**
+ * @brief Runs a block in which new pseudo property storage comes from a single arena that is freed in one go.
+ *
+ * @param block The block to run. Typically it creates, uses and throws away a batch of short-lived objects, such as the objects for one request.
+ *
+ * Scalar and struct pseudo properties (the ones created by `FMS_generatePseudoPropertyAdderForType:` that aren't
+ * objects or atomic) keep each object's values in a slab: a small heap block, owned by a slab object that is
+ * attached to the object and released, and then freed, when the object goes away. When you create and destroy
+ * millions of objects that is a lot of allocating and freeing.
+ *
+ * Inside `block`, the first write to an object's pseudo properties carves its slab out of an arena that belongs
+ * to this call instead. No slab is allocated or freed per object, and the object only holds a pointer to its slab
+ * and a reference to the arena chunk (a large block shared by many objects) it came from. When `block` returns (or
+ * throws) the scope lets go of its chunks, and every chunk that no object still uses is freed in one go. `block` is
+ * wrapped in an `@autoreleasepool`, so objects it autoreleases are gone before that happens.
+ *
+ * Scopes nest: storage comes from the innermost one. Arenas belong to the thread that called this method, so
+ * objects first written on other threads use the heap as usual.
+ *
+ * Objects may outlive the scope, and their slabs never move, so they keep their values and can go on being used
+ * from any thread. A chunk with a surviving object stays allocated (all of it) until the last of its objects is
+ * deallocated, so the arena only pays off when most objects die inside it.
+ *
+ * Note: Object, weak, atomic and lazy pseudo properties, and properties added with
+ * `FMS_allocateSubclassWithPseudoProperties:`, are stored as before.
+ */
+
++ (void)FMS_performWithPseudoPropertyArena:(FMSPseudoPropertyArenaBlock)block;
+
+/**
+ * @brief Returns the number of bytes the calling thread's innermost pseudo property arena has reserved so far.
+ *
+ * @return The arena's size in bytes, or 0 outside `FMS_performWithPseudoPropertyArena:`.
+ */
+
++ (NSUInteger)FMS_currentPseudoPropertyArenaSize;
+
 
 /**
  * @brief Make the instance a subclass of its current class. This lets you override methods on the new subclass without affecting any other objects in your project.
@@ -316,4 +827,312 @@ typedef void (^FMSPseudoPropertyAdder) (NSString *propertyName);
  
 - (void)FMS_dynamiclySubclass;
 
+/**
+ * @brief Moves the instance into a dynamic subclass that is shared with every other object given the same changes.
+ *
+ * @param signature A string that identifies the changes `configuration` makes (e.g. `@"logFirstName"`). Objects of the same class that use the same signature share a single subclass.
+ * @param configuration A block that makes the changes (e.g. calls `FMS_overrideInstanceMethod:oldSelector:implementationBlock:`) on the new subclass. It is only called when the subclass is first created, before any object is moved into it, and may itself call this method.
+ * @return The shared subclass that the instance now belongs to.
+ *
+ * `FMS_dynamiclySubclass` creates and registers a new class for every object it is called on. Those classes
+ * are never freed, and every object starts with a cold method cache. This method instead caches the generated
+ * subclass by the object's current class and `signature`. The first call creates and configures the subclass.
+ * Later calls with the same class and signature just move the object into the cached subclass.
+ *
+ * The subclass is reference counted by its instances. Once the last instance has been deallocated, the subclass
+ * is removed from the cache and disposed of with `objc_disposeClassPair()`. Like a restored swizzle, it is retired
+ * and only disposed of once the instance's dealloc has returned and a short grace period has passed. A later call with the same signature will create and configure a fresh subclass.
+ * Overriding a method on a single object in a shared subclass (`FMS_replaceMethod:withImplementationBlock:`)
+ * builds a permanent dispatching class on it, so that subclass is then kept for the life of the process.
+ *
+ * Calling this on an object that is already in a shared subclass moves it to the shared subclass of its original
+ * class for the new signature, dropping the changes made for the old one. Objects in any other generated class
+ * (from `FMS_dynamiclySubclass` or a per-object override) are rejected with an `NSInvalidArgumentException`.
+ *
+ * Note: Configurations run without a global lock, so two threads that first use a signature at the same time may
+ * both run `configuration`. Only one of the two subclasses is kept; the other is disposed of before any object
+ * is moved into it.
+ *
+ * Note: The signature must uniquely describe what the configuration block does. Two different configurations
+ * that use the same signature will silently share whichever subclass was created first.
+ *
+ * Note: Do not call `FMS_dynamiclySubclass` on, or add KVO observers to, objects in a shared subclass. Both create
+ * further subclasses of the shared class, which would be left pointing at a disposed class once it is freed.
+ *
+ * Note: Like `FMS_dynamiclySubclass`, this cannot be used with tagged pointers.
+ */
+
+- (Class)FMS_dynamiclySubclassWithSignature:(NSString *)signature
+                              configuration:(FMSDynamicSubclassConfiguration)configuration;
+
+/**
+ * @brief Replaces an instance method for this object only.
+ *
+ * @param selector The selector for the method we wish to replace. The method must be defined either by the object's class or by one of its ancestors.
+ * @param block The new implementation, with the same signature as `FMS_replaceInstanceMethod:withImplementationBlock:` expects.
+ * @return A token that removes this object's override again. The object keeps using the shared class afterwards.
+ *
+ * This is the per-object equivalent of calling `FMS_dynamiclySubclass` and then replacing the method on
+ * `[obj class]`, without creating a class per object. Every object of a given class that has its own overrides is
+ * moved into one shared dispatching subclass (so `[obj class]` changes, just as it does with
+ * `FMS_dynamiclySubclass`). Each overridden selector gets a trampoline on that class, which looks up the receiver's
+ * own implementation in a small table attached to the object, and otherwise calls the original class's current
+ * implementation. Memory therefore grows with the number of selectors you override, not with the number of objects.
+ *
+ * Note: An object can only override a given selector once. Restore the token before overriding it again.
+ *
+ * Note: Don't add or restore overrides for an object while another thread is calling its methods. Overrides for
+ * different objects can be changed at any time.
+ *
+ * Note: The method's signature must be one that `FMS_hookInstanceMethod:before:after:` can wrap. Anything else
+ * throws an `NSInvalidArgumentException`. Like `FMS_dynamiclySubclass`, this cannot be used with tagged pointers.
+ */
+
+- (FMSSwizzleToken *)FMS_replaceMethod:(SEL)selector withImplementationBlock:(id)block;
+
+/**
+ * @brief Overrides an instance method for this object only, keeping the original reachable through `oldSelector`.
+ *
+ * @param selector The selector for the method we wish to override.
+ * @param oldSelector The selector used to call the original implementation. It is added to the shared dispatching class, so every object of the class that overrides `selector` may use the same `oldSelector`. It must not be used for anything else, and must have the same number of arguments as `selector`.
+ * @param block The new implementation.
+ * @return A token that removes this object's override again. The old selector stays in place, since other objects may use it.
+ *
+ * See `FMS_replaceMethod:withImplementationBlock:`. Calling `oldSelector` always reaches the original class's current
+ * implementation, even if that class is swizzled later.
+ */
+
+- (FMSSwizzleToken *)FMS_overrideMethod:(SEL)selector oldSelector:(SEL)oldSelector implementationBlock:(id)block;
+
+/**
+ * @brief Frees the restored implementations that no call can still be running.
+ *
+ * @return The number of restored swizzles whose implementations were freed.
+ *
+ * Another thread may be part-way through a swizzled method when its token is restored, so `restore` can't free
+ * the replacement there and then. Restored implementations (with their blocks, hook handlers and tokens) are
+ * retired instead, as are single-object overrides (and their outgrown tables) once restored or once their object
+ * is deallocated. Every call into them counts itself while it runs, and each retirement frees whatever was retired
+ * before it once those calls have returned and a short grace period has passed. This method does the same without
+ * retiring anything, e.g. to free the last restore's implementations sooner. It never waits, and is safe to call
+ * at any time, from any thread.
+ */
+
++ (NSUInteger)FMS_reclaimRetiredImplementations;
+
+/**
+ * @brief Returns the number of restored swizzles whose implementations are waiting to be freed.
+ */
+
++ (NSUInteger)FMS_retiredImplementationCount;
+
+/**
+ * @brief Returns the number of generated subclasses that are currently registered with the runtime.
+ *
+ * This includes classes created by `FMS_dynamiclySubclass` (which are never freed), shared subclasses created by
+ * `FMS_dynamiclySubclassWithSignature:configuration:` that have not yet been disposed of, and the single dispatching
+ * subclass created for each class whose objects use `FMS_replaceMethod:withImplementationBlock:` or
+ * `FMS_overrideMethod:oldSelector:implementationBlock:`.
+ */
+
++ (NSUInteger)FMS_liveGeneratedClassCount;
+
+/**
+ * @brief Returns the number of shared subclasses currently held in the dynamic subclass cache.
+ */
+
++ (NSUInteger)FMS_cachedDynamicSubclassCount;
+
+/**
+ * @brief Returns an `FMSSwizzleRecord` for every change FMSSwizzler currently has in place.
+ *
+ * Every alias, replacement, override, hook, single-object override, pseudo property and generated class is
+ * recorded when it is installed, with its class, selector, type encoding, install time and the implementation
+ * it replaced. Records are removed when their token is restored, or when their generated class is disposed of.
+ * The array is in no particular order.
+ *
+ * Reading the records never blocks installs, and installs never block readers: each record is copied without
+ * taking a lock, and a record that changes while it is being copied is read again. So this is safe to call from
+ * a crash reporter or a debugging command while other threads are busy. Nothing here is touched when a
+ * swizzled method is called, so recording has no effect on dispatch.
+ *
+ * Note: Methods changed outside FMSSwizzler (e.g. with `method_exchangeImplementations()`) are not recorded.
+ */
+
++ (NSArray *)FMS_activeSwizzleRecords;
+
+/**
+ * @brief Returns `FMS_activeSwizzleRecords` as a UTF-8 JSON document.
+ *
+ * The document is an object with a `version` and a `records` array. Each record has `kind`, `class`,
+ * `classMethod`, `installNanoseconds`, `originalImplementation` and `installedImplementation` (as hex strings),
+ * and, where they apply, `baseClass`, `selector` and `typeEncoding`.
+ */
+
++ (NSData *)FMS_swizzleRecordsJSON;
+
+/**
+ * @brief Returns `FMS_activeSwizzleRecords` in a compact binary format.
+ *
+ * The snapshot starts with the 4 bytes `FMSSwizzleRecordSnapshotMagic`, a `uint32_t` version and a `uint32_t`
+ * record count. Each record is then written as a `uint8_t` kind, a `uint8_t` class-method flag, a `uint64_t`
+ * install time, the original and installed implementations as `uint64_t`s, and four strings: the class name,
+ * base class name, selector and type encoding. Each string is a `uint16_t` length followed by that many bytes
+ * (a length of 0 means there is none). Numbers are in the host's byte order.
+ */
+
++ (NSData *)FMS_swizzleRecordSnapshot;
+
+/**
+ * @brief Looks up the instance methods for the given selectors now, so the first real calls don't have to.
+ *
+ * @param selectors The selectors to look up. Selectors the class doesn't respond to are skipped.
+ * @param count The number of selectors.
+ * @return The number of selectors the class responds to.
+ *
+ * The first time a class is sent a selector, the runtime searches the class and its superclasses for the
+ * method and stores what it finds in the class's method cache; every later call finds it there. Generated
+ * classes (`FMS_dynamiclySubclass`, `FMS_allocateSubclassWithPseudoProperties:`) and methods that have just been
+ * swizzled start out with nothing cached, so the first call to each method pays for that search. Prewarming
+ * does the searches up front, at a time you choose (just after configuring a class, say), and also runs
+ * `+initialize` if it hasn't run yet.
+ *
+ * Note: Swizzling a method again empties the cache for it, so prewarm after the last change, not before.
+ */
+
++ (NSUInteger)FMS_prewarmMethodCacheForSelectors:(const SEL *)selectors count:(NSUInteger)count;
+
+/**
+ * @brief Prewarms the method cache for every instance method the class or its superclasses implement.
+ *
+ * @return The number of distinct selectors looked up.
+ *
+ * The root class's own methods (`NSObject`'s, for most classes) are left out, since there are hundreds of them.
+ * Use `FMS_prewarmMethodCacheForSelectors:count:` for the ones your hot path calls.
+ */
+
++ (NSUInteger)FMS_prewarmMethodCache;
+
+/**
+ * @brief Returns the current implementation of each of the given instance methods, to be called directly.
+ *
+ * @param selectors The selectors to look up.
+ * @param count The number of selectors.
+ * @return A snapshot with one implementation per selector (`NULL` where the class doesn't respond to it).
+ *
+ * Calling through the snapshot's `IMP`s skips `objc_msgSend()` entirely, which is worth it only in the hottest
+ * loops. Looking up each selector also prewarms the method cache, as `FMS_prewarmMethodCacheForSelectors:count:` does.
+ *
+ * Note: The snapshot becomes invalid as soon as FMSSwizzler changes any method anywhere. See `FMSIMPSnapshot`.
+ */
+
++ (FMSIMPSnapshot *)FMS_IMPSnapshotForSelectors:(const SEL *)selectors count:(NSUInteger)count;
+
+/**
+ * @brief Returns a snapshot of every instance method that `FMS_prewarmMethodCache` would prewarm.
+ */
+
++ (FMSIMPSnapshot *)FMS_IMPSnapshot;
+
+/**
+ * @brief Marks every `FMSIMPSnapshot` as invalid.
+ *
+ * FMSSwizzler does this itself whenever it changes a method. Call it after changing methods some other way.
+ */
+
++ (void)FMS_invalidateIMPSnapshots;
+
 @end
+
+
+#pragma mark - Static Selector Checks
+
+/*
+ * Counts the colons in a selector name known at compile time. The expansion is a constant expression over the
+ * string literal, unrolled for names of up to 128 characters, so clang can evaluate it while compiling.
+ */
+#define FMS_COLON_AT(NAME, INDEX) (__builtin_strlen(NAME) > (INDEX) && (NAME)[INDEX] == ':')
+#define FMS_COLONS_8(NAME, BASE) \
+    (FMS_COLON_AT(NAME, BASE + 0) + FMS_COLON_AT(NAME, BASE + 1) + FMS_COLON_AT(NAME, BASE + 2) + \
+     FMS_COLON_AT(NAME, BASE + 3) + FMS_COLON_AT(NAME, BASE + 4) + FMS_COLON_AT(NAME, BASE + 5) + \
+     FMS_COLON_AT(NAME, BASE + 6) + FMS_COLON_AT(NAME, BASE + 7))
+#define FMS_COLONS_64(NAME, BASE) \
+    (FMS_COLONS_8(NAME, BASE + 0) + FMS_COLONS_8(NAME, BASE + 8) + FMS_COLONS_8(NAME, BASE + 16) + \
+     FMS_COLONS_8(NAME, BASE + 24) + FMS_COLONS_8(NAME, BASE + 32) + FMS_COLONS_8(NAME, BASE + 40) + \
+     FMS_COLONS_8(NAME, BASE + 48) + FMS_COLONS_8(NAME, BASE + 56))
+#define FMS_STATIC_ARGUMENT_COUNT(NAME) (FMS_COLONS_64(NAME, 0) + FMS_COLONS_64(NAME, 64))
+
+#ifndef __has_attribute
+#define __has_attribute(ATTRIBUTE) 0
+#endif
+
+static inline BOOL FMSStaticSelectorArgumentsMatch(const char *originalName, const char *newName)
+#if __has_attribute(diagnose_if)
+__attribute__((diagnose_if(__builtin_strlen(originalName) <= 128 && __builtin_strlen(newName) <= 128 &&
+                           FMS_STATIC_ARGUMENT_COUNT(originalName) != FMS_STATIC_ARGUMENT_COUNT(newName),
+                           "The selectors must have the same number of arguments", "error")))
+#endif
+;
+
+/*
+ * At runtime this folds away for literal names. Where the compiler could not check the names (or the names are
+ * too long), it returns the real answer, and a mismatch is reported by the runtime check instead.
+ */
+static inline BOOL FMSStaticSelectorArgumentsMatch(const char *originalName, const char *newName) {
+    
+    NSUInteger originalCount = 0;
+    NSUInteger newCount = 0;
+    
+    for (const char *character = originalName; *character != '\0'; character++) {
+        if (*character == ':') originalCount++;
+    }
+    
+    for (const char *character = newName; *character != '\0'; character++) {
+        if (*character == ':') newCount++;
+    }
+    
+    return originalCount == newCount;
+}
+
+/**
+ * @brief Aliases an instance method, checking literal selectors at compile time.
+ *
+ * Takes bare selector names (as you would write them inside `@selector()`), e.g.
+ * `FMS_ALIAS_INSTANCE_METHOD([Person class], setFirstName:, oldSetFirstName:);`
+ *
+ * When compiled with clang, selectors with different numbers of arguments are a compile time error, and the
+ * runtime argument check is skipped entirely. Evaluates to the `FMSSwizzleToken` returned by
+ * `FMS_aliasInstanceMethod:newSelector:`.
+ */
+#define FMS_ALIAS_INSTANCE_METHOD(CLASS, ORIGINAL, ALIAS) \
+    [(CLASS) FMS_aliasInstanceMethod:@selector(ORIGINAL) \
+                         newSelector:@selector(ALIAS) \
+              argumentCountsVerified:FMSStaticSelectorArgumentsMatch(#ORIGINAL, #ALIAS)]
+
+/**
+ * @brief Aliases a class method, checking literal selectors at compile time. See `FMS_ALIAS_INSTANCE_METHOD()`.
+ */
+#define FMS_ALIAS_CLASS_METHOD(CLASS, ORIGINAL, ALIAS) \
+    [(CLASS) FMS_aliasClassMethod:@selector(ORIGINAL) \
+                      newSelector:@selector(ALIAS) \
+           argumentCountsVerified:FMSStaticSelectorArgumentsMatch(#ORIGINAL, #ALIAS)]
+
+/**
+ * @brief Overrides an instance method, checking literal selectors at compile time. See `FMS_ALIAS_INSTANCE_METHOD()`.
+ *
+ * e.g. `FMS_OVERRIDE_INSTANCE_METHOD([Person class], firstName, oldFirstName, ^(Person *_self){ return @"Bob"; });`
+ */
+#define FMS_OVERRIDE_INSTANCE_METHOD(CLASS, SELECTOR, OLD_SELECTOR, ...) \
+    [(CLASS) FMS_overrideInstanceMethod:@selector(SELECTOR) \
+                            oldSelector:@selector(OLD_SELECTOR) \
+                 argumentCountsVerified:FMSStaticSelectorArgumentsMatch(#SELECTOR, #OLD_SELECTOR) \
+                    implementationBlock:(__VA_ARGS__)]
+
+/**
+ * @brief Overrides a class method, checking literal selectors at compile time. See `FMS_ALIAS_INSTANCE_METHOD()`.
+ */
+#define FMS_OVERRIDE_CLASS_METHOD(CLASS, SELECTOR, OLD_SELECTOR, ...) \
+    [(CLASS) FMS_overrideClassMethod:@selector(SELECTOR) \
+                         oldSelector:@selector(OLD_SELECTOR) \
+              argumentCountsVerified:FMSStaticSelectorArgumentsMatch(#SELECTOR, #OLD_SELECTOR) \
+                 implementationBlock:(__VA_ARGS__)]
@@ -29,308 +29,2197 @@
 //    STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
 //    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
-#import "NSObject+FMSSwizzler.h"
-#import <objc/runtime.h>
-
-#if __LP64__ || TARGET_OS_EMBEDDED || TARGET_OS_IPHONE || TARGET_OS_WIN32 || NS_BUILD_32_LIKE_64
-#define integerType @"l"
-#define unsignedIntegerType @"L"
-#else
-#define integerType @"i"
-#define unsignedIntegerType @"I"
+#import "FMSSwizzlerInternal.h"
+#import <pthread.h>
+#import <stdatomic.h>
+#import <sched.h>
+
+#if !__has_feature(objc_arc)
+#error AFNetworking must be built with ARC.
+// You can turn on ARC for only AFNetworking files by adding -fobjc-arc to the build phase for each of its files.
 #endif
 
-#if !__has_feature(objc_arc)
-#error AFNetworking must be built with ARC.
-// You can turn on ARC for only AFNetworking files by adding -fobjc-arc to the build phase for each of its files.
-#endif
+/*
+ * Storage details for each FMSPseudoPropertyType, used when the property is backed by
+ * raw memory (an instance variable or a slab slot) rather than by an associated object.
+ */
+typedef struct {
+    const char *encoding;
+    size_t size;
+    size_t alignment;
+    BOOL isStrongObject;
+    BOOL isWeakObject;
+} FMSPseudoPropertyTypeInfo;
+
+#define FMSTypeInfo(TYPE, STRONG) ((FMSPseudoPropertyTypeInfo){@encode(TYPE), sizeof(TYPE), __alignof__(TYPE), STRONG, NO})
+
+static BOOL FMSGetPseudoPropertyTypeInfo(FMSPseudoPropertyType type, FMSPseudoPropertyTypeInfo *info) {
+    
+    switch (type) {
+        case FMSObjectRetain:
+        case FMSObjectCopy:
+            *info = FMSTypeInfo(id, YES);
+            return YES;
+            
+        case FMSObjectAssignUnsafe:
+            *info = FMSTypeInfo(id, NO);
+            return YES;
+            
+        case FMSBool:
+            *info = FMSTypeInfo(BOOL, NO);
+            return YES;
+            
+        case FMSInteger:
+            *info = FMSTypeInfo(NSInteger, NO);
+            return YES;
+            
+        case FMSUnsignedInteger:
+            *info = FMSTypeInfo(NSUInteger, NO);
+            return YES;
+            
+        case FMSFloat:
+            *info = FMSTypeInfo(float, NO);
+            return YES;
+            
+        case FMSDouble:
+            *info = FMSTypeInfo(double, NO);
+            return YES;
+            
+        case FMSRange:
+            *info = FMSTypeInfo(NSRange, NO);
+            return YES;
+            
+        case FMSPoint:
+            *info = FMSTypeInfo(FMSPointValue, NO);
+            return YES;
+            
+        case FMSSize:
+            *info = FMSTypeInfo(FMSSizeValue, NO);
+            return YES;
+            
+        case FMSRect:
+            *info = FMSTypeInfo(FMSRectValue, NO);
+            return YES;
+            
+        case FMSObjectWeak:
+            *info = FMSTypeInfo(id, NO);
+            info->isWeakObject = YES;
+            return YES;
+            
+        case FMSObjectRetainAtomic:
+            *info = FMSTypeInfo(id, YES);
+            return YES;
+            
+        // Atomic scalars look like their plain counterparts to the runtime; only the accessors differ.
+        case FMSBoolAtomic:
+            *info = FMSTypeInfo(BOOL, NO);
+            return YES;
+            
+        case FMSIntegerAtomic:
+            *info = FMSTypeInfo(NSInteger, NO);
+            return YES;
+            
+        case FMSUnsignedIntegerAtomic:
+            *info = FMSTypeInfo(NSUInteger, NO);
+            return YES;
+            
+        case FMSFloatAtomic:
+            *info = FMSTypeInfo(float, NO);
+            return YES;
+            
+        case FMSDoubleAtomic:
+            *info = FMSTypeInfo(double, NO);
+            return YES;
+    }
+    
+    return NO;
+}
+
+/*
+ * Generates `getterImp` and `setterImp` for a plain-old-data pseudo property of the given C type.
+ * `READ_ADDRESS` must evaluate to the property's storage, or NULL if it hasn't been created yet (in
+ * which case the getter returns a zeroed value). `WRITE_ADDRESS` must always evaluate to the storage.
+ * Both expressions may refer to `_self`.
+ */
+#define FMS_VALUE_ACCESSORS(TYPE, READ_ADDRESS, WRITE_ADDRESS)                          \
+    getterImp = imp_implementationWithBlock(^TYPE (id _self) {                          \
+        const TYPE *slot = (const TYPE *)(READ_ADDRESS);                                \
+        if (slot == NULL) {                                                             \
+            TYPE empty;                                                                 \
+            memset(&empty, 0, sizeof(TYPE));                                            \
+            return empty;                                                               \
+        }                                                                               \
+        return *slot;                                                                   \
+    });                                                                                 \
+    setterImp = imp_implementationWithBlock(^(id _self, TYPE value) {                   \
+        *(TYPE *)(WRITE_ADDRESS) = value;                                               \
+    })
+
+/*
+ * Generates `getterImp` and `setterImp` for an atomic scalar pseudo property of the given C type.
+ * `READ_ADDRESS` and `WRITE_ADDRESS` work as they do for `FMS_VALUE_ACCESSORS`, but the storage must
+ * never move once it has been handed out, since another thread may be reading it without a lock.
+ */
+#define FMS_ATOMIC_VALUE_ACCESSORS(TYPE, READ_ADDRESS, WRITE_ADDRESS)                   \
+    getterImp = imp_implementationWithBlock(^TYPE (id _self) {                          \
+        _Atomic(TYPE) *slot = (_Atomic(TYPE) *)(READ_ADDRESS);                          \
+        if (slot == NULL) {                                                             \
+            return (TYPE)0;                                                             \
+        }                                                                               \
+        return atomic_load_explicit(slot, memory_order_acquire);                        \
+    });                                                                                 \
+    setterImp = imp_implementationWithBlock(^(id _self, TYPE value) {                   \
+        _Atomic(TYPE) *slot = (_Atomic(TYPE) *)(WRITE_ADDRESS);                         \
+        atomic_store_explicit(slot, value, memory_order_release);                       \
+    })
+
+static inline __attribute__((returns_nonnull)) void *FMSIvarAddress(__unsafe_unretained id obj, ptrdiff_t offset) {
+    return (uint8_t *)(__bridge void *)obj + offset;
+}
+
+static uint8_t FMSLog2Alignment(size_t alignment) {
+    
+    uint8_t result = 0;
+    while (((size_t)1 << result) < alignment) {
+        result++;
+    }
+    
+    return result;
+}
+
+#pragma mark - Pseudo Property Lock Stripes
+
+/*
+ * Atomic object properties, and slabs that are being created or grown, are guarded by one of a fixed
+ * set of spinlocks, picked by hashing the object and the property key. Unrelated properties almost
+ * never share a stripe, so there's no global lock for every atomic property in the process to queue
+ * up behind. Each stripe gets its own cache line so threads spinning on neighbouring stripes don't
+ * slow each other down.
+ */
+#define FMSPseudoPropertyLockStripeCount 64
+
+typedef struct {
+    _Alignas(64) atomic_uint locked;
+} FMSPseudoPropertyLockStripe;
+
+static FMSPseudoPropertyLockStripe FMSPseudoPropertyLockStripes[FMSPseudoPropertyLockStripeCount];
+
+static inline FMSPseudoPropertyLockStripe *FMSPseudoPropertyLockStripeFor(__unsafe_unretained id obj, const void *key) {
+    
+    uintptr_t hash = ((uintptr_t)(__bridge void *)obj >> 4) ^ ((uintptr_t)key >> 3);
+    hash ^= hash >> 7;
+    
+    return &FMSPseudoPropertyLockStripes[hash % FMSPseudoPropertyLockStripeCount];
+}
+
+static inline void FMSPseudoPropertyLockStripeLock(FMSPseudoPropertyLockStripe *stripe) {
+    
+    unsigned int spins = 0;
+    
+    while (atomic_exchange_explicit(&stripe->locked, 1, memory_order_acquire) != 0) {
+        
+        // Wait on a plain load so the cache line isn't bounced between waiters.
+        while (atomic_load_explicit(&stripe->locked, memory_order_relaxed) != 0) {
+            
+            if (++spins > 128) {
+                sched_yield();
+            }
+        }
+    }
+}
+
+/*
+ * Kept out of line on purpose: ARC must see an opaque call here, or it may move the retain of a value
+ * read under the lock past the unlock.
+ */
+static __attribute__((noinline)) void FMSPseudoPropertyLockStripeUnlock(FMSPseudoPropertyLockStripe *stripe) {
+    atomic_store_explicit(&stripe->locked, 0, memory_order_release);
+}
+
+#pragma mark - Pseudo Property Slabs
+
+/*
+ * Scalar and struct pseudo properties are stored unboxed in a per-object block of memory (a slab). Each
+ * class that declares slab-backed properties owns a layout, which hands out offsets in the order the
+ * properties are added. The layout object's address is also the association key for the slabs, so each
+ * object holds at most one slab per declaring class, no matter how many properties it has.
+ *
+ * Other threads may be reading or writing a slab without a lock, so its storage never moves. A slab is a
+ * chain of segments, each covering a range of offsets: the first is sized for every property the layout
+ * knew about when the slab was created, and a property added later gets a new segment appended to the
+ * chain rather than a bigger copy of the old one.
+ */
+@interface FMSPseudoPropertySlabLayout : NSObject {
+@public
+    size_t _length;
+    
+    // Its address is the association key for the arena chunk an object's slab was carved out of, if any.
+    char _arenaChunkKey;
+}
+@end
+
+@implementation FMSPseudoPropertySlabLayout
+@end
+
+typedef struct FMSPseudoPropertySlabSegment {
+    size_t start;
+    size_t end;
+    struct FMSPseudoPropertySlabSegment *_Atomic next;
+    _Alignas(16) uint8_t bytes[];
+} FMSPseudoPropertySlabSegment;
+
+@interface FMSPseudoPropertySlab : NSObject {
+@public
+    FMSPseudoPropertySlabSegment *_segments;
+    
+    // Set when an arena slab grew: its first segment is still carved out of an arena chunk, which the object keeps.
+    BOOL _borrowsFirstSegment;
+}
+@end
+
+@implementation FMSPseudoPropertySlab
+
+- (void)dealloc {
+    
+    FMSPseudoPropertySlabSegment *segment = _segments;
+    
+    if (_borrowsFirstSegment && segment != NULL) {
+        segment = atomic_load_explicit(&segment->next, memory_order_relaxed);
+    }
+    
+    while (segment != NULL) {
+        FMSPseudoPropertySlabSegment *next = atomic_load_explicit(&segment->next, memory_order_relaxed);
+        free(segment);
+        segment = next;
+    }
+}
+
+@end
+
+static size_t FMSReserveSlabSlot(FMSPseudoPropertySlabLayout *layout, size_t size, size_t alignment) {
+    
+    @synchronized(layout) {
+        
+        size_t offset = (layout->_length + alignment - 1) & ~(alignment - 1);
+        layout->_length = offset + size;
+        
+        return offset;
+    }
+}
+
+#pragma mark - Pseudo Property Arenas
+
+/*
+ * Inside FMS_performWithPseudoPropertyArena:, new slabs are carved out of a per-thread arena instead of being
+ * separate heap blocks owned by separate slab objects. The arena is a list of large chunks, and the object only
+ * holds an unretained (OBJC_ASSOCIATION_ASSIGN) pointer to its slab's first segment, so no slab is allocated or
+ * freed per object.
+ *
+ * Other threads may be using a slab without a lock, so a slab never moves, even when its object outlives the
+ * scope. Instead each chunk is reference counted: the scope holds one reference, and every object with a slab in
+ * the chunk holds another (a retained association), which the runtime releases as it tears the object down. When
+ * the scope ends it lets go of its references, and each chunk is freed once the last object carved out of it is
+ * gone. Most chunks are freed right there, while a chunk with a surviving object stays until that object is
+ * deallocated.
+ *
+ * Arena slabs share the association key with heap slabs. They aren't objects, so the pointer is tagged in its
+ * low bit (arena memory is 16-byte aligned, and a heap slab is never a tagged pointer) and only ever passed
+ * through the two function pointers below, which ARC doesn't retain or release.
+ */
+#define FMSPseudoPropertyArenaChunkSize (64 * 1024)
+#define FMSArenaSlabTag ((uintptr_t)1)
+
+@interface FMSPseudoPropertyArenaChunk : NSObject {
+@public
+    FMSPseudoPropertyArenaChunk *_next;
+    size_t _capacity;
+    size_t _used;
+    uint8_t *_bytes;
+}
+@end
+
+@implementation FMSPseudoPropertyArenaChunk
+
+- (void)dealloc {
+    free(_bytes);
+}
+
+@end
+
+typedef struct FMSPseudoPropertyArena {
+    
+    // The newest chunk (retained), which links to the older ones.
+    void *chunks;
+    size_t reservedBytes;
+    
+    struct FMSPseudoPropertyArena *previous;
+} FMSPseudoPropertyArena;
+
+static void *(*const FMSGetAssociatedPointer)(id, const void *) =
+(void *(*)(id, const void *))objc_getAssociatedObject;
+
+static void (*const FMSSetAssociatedPointer)(id, const void *, void *, objc_AssociationPolicy) =
+(void (*)(id, const void *, void *, objc_AssociationPolicy))objc_setAssociatedObject;
+
+// The innermost arena scope on this thread, or NULL. Each scope's arena lives in its stack frame.
+static _Thread_local FMSPseudoPropertyArena *FMSCurrentPseudoPropertyArena = NULL;
+
+// Returns `size` bytes from the arena, and the chunk they came from.
+static void *FMSArenaAllocate(FMSPseudoPropertyArena *arena,
+                              size_t size,
+                              __unsafe_unretained FMSPseudoPropertyArenaChunk **chunkOut) {
+    
+    size = (size + 15) & ~(size_t)15;
+    
+    __unsafe_unretained FMSPseudoPropertyArenaChunk *chunk = (__bridge FMSPseudoPropertyArenaChunk *)arena->chunks;
+    
+    if (chunk == nil || chunk->_capacity - chunk->_used < size) {
+        
+        FMSPseudoPropertyArenaChunk *newChunk = [[FMSPseudoPropertyArenaChunk alloc] init];
+        newChunk->_capacity = MAX(size, (size_t)FMSPseudoPropertyArenaChunkSize);
+        
+        // malloc() memory is aligned for any type a slab holds, which keeps the tag bit free.
+        newChunk->_bytes = malloc(newChunk->_capacity);
+        if (newChunk->_bytes == NULL) {
+            [NSException raise:NSMallocException format:@"Could not grow the pseudo property arena"];
+        }
+        
+        arena->reservedBytes += newChunk->_capacity;
+        
+        // An oversized slab gets a chunk of its own behind the current one, which keeps filling up.
+        if (chunk != nil && size > FMSPseudoPropertyArenaChunkSize / 2) {
+            newChunk->_next = chunk->_next;
+            chunk->_next = newChunk;
+        } else {
+            newChunk->_next = (__bridge_transfer FMSPseudoPropertyArenaChunk *)arena->chunks;
+            arena->chunks = (__bridge_retained void *)newChunk;
+        }
+        
+        chunk = newChunk;
+    }
+    
+    void *bytes = chunk->_bytes + chunk->_used;
+    chunk->_used += size;
+    
+    *chunkOut = chunk;
+    return bytes;
+}
+
+// Lets go of the scope's references. Chunks that no surviving object was carved out of are freed.
+static void FMSDrainPseudoPropertyArena(FMSPseudoPropertyArena *arena) {
+    
+    FMSPseudoPropertyArenaChunk *chunk = (__bridge_transfer FMSPseudoPropertyArenaChunk *)arena->chunks;
+    
+    arena->chunks = NULL;
+    arena->reservedBytes = 0;
+    
+    // Unlinked one at a time, so releasing a long list doesn't recurse.
+    while (chunk != nil) {
+        FMSPseudoPropertyArenaChunk *next = chunk->_next;
+        chunk->_next = nil;
+        chunk = next;
+    }
+}
+
+#pragma mark - Pseudo Property Slab Access
+
+/*
+ * Makes a zeroed segment covering [start, end), in the arena if one is given and on the heap otherwise. For an
+ * arena segment, `chunk` is set to the chunk it was carved out of.
+ */
+static FMSPseudoPropertySlabSegment *FMSMakeSlabSegment(FMSPseudoPropertyArena *arena,
+                                                        size_t start,
+                                                        size_t end,
+                                                        __unsafe_unretained FMSPseudoPropertyArenaChunk **chunk) {
+    
+    size_t size = sizeof(FMSPseudoPropertySlabSegment) + (end - start);
+    FMSPseudoPropertySlabSegment *segment = (arena != NULL) ? FMSArenaAllocate(arena, size, chunk) : malloc(size);
+    
+    if (segment == NULL) {
+        [NSException raise:NSMallocException format:@"Could not allocate a pseudo property slab"];
+    }
+    
+    segment->start = start;
+    segment->end = end;
+    atomic_init(&segment->next, NULL);
+    memset(segment->bytes, 0, end - start);
+    
+    return segment;
+}
+
+// Finds the first segment of the object's slab, wherever it lives, or NULL if it has no slab yet.
+static inline FMSPseudoPropertySlabSegment *FMSSlabSegments(__unsafe_unretained id obj,
+                                                            __unsafe_unretained FMSPseudoPropertySlabLayout *layout) {
+    
+    uintptr_t slabPointer = (uintptr_t)FMSGetAssociatedPointer(obj, (__bridge const void *)layout);
+    
+    if (slabPointer & FMSArenaSlabTag) {
+        return (FMSPseudoPropertySlabSegment *)(slabPointer & ~FMSArenaSlabTag);
+    }
+    
+    if (slabPointer == 0) return NULL;
+    
+    __unsafe_unretained FMSPseudoPropertySlab *slab = (__bridge FMSPseudoPropertySlab *)(void *)slabPointer;
+    
+    return slab->_segments;
+}
+
+/*
+ * Segment boundaries always fall on the end of a property, so a property is never split across two segments
+ * and the first segment whose end covers it is the one that holds it.
+ */
+static inline uint8_t *FMSSlabSegmentAddress(FMSPseudoPropertySlabSegment *segment, size_t offset, size_t size) {
+    
+    while (segment != NULL) {
+        
+        if (offset + size <= segment->end) {
+            return segment->bytes + (offset - segment->start);
+        }
+        
+        segment = atomic_load_explicit(&segment->next, memory_order_acquire);
+    }
+    
+    return NULL;
+}
+
+static inline const void *FMSSlabReadAddress(__unsafe_unretained id obj,
+                                             __unsafe_unretained FMSPseudoPropertySlabLayout *layout,
+                                             size_t offset,
+                                             size_t size) {
+    
+    return FMSSlabSegmentAddress(FMSSlabSegments(obj, layout), offset, size);
+}
+
+/*
+ * First write, or properties were added to the class after this object's slab was created. The slab is sized
+ * for every property the layout currently knows about, so this happens rarely. Two threads writing at once
+ * must agree on a single slab, so this runs under the object's lock stripe and looks again once it holds it.
+ *
+ * A new slab is carved out of the current arena if there is one, and goes on the heap otherwise. A new segment
+ * always goes on the heap: an arena slab that grows (for instance when an object from an arena scope is given a
+ * new property on another thread) is taken over by a heap slab that owns the segments after the first.
+ */
+static __attribute__((noinline)) void *FMSGrowSlab(__unsafe_unretained id obj,
+                                                   __unsafe_unretained FMSPseudoPropertySlabLayout *layout,
+                                                   size_t offset,
+                                                   size_t size) {
+    
+    const void *key = (__bridge const void *)layout;
+    
+    FMSPseudoPropertyLockStripe *stripe = FMSPseudoPropertyLockStripeFor(obj, key);
+    FMSPseudoPropertyLockStripeLock(stripe);
+    
+    uintptr_t slabPointer = (uintptr_t)FMSGetAssociatedPointer(obj, key);
+    FMSPseudoPropertySlabSegment *segments = FMSSlabSegments(obj, layout);
+    uint8_t *address = FMSSlabSegmentAddress(segments, offset, size);
+    
+    if (address == NULL) {
+        
+        size_t length = MAX(layout->_length, offset + size);
+        
+        if (segments == NULL) {
+            
+            FMSPseudoPropertyArena *arena = FMSCurrentPseudoPropertyArena;
+            __unsafe_unretained FMSPseudoPropertyArenaChunk *chunk = nil;
+            FMSPseudoPropertySlabSegment *segment = FMSMakeSlabSegment(arena, 0, length, &chunk);
+            
+            if (arena != NULL) {
+                objc_setAssociatedObject(obj, &layout->_arenaChunkKey, chunk, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+                FMSSetAssociatedPointer(obj, key, (void *)((uintptr_t)segment | FMSArenaSlabTag), OBJC_ASSOCIATION_ASSIGN);
+            } else {
+                FMSPseudoPropertySlab *slab = [[FMSPseudoPropertySlab alloc] init];
+                slab->_segments = segment;
+                objc_setAssociatedObject(obj, key, slab, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+            }
+            
+            address = segment->bytes + offset;
+            
+        } else {
+            
+            if (slabPointer & FMSArenaSlabTag) {
+                FMSPseudoPropertySlab *slab = [[FMSPseudoPropertySlab alloc] init];
+                slab->_segments = segments;
+                slab->_borrowsFirstSegment = YES;
+                objc_setAssociatedObject(obj, key, slab, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+            }
+            
+            FMSPseudoPropertySlabSegment *last = segments;
+            FMSPseudoPropertySlabSegment *next;
+            
+            while ((next = atomic_load_explicit(&last->next, memory_order_acquire)) != NULL) {
+                last = next;
+            }
+            
+            // Start on a 16-byte boundary so the new properties stay aligned. The overlap with `last` is never used.
+            FMSPseudoPropertySlabSegment *segment = FMSMakeSlabSegment(NULL, last->end & ~(size_t)15, length, NULL);
+            atomic_store_explicit(&last->next, segment, memory_order_release);
+            
+            address = segment->bytes + (offset - segment->start);
+        }
+    }
+    
+    FMSPseudoPropertyLockStripeUnlock(stripe);
+    
+    return address;
+}
+
+static inline void *FMSSlabWriteAddress(__unsafe_unretained id obj,
+                                        __unsafe_unretained FMSPseudoPropertySlabLayout *layout,
+                                        size_t offset,
+                                        size_t size) {
+    
+    uint8_t *address = FMSSlabSegmentAddress(FMSSlabSegments(obj, layout), offset, size);
+    
+    if (address != NULL) {
+        return address;
+    }
+    
+    return FMSGrowSlab(obj, layout, offset, size);
+}
+
+#pragma mark - Atomic and Weak Pseudo Property Storage
+
+/*
+ * Associated objects can't hold a zeroing weak reference, and atomic scalars need a naturally aligned
+ * word of their own. Both get a small box that is created on first write and then stays attached to
+ * the object for the rest of its life.
+ */
+@interface FMSPseudoPropertyWeakBox : NSObject {
+@public
+    __weak id _value;
+}
+@end
+
+@implementation FMSPseudoPropertyWeakBox
+@end
+
+@interface FMSPseudoPropertyAtomicBox : NSObject {
+@public
+    uint64_t _storage;
+}
+@end
+
+@implementation FMSPseudoPropertyAtomicBox
+@end
+
+static id FMSPseudoPropertyBox(__unsafe_unretained id obj, const void *key, Class boxClass) {
+    
+    id box = objc_getAssociatedObject(obj, key);
+    
+    if (box != nil) {
+        return box;
+    }
+    
+    // Two threads writing the property for the first time must agree on a single box.
+    FMSPseudoPropertyLockStripe *stripe = FMSPseudoPropertyLockStripeFor(obj, key);
+    FMSPseudoPropertyLockStripeLock(stripe);
+    
+    box = objc_getAssociatedObject(obj, key);
+    
+    if (box == nil) {
+        box = [[boxClass alloc] init];
+        objc_setAssociatedObject(obj, key, box, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    }
+    
+    FMSPseudoPropertyLockStripeUnlock(stripe);
+    
+    return box;
+}
+
+static inline void *FMSAtomicBoxReadAddress(__unsafe_unretained id obj, const void *key) {
+    
+    __unsafe_unretained FMSPseudoPropertyAtomicBox *box = objc_getAssociatedObject(obj, key);
+    
+    return box == nil ? NULL : &box->_storage;
+}
+
+static inline void *FMSAtomicBoxWriteAddress(__unsafe_unretained id obj, const void *key) {
+    
+    __unsafe_unretained FMSPseudoPropertyAtomicBox *box = FMSPseudoPropertyBox(obj, key, [FMSPseudoPropertyAtomicBox class]);
+    
+    return &box->_storage;
+}
+
+#pragma mark - Lazy Pseudo Property Storage
+
+/*
+ * Each lazy property gets a cell per object, created the first time the property is read or written.
+ * `_ready` is only set (with release ordering) after the value has been stored, so a reader that sees it
+ * set (with acquire ordering) also sees the value and never needs the cell's mutex. The mutex only
+ * serializes the initializer, the setter and invalidation against each other.
+ *
+ * Object values are also guarded by the striped spinlocks (picked by the cell's address), since a reader
+ * has to retain the value before a setter or invalidation on another thread can release it.
+ */
+@interface FMSLazyPseudoPropertyCell : NSObject {
+@public
+    pthread_mutex_t _lock;
+    atomic_bool _ready;
+    id _object;
+    FMSRectValue _storage;  // Large enough, and aligned, for every scalar and struct type.
+}
+@end
+
+@implementation FMSLazyPseudoPropertyCell
+
+- (id)init {
+    
+    self = [super init];
+    
+    if (self) {
+        pthread_mutex_init(&_lock, NULL);
+    }
+    
+    return self;
+}
+
+- (void)dealloc {
+    pthread_mutex_destroy(&_lock);
+}
+
+@end
+
+typedef void (^FMSLazyPseudoPropertyStore) (FMSLazyPseudoPropertyCell *cell, id value);
+
+static inline FMSLazyPseudoPropertyCell *FMSLazyCellForWriting(__unsafe_unretained id obj, const void *key) {
+    return FMSPseudoPropertyBox(obj, key, [FMSLazyPseudoPropertyCell class]);
+}
+
+/*
+ * The slow path of every lazy getter. Runs the initializer unless another thread got there first, in
+ * which case this waits for that thread's value instead.
+ */
+static FMSLazyPseudoPropertyCell *FMSLazyCellInitialize(__unsafe_unretained id obj,
+                                                        const void *key,
+                                                        FMSPseudoPropertyInitializer initializer,
+                                                        FMSLazyPseudoPropertyStore store) {
+    
+    FMSLazyPseudoPropertyCell *cell = FMSLazyCellForWriting(obj, key);
+    pthread_mutex_lock(&cell->_lock);
+    
+    @try {
+        
+        if (!atomic_load_explicit(&cell->_ready, memory_order_relaxed)) {
+            
+            store(cell, initializer(obj));
+            atomic_store_explicit(&cell->_ready, true, memory_order_release);
+        }
+    }
+    @finally {
+        pthread_mutex_unlock(&cell->_lock);
+    }
+    
+    return cell;
+}
+
+static id FMSLazyCellReadObject(__unsafe_unretained FMSLazyPseudoPropertyCell *cell, BOOL *ready) {
+    
+    FMSPseudoPropertyLockStripe *stripe = FMSPseudoPropertyLockStripeFor(cell, NULL);
+    FMSPseudoPropertyLockStripeLock(stripe);
+    
+    *ready = atomic_load_explicit(&cell->_ready, memory_order_relaxed);
+    id result = *ready ? cell->_object : nil;
+    
+    FMSPseudoPropertyLockStripeUnlock(stripe);
+    return result;
+}
+
+/*
+ * Must be called with the cell's mutex held. Passing `ready` as NO invalidates the cell.
+ */
+static void FMSLazyCellWriteObject(__unsafe_unretained FMSLazyPseudoPropertyCell *cell, id value, BOOL ready) {
+    
+    FMSPseudoPropertyLockStripe *stripe = FMSPseudoPropertyLockStripeFor(cell, NULL);
+    FMSPseudoPropertyLockStripeLock(stripe);
+    
+    // Holding the old value keeps its dealloc (if this was the last reference) outside the lock.
+    id previous = cell->_object;
+    cell->_object = value;
+    atomic_store_explicit(&cell->_ready, ready, memory_order_release);
+    
+    FMSPseudoPropertyLockStripeUnlock(stripe);
+    previous = nil;
+}
+
+/*
+ * Unwraps the `NSValue` an initializer returned for a struct property.
+ */
+static void FMSLazyUnboxValue(id value, void *buffer, size_t size) {
+    
+    memset(buffer, 0, size);
+    
+    if (value == nil) {
+        return;
+    }
+    
+    NSUInteger valueSize = 0;
+    
+    if ([value isKindOfClass:[NSValue class]]) {
+        NSGetSizeAndAlignment([value objCType], &valueSize, NULL);
+    }
+    
+    if (valueSize != size) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"The initializer returned %@, which doesn't match the lazy property's type", value];
+    }
+    
+    [value getValue:buffer];
+}
+
+#define FMSLazyPlainLoad(TYPE, SLOT) (*(TYPE *)(SLOT))
+#define FMSLazyPlainStore(TYPE, SLOT, VALUE) (*(TYPE *)(SLOT) = (VALUE))
+#define FMSLazyAtomicLoad(TYPE, SLOT) atomic_load_explicit((_Atomic(TYPE) *)(SLOT), memory_order_acquire)
+#define FMSLazyAtomicStore(TYPE, SLOT, VALUE) atomic_store_explicit((_Atomic(TYPE) *)(SLOT), (VALUE), memory_order_release)
+
+/*
+ * Generates `getterImp` and `setterImp` for a lazy scalar or struct pseudo property of the given C type.
+ * `UNBOXED` converts the initializer's result (`value`) to `TYPE`. `LOAD` and `STORE` are either the
+ * plain or the atomic access macros above. Expects `key` and `initializer` to be in scope.
+ */
+#define FMS_LAZY_VALUE_ACCESSORS(TYPE, UNBOXED, LOAD, STORE)                            \
+    getterImp = imp_implementationWithBlock(^TYPE (id _self) {                          \
+        __unsafe_unretained FMSLazyPseudoPropertyCell *cell = objc_getAssociatedObject(_self, key); \
+        if (cell == nil || !atomic_load_explicit(&cell->_ready, memory_order_acquire)) { \
+            cell = FMSLazyCellInitialize(_self, key, initializer,                      \
+                                         ^(FMSLazyPseudoPropertyCell *target, id value) { \
+                STORE(TYPE, &target->_storage, (UNBOXED));                              \
+            });                                                                         \
+        }                                                                               \
+        return LOAD(TYPE, &cell->_storage);                                             \
+    });                                                                                 \
+    setterImp = imp_implementationWithBlock(^(id _self, TYPE value) {                   \
+        FMSLazyPseudoPropertyCell *cell = FMSLazyCellForWriting(_self, key);            \
+        pthread_mutex_lock(&cell->_lock);                                               \
+        STORE(TYPE, &cell->_storage, value);                                            \
+        atomic_store_explicit(&cell->_ready, true, memory_order_release);               \
+        pthread_mutex_unlock(&cell->_lock);                                             \
+    })
+
+#define FMSLazyUnboxStruct(TYPE) ({ TYPE unboxed; FMSLazyUnboxValue(value, &unboxed, sizeof(TYPE)); unboxed; })
+
+#pragma mark - Interned Pseudo Property Names
+
+static BOOL FMSLoggingEnabled = NO;
+
+/*
+ * Every distinct property name is validated once and then interned. The interned object holds the
+ * getter and setter selectors, and its address doubles as the association key for object properties,
+ * so adding the same name to many classes never re-validates it or rebuilds its selectors.
+ */
+@interface FMSPseudoPropertyName : NSObject {
+@public
+    SEL _getter;
+    SEL _setter;
+}
+@end
+
+@implementation FMSPseudoPropertyName
+@end
+
+static pthread_mutex_t FMSPseudoPropertyNameLock = PTHREAD_MUTEX_INITIALIZER;
+static NSMutableDictionary *FMSPseudoPropertyNames = nil;
+
+static FMSPseudoPropertyName *FMSLookupPseudoPropertyName(NSString *propertyName) {
+    
+    pthread_mutex_lock(&FMSPseudoPropertyNameLock);
+    FMSPseudoPropertyName *name = FMSPseudoPropertyNames[propertyName];
+    pthread_mutex_unlock(&FMSPseudoPropertyNameLock);
+    
+    return name;
+}
+
+// Names must start with a lower case letter, and contain only letters, numbers and underscores.
+// Returns NO if the name is invalid. Sets `isASCII` to NO (and returns NO) if the name could not be
+// checked because it contains non-ASCII characters.
+static BOOL FMSValidateASCIIPropertyName(const char *name, BOOL *isASCII) {
+    
+    *isASCII = YES;
+    
+    if (name[0] < 'a' || name[0] > 'z') {
+        *isASCII = ((unsigned char)name[0] < 0x80);
+        return NO;
+    }
+    
+    for (const char *character = name + 1; *character != '\0'; character++) {
+        
+        char c = *character;
+        
+        if ((unsigned char)c >= 0x80) {
+            *isASCII = NO;
+            return NO;
+        }
+        
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) {
+            return NO;
+        }
+    }
+    
+    return YES;
+}
+
+static NSRegularExpression *FMSUnicodePropertyNameExpression = nil;
+
+static void FMSMakeUnicodePropertyNameExpression(void) {
+    
+    NSError *error;
+    FMSUnicodePropertyNameExpression =
+    [NSRegularExpression regularExpressionWithPattern:@"\\A\\p{Ll}[\\p{Ll}\\p{Lu}\\p{Lo}\\p{Nd}_]*\\z"
+                                              options:0
+                                                error:&error];
+    
+    if (error != nil) {
+        NSLog(@"*** An Error Occurred: %@ ***", [error localizedDescription]);
+    }
+}
+
+static BOOL FMSValidateUnicodePropertyName(NSString *propertyName) {
+    
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, FMSMakeUnicodePropertyNameExpression);
+    
+    NSRegularExpression *regexp = FMSUnicodePropertyNameExpression;
+    
+    if (regexp == nil) {
+        [NSException
+         raise:NSGenericException
+         format:@"An error occurred creating the regular expression to validate the pseudo property names"];
+    }
+    
+    NSRange range = NSMakeRange(0, [propertyName length]);
+    return [regexp numberOfMatchesInString:propertyName options:NSMatchingReportCompletion range:range] > 0;
+}
+
+/*
+ * Returns the interned name for `propertyName`, validating and creating it on first use.
+ * Throws an NSInvalidArgumentException if the name is not a valid property name.
+ */
+static FMSPseudoPropertyName *FMSInternPseudoPropertyName(NSString *propertyName) {
+    
+    if (![propertyName isKindOfClass:[NSString class]] || [propertyName length] == 0) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"%@ is not a valid property name.", propertyName];
+    }
+    
+    FMSPseudoPropertyName *name = FMSLookupPseudoPropertyName(propertyName);
+    if (name != nil) {
+        return name;
+    }
+    
+    char buffer[256];
+    BOOL isASCII = [propertyName getCString:buffer maxLength:sizeof(buffer) encoding:NSASCIIStringEncoding];
+    BOOL isValid = NO;
+    
+    if (isASCII) {
+        isValid = FMSValidateASCIIPropertyName(buffer, &isASCII);
+    }
+    
+    if (!isASCII) {
+        isValid = FMSValidateUnicodePropertyName(propertyName);
+    }
+    
+    if (!isValid) {
+        [NSException
+         raise:NSInvalidArgumentException
+         format:@"%@ is not a valid property name. It must start with a lower case letter and "
+         @"have only letters, numbers and underscores.",
+         propertyName];
+    }
+    
+    name = [[FMSPseudoPropertyName alloc] init];
+    
+    if (isASCII) {
+        
+        // "set" + capitalized name + ":" without going through NSString formatting.
+        size_t length = strlen(buffer);
+        char setterName[length + 5];
+        
+        memcpy(setterName, "set", 3);
+        memcpy(setterName + 3, buffer, length);
+        setterName[3] = (char)(buffer[0] - 'a' + 'A');
+        setterName[length + 3] = ':';
+        setterName[length + 4] = '\0';
+        
+        name->_getter = sel_registerName(buffer);
+        name->_setter = sel_registerName(setterName);
+        
+    } else {
+        
+        NSString *setterName = [NSString stringWithFormat:@"set%@%@:",
+                                [[propertyName substringToIndex: 1] uppercaseString],
+                                [propertyName substringFromIndex: 1]];
+        
+        name->_getter = NSSelectorFromString(propertyName);
+        name->_setter = NSSelectorFromString(setterName);
+    }
+    
+    pthread_mutex_lock(&FMSPseudoPropertyNameLock);
+    
+    if (FMSPseudoPropertyNames == nil) {
+        FMSPseudoPropertyNames = [NSMutableDictionary dictionary];
+    }
+    
+    // Another thread may have interned the same name while we were validating it.
+    FMSPseudoPropertyName *existing = FMSPseudoPropertyNames[propertyName];
+    
+    if (existing != nil) {
+        name = existing;
+    } else {
+        FMSPseudoPropertyNames[[propertyName copy]] = name;
+    }
+    
+    pthread_mutex_unlock(&FMSPseudoPropertyNameLock);
+    
+    return name;
+}
+
+#pragma mark - Pseudo Property Batches
+
+static NSData *FMSPseudoPropertyDescriptorsFromDictionary(NSDictionary *properties) {
+    
+    NSMutableData *data = [NSMutableData dataWithLength:[properties count] * sizeof(FMSPseudoPropertyDescriptor)];
+    FMSPseudoPropertyDescriptor *descriptors = [data mutableBytes];
+    NSUInteger index = 0;
+    
+    for (NSString *propertyName in properties) {
+        
+        id type = properties[propertyName];
+        
+        if (![type isKindOfClass:[NSNumber class]]) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"The type for %@ must be an FMSPseudoPropertyType wrapped in an NSNumber", propertyName];
+        }
+        
+        descriptors[index].name = propertyName;
+        descriptors[index].type = [type intValue];
+        index++;
+    }
+    
+    return data;
+}
+
+static int FMSCompareNames(const void *first, const void *second) {
+    return strcmp(*(const char * const *)first, *(const char * const *)second);
+}
+
+/*
+ * Returns a sorted, malloc'd array with the names of every instance method `cls` responds to,
+ * including inherited methods. The caller must free the array (but not the names).
+ */
+static const char **FMSCopySortedInstanceMethodNames(Class cls, NSUInteger *count) {
+    
+    NSUInteger capacity = 256;
+    NSUInteger total = 0;
+    const char **names = malloc(capacity * sizeof(const char *));
+    
+    for (Class current = cls; current != Nil; current = class_getSuperclass(current)) {
+        
+        unsigned int methodCount = 0;
+        Method *methods = class_copyMethodList(current, &methodCount);
+        
+        if (total + methodCount > capacity) {
+            capacity = MAX(capacity * 2, total + methodCount);
+            names = realloc(names, capacity * sizeof(const char *));
+        }
+        
+        for (unsigned int index = 0; index < methodCount; index++) {
+            names[total++] = sel_getName(method_getName(methods[index]));
+        }
+        
+        free(methods);
+    }
+    
+    qsort(names, total, sizeof(const char *), FMSCompareNames);
+    
+    *count = total;
+    return names;
+}
+
+#pragma mark - Selector Arguments
+
+// Counts the colons in the selector's name directly, rather than building an NSString and splitting it.
+NSUInteger FMSSelectorArgumentCount(SEL selector) {
+    
+    NSUInteger count = 0;
+    
+    for (const char *name = sel_getName(selector); *name != '\0'; name++) {
+        if (*name == ':') count++;
+    }
+    
+    return count;
+}
+
+// The alias must take as many arguments as the method it points to (not counting self and _cmd).
+void FMSCheckAliasArguments(Method originalMethod, SEL newSelector) {
+    
+    NSUInteger originalArgCount = method_getNumberOfArguments(originalMethod) - 2;
+    NSUInteger newArgCount = FMSSelectorArgumentCount(newSelector);
+    
+    if (originalArgCount != newArgCount) {
+        
+        [NSException
+         raise:NSInvalidArgumentException
+         format:@"The selectors must have the same number of arguments, had %d and %d",
+         (int)originalArgCount, (int)newArgCount];
+    }
+}
+
+#pragma mark - Class Locks
+
+/*
+ * Every FMS_ mutation holds a lock for the class it modifies, so check-then-add sequences (and the two
+ * halves of an override) can't interleave. Rather than one global lock, classes are hashed onto a fixed
+ * table of mutexes: hooks installed on unrelated classes almost never contend, and no per-class state
+ * has to be allocated. Class methods lock the metaclass.
+ */
+#define FMSClassLockCount 64
+
+static pthread_mutex_t FMSClassLocks[FMSClassLockCount];
+static pthread_once_t FMSClassLocksOnce = PTHREAD_ONCE_INIT;
+
+// The locks are recursive, since the runtime may call back into user code (e.g. +resolveInstanceMethod:)
+// that installs more hooks on the same class while we hold its lock.
+static void FMSInitializeClassLocks(void) {
+    
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    
+    for (NSUInteger index = 0; index < FMSClassLockCount; index++) {
+        pthread_mutex_init(&FMSClassLocks[index], &attributes);
+    }
+    
+    pthread_mutexattr_destroy(&attributes);
+}
+
+static inline pthread_mutex_t *FMSLockForClass(Class cls) {
+    
+    pthread_once(&FMSClassLocksOnce, FMSInitializeClassLocks);
+    
+    uintptr_t address = (uintptr_t)(__bridge void *)cls;
+    return &FMSClassLocks[((address >> 4) ^ (address >> 12)) % FMSClassLockCount];
+}
+
+void FMSPerformLocked(Class cls, void (^block)(void)) {
+    
+    pthread_mutex_t *lock = FMSLockForClass(cls);
+    pthread_mutex_lock(lock);
+    
+    @try {
+        block();
+    }
+    @finally {
+        pthread_mutex_unlock(lock);
+    }
+}
+
+static int FMSCompareLocks(const void *first, const void *second) {
+    
+    uintptr_t a = (uintptr_t)*(pthread_mutex_t * const *)first;
+    uintptr_t b = (uintptr_t)*(pthread_mutex_t * const *)second;
+    
+    return (a > b) - (a < b);
+}
+
+// Several classes can share a lock, so take each distinct lock once, always in address order, to avoid deadlocks.
+void FMSPerformLockedClasses(NSArray *classes, void (^block)(void)) {
+    
+    NSUInteger count = [classes count];
+    pthread_mutex_t **locks = malloc(MAX(count, (NSUInteger)1) * sizeof(pthread_mutex_t *));
+    
+    for (NSUInteger index = 0; index < count; index++) {
+        locks[index] = FMSLockForClass(classes[index]);
+    }
+    
+    qsort(locks, count, sizeof(pthread_mutex_t *), FMSCompareLocks);
+    
+    NSUInteger uniqueCount = 0;
+    
+    for (NSUInteger index = 0; index < count; index++) {
+        
+        if (uniqueCount == 0 || locks[uniqueCount - 1] != locks[index]) {
+            locks[uniqueCount++] = locks[index];
+            pthread_mutex_lock(locks[uniqueCount - 1]);
+        }
+    }
+    
+    @try {
+        block();
+    }
+    @finally {
+        
+        while (uniqueCount > 0) {
+            pthread_mutex_unlock(locks[--uniqueCount]);
+        }
+        
+        free(locks);
+    }
+}
+
+#pragma mark - Dynamic Subclass Cache
+
+/*
+ * Objects that receive identical swizzles can share one generated subclass. Shared subclasses are
+ * cached by base class and signature, and each object that uses one holds a lease on it. When the last
+ * lease is released the class is removed from the cache and disposed of.
+ *
+ * A leased class is only ever a direct subclass of an ordinary class. An object that moves from one
+ * cached subclass to another is re-based on the old entry's base class, and objects in any other
+ * generated class are turned away, so disposing of a cached class never pulls the superclass out from
+ * under another generated class.
+ */
+@interface FMSDynamicSubclassCacheEntry : NSObject {
+@public
+    Class _cls;
+    Class _baseClass;
+    NSString *_signature;
+    NSUInteger _instanceCount;
+}
+@end
+
+@implementation FMSDynamicSubclassCacheEntry
+@end
+
+@interface FMSDynamicSubclassLease : NSObject {
+@public
+    FMSDynamicSubclassCacheEntry *_entry;
+}
+@end
+
+static char FMSDynamicSubclassLeaseKey;
+
+// Set on every class made by +allocateDynamicSubclass, so they can be told apart from ordinary classes.
+static char FMSGeneratedClassKey;
+
+static atomic_size_t FMSLiveGeneratedClassCount = 0;
+static atomic_size_t FMSCachedDynamicSubclassCount = 0;
+
+static pthread_mutex_t FMSDynamicSubclassCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+// base class -> signature -> FMSDynamicSubclassCacheEntry
+static NSMutableDictionary *FMSDynamicSubclassCache = nil;
+
+static BOOL FMSIsGeneratedClass(Class cls) {
+    return objc_getAssociatedObject(cls, &FMSGeneratedClassKey) != nil;
+}
+
+// Only for classes that no object has ever been moved into.
+static void FMSDisposeUnusedDynamicSubclass(Class cls) {
+    
+    FMSRetireSwizzleRecordsForClass(cls);
+    objc_disposeClassPair(cls);
+    atomic_fetch_sub(&FMSLiveGeneratedClassCount, 1);
+}
+
+/*
+ * The lease is normally released while the runtime is still tearing the object down (when its associated
+ * objects are removed), and the class can't be disposed of until the object's memory is gone. So each cached
+ * class overrides dealloc to hold on to the object's lease until the superclass's dealloc has returned.
+ */
+static void FMSAddLeaseHoldingDealloc(Class cls, Class baseClass) {
+    
+    SEL deallocSelector = sel_registerName("dealloc");
+    
+    IMP deallocImp = imp_implementationWithBlock(^(__unsafe_unretained id _self) {
+        
+        // Counted, so the class (which this IMP belongs to) outlives the call. See FMSReleaseDynamicSubclass().
+        FMS_SWIZZLED_CALL_SCOPE;
+        
+        __attribute__((objc_precise_lifetime))
+        FMSDynamicSubclassLease *lease = objc_getAssociatedObject(_self, &FMSDynamicSubclassLeaseKey);
+        
+        IMP superDealloc = class_getMethodImplementation(baseClass, deallocSelector);
+        ((void (*)(__unsafe_unretained id, SEL))superDealloc)(_self, deallocSelector);
+    });
+    
+    class_addMethod(cls, deallocSelector, deallocImp, "v@:");
+}
+
+/*
+ * The configuration block runs without holding the cache lock, so configurations don't queue up behind each
+ * other and a configuration may itself share subclasses. If another thread publishes a class for the same
+ * signature in the meantime, its class wins and ours is thrown away unused.
+ */
+static FMSDynamicSubclassCacheEntry *FMSAcquireDynamicSubclass(Class baseClass,
+                                                               NSString *signature,
+                                                               FMSDynamicSubclassConfiguration configuration) {
+    
+    pthread_mutex_lock(&FMSDynamicSubclassCacheLock);
+    
+    FMSDynamicSubclassCacheEntry *entry = FMSDynamicSubclassCache[baseClass][signature];
+    
+    if (entry != nil) {
+        entry->_instanceCount++;
+    }
+    
+    pthread_mutex_unlock(&FMSDynamicSubclassCacheLock);
+    
+    if (entry != nil) {
+        return entry;
+    }
+    
+    Class cls = [baseClass allocateDynamicSubclass];
+    
+    @try {
+        
+        FMSAddLeaseHoldingDealloc(cls, baseClass);
+        
+        // Configure the class completely before any object can be moved into it.
+        if (configuration != nil) {
+            configuration(cls);
+        }
+    }
+    @catch (NSException *exception) {
+        
+        // No object has been moved into the class yet, so it's safe to throw it away.
+        FMSDisposeUnusedDynamicSubclass(cls);
+        @throw;
+    }
+    
+    pthread_mutex_lock(&FMSDynamicSubclassCacheLock);
+    
+    if (FMSDynamicSubclassCache == nil) {
+        FMSDynamicSubclassCache = [NSMutableDictionary dictionary];
+    }
+    
+    NSMutableDictionary *signatures = FMSDynamicSubclassCache[baseClass];
+    
+    if (signatures == nil) {
+        signatures = [NSMutableDictionary dictionary];
+        FMSDynamicSubclassCache[(id <NSCopying>)baseClass] = signatures;
+    }
+    
+    entry = signatures[signature];
+    BOOL lostRace = (entry != nil);
+    
+    if (!lostRace) {
+        
+        entry = [[FMSDynamicSubclassCacheEntry alloc] init];
+        entry->_cls = cls;
+        entry->_baseClass = baseClass;
+        entry->_signature = [signature copy];
+        
+        signatures[entry->_signature] = entry;
+        atomic_fetch_add(&FMSCachedDynamicSubclassCount, 1);
+    }
+    
+    entry->_instanceCount++;
+    
+    pthread_mutex_unlock(&FMSDynamicSubclassCacheLock);
+    
+    if (lostRace) {
+        FMSDisposeUnusedDynamicSubclass(cls);
+    }
+    
+    return entry;
+}
+
+static void FMSReleaseDynamicSubclass(FMSDynamicSubclassCacheEntry *entry) {
+    
+    pthread_mutex_lock(&FMSDynamicSubclassCacheLock);
+    
+    BOOL unused = (--entry->_instanceCount == 0);
+    
+    pthread_mutex_unlock(&FMSDynamicSubclassCacheLock);
+    
+    if (!unused) {
+        return;
+    }
+    
+    // The last instance has finished tearing down (or has moved to another class), but its dealloc may
+    // still be returning through our IMP. That IMP counts itself as a swizzled call, so the class is retired
+    // like a restored IMP and disposed of once no call can still be inside it. By then another object may
+    // have acquired it again, in which case we leave it alone.
+    FMSRetireImplementation(^{
+        
+        pthread_mutex_lock(&FMSDynamicSubclassCacheLock);
+        
+        if (entry->_instanceCount == 0 && entry->_cls != Nil) {
+            
+            [FMSDynamicSubclassCache[entry->_baseClass] removeObjectForKey:entry->_signature];
+            
+            FMSRetireSwizzleRecordsForClass(entry->_cls);
+            objc_disposeClassPair(entry->_cls);
+            entry->_cls = Nil;
+            
+            atomic_fetch_sub(&FMSCachedDynamicSubclassCount, 1);
+            atomic_fetch_sub(&FMSLiveGeneratedClassCount, 1);
+        }
+        
+        pthread_mutex_unlock(&FMSDynamicSubclassCacheLock);
+    });
+}
+
+@implementation FMSDynamicSubclassLease
+
+- (void)dealloc {
+    FMSReleaseDynamicSubclass(_entry);
+}
+
+@end
+
+void FMSPinDynamicSubclass(id obj, Class cls) {
+    
+    FMSDynamicSubclassLease *lease = objc_getAssociatedObject(obj, &FMSDynamicSubclassLeaseKey);
+    
+    // The object's own lease keeps the class in the cache while we take a count of our own.
+    if (lease == nil || lease->_entry->_cls != cls) return;
+    
+    pthread_mutex_lock(&FMSDynamicSubclassCacheLock);
+    lease->_entry->_instanceCount++;
+    pthread_mutex_unlock(&FMSDynamicSubclassCacheLock);
+}
+
+
+@implementation NSObject (FMS_Swizzler)
+
+#pragma mark - Logging
+
++ (void)FMS_setLoggingEnabled:(BOOL)enabled {
+    FMSLoggingEnabled = enabled;
+}
+
++ (BOOL)FMS_isLoggingEnabled {
+    return FMSLoggingEnabled;
+}
+
+#pragma mark - Pseudo Property Methods
+
++ (FMSPseudoPropertyAdder)FMS_generatePseudoPropertyAdderForType:(FMSPseudoPropertyType)type {
+    
+    FMSPseudoPropertyTypeInfo info;
+    
+    if (!FMSGetPseudoPropertyTypeInfo(type, &info)) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"%d is not a valid FMSPsudoPropertyType", type];
+    }
+    
+    FMSPseudoPropertyAdder adder = ^(NSString *propertyName) {
+        
+        FMSPseudoPropertyDescriptor descriptor = {propertyName, type};
+        [self FMS_addPseudoPropertyDescriptors:&descriptor count:1];
+    };
+    
+    return adder;
+}
+
++ (void)FMS_addPseudoProperties:(NSDictionary *)properties {
+    
+    NSData *descriptors = FMSPseudoPropertyDescriptorsFromDictionary(properties);
+    
+    [self FMS_addPseudoPropertyDescriptors:[descriptors bytes]
+                                     count:[descriptors length] / sizeof(FMSPseudoPropertyDescriptor)];
+}
+
++ (void)FMS_addPseudoPropertyDescriptors:(const FMSPseudoPropertyDescriptor *)descriptors count:(NSUInteger)count {
+    
+    FMSPerformLocked(self, ^{
+        [self performAddPseudoPropertyDescriptors:descriptors count:count];
+    });
+}
+
++ (void)performAddPseudoPropertyDescriptors:(const FMSPseudoPropertyDescriptor *)descriptors count:(NSUInteger)count {
+    
+    NSArray *names = [self validatePseudoPropertyDescriptors:descriptors count:count];
+    
+    // Everything has been checked, so nothing below can fail and leave the class half-installed.
+    for (NSUInteger index = 0; index < count; index++) {
+        
+        FMSPseudoPropertyType type = descriptors[index].type;
+        FMSPseudoPropertyName *name = names[index];
+        
+        FMSPseudoPropertyTypeInfo info;
+        FMSGetPseudoPropertyTypeInfo(type, &info);
+        
+        IMP getterImp;
+        IMP setterImp;
+        [self makePseudoPropertyAccessorsForName:name type:type getterImp:&getterImp setterImp:&setterImp];
+        
+        [self installPseudoProperty:name typeEncoding:info.encoding getterImp:getterImp setterImp:setterImp];
+    }
+}
+
++ (void)makePseudoPropertyAccessorsForName:(FMSPseudoPropertyName *)name
+                                      type:(FMSPseudoPropertyType)type
+                                 getterImp:(IMP *)getterOut
+                                 setterImp:(IMP *)setterOut {
+    
+    const void *key = (__bridge const void *)name;
+    
+    IMP getterImp;
+    IMP setterImp;
+    
+    switch (type) {
+        case FMSObjectRetain: {
+            
+            getterImp = imp_implementationWithBlock(^(id _self){
+                
+                id result = objc_getAssociatedObject(_self, key);
+                return result;
+                
+            });
+            
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
+                
+                objc_setAssociatedObject(_self,
+                                         key,
+                                         obj,
+                                         OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+                
+            });
+            
+            break;
+        }
+            
+            
+            
+        case FMSObjectCopy: {
+            
+            getterImp = imp_implementationWithBlock(^(id _self){
+                
+                return objc_getAssociatedObject(_self, key);
+                
+            });
+            
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
+                
+                objc_setAssociatedObject(_self,
+                                         key,
+                                         obj,
+                                         OBJC_ASSOCIATION_COPY_NONATOMIC);
+                
+            });
+            
+            break;
+        }
+            
+            
+            
+        case FMSObjectAssignUnsafe: {
+            
+            getterImp = imp_implementationWithBlock(^(id _self){
+                
+                return objc_getAssociatedObject(_self, key);
+                
+            });
+            
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
+                
+                objc_setAssociatedObject(_self,
+                                         key,
+                                         obj,
+                                         OBJC_ASSOCIATION_ASSIGN);
+                
+            });
+            
+            break;
+        }
+            
+            
+            
+        case FMSObjectWeak: {
+            
+            getterImp = imp_implementationWithBlock(^id (id _self){
+                
+                __unsafe_unretained FMSPseudoPropertyWeakBox *box = objc_getAssociatedObject(_self, key);
+                return box == nil ? nil : box->_value;
+                
+            });
+            
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
+                
+                FMSPseudoPropertyWeakBox *box = FMSPseudoPropertyBox(_self, key, [FMSPseudoPropertyWeakBox class]);
+                box->_value = obj;
+                
+            });
+            
+            break;
+        }
+            
+            
+            
+        case FMSObjectRetainAtomic: {
+            
+            getterImp = imp_implementationWithBlock(^(id _self){
+                
+                // The value must be retained before the lock is dropped, or a setter on another
+                // thread could release it out from under us.
+                FMSPseudoPropertyLockStripe *stripe = FMSPseudoPropertyLockStripeFor(_self, key);
+                FMSPseudoPropertyLockStripeLock(stripe);
+                
+                id result = objc_getAssociatedObject(_self, key);
+                
+                FMSPseudoPropertyLockStripeUnlock(stripe);
+                return result;
+                
+            });
+            
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
+                
+                FMSPseudoPropertyLockStripe *stripe = FMSPseudoPropertyLockStripeFor(_self, key);
+                FMSPseudoPropertyLockStripeLock(stripe);
+                
+                // Holding the old value keeps its dealloc (if this was the last reference) outside the lock.
+                id previous = objc_getAssociatedObject(_self, key);
+                objc_setAssociatedObject(_self,
+                                         key,
+                                         obj,
+                                         OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+                
+                FMSPseudoPropertyLockStripeUnlock(stripe);
+                previous = nil;
+                
+            });
+            
+            break;
+        }
+            
+            
+            
+        case FMSBoolAtomic:
+            FMS_ATOMIC_VALUE_ACCESSORS(BOOL, FMSAtomicBoxReadAddress(_self, key), FMSAtomicBoxWriteAddress(_self, key));
+            break;
+            
+        case FMSIntegerAtomic:
+            FMS_ATOMIC_VALUE_ACCESSORS(NSInteger, FMSAtomicBoxReadAddress(_self, key), FMSAtomicBoxWriteAddress(_self, key));
+            break;
+            
+        case FMSUnsignedIntegerAtomic:
+            FMS_ATOMIC_VALUE_ACCESSORS(NSUInteger, FMSAtomicBoxReadAddress(_self, key), FMSAtomicBoxWriteAddress(_self, key));
+            break;
+            
+        case FMSFloatAtomic:
+            FMS_ATOMIC_VALUE_ACCESSORS(float, FMSAtomicBoxReadAddress(_self, key), FMSAtomicBoxWriteAddress(_self, key));
+            break;
+            
+        case FMSDoubleAtomic:
+            FMS_ATOMIC_VALUE_ACCESSORS(double, FMSAtomicBoxReadAddress(_self, key), FMSAtomicBoxWriteAddress(_self, key));
+            break;
+            
+        default:
+            
+            // Scalars and structs are stored unboxed in the object's slab.
+            [self makeSlabBackedPseudoPropertyAccessorsForType:type getterImp:&getterImp setterImp:&setterImp];
+    }
+    
+    *getterOut = getterImp;
+    *setterOut = setterImp;
+}
+
++ (void)makeSlabBackedPseudoPropertyAccessorsForType:(FMSPseudoPropertyType)type
+                                           getterImp:(IMP *)getterOut
+                                           setterImp:(IMP *)setterOut {
+    
+    FMSPseudoPropertyTypeInfo info;
+    FMSGetPseudoPropertyTypeInfo(type, &info);
+    
+    FMSPseudoPropertySlabLayout *layout = [self pseudoPropertySlabLayout];
+    size_t offset = FMSReserveSlabSlot(layout, info.size, info.alignment);
+    
+    IMP getterImp;
+    IMP setterImp;
+    
+    switch (type) {
+        case FMSBool:
+            FMS_VALUE_ACCESSORS(BOOL,
+                                FMSSlabReadAddress(_self, layout, offset, sizeof(BOOL)),
+                                FMSSlabWriteAddress(_self, layout, offset, sizeof(BOOL)));
+            break;
+            
+        case FMSInteger:
+            FMS_VALUE_ACCESSORS(NSInteger,
+                                FMSSlabReadAddress(_self, layout, offset, sizeof(NSInteger)),
+                                FMSSlabWriteAddress(_self, layout, offset, sizeof(NSInteger)));
+            break;
+            
+        case FMSUnsignedInteger:
+            FMS_VALUE_ACCESSORS(NSUInteger,
+                                FMSSlabReadAddress(_self, layout, offset, sizeof(NSUInteger)),
+                                FMSSlabWriteAddress(_self, layout, offset, sizeof(NSUInteger)));
+            break;
+            
+        case FMSFloat:
+            FMS_VALUE_ACCESSORS(float,
+                                FMSSlabReadAddress(_self, layout, offset, sizeof(float)),
+                                FMSSlabWriteAddress(_self, layout, offset, sizeof(float)));
+            break;
+            
+        case FMSDouble:
+            FMS_VALUE_ACCESSORS(double,
+                                FMSSlabReadAddress(_self, layout, offset, sizeof(double)),
+                                FMSSlabWriteAddress(_self, layout, offset, sizeof(double)));
+            break;
+            
+        case FMSRange:
+            FMS_VALUE_ACCESSORS(NSRange,
+                                FMSSlabReadAddress(_self, layout, offset, sizeof(NSRange)),
+                                FMSSlabWriteAddress(_self, layout, offset, sizeof(NSRange)));
+            break;
+            
+        case FMSPoint:
+            FMS_VALUE_ACCESSORS(FMSPointValue,
+                                FMSSlabReadAddress(_self, layout, offset, sizeof(FMSPointValue)),
+                                FMSSlabWriteAddress(_self, layout, offset, sizeof(FMSPointValue)));
+            break;
+            
+        case FMSSize:
+            FMS_VALUE_ACCESSORS(FMSSizeValue,
+                                FMSSlabReadAddress(_self, layout, offset, sizeof(FMSSizeValue)),
+                                FMSSlabWriteAddress(_self, layout, offset, sizeof(FMSSizeValue)));
+            break;
+            
+        case FMSRect:
+            FMS_VALUE_ACCESSORS(FMSRectValue,
+                                FMSSlabReadAddress(_self, layout, offset, sizeof(FMSRectValue)),
+                                FMSSlabWriteAddress(_self, layout, offset, sizeof(FMSRectValue)));
+            break;
+            
+        default:
+            
+            [NSException raise:NSInvalidArgumentException
+                        format:@"%d is not a slab-backed FMSPsudoPropertyType", type];
+    }
+    
+    *getterOut = getterImp;
+    *setterOut = setterImp;
+}
+
++ (FMSPseudoPropertySlabLayout *)pseudoPropertySlabLayout {
+    
+    static char FMSSlabLayoutKey;
+    
+    @synchronized(self) {
+        
+        FMSPseudoPropertySlabLayout *layout = objc_getAssociatedObject(self, &FMSSlabLayoutKey);
+        
+        if (layout == nil) {
+            layout = [[FMSPseudoPropertySlabLayout alloc] init];
+            objc_setAssociatedObject(self, &FMSSlabLayoutKey, layout, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        
+        return layout;
+    }
+}
+
 
-@implementation NSObject (FMS_Swizzler)
+#pragma mark - Pseudo Property Arena Scopes
 
-#pragma mark - Pseudo Property Methods
++ (void)FMS_performWithPseudoPropertyArena:(FMSPseudoPropertyArenaBlock)block {
+    
+    FMSPseudoPropertyArena arena = { NULL, 0, FMSCurrentPseudoPropertyArena };
+    FMSCurrentPseudoPropertyArena = &arena;
+    
+    @try {
+        @autoreleasepool {
+            block();
+        }
+    } @finally {
+        
+        FMSCurrentPseudoPropertyArena = arena.previous;
+        FMSDrainPseudoPropertyArena(&arena);
+    }
+}
 
-+ (FMSPseudoPropertyAdder)FMS_generatePseudoPropertyAdderForType:(FMSPseudoPropertyType)type {
++ (NSUInteger)FMS_currentPseudoPropertyArenaSize {
+    
+    FMSPseudoPropertyArena *arena = FMSCurrentPseudoPropertyArena;
+    return (arena == NULL) ? 0 : arena->reservedBytes;
+}
+
+#pragma mark - Lazy Pseudo Properties
+
++ (FMSLazyPseudoPropertyAdder)FMS_generateLazyPseudoPropertyAdderForType:(FMSPseudoPropertyType)type {
+    
+    FMSPseudoPropertyTypeInfo info;
+    
+    if (!FMSGetPseudoPropertyTypeInfo(type, &info)) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"%d is not a valid FMSPsudoPropertyType", type];
+    }
+    
+    if (type == FMSObjectWeak || type == FMSObjectAssignUnsafe) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"%d can't be used for a lazy pseudo property, since it doesn't keep its value alive", type];
+    }
+    
+    FMSLazyPseudoPropertyAdder adder = ^(NSString *propertyName,
+                                         FMSPseudoPropertyInitializer initializer,
+                                         SEL invalidationSelector) {
+        
+        if (initializer == nil) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"Lazy pseudo properties need an initializer"];
+        }
+        
+        FMSPerformLocked(self, ^{
+            [self performAddLazyPseudoProperty:propertyName
+                                          type:type
+                                   initializer:initializer
+                          invalidationSelector:invalidationSelector];
+        });
+    };
+    
+    return adder;
+}
+
++ (void)performAddLazyPseudoProperty:(NSString *)propertyName
+                                type:(FMSPseudoPropertyType)type
+                         initializer:(FMSPseudoPropertyInitializer)initializer
+                invalidationSelector:(SEL)invalidationSelector {
+    
+    FMSPseudoPropertyDescriptor descriptor = {propertyName, type};
+    FMSPseudoPropertyName *name = [self validatePseudoPropertyDescriptors:&descriptor count:1][0];
+    
+    if (invalidationSelector != NULL) {
+        
+        if ([self instancesRespondToSelector:invalidationSelector] ||
+            sel_isEqual(invalidationSelector, name->_getter) ||
+            sel_isEqual(invalidationSelector, name->_setter)) {
+            
+            [NSException raise:NSInvalidArgumentException
+                        format:@"The %@ method already exists", NSStringFromSelector(invalidationSelector)];
+        }
+        
+        if (FMSSelectorArgumentCount(invalidationSelector) != 0) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"The invalidation selector %@ must not take any arguments",
+                               NSStringFromSelector(invalidationSelector)];
+        }
+    }
+    
+    FMSPseudoPropertyTypeInfo info;
+    FMSGetPseudoPropertyTypeInfo(type, &info);
     
-    FMSPseudoPropertyAdder adder;
+    IMP getterImp;
+    IMP setterImp;
+    [self makeLazyPseudoPropertyAccessorsForName:name
+                                            type:type
+                                     initializer:initializer
+                                       getterImp:&getterImp
+                                       setterImp:&setterImp];
+    
+    [self installPseudoProperty:name typeEncoding:info.encoding getterImp:getterImp setterImp:setterImp];
+    
+    if (invalidationSelector != NULL) {
+        
+        const void *key = (__bridge const void *)name;
+        BOOL isObject = (info.encoding[0] == _C_ID);
+        
+        IMP invalidateImp = imp_implementationWithBlock(^(id _self) {
+            
+            __unsafe_unretained FMSLazyPseudoPropertyCell *cell = objc_getAssociatedObject(_self, key);
+            
+            // Nothing has been cached yet, so there's nothing to invalidate.
+            if (cell == nil) {
+                return;
+            }
+            
+            pthread_mutex_lock(&cell->_lock);
+            
+            if (isObject) {
+                FMSLazyCellWriteObject(cell, nil, NO);
+            } else {
+                atomic_store_explicit(&cell->_ready, false, memory_order_release);
+            }
+            
+            pthread_mutex_unlock(&cell->_lock);
+        });
+        
+        class_addMethod([self class], invalidationSelector, invalidateImp, "v@:");
+    }
+}
+
++ (void)makeLazyPseudoPropertyAccessorsForName:(FMSPseudoPropertyName *)name
+                                          type:(FMSPseudoPropertyType)type
+                                   initializer:(FMSPseudoPropertyInitializer)initializer
+                                     getterImp:(IMP *)getterOut
+                                     setterImp:(IMP *)setterOut {
+    
+    const void *key = (__bridge const void *)name;
+    
+    IMP getterImp;
+    IMP setterImp;
     
     switch (type) {
-        case FMSObjectRetain: {
+        case FMSObjectRetain:
+        case FMSObjectCopy:
+        case FMSObjectRetainAtomic: {
             
-            adder = ^(NSString *propertyName) {
+            BOOL copies = (type == FMSObjectCopy);
+            
+            FMSLazyPseudoPropertyStore store = ^(FMSLazyPseudoPropertyCell *cell, id value) {
+                FMSLazyCellWriteObject(cell, copies ? [value copy] : value, YES);
+            };
+            
+            getterImp = imp_implementationWithBlock(^id (id _self){
                 
-                NSString *key = [NSString stringWithFormat:@"FMS%@Key", propertyName];
+                __unsafe_unretained FMSLazyPseudoPropertyCell *cell = objc_getAssociatedObject(_self, key);
                 
-                IMP getterImp = imp_implementationWithBlock(^(id _self){
+                // Loop in case the value is invalidated between initializing it and reading it back.
+                while (YES) {
                     
-                    id result = objc_getAssociatedObject(_self, (__bridge const void *)(key));
-                    return result;
+                    if (cell != nil) {
+                        
+                        BOOL ready;
+                        id result = FMSLazyCellReadObject(cell, &ready);
+                        
+                        if (ready) {
+                            return result;
+                        }
+                    }
                     
-                });
+                    cell = FMSLazyCellInitialize(_self, key, initializer, store);
+                }
+            });
+            
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
                 
-                IMP setterImp = imp_implementationWithBlock(^(id _self, id obj){
-                    
-                    objc_setAssociatedObject(_self,
-                                             (__bridge const void *)(key),
-                                             obj,
-                                             OBJC_ASSOCIATION_RETAIN_NONATOMIC);
-                    
-                });
+                FMSLazyPseudoPropertyCell *cell = FMSLazyCellForWriting(_self, key);
                 
-                NSString *typeString = @"@";
-                [self createPseudoProperties:propertyName typeString:typeString getterImp:getterImp setterImp:setterImp];
-            };
+                pthread_mutex_lock(&cell->_lock);
+                FMSLazyCellWriteObject(cell, copies ? [obj copy] : obj, YES);
+                pthread_mutex_unlock(&cell->_lock);
+            });
             
             break;
-            
         }
             
+        case FMSBool:
+            FMS_LAZY_VALUE_ACCESSORS(BOOL, [value boolValue], FMSLazyPlainLoad, FMSLazyPlainStore);
+            break;
             
+        case FMSInteger:
+            FMS_LAZY_VALUE_ACCESSORS(NSInteger, [value integerValue], FMSLazyPlainLoad, FMSLazyPlainStore);
+            break;
             
-        case FMSObjectCopy: {
+        case FMSUnsignedInteger:
+            FMS_LAZY_VALUE_ACCESSORS(NSUInteger, [value unsignedIntegerValue], FMSLazyPlainLoad, FMSLazyPlainStore);
+            break;
             
-            adder = ^(NSString *propertyName) {
-                
-                NSString *key = [NSString stringWithFormat:@"FMS%@Key", propertyName];
-                
-                IMP getterImp = imp_implementationWithBlock(^(id _self){
-                    
-                    return objc_getAssociatedObject(_self, (__bridge const void *)(key));
-                    
-                });
-                
-                IMP setterImp = imp_implementationWithBlock(^(id _self, id obj){
-                    
-                    objc_setAssociatedObject(_self,
-                                             (__bridge const void *)(key),
-                                             obj,
-                                             OBJC_ASSOCIATION_COPY_NONATOMIC);
-                    
-                });
-                
-                NSString *typeString = @"@";
-                [self createPseudoProperties:propertyName typeString:typeString getterImp:getterImp setterImp:setterImp];
-            };
+        case FMSFloat:
+            FMS_LAZY_VALUE_ACCESSORS(float, [value floatValue], FMSLazyPlainLoad, FMSLazyPlainStore);
+            break;
             
+        case FMSDouble:
+            FMS_LAZY_VALUE_ACCESSORS(double, [value doubleValue], FMSLazyPlainLoad, FMSLazyPlainStore);
             break;
-        }
             
+        case FMSRange:
+            FMS_LAZY_VALUE_ACCESSORS(NSRange, FMSLazyUnboxStruct(NSRange), FMSLazyPlainLoad, FMSLazyPlainStore);
+            break;
             
+        case FMSPoint:
+            FMS_LAZY_VALUE_ACCESSORS(FMSPointValue, FMSLazyUnboxStruct(FMSPointValue), FMSLazyPlainLoad, FMSLazyPlainStore);
+            break;
             
-        case FMSObjectAssignUnsafe: {
+        case FMSSize:
+            FMS_LAZY_VALUE_ACCESSORS(FMSSizeValue, FMSLazyUnboxStruct(FMSSizeValue), FMSLazyPlainLoad, FMSLazyPlainStore);
+            break;
             
-            adder = ^(NSString *propertyName) {
-                
-                NSString *key = [NSString stringWithFormat:@"FMS%@Key", propertyName];
-                
-                IMP getterImp = imp_implementationWithBlock(^(id _self){
-                    
-                    return objc_getAssociatedObject(_self, (__bridge const void *)(key));
-                    
-                });
-                
-                IMP setterImp = imp_implementationWithBlock(^(id _self, id obj){
-                    
-                    objc_setAssociatedObject(_self,
-                                             (__bridge const void *)(key),
-                                             obj,
-                                             OBJC_ASSOCIATION_ASSIGN);
-                    
-                });
-                
-                NSString *typeString = @"@";
-                [self createPseudoProperties:propertyName typeString:typeString getterImp:getterImp setterImp:setterImp];
-            };
+        case FMSRect:
+            FMS_LAZY_VALUE_ACCESSORS(FMSRectValue, FMSLazyUnboxStruct(FMSRectValue), FMSLazyPlainLoad, FMSLazyPlainStore);
+            break;
+            
+        case FMSBoolAtomic:
+            FMS_LAZY_VALUE_ACCESSORS(BOOL, [value boolValue], FMSLazyAtomicLoad, FMSLazyAtomicStore);
+            break;
+            
+        case FMSIntegerAtomic:
+            FMS_LAZY_VALUE_ACCESSORS(NSInteger, [value integerValue], FMSLazyAtomicLoad, FMSLazyAtomicStore);
+            break;
+            
+        case FMSUnsignedIntegerAtomic:
+            FMS_LAZY_VALUE_ACCESSORS(NSUInteger, [value unsignedIntegerValue], FMSLazyAtomicLoad, FMSLazyAtomicStore);
+            break;
+            
+        case FMSFloatAtomic:
+            FMS_LAZY_VALUE_ACCESSORS(float, [value floatValue], FMSLazyAtomicLoad, FMSLazyAtomicStore);
+            break;
             
+        case FMSDoubleAtomic:
+            FMS_LAZY_VALUE_ACCESSORS(double, [value doubleValue], FMSLazyAtomicLoad, FMSLazyAtomicStore);
             break;
+            
+        default:
+            
+            [NSException raise:NSInvalidArgumentException
+                        format:@"%d can't be used for a lazy pseudo property", type];
+    }
+    
+    *getterOut = getterImp;
+    *setterOut = setterImp;
+}
+
+
+#pragma mark - Ivar-Backed Pseudo Properties
+
++ (Class)FMS_allocateSubclassWithPseudoProperties:(NSDictionary *)properties {
+    
+    Class startingClass = [self class];
+    
+    // Validate everything before we touch the runtime, so a bad entry never leaves a half-built class.
+    NSData *descriptorData = FMSPseudoPropertyDescriptorsFromDictionary(properties);
+    const FMSPseudoPropertyDescriptor *descriptors = [descriptorData bytes];
+    NSUInteger count = [descriptorData length] / sizeof(FMSPseudoPropertyDescriptor);
+    
+    NSArray *names = [startingClass validatePseudoPropertyDescriptors:descriptors count:count];
+    
+    NSString *className = [self nextGeneratedSubclassNameForClass:startingClass];
+    
+    Class cls = objc_allocateClassPair(startingClass,
+                                       [className cStringUsingEncoding:NSUTF8StringEncoding],
+                                       0);
+    
+    if (cls == Nil) {
+        [NSException raise:NSGenericException
+                    format:@"Unable to allocate the class %@", className];
+    }
+    
+    for (NSUInteger index = 0; index < count; index++) {
+        
+        FMSPseudoPropertyTypeInfo info;
+        FMSGetPseudoPropertyTypeInfo(descriptors[index].type, &info);
+        
+        NSString *ivarName = [NSString stringWithFormat:@"_FMS_%@", descriptors[index].name];
+        
+        if (!class_addIvar(cls,
+                           [ivarName cStringUsingEncoding:NSUTF8StringEncoding],
+                           info.size,
+                           FMSLog2Alignment(info.alignment),
+                           info.encoding)) {
+            
+            objc_disposeClassPair(cls);
+            [NSException raise:NSGenericException
+                        format:@"An unknown exception occured while adding the %@ instance variable", ivarName];
+        }
+    }
+    
+    objc_registerClassPair(cls);
+    objc_setAssociatedObject(cls, &FMSGeneratedClassKey, startingClass, OBJC_ASSOCIATION_ASSIGN);
+    atomic_fetch_add(&FMSLiveGeneratedClassCount, 1);
+    FMSRecordSwizzle(FMSSwizzleRecordGeneratedClass, cls, NULL, NULL, NULL, NULL, startingClass);
+    
+    // Ivar offsets are only final once the class has been registered.
+    NSMutableData *strongOffsets = [NSMutableData data];
+    NSMutableData *weakOffsets = [NSMutableData data];
+    
+    for (NSUInteger index = 0; index < count; index++) {
+        
+        FMSPseudoPropertyType type = descriptors[index].type;
+        FMSPseudoPropertyTypeInfo info;
+        FMSGetPseudoPropertyTypeInfo(type, &info);
+        
+        NSString *ivarName = [NSString stringWithFormat:@"_FMS_%@", descriptors[index].name];
+        Ivar ivar = class_getInstanceVariable(cls, [ivarName cStringUsingEncoding:NSUTF8StringEncoding]);
+        ptrdiff_t offset = ivar_getOffset(ivar);
+        
+        if (info.isStrongObject) {
+            [strongOffsets appendBytes:&offset length:sizeof(offset)];
+        } else if (info.isWeakObject) {
+            [weakOffsets appendBytes:&offset length:sizeof(offset)];
         }
+        
+        IMP getterImp;
+        IMP setterImp;
+        [cls makeIvarBackedPseudoPropertyAccessorsForType:type offset:offset getterImp:&getterImp setterImp:&setterImp];
+        
+        [cls installPseudoProperty:names[index] typeEncoding:info.encoding getterImp:getterImp setterImp:setterImp];
+    }
+    
+    // The runtime doesn't know how to release the object ivars we added (or unregister the weak
+    // ones), so clear them before handing off to the superclass's dealloc.
+    if ([strongOffsets length] > 0 || [weakOffsets length] > 0) {
+        
+        SEL deallocSelector = sel_registerName("dealloc");
+        
+        IMP deallocImp = imp_implementationWithBlock(^(__unsafe_unretained id _self) {
             
+            const ptrdiff_t *offsets = [strongOffsets bytes];
+            NSUInteger offsetCount = [strongOffsets length] / sizeof(ptrdiff_t);
             
+            for (NSUInteger index = 0; index < offsetCount; index++) {
+                __strong id *slot = (__strong id *)FMSIvarAddress(_self, offsets[index]);
+                *slot = nil;
+            }
             
-        case FMSBool: {
+            const ptrdiff_t *weak = [weakOffsets bytes];
+            NSUInteger weakCount = [weakOffsets length] / sizeof(ptrdiff_t);
             
-            adder = ^(NSString *propertyName) {
-                
-                NSString *key = [NSString stringWithFormat:@"FMS%@Key", propertyName];
-                
-                IMP getterImp = imp_implementationWithBlock(^(id _self){
-                    
-                    return [objc_getAssociatedObject(_self, (__bridge const void *)(key)) boolValue];
-                    
-                });
-                
-                IMP setterImp = imp_implementationWithBlock(^(id _self, BOOL value){
-                    
-                    objc_setAssociatedObject(_self,
-                                             (__bridge const void *)(key),
-                                             @(value),
-                                             OBJC_ASSOCIATION_RETAIN_NONATOMIC);
-                    
-                });
-                
-                NSString *typeString = @"c";
-                [self createPseudoProperties:propertyName typeString:typeString getterImp:getterImp setterImp:setterImp];
-            };
+            for (NSUInteger index = 0; index < weakCount; index++) {
+                __weak id *slot = (__weak id *)FMSIvarAddress(_self, weak[index]);
+                *slot = nil;
+            }
+            
+            IMP superDealloc = class_getMethodImplementation(startingClass, deallocSelector);
+            ((void (*)(__unsafe_unretained id, SEL))superDealloc)(_self, deallocSelector);
+        });
+        
+        class_addMethod(cls, deallocSelector, deallocImp, "v@:");
+    }
+    
+    return cls;
+}
+
++ (void)makeIvarBackedPseudoPropertyAccessorsForType:(FMSPseudoPropertyType)type
+                                              offset:(ptrdiff_t)offset
+                                           getterImp:(IMP *)getterOut
+                                           setterImp:(IMP *)setterOut {
+    
+    IMP getterImp;
+    IMP setterImp;
+    
+    switch (type) {
+        case FMSObjectRetain: {
+            
+            getterImp = imp_implementationWithBlock(^(id _self){
+                return *(__strong id *)FMSIvarAddress(_self, offset);
+            });
+            
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
+                *(__strong id *)FMSIvarAddress(_self, offset) = obj;
+            });
             
             break;
         }
             
+        case FMSObjectCopy: {
             
+            getterImp = imp_implementationWithBlock(^(id _self){
+                return *(__strong id *)FMSIvarAddress(_self, offset);
+            });
             
-        case FMSInteger: {
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
+                *(__strong id *)FMSIvarAddress(_self, offset) = [obj copy];
+            });
             
-            adder = ^(NSString *propertyName) {
-                
-                NSString *key = [NSString stringWithFormat:@"FMS%@Key", propertyName];
-                
-                IMP getterImp = imp_implementationWithBlock(^(id _self){
-                    
-                    return [objc_getAssociatedObject(_self, (__bridge const void *)(key)) integerValue];
-                    
-                });
-                
-                IMP setterImp = imp_implementationWithBlock(^(id _self, NSInteger value){
-                    
-                    objc_setAssociatedObject(_self,
-                                             (__bridge const void *)(key),
-                                             @(value),
-                                             OBJC_ASSOCIATION_RETAIN_NONATOMIC);
-                    
-                });
-                
-                NSString *typeString = integerType;
-                [self createPseudoProperties:propertyName typeString:typeString getterImp:getterImp setterImp:setterImp];
-            };
+            break;
+        }
+            
+        case FMSObjectAssignUnsafe: {
+            
+            getterImp = imp_implementationWithBlock(^id (id _self){
+                return *(__unsafe_unretained id *)FMSIvarAddress(_self, offset);
+            });
+            
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
+                *(__unsafe_unretained id *)FMSIvarAddress(_self, offset) = obj;
+            });
             
             break;
         }
             
+        case FMSObjectWeak: {
+            
+            getterImp = imp_implementationWithBlock(^id (id _self){
+                return *(__weak id *)FMSIvarAddress(_self, offset);
+            });
             
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
+                *(__weak id *)FMSIvarAddress(_self, offset) = obj;
+            });
             
-        case FMSUnsignedInteger: {
+            break;
+        }
             
-            adder = ^(NSString *propertyName) {
+        case FMSObjectRetainAtomic: {
+            
+            getterImp = imp_implementationWithBlock(^(id _self){
                 
-                NSString *key = [NSString stringWithFormat:@"FMS%@Key", propertyName];
+                FMSPseudoPropertyLockStripe *stripe = FMSPseudoPropertyLockStripeFor(_self, (const void *)offset);
+                FMSPseudoPropertyLockStripeLock(stripe);
                 
-                IMP getterImp = imp_implementationWithBlock(^(id _self){
-                    
-                    return [objc_getAssociatedObject(_self, (__bridge const void *)(key))
-                            unsignedIntegerValue];
-                    
-                });
+                id result = *(__strong id *)FMSIvarAddress(_self, offset);
                 
-                IMP setterImp = imp_implementationWithBlock(^(id _self, NSUInteger value){
-                    
-                    objc_setAssociatedObject(_self,
-                                             (__bridge const void *)(key),
-                                             @(value),
-                                             OBJC_ASSOCIATION_RETAIN_NONATOMIC);
-                    
-                });
+                FMSPseudoPropertyLockStripeUnlock(stripe);
+                return result;
+            });
+            
+            setterImp = imp_implementationWithBlock(^(id _self, id obj){
                 
-                NSString *typeString = unsignedIntegerType;
-                [self createPseudoProperties:propertyName typeString:typeString getterImp:getterImp setterImp:setterImp];
-            };
+                FMSPseudoPropertyLockStripe *stripe = FMSPseudoPropertyLockStripeFor(_self, (const void *)offset);
+                FMSPseudoPropertyLockStripeLock(stripe);
+                
+                __strong id *slot = (__strong id *)FMSIvarAddress(_self, offset);
+                id previous = *slot;
+                *slot = obj;
+                
+                FMSPseudoPropertyLockStripeUnlock(stripe);
+                previous = nil;
+            });
             
             break;
         }
             
+        case FMSBool:
+            FMS_VALUE_ACCESSORS(BOOL, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
             
+        case FMSInteger:
+            FMS_VALUE_ACCESSORS(NSInteger, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
             
-        case FMSFloat: {
+        case FMSUnsignedInteger:
+            FMS_VALUE_ACCESSORS(NSUInteger, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
             
-            adder = ^(NSString *propertyName) {
-                
-                NSString *key = [NSString stringWithFormat:@"FMS%@Key", propertyName];
-                
-                IMP getterImp = imp_implementationWithBlock(^(id _self){
-                    
-                    return [objc_getAssociatedObject(_self, (__bridge const void *)(key))
-                            floatValue];
-                    
-                });
-                
-                IMP setterImp = imp_implementationWithBlock(^(id _self, float value){
-                    
-                    objc_setAssociatedObject(_self,
-                                             (__bridge const void *)(key),
-                                             @(value),
-                                             OBJC_ASSOCIATION_RETAIN_NONATOMIC);
-                    
-                });
-                
-                NSString *typeString = @"f";
-                [self createPseudoProperties:propertyName typeString:typeString getterImp:getterImp setterImp:setterImp];
-            };
+        case FMSFloat:
+            FMS_VALUE_ACCESSORS(float, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
             
+        case FMSDouble:
+            FMS_VALUE_ACCESSORS(double, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
             break;
-        }
             
+        case FMSRange:
+            FMS_VALUE_ACCESSORS(NSRange, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
             
+        case FMSPoint:
+            FMS_VALUE_ACCESSORS(FMSPointValue, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
             
-        case FMSDouble: {
+        case FMSSize:
+            FMS_VALUE_ACCESSORS(FMSSizeValue, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
             
-            adder = ^(NSString *propertyName) {
-                
-                NSString *key = [NSString stringWithFormat:@"FMS%@Key", propertyName];
-                
-                IMP getterImp = imp_implementationWithBlock(^(id _self){
-                    
-                    return [objc_getAssociatedObject(_self, (__bridge const void *)(key))
-                            doubleValue];
-                    
-                });
-                
-                IMP setterImp = imp_implementationWithBlock(^(id _self, double value){
-                    
-                    objc_setAssociatedObject(_self,
-                                             (__bridge const void *)(key),
-                                             @(value),
-                                             OBJC_ASSOCIATION_RETAIN_NONATOMIC);
-                    
-                });
-                
-                NSString *typeString = @"d";
-                [self createPseudoProperties:propertyName typeString:typeString getterImp:getterImp setterImp:setterImp];
-            };
+        case FMSRect:
+            FMS_VALUE_ACCESSORS(FMSRectValue, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
             
+        case FMSBoolAtomic:
+            FMS_ATOMIC_VALUE_ACCESSORS(BOOL, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
+            
+        case FMSIntegerAtomic:
+            FMS_ATOMIC_VALUE_ACCESSORS(NSInteger, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
+            
+        case FMSUnsignedIntegerAtomic:
+            FMS_ATOMIC_VALUE_ACCESSORS(NSUInteger, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
             break;
-        }
             
+        case FMSFloatAtomic:
+            FMS_ATOMIC_VALUE_ACCESSORS(float, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
             
+        case FMSDoubleAtomic:
+            FMS_ATOMIC_VALUE_ACCESSORS(double, FMSIvarAddress(_self, offset), FMSIvarAddress(_self, offset));
+            break;
             
         default:
             
             [NSException raise:NSInvalidArgumentException
                         format:@"%d is not a valid FMSPsudoPropertyType", type];
-            
     }
     
-    return adder;
+    *getterOut = getterImp;
+    *setterOut = setterImp;
 }
 
 #pragma mark - Instance Method Swizzlers
 
-+ (void)FMS_aliasInstanceMethod:(SEL)originalSelector newSelector:(SEL)newSelector {
-    
-    if (class_getInstanceMethod(self, newSelector) != NULL) {
-        [NSException
-         raise:NSInvalidArgumentException
-         format:@"The selector %@ is already being used.",
-         NSStringFromSelector(newSelector)];
-    }
-    
-    NSUInteger originalArgCount = [[NSStringFromSelector(originalSelector) componentsSeparatedByString:@":"] count];
-    NSUInteger newArgCount = [[NSStringFromSelector(newSelector) componentsSeparatedByString:@":"] count];
-    
-    if ( originalArgCount != newArgCount) {
-        
-        [NSException
-         raise:NSInvalidArgumentException
-         format:@"The selectors must have the same number of arguments, had %d and %d",
-         (int)originalArgCount, (int)newArgCount];
-        
-    }
++ (IMP)performAliasInstanceMethod:(SEL)originalSelector
+                      newSelector:(SEL)newSelector
+                   checkArguments:(BOOL)checkArguments {
     
     Method originalMethod = class_getInstanceMethod(self, originalSelector);
     
@@ -339,18 +2228,46 @@
                     format:@"The original method does not exist"];
     }
     
+    if (checkArguments) {
+        FMSCheckAliasArguments(originalMethod, newSelector);
+    }
+    
+    // Aliases retired by restoring their token can be reused, otherwise every toggle would leak a selector.
+    BOOL reusingRetiredAlias = NO;
+    
+    if (class_getInstanceMethod(self, newSelector) != NULL) {
+        
+        reusingRetiredAlias = FMSIsRetiredAlias(self, newSelector);
+        
+        if (!reusingRetiredAlias) {
+            [NSException
+             raise:NSInvalidArgumentException
+             format:@"The selector %@ is already being used.",
+             NSStringFromSelector(newSelector)];
+        }
+    }
+    
     IMP implementation = method_getImplementation(originalMethod);
     const char *typeEncoding = method_getTypeEncoding(originalMethod);
     
-    if (!class_addMethod(self, newSelector, implementation, typeEncoding)) {
+    if (reusingRetiredAlias) {
+        
+        class_replaceMethod(self, newSelector, implementation, typeEncoding);
+        FMSReviveAlias(self, newSelector);
+        
+    } else if (!class_addMethod(self, newSelector, implementation, typeEncoding)) {
         
         [NSException
          raise:NSGenericException
          format:@"An unknown exception occured while adding the alias method"];
     }
+    
+    return implementation;
 }
 
-+ (void)FMS_replaceInstanceMethod:(SEL)methodSelector withImplementationBlock:(id)block {
++ (FMSSwizzleToken *)performReplaceInstanceMethod:(SEL)methodSelector
+                          withImplementationBlock:(id)block
+                                    aliasSelector:(SEL)aliasSelector {
     
     // Make sure we have an implementation in the current class (not super class)
     Method originalMethod = class_getInstanceMethod(self, methodSelector);
@@ -361,40 +2278,83 @@
     }
     
     const char *typeEncoding = method_getTypeEncoding(originalMethod);
-    IMP newImp = imp_implementationWithBlock(block);
+    IMP inheritedImp = method_getImplementation(originalMethod);
+    BOOL counted = NO;
+    IMP newImp = FMSImplementationWithBlock(originalMethod, block, &counted);
+    
+    // class_replaceMethod() returns NULL when the method was inherited (and has just been added to this class).
+    IMP previousImp = class_replaceMethod(self, methodSelector, newImp, typeEncoding);
     
-    class_replaceMethod(self, methodSelector, newImp, typeEncoding);
+    FMSSwizzleToken *token = FMSRecordReplacement(self,
+                                                  methodSelector,
+                                                  aliasSelector,
+                                                  previousImp ?: inheritedImp,
+                                                  newImp,
+                                                  previousImp == NULL);
+    token->_uncountedImplementation = !counted;
+    
+    return token;
 }
 
-+ (void)FMS_overrideInstanceMethod:(SEL)selector oldSelector:(SEL)oldSelector implementationBlock:(id)block {
++ (FMSSwizzleToken *)FMS_aliasInstanceMethod:(SEL)originalSelector newSelector:(SEL)newSelector {
     
-    [self FMS_aliasInstanceMethod:selector newSelector:oldSelector];
-    [self FMS_replaceInstanceMethod:selector withImplementationBlock:block];
+    return [self FMS_aliasInstanceMethod:originalSelector newSelector:newSelector argumentCountsVerified:NO];
 }
 
++ (FMSSwizzleToken *)FMS_aliasInstanceMethod:(SEL)originalSelector
+                                 newSelector:(SEL)newSelector
+                      argumentCountsVerified:(BOOL)verified {
+    
+    __block FMSSwizzleToken *token = nil;
+    
+    FMSPerformLocked(self, ^{
+        IMP implementation = [self performAliasInstanceMethod:originalSelector
+                                                  newSelector:newSelector
+                                               checkArguments:!verified];
+        token = FMSRecordAlias(self, newSelector, implementation);
+    });
+    
+    return token;
+}
 
-#pragma mark - Class Method Swizzlers
++ (FMSSwizzleToken *)FMS_replaceInstanceMethod:(SEL)methodSelector withImplementationBlock:(id)block {
+    
+    __block FMSSwizzleToken *token = nil;
+    
+    FMSPerformLocked(self, ^{
+        token = [self performReplaceInstanceMethod:methodSelector withImplementationBlock:block aliasSelector:NULL];
+    });
+    
+    return token;
+}
 
-+ (void)FMS_aliasClassMethod:(SEL)originalSelector newSelector:(SEL)newSelector {
++ (FMSSwizzleToken *)FMS_overrideInstanceMethod:(SEL)selector oldSelector:(SEL)oldSelector implementationBlock:(id)block {
     
-    if (class_getClassMethod(self, newSelector) != NULL) {
-        [NSException
-         raise:NSInvalidArgumentException
-         format:@"The selector %@ is already being used.",
-         NSStringFromSelector(newSelector)];
-    }
+    return [self FMS_overrideInstanceMethod:selector oldSelector:oldSelector argumentCountsVerified:NO implementationBlock:block];
+}
+
++ (FMSSwizzleToken *)FMS_overrideInstanceMethod:(SEL)selector
+                                    oldSelector:(SEL)oldSelector
+                         argumentCountsVerified:(BOOL)verified
+                            implementationBlock:(id)block {
     
-    NSUInteger originalArgCount = [[NSStringFromSelector(originalSelector) componentsSeparatedByString:@":"] count];
-    NSUInteger newArgCount = [[NSStringFromSelector(newSelector) componentsSeparatedByString:@":"] count];
+    __block FMSSwizzleToken *token = nil;
     
-    if ( originalArgCount != newArgCount) {
-        
-        [NSException
-         raise:NSInvalidArgumentException
-         format:@"The selectors must have the same number of arguments, had %d and %d",
-         (int)originalArgCount, (int)newArgCount];
-        
-    }
+    // Hold the lock across both steps, so no other hook can slip in between the alias and the replacement.
+    FMSPerformLocked(self, ^{
+        [self performAliasInstanceMethod:selector newSelector:oldSelector checkArguments:!verified];
+        token = [self performReplaceInstanceMethod:selector withImplementationBlock:block aliasSelector:oldSelector];
+    });
+    
+    return token;
+}
+
+
+#pragma mark - Class Method Swizzlers
+
++ (IMP)performAliasClassMethod:(SEL)originalSelector
+                   newSelector:(SEL)newSelector
+                checkArguments:(BOOL)checkArguments {
     
     Method originalMethod = class_getClassMethod(self, originalSelector);
     
@@ -403,19 +2363,46 @@
                     format:@"The original method does not exist"];
     }
     
+    if (checkArguments) {
+        FMSCheckAliasArguments(originalMethod, newSelector);
+    }
+    
+    BOOL reusingRetiredAlias = NO;
+    
+    if (class_getClassMethod(self, newSelector) != NULL) {
+        
+        reusingRetiredAlias = FMSIsRetiredAlias(object_getClass(self), newSelector);
+        
+        if (!reusingRetiredAlias) {
+            [NSException
+             raise:NSInvalidArgumentException
+             format:@"The selector %@ is already being used.",
+             NSStringFromSelector(newSelector)];
+        }
+    }
+    
     IMP implementation = method_getImplementation(originalMethod);
     const char *typeEncoding = method_getTypeEncoding(originalMethod);
     
-    if (!class_addMethod(object_getClass(self), newSelector, implementation, typeEncoding)) {
+    if (reusingRetiredAlias) {
+        
+        class_replaceMethod(object_getClass(self), newSelector, implementation, typeEncoding);
+        FMSReviveAlias(object_getClass(self), newSelector);
+        
+    } else if (!class_addMethod(object_getClass(self), newSelector, implementation, typeEncoding)) {
         
         [NSException
          raise:NSGenericException
          format:@"An unknown exception occured while adding the alias method"];
     }
+    
+    return implementation;
 }
 
 
-+ (void)FMS_replaceClassMethod:(SEL)methodSelector withImplementationBlock:(id)block {
++ (FMSSwizzleToken *)performReplaceClassMethod:(SEL)methodSelector
+                       withImplementationBlock:(id)block
+                                 aliasSelector:(SEL)aliasSelector {
     
     // Make sure we have a method implemented.
     Method originalMethod = class_getClassMethod(object_getClass(self), methodSelector);
@@ -426,90 +2413,382 @@
     }
     
     const char *typeEncoding = method_getTypeEncoding(originalMethod);
-    IMP newImp = imp_implementationWithBlock(block);
-    class_replaceMethod(object_getClass(self), methodSelector, newImp, typeEncoding);
+    IMP inheritedImp = method_getImplementation(originalMethod);
+    BOOL counted = NO;
+    IMP newImp = FMSImplementationWithBlock(originalMethod, block, &counted);
+    IMP previousImp = class_replaceMethod(object_getClass(self), methodSelector, newImp, typeEncoding);
+    
+    FMSSwizzleToken *token = FMSRecordReplacement(object_getClass(self),
+                                                  methodSelector,
+                                                  aliasSelector,
+                                                  previousImp ?: inheritedImp,
+                                                  newImp,
+                                                  previousImp == NULL);
+    token->_uncountedImplementation = !counted;
+    
+    return token;
 }
 
 
-+ (void)FMS_overrideClassMethod:(SEL)selector oldSelector:(SEL)oldSelector implementationBlock:(id)block {
++ (FMSSwizzleToken *)FMS_aliasClassMethod:(SEL)originalSelector newSelector:(SEL)newSelector {
     
-    [self FMS_aliasClassMethod:selector newSelector:oldSelector];
-    [self FMS_replaceClassMethod:selector withImplementationBlock:block];
+    return [self FMS_aliasClassMethod:originalSelector newSelector:newSelector argumentCountsVerified:NO];
 }
 
++ (FMSSwizzleToken *)FMS_aliasClassMethod:(SEL)originalSelector
+                              newSelector:(SEL)newSelector
+                   argumentCountsVerified:(BOOL)verified {
+    
+    __block FMSSwizzleToken *token = nil;
+    
+    FMSPerformLocked(object_getClass(self), ^{
+        IMP implementation = [self performAliasClassMethod:originalSelector
+                                               newSelector:newSelector
+                                            checkArguments:!verified];
+        token = FMSRecordAlias(object_getClass(self), newSelector, implementation);
+    });
+    
+    return token;
+}
 
-#pragma mark - Private Methods
++ (FMSSwizzleToken *)FMS_replaceClassMethod:(SEL)methodSelector withImplementationBlock:(id)block {
+    
+    __block FMSSwizzleToken *token = nil;
+    
+    FMSPerformLocked(object_getClass(self), ^{
+        token = [self performReplaceClassMethod:methodSelector withImplementationBlock:block aliasSelector:NULL];
+    });
+    
+    return token;
+}
 
-+ (void)createPseudoProperties:(NSString *)propertyName
-                    typeString:(NSString *)typeString
-                     getterImp:(IMP)getterImp
-                     setterImp:(IMP)setterImp {
++ (FMSSwizzleToken *)FMS_overrideClassMethod:(SEL)selector oldSelector:(SEL)oldSelector implementationBlock:(id)block {
     
-    // make sure we have a valid property name should be non-nil, one word, lettter for first character,
-    // lower case letter for first character, and only numbers, letters or underscores.
-    NSError *error;
-    NSRegularExpression *regexp =
-    [NSRegularExpression regularExpressionWithPattern:@"\\A\\p{Ll}[\\p{Ll}\\p{Lu}\\p{Lo}\\p{Nd}_]*\\z"
-                                              options:0
-                                                error:&error];
+    return [self FMS_overrideClassMethod:selector oldSelector:oldSelector argumentCountsVerified:NO implementationBlock:block];
+}
+
++ (FMSSwizzleToken *)FMS_overrideClassMethod:(SEL)selector
+                                 oldSelector:(SEL)oldSelector
+                      argumentCountsVerified:(BOOL)verified
+                         implementationBlock:(id)block {
     
+    __block FMSSwizzleToken *token = nil;
     
-    if (error != nil) {
-        NSString *message = [error localizedDescription];
-        NSLog(@"*** An Error Occurred: %@ ***", message);
-        
-        [NSException
-         raise:NSGenericException
-         format:@"An error occurred creating the regular expression to validate "
-         @"the pseudo property names: %@",
-         message];
+    FMSPerformLocked(object_getClass(self), ^{
+        [self performAliasClassMethod:selector newSelector:oldSelector checkArguments:!verified];
+        token = [self performReplaceClassMethod:selector withImplementationBlock:block aliasSelector:oldSelector];
+    });
+    
+    return token;
+}
+
+
+#pragma mark - Swizzle Batches
+
++ (FMSSwizzleBatchResult *)FMS_performSwizzleBatch:(FMSSwizzleBatchBlock)batchBlock {
+    
+    return FMSPerformSwizzleBatch(batchBlock);
+}
+
+#pragma mark - Method Hooks
+
++ (FMSSwizzleToken *)FMS_hookInstanceMethod:(SEL)selector before:(FMSMethodHookBlock)before after:(FMSMethodHookBlock)after {
+    
+    __block FMSSwizzleToken *token = nil;
+    
+    FMSPerformLocked(self, ^{
+        token = FMSInstallMethodHook(self, selector, before, after);
+    });
+    
+    return token;
+}
+
++ (FMSSwizzleToken *)FMS_hookClassMethod:(SEL)selector before:(FMSMethodHookBlock)before after:(FMSMethodHookBlock)after {
+    
+    __block FMSSwizzleToken *token = nil;
+    
+    FMSPerformLocked(object_getClass(self), ^{
+        token = FMSInstallMethodHook(object_getClass(self), selector, before, after);
+    });
+    
+    return token;
+}
+
++ (FMSSampler *)FMS_hookInstanceMethod:(SEL)selector
+                          samplingRate:(NSUInteger)samplingRate
+                                before:(FMSMethodHookBlock)before
+                                 after:(FMSMethodHookBlock)after {
+    
+    FMSSampler *sampler = [[FMSSampler alloc] init];
+    sampler.samplingRate = samplingRate;
+    
+    FMSPerformLocked(self, ^{
+        FMSInstallSampledMethodHook(self, selector, sampler, before, after);
+    });
+    
+    return sampler;
+}
+
++ (FMSSampler *)FMS_hookClassMethod:(SEL)selector
+                       samplingRate:(NSUInteger)samplingRate
+                             before:(FMSMethodHookBlock)before
+                              after:(FMSMethodHookBlock)after {
+    
+    FMSSampler *sampler = [[FMSSampler alloc] init];
+    sampler.samplingRate = samplingRate;
+    
+    FMSPerformLocked(object_getClass(self), ^{
+        FMSInstallSampledMethodHook(object_getClass(self), selector, sampler, before, after);
+    });
+    
+    return sampler;
+}
+
+#pragma mark - Hook Chains
+
++ (FMSHookChainHandler *)FMS_chainInstanceMethod:(SEL)selector
+                                          before:(FMSMethodHookBlock)before
+                                           after:(FMSMethodHookBlock)after {
+    
+    __block FMSHookChainHandler *handler = nil;
+    
+    FMSPerformLocked(self, ^{
+        handler = FMSAddHookChainHandler(self, selector, before, nil, after);
+    });
+    
+    return handler;
+}
+
++ (FMSHookChainHandler *)FMS_chainInstanceMethod:(SEL)selector around:(FMSHookChainAroundBlock)around {
+    
+    if (around == nil) {
+        [NSException raise:NSInvalidArgumentException format:@"An around handler needs a block"];
     }
     
-    NSRange range = NSMakeRange(0, [propertyName length]);
-    if ([regexp numberOfMatchesInString:propertyName options:NSMatchingReportCompletion range:range] == 0) {
-                
-        [NSException
-         raise:NSInvalidArgumentException
-         format:@"%@ is not a valid property name. It must start with a lower case letter and "
-         @"have only letters, numbers and underscores.",
-         propertyName];
+    __block FMSHookChainHandler *handler = nil;
+    
+    FMSPerformLocked(self, ^{
+        handler = FMSAddHookChainHandler(self, selector, nil, around, nil);
+    });
+    
+    return handler;
+}
+
++ (FMSHookChainHandler *)FMS_chainClassMethod:(SEL)selector
+                                       before:(FMSMethodHookBlock)before
+                                        after:(FMSMethodHookBlock)after {
+    
+    __block FMSHookChainHandler *handler = nil;
+    
+    FMSPerformLocked(object_getClass(self), ^{
+        handler = FMSAddHookChainHandler(object_getClass(self), selector, before, nil, after);
+    });
+    
+    return handler;
+}
+
++ (FMSHookChainHandler *)FMS_chainClassMethod:(SEL)selector around:(FMSHookChainAroundBlock)around {
+    
+    if (around == nil) {
+        [NSException raise:NSInvalidArgumentException format:@"An around handler needs a block"];
     }
     
+    __block FMSHookChainHandler *handler = nil;
     
-    SEL getter = NSSelectorFromString(propertyName);
+    FMSPerformLocked(object_getClass(self), ^{
+        handler = FMSAddHookChainHandler(object_getClass(self), selector, nil, around, nil);
+    });
     
-    NSString *setterName = [NSString stringWithFormat:@"set%@%@:",
-                            [[propertyName substringToIndex: 1] uppercaseString],
-                            [propertyName substringFromIndex: 1]];
+    return handler;
+}
+
++ (FMSHookChain *)FMS_hookChainForInstanceMethod:(SEL)selector {
     
-    SEL setter = NSSelectorFromString(setterName);
+    return FMSHookChainForMethod(self, selector);
+}
+
++ (FMSHookChain *)FMS_hookChainForClassMethod:(SEL)selector {
     
-    if ([self instancesRespondToSelector:getter]) {
-        [NSException raise:NSInvalidArgumentException
-                    format:@"The %@ method already exists", NSStringFromSelector(getter)];
+    return FMSHookChainForMethod(object_getClass(self), selector);
+}
+
+#pragma mark - Instrumentation
+
++ (FMSSwizzleToken *)FMS_instrumentInstanceMethod:(SEL)selector {
+    
+    __block FMSSwizzleToken *token = nil;
+    
+    FMSPerformLocked(self, ^{
+        token = FMSInstrumentMethod(self, selector, nil);
+    });
+    
+    return token;
+}
+
++ (FMSSampler *)FMS_instrumentInstanceMethod:(SEL)selector samplingRate:(NSUInteger)samplingRate {
+    
+    FMSSampler *sampler = [[FMSSampler alloc] init];
+    sampler.samplingRate = samplingRate;
+    
+    FMSPerformLocked(self, ^{
+        FMSInstrumentMethod(self, selector, sampler);
+    });
+    
+    return sampler;
+}
+
++ (FMSMethodStatistics *)FMS_statisticsForInstanceMethod:(SEL)selector {
+    
+    return FMSStatisticsForMethod(self, selector);
+}
+
+#pragma mark - Method Cache
+
++ (NSUInteger)FMS_prewarmMethodCacheForSelectors:(const SEL *)selectors count:(NSUInteger)count {
+    
+    if (selectors == NULL && count > 0) {
+        [NSException raise:NSInvalidArgumentException format:@"Prewarming %lu selectors needs a selector array", (unsigned long)count];
     }
     
-    if ([self instancesRespondToSelector:setter]) {
-        [NSException raise:NSInvalidArgumentException
-                    format:@"The %@ method already exists", NSStringFromSelector(setter)];
+    return (count > 0) ? FMSPrewarmMethodCache(self, selectors, count) : 0;
+}
+
++ (NSUInteger)FMS_prewarmMethodCache {
+    
+    return FMSPrewarmMethodCache(self, NULL, 0);
+}
+
++ (FMSIMPSnapshot *)FMS_IMPSnapshotForSelectors:(const SEL *)selectors count:(NSUInteger)count {
+    
+    if (selectors == NULL && count > 0) {
+        [NSException raise:NSInvalidArgumentException format:@"A snapshot of %lu selectors needs a selector array", (unsigned long)count];
+    }
+    
+    // An empty array, so the snapshot isn't mistaken for one of every method.
+    static const SEL FMSNoSelectors[1] = {NULL};
+    
+    return FMSTakeIMPSnapshot(self, (count > 0) ? selectors : FMSNoSelectors, count);
+}
+
++ (FMSIMPSnapshot *)FMS_IMPSnapshot {
+    
+    return FMSTakeIMPSnapshot(self, NULL, 0);
+}
+
++ (void)FMS_invalidateIMPSnapshots {
+    
+    FMSInvalidateIMPSnapshots();
+}
+
+
+#pragma mark - Private Methods
+
++ (NSArray *)validatePseudoPropertyDescriptors:(const FMSPseudoPropertyDescriptor *)descriptors
+                                         count:(NSUInteger)count {
+    
+    NSMutableArray *names = [NSMutableArray arrayWithCapacity:count];
+    NSMutableSet *seenNames = [NSMutableSet setWithCapacity:count];
+    
+    for (NSUInteger index = 0; index < count; index++) {
+        
+        FMSPseudoPropertyName *name = FMSInternPseudoPropertyName(descriptors[index].name);
+        
+        FMSPseudoPropertyTypeInfo info;
+        if (!FMSGetPseudoPropertyTypeInfo(descriptors[index].type, &info)) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"%d is not a valid FMSPsudoPropertyType", descriptors[index].type];
+        }
+        
+        if ([seenNames containsObject:name]) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"The %@ property appears more than once", descriptors[index].name];
+        }
+        
+        [seenNames addObject:name];
+        [names addObject:name];
+    }
+    
+    if (count == 1) {
+        
+        // Not worth taking a snapshot for a single property.
+        FMSPseudoPropertyName *name = names[0];
+        
+        if ([self instancesRespondToSelector:name->_getter]) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"The %@ method already exists", NSStringFromSelector(name->_getter)];
+        }
+        
+        if ([self instancesRespondToSelector:name->_setter]) {
+            [NSException raise:NSInvalidArgumentException
+                        format:@"The %@ method already exists", NSStringFromSelector(name->_setter)];
+        }
+        
+    } else if (count > 1) {
+        
+        NSUInteger selectorCount;
+        const char **selectorNames = FMSCopySortedInstanceMethodNames(self, &selectorCount);
+        
+        for (FMSPseudoPropertyName *name in names) {
+            
+            SEL accessors[] = {name->_getter, name->_setter};
+            
+            for (NSUInteger index = 0; index < 2; index++) {
+                
+                const char *accessorName = sel_getName(accessors[index]);
+                
+                if (bsearch(&accessorName, selectorNames, selectorCount, sizeof(const char *), FMSCompareNames) != NULL) {
+                    
+                    free(selectorNames);
+                    [NSException raise:NSInvalidArgumentException
+                                format:@"The %@ method already exists", NSStringFromSelector(accessors[index])];
+                }
+            }
+        }
+        
+        free(selectorNames);
     }
     
-    NSLog(@"Creating properties: %@ and %@",
-          NSStringFromSelector(getter),
-          NSStringFromSelector(setter));
+    return names;
+}
+
++ (void)installPseudoProperty:(FMSPseudoPropertyName *)name
+                 typeEncoding:(const char *)typeEncoding
+                    getterImp:(IMP)getterImp
+                    setterImp:(IMP)setterImp {
+    
+    SEL getter = name->_getter;
+    SEL setter = name->_setter;
+    
+    if (FMSLoggingEnabled) {
+        NSLog(@"Creating properties: %@ and %@",
+              NSStringFromSelector(getter),
+              NSStringFromSelector(setter));
+    }
     
     
     Class class = [self class];
     
+    size_t length = strlen(typeEncoding);
+    
+    char getterTypes[length + 3];
+    memcpy(getterTypes, typeEncoding, length);
+    memcpy(getterTypes + length, "@:", 3);
+    class_addMethod(class, getter, getterImp, getterTypes);
     
-    NSString *getterTypeString = [NSString stringWithFormat:@"%@@:", typeString];
-    class_addMethod(class, getter, getterImp,
-                    [getterTypeString cStringUsingEncoding:NSUTF8StringEncoding]);
+    char setterTypes[length + 4];
+    memcpy(setterTypes, "v@:", 3);
+    memcpy(setterTypes + 3, typeEncoding, length + 1);
+    class_addMethod(class, setter, setterImp, setterTypes);
     
-    NSString *setterTypeString = [NSString stringWithFormat:@"v@:%@", typeString];
-    class_addMethod(class, setter, setterImp,
-                    [setterTypeString cStringUsingEncoding:NSUTF8StringEncoding]);
+    FMSRecordSwizzle(FMSSwizzleRecordPseudoProperty, class, getter, typeEncoding, NULL, getterImp, Nil);
+}
+
++ (NSString *)nextGeneratedSubclassNameForClass:(Class)startingClass {
     
+    static atomic_size_t count = 0;
+    size_t current = atomic_fetch_add(&count, 1) + 1;
+    
+    return [NSString stringWithFormat:@"RKW_%@_%@", startingClass, @(current)];
 }
 
 #pragma mark - Dynamic Subclassing
@@ -517,6 +2796,97 @@
 - (void)FMS_dynamiclySubclass {
     
     Class startingClass = [self class];
+    [self checkCanDynamiclySubclass];
+    
+    Class cls = [startingClass allocateDynamicSubclass];
+    object_setClass(self, cls);
+}
+
+- (Class)FMS_dynamiclySubclassWithSignature:(NSString *)signature
+                              configuration:(FMSDynamicSubclassConfiguration)configuration {
+    
+    Class startingClass = [self class];
+    [self checkCanDynamiclySubclass];
+    
+    if (signature == nil) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"A signature is required to share dynamic subclasses"];
+    }
+    
+    // An object that is already in a shared subclass moves to a sibling, never to a subclass of its current class.
+    FMSDynamicSubclassLease *currentLease = objc_getAssociatedObject(self, &FMSDynamicSubclassLeaseKey);
+    
+    if (currentLease != nil && currentLease->_entry->_cls == startingClass) {
+        startingClass = currentLease->_entry->_baseClass;
+    }
+    
+    if (FMSIsGeneratedClass(startingClass)) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"%@ is a generated class, and can't be the base of a shared dynamic subclass", startingClass];
+    }
+    
+    FMSDynamicSubclassCacheEntry *entry = FMSAcquireDynamicSubclass(startingClass, signature, configuration);
+    
+    FMSDynamicSubclassLease *lease = [[FMSDynamicSubclassLease alloc] init];
+    lease->_entry = entry;
+    
+    object_setClass(self, entry->_cls);
+    
+    // The lease is released when this object is deallocated (or moved to another cached subclass),
+    // which lets us dispose of the class once it has no instances left.
+    objc_setAssociatedObject(self, &FMSDynamicSubclassLeaseKey, lease, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    
+    return entry->_cls;
+}
+
+- (FMSSwizzleToken *)FMS_replaceMethod:(SEL)selector withImplementationBlock:(id)block {
+    
+    [self checkCanDynamiclySubclass];
+    return FMSInstallInstanceOverride(self, selector, NULL, block);
+}
+
+- (FMSSwizzleToken *)FMS_overrideMethod:(SEL)selector oldSelector:(SEL)oldSelector implementationBlock:(id)block {
+    
+    [self checkCanDynamiclySubclass];
+    
+    if (oldSelector == NULL) {
+        [NSException raise:NSInvalidArgumentException
+                    format:@"An override needs an old selector"];
+    }
+    
+    return FMSInstallInstanceOverride(self, selector, oldSelector, block);
+}
+
++ (NSUInteger)FMS_liveGeneratedClassCount {
+    return atomic_load(&FMSLiveGeneratedClassCount);
+}
+
++ (NSUInteger)FMS_reclaimRetiredImplementations {
+    return FMSReclaimRetiredImplementations();
+}
+
++ (NSUInteger)FMS_retiredImplementationCount {
+    return FMSRetiredImplementationCount();
+}
+
++ (NSUInteger)FMS_cachedDynamicSubclassCount {
+    return atomic_load(&FMSCachedDynamicSubclassCount);
+}
+
++ (NSArray *)FMS_activeSwizzleRecords {
+    return FMSActiveSwizzleRecords();
+}
+
++ (NSData *)FMS_swizzleRecordsJSON {
+    return FMSSwizzleRecordsJSON();
+}
+
++ (NSData *)FMS_swizzleRecordSnapshot {
+    return FMSSwizzleRecordSnapshot();
+}
+
+- (void)checkCanDynamiclySubclass {
+    
     NSInteger pointer = (NSInteger)self;
     
     if ((pointer & 1) == 1) {
@@ -525,11 +2895,12 @@
                     format:@"Cannot dynamic subclass a tagged pointer object."];
         
     }
+}
+
++ (Class)allocateDynamicSubclass {
     
-    static NSUInteger count = 0;
-    count ++;
-    
-    NSString *className = [NSString stringWithFormat:@"RKW_%@_%@", startingClass, @(count)];
+    Class startingClass = self;
+    NSString *className = [startingClass nextGeneratedSubclassNameForClass:startingClass];
     
     Class cls = objc_allocateClassPair(startingClass,
                                        [className cStringUsingEncoding:NSUTF8StringEncoding],
@@ -537,12 +2908,15 @@
     
     
     objc_registerClassPair(cls);
-    object_setClass(self, cls);
+    objc_setAssociatedObject(cls, &FMSGeneratedClassKey, startingClass, OBJC_ASSOCIATION_ASSIGN);
+    atomic_fetch_add(&FMSLiveGeneratedClassCount, 1);
+    FMSRecordSwizzle(FMSSwizzleRecordGeneratedClass, cls, NULL, NULL, NULL, NULL, startingClass);
     
     [cls FMS_replaceInstanceMethod:@selector(classForCoder) withImplementationBlock:^(__unused id _self) {
         return startingClass;
     }];
+    
+    return cls;
 }
 
 @end
-
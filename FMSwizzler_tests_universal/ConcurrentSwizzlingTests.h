@@ -0,0 +1,10 @@
+//
+//  ConcurrentSwizzlingTests.h
+//  FMSSwizzler
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface ConcurrentSwizzlingTests : SenTestCase
+
+@end
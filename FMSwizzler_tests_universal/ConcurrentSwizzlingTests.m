@@ -0,0 +1,104 @@
+//
+//  ConcurrentSwizzlingTests.m
+//  FMSSwizzler
+//
+
+#import "ConcurrentSwizzlingTests.h"
+#import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+#import <objc/message.h>
+#import <libkern/OSAtomic.h>
+
+static const NSUInteger ThreadCount = 16;
+
+@implementation ConcurrentSwizzlingTests
+
+- (void)testConcurrentOverridesAllTakeEffect {
+    
+    Class cls = [Person freshSubclassNamed:@"ConcurrentOverridePerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    __block int32_t hookCalls = 0;
+    __block int32_t callsDuringInstall = 0;
+    
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    
+    // Half of the iterations install a hook, the other half hammer the method while hooks are going in.
+    dispatch_apply(ThreadCount * 2, queue, ^(size_t index) {
+        
+        if (index % 2 == 0) {
+            
+            SEL oldSelector = NSSelectorFromString([NSString stringWithFormat:@"concurrentOldFullName%zu", index]);
+            
+            [cls FMS_overrideInstanceMethod:@selector(fullName)
+                                oldSelector:oldSelector
+                        implementationBlock:^(Person *_self) {
+                            
+                            OSAtomicIncrement32(&hookCalls);
+                            return ((NSString *(*)(id, SEL))objc_msgSend)(_self, oldSelector);
+                        }];
+            
+        } else {
+            
+            for (NSUInteger call = 0; call < 1000; call++) {
+                STAssertEqualObjects([person fullName], @"John Smith", @"Calls should never see a broken chain");
+            }
+            
+            OSAtomicIncrement32(&callsDuringInstall);
+        }
+    });
+    
+    STAssertEquals(callsDuringInstall, (int32_t)ThreadCount, @"All of the callers should have finished");
+    
+    hookCalls = 0;
+    STAssertEqualObjects([person fullName], @"John Smith", @"The original method should still be called");
+    STAssertEquals(hookCalls, (int32_t)ThreadCount, @"Every hook should be in the chain exactly once");
+}
+
+- (void)testConcurrentAliasesOfTheSameSelector {
+    
+    Class cls = [Person freshSubclassNamed:@"ConcurrentAliasPerson"];
+    __block int32_t failures = 0;
+    
+    // Every thread races to create the same alias. Exactly one should win.
+    dispatch_apply(ThreadCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index) {
+        
+        @try {
+            [cls FMS_aliasInstanceMethod:@selector(firstName) newSelector:NSSelectorFromString(@"racedFirstName")];
+        }
+        @catch (NSException *exception) {
+            STAssertEqualObjects([exception name], NSInvalidArgumentException,
+                                 @"Losers should see the selector already in use");
+            OSAtomicIncrement32(&failures);
+        }
+    });
+    
+    STAssertEquals(failures, (int32_t)(ThreadCount - 1), @"Only one alias should have been created");
+}
+
+- (void)testConcurrentPseudoProperties {
+    
+    Class cls = [Person freshSubclassNamed:@"ConcurrentPropertyPerson"];
+    
+    dispatch_apply(ThreadCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index) {
+        
+        NSString *name = [NSString stringWithFormat:@"concurrentValue%zu", index];
+        [cls FMS_generatePseudoPropertyAdderForType:FMSInteger](name);
+    });
+    
+    Person *person = [[cls alloc] init];
+    
+    for (NSUInteger index = 0; index < ThreadCount; index++) {
+        
+        NSString *setterName = [NSString stringWithFormat:@"setConcurrentValue%lu:", (unsigned long)index];
+        NSString *getterName = [NSString stringWithFormat:@"concurrentValue%lu", (unsigned long)index];
+        
+        ((void (*)(id, SEL, NSInteger))objc_msgSend)(person, NSSelectorFromString(setterName), (NSInteger)index);
+        NSInteger value = ((NSInteger (*)(id, SEL))objc_msgSend)(person, NSSelectorFromString(getterName));
+        
+        STAssertEquals(value, (NSInteger)index, @"Each property should have its own slot");
+    }
+}
+
+@end
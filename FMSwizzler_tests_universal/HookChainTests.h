@@ -0,0 +1,10 @@
+//
+//  HookChainTests.h
+//  FMSSwizzler
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface HookChainTests : SenTestCase
+
+@end
@@ -0,0 +1,305 @@
+//
+//  HookChainTests.m
+//  FMSSwizzler
+//
+
+#import "HookChainTests.h"
+#import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+
+@implementation HookChainTests
+
+- (void)testHandlersRunInChainOrder {
+    
+    Class cls = [Person freshSubclassNamed:@"ChainOrderPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    NSMutableArray *calls = [NSMutableArray array];
+    
+    [cls FMS_chainInstanceMethod:@selector(fullNameWithTitle:)
+                          before:^(id receiver, SEL selector) { [calls addObject:@"before 1"]; }
+                           after:^(id receiver, SEL selector) { [calls addObject:@"after 1"]; }];
+    
+    [cls FMS_chainInstanceMethod:@selector(fullNameWithTitle:) around:^(id receiver, SEL selector, FMSHookChainProceedBlock proceed) {
+        [calls addObject:@"around 1 in"];
+        proceed();
+        [calls addObject:@"around 1 out"];
+    }];
+    
+    [cls FMS_chainInstanceMethod:@selector(fullNameWithTitle:)
+                          before:^(id receiver, SEL selector) { [calls addObject:@"before 2"]; }
+                           after:^(id receiver, SEL selector) { [calls addObject:@"after 2"]; }];
+    
+    [cls FMS_chainInstanceMethod:@selector(fullNameWithTitle:) around:^(id receiver, SEL selector, FMSHookChainProceedBlock proceed) {
+        [calls addObject:@"around 2 in"];
+        proceed();
+        [calls addObject:@"around 2 out"];
+    }];
+    
+    STAssertEqualObjects([person fullNameWithTitle:@"Mr"], @"Mr John Smith", @"The arguments and result should pass through");
+    
+    NSArray *expected = @[@"before 1", @"before 2", @"around 1 in", @"around 2 in",
+                          @"around 2 out", @"around 1 out", @"after 2", @"after 1"];
+    STAssertEqualObjects(calls, expected, @"Handlers should run in chain order");
+    
+    FMSHookChain *chain = [cls FMS_hookChainForInstanceMethod:@selector(fullNameWithTitle:)];
+    
+    STAssertNotNil(chain, @"The method should have a chain");
+    STAssertEquals([chain handlerCount], (NSUInteger)4, @"Every handler should be in the chain");
+    STAssertEquals([chain targetClass], cls, @"The chain should be on the subclass");
+    STAssertNil([cls FMS_hookChainForInstanceMethod:@selector(fullName)], @"Other methods shouldn't have a chain");
+}
+
+- (void)testChainsDontAddAliases {
+    
+    Class cls = [Person freshSubclassNamed:@"ChainAliasPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block NSUInteger calls = 0;
+    
+    for (NSUInteger index = 0; index < 10; index++) {
+        [cls FMS_chainInstanceMethod:@selector(setFirstName:)
+                              before:^(id receiver, SEL selector) { calls++; }
+                               after:nil];
+    }
+    
+    unsigned int methodCount = 0;
+    free(class_copyMethodList(cls, &methodCount));
+    
+    STAssertEquals(methodCount, 1u, @"Only the chained method itself should be added to the class");
+    
+    person.firstName = @"Jane";
+    
+    STAssertEqualObjects(person.firstName, @"Jane", @"The original should run once");
+    STAssertEquals(calls, (NSUInteger)10, @"Every handler should run");
+}
+
+- (void)testRemovingHandlers {
+    
+    Class cls = [Person freshSubclassNamed:@"ChainRemovalPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    NSMutableArray *calls = [NSMutableArray array];
+    
+    FMSHookChainHandler *first = [cls FMS_chainInstanceMethod:@selector(fullName)
+                                                       before:^(id receiver, SEL selector) { [calls addObject:@"first"]; }
+                                                        after:nil];
+    FMSHookChainHandler *second = [cls FMS_chainInstanceMethod:@selector(fullName)
+                                                        before:^(id receiver, SEL selector) { [calls addObject:@"second"]; }
+                                                         after:nil];
+    FMSHookChainHandler *third = [cls FMS_chainInstanceMethod:@selector(fullName)
+                                                       before:^(id receiver, SEL selector) { [calls addObject:@"third"]; }
+                                                        after:nil];
+    
+    IMP installed = method_getImplementation(class_getInstanceMethod(cls, @selector(fullName)));
+    
+    [second remove];
+    [second remove];
+    
+    STAssertFalse([second isActive], @"A removed handler should be inactive");
+    STAssertTrue([first isActive] && [third isActive], @"The other handlers should stay");
+    STAssertEquals([[second chain] handlerCount], (NSUInteger)2, @"Removing twice should only remove once");
+    
+    [person fullName];
+    STAssertEqualObjects(calls, (@[@"first", @"third"]), @"The removed handler shouldn't run");
+    
+    [first remove];
+    [third remove];
+    [calls removeAllObjects];
+    
+    STAssertEqualObjects([person fullName], @"John Smith", @"An empty chain should still call the original");
+    STAssertEquals([calls count], (NSUInteger)0, @"No handlers should run");
+    STAssertEquals(method_getImplementation(class_getInstanceMethod(cls, @selector(fullName))), installed,
+                   @"Adding and removing handlers shouldn't reinstall the trampoline");
+}
+
+- (void)testAroundHandlersCanSkipTheCall {
+    
+    Class cls = [Person freshSubclassNamed:@"ChainSkipPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block BOOL skip = YES;
+    __block NSUInteger innerCalls = 0;
+    
+    [cls FMS_chainInstanceMethod:@selector(canLegallyDrink) around:^(id receiver, SEL selector, FMSHookChainProceedBlock proceed) {
+        if (!skip) proceed();
+    }];
+    
+    [cls FMS_chainInstanceMethod:@selector(canLegallyDrink) around:^(id receiver, SEL selector, FMSHookChainProceedBlock proceed) {
+        innerCalls++;
+        proceed();
+    }];
+    
+    STAssertFalse([person canLegallyDrink], @"Skipping the call should return zero");
+    STAssertEquals(innerCalls, (NSUInteger)0, @"Skipping should skip the inner around handlers too");
+    
+    skip = NO;
+    
+    STAssertTrue([person canLegallyDrink], @"Proceeding should return the original result");
+    STAssertEquals(innerCalls, (NSUInteger)1, @"The inner around handler should run");
+}
+
+- (void)testHandlersCanRemoveThemselves {
+    
+    Class cls = [Person freshSubclassNamed:@"ChainSelfRemovalPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block NSUInteger calls = 0;
+    __block FMSHookChainHandler *handler = nil;
+    
+    handler = [cls FMS_chainInstanceMethod:@selector(getCMD)
+                                    before:^(id receiver, SEL selector) {
+                                        calls++;
+                                        [handler remove];
+                                    }
+                                     after:nil];
+    
+    STAssertEqualObjects([person getCMD], @"getCMD", @"The original should see its own selector");
+    STAssertEqualObjects([person getCMD], @"getCMD", @"The original should see its own selector");
+    STAssertEquals(calls, (NSUInteger)1, @"The handler should only run until it removes itself");
+    
+    handler = nil;
+}
+
+- (void)testRestoringTheTokenRemovesTheChain {
+    
+    Class cls = [Person freshSubclassNamed:@"ChainRestorePerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block NSUInteger calls = 0;
+    
+    FMSHookChainHandler *handler = [cls FMS_chainInstanceMethod:@selector(fullName)
+                                                         before:^(id receiver, SEL selector) { calls++; }
+                                                          after:nil];
+    
+    FMSHookChain *chain = [handler chain];
+    [[chain token] restore];
+    
+    [person fullName];
+    
+    STAssertEquals(calls, (NSUInteger)0, @"Restoring the token should remove the handlers");
+    STAssertFalse([handler isActive], @"The handler should be inactive");
+    STAssertEquals([chain handlerCount], (NSUInteger)0, @"The chain should be empty");
+    STAssertNil([cls FMS_hookChainForInstanceMethod:@selector(fullName)], @"The method shouldn't have a chain");
+    
+    FMSHookChainHandler *replacement = [cls FMS_chainInstanceMethod:@selector(fullName)
+                                                             before:^(id receiver, SEL selector) { calls++; }
+                                                              after:nil];
+    [person fullName];
+    
+    STAssertTrue([replacement chain] != chain, @"The next handler should start a new chain");
+    STAssertEquals(calls, (NSUInteger)1, @"The new chain should run its handler");
+}
+
+- (void)testRestoringTheTokenFreesTheHandlersStraightAway {
+    
+    Class cls = [Person freshSubclassNamed:@"ChainRestoreFreesPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __weak id weakCaptured = nil;
+    FMSHookChain *chain = nil;
+    
+    @autoreleasepool {
+        
+        NSObject *captured = [[NSObject alloc] init];
+        weakCaptured = captured;
+        
+        FMSHookChainHandler *handler =
+        [cls FMS_chainInstanceMethod:@selector(fullName)
+                              before:^(id receiver, SEL selector) { (void)captured; }
+                               after:nil];
+        
+        chain = [handler chain];
+        [person fullName];
+        [[chain token] restore];
+    }
+    
+    // No call is inside the chain, so its own epochs free the handlers without waiting for the trampoline.
+    STAssertNil(weakCaptured, @"Restoring should free the handlers' blocks");
+    STAssertEquals([chain handlerCount], (NSUInteger)0, @"The restored chain should have no handlers");
+    STAssertEqualObjects([person fullName], @"John Smith", @"The original should be back");
+}
+
+- (void)testRestoringTheTokenFromInsideAHandler {
+    
+    Class cls = [Person freshSubclassNamed:@"ChainRestoreInsidePerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block NSUInteger afterCalls = 0;
+    __block FMSHookChain *chain = nil;
+    
+    @autoreleasepool {
+        
+        FMSHookChainHandler *handler =
+        [cls FMS_chainInstanceMethod:@selector(fullName)
+                              before:^(id receiver, SEL selector) { [[chain token] restore]; }
+                               after:^(id receiver, SEL selector) { afterCalls++; }];
+        
+        chain = [handler chain];
+    }
+    
+    // The call that restores the chain is still inside its trampoline, and finishes with the handlers it started with.
+    STAssertEqualObjects([person fullName], @"John Smith", @"The original should still run");
+    STAssertEquals(afterCalls, (NSUInteger)1, @"The call that restored the chain should still run its after handler");
+    
+    chain = nil;
+    [Person drainRetiredImplementations];
+    
+    STAssertEqualObjects([person fullName], @"John Smith", @"The original should run once the chain is gone");
+    STAssertEquals(afterCalls, (NSUInteger)1, @"Later calls should not run the handlers");
+}
+
+- (void)testClassMethodChains {
+    
+    Class cls = [Person freshSubclassNamed:@"ChainClassMethodPerson"];
+    __block NSUInteger calls = 0;
+    
+    [cls FMS_chainClassMethod:@selector(personWithFirstName:lastName:age:)
+                       before:nil
+                        after:^(id receiver, SEL selector) {
+                            if (receiver == cls) calls++;
+                        }];
+    
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    STAssertEqualObjects([person fullName], @"John Smith", @"The class method's arguments should pass through");
+    STAssertEquals(calls, (NSUInteger)1, @"The handler should run with the class as the receiver");
+    STAssertNotNil([cls FMS_hookChainForClassMethod:@selector(personWithFirstName:lastName:age:)],
+                   @"The class method should have a chain");
+}
+
+- (void)testChangingHandlersWhileCalling {
+    
+    Class cls = [Person freshSubclassNamed:@"ChainConcurrentPerson"];
+    __block volatile BOOL failed = NO;
+    
+    [cls FMS_chainInstanceMethod:@selector(fullNameWithTitle:)
+                          before:^(id receiver, SEL selector) {}
+                           after:nil];
+    
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+    
+    for (NSUInteger thread = 0; thread < 4; thread++) {
+        
+        dispatch_group_async(group, queue, ^{
+            
+            Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+            
+            for (NSUInteger call = 0; call < 20000; call++) {
+                if (![[person fullNameWithTitle:@"Dr"] isEqualToString:@"Dr John Smith"]) failed = YES;
+            }
+        });
+    }
+    
+    for (NSUInteger change = 0; change < 500; change++) {
+        
+        FMSHookChainHandler *handler =
+        [cls FMS_chainInstanceMethod:@selector(fullNameWithTitle:) around:^(id receiver, SEL selector, FMSHookChainProceedBlock proceed) {
+            proceed();
+        }];
+        
+        [handler remove];
+    }
+    
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    
+    STAssertFalse(failed, @"Every call should reach the original while handlers change");
+    STAssertEquals([[cls FMS_hookChainForInstanceMethod:@selector(fullNameWithTitle:)] handlerCount], (NSUInteger)1,
+                   @"Only the first handler should be left");
+}
+
+@end
@@ -0,0 +1,10 @@
+//
+//  InstanceOverrideTests.h
+//  FMSSwizzler
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface InstanceOverrideTests : SenTestCase
+
+@end
@@ -0,0 +1,121 @@
+//
+//  InstanceOverrideTests.m
+//  FMSSwizzler
+//
+
+#import "InstanceOverrideTests.h"
+#import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+
+// This prevents compiler errors for non-declared methods
+@interface NSObject(InstanceOverrideTests)
+
+- (NSString *)instanceOldFullName;
+
+@end
+
+@implementation InstanceOverrideTests
+
+- (void)testOverridesOnlyAffectOneObject {
+    
+    Class cls = [Person freshSubclassNamed:@"InstanceOverridePerson"];
+    Person *john = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    Person *sara = [cls personWithFirstName:@"Sara" lastName:@"Jones" age:35];
+    Person *plain = [cls personWithFirstName:@"Jim" lastName:@"Brown" age:20];
+    
+    NSUInteger classCount = [NSObject FMS_liveGeneratedClassCount];
+    
+    [john FMS_replaceMethod:@selector(fullName) withImplementationBlock:^(Person *_self) {
+        return @"Bob";
+    }];
+    [sara FMS_replaceMethod:@selector(fullName) withImplementationBlock:^(Person *_self) {
+        return @"Alice";
+    }];
+    
+    STAssertEqualObjects([john fullName], @"Bob", @"John's override should be used");
+    STAssertEqualObjects([sara fullName], @"Alice", @"Sara's override should be used");
+    STAssertEqualObjects([plain fullName], @"Jim Brown", @"Other objects should not change");
+    
+    STAssertEquals([john class], [sara class], @"Both objects should share a single dispatching class");
+    STAssertEquals([NSObject FMS_liveGeneratedClassCount], classCount + 1, @"Only one class should be generated");
+    STAssertTrue([john isKindOfClass:cls], @"The object should still be a kind of its original class");
+}
+
+- (void)testOverridingWithAnOldSelector {
+    
+    Class cls = [Person freshSubclassNamed:@"InstanceOldSelectorPerson"];
+    Person *john = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    Person *sara = [cls personWithFirstName:@"Sara" lastName:@"Jones" age:35];
+    
+    FMSSwizzleToken *token =
+    [john FMS_overrideMethod:@selector(fullName)
+                 oldSelector:@selector(instanceOldFullName)
+         implementationBlock:^(Person *_self) {
+             return [NSString stringWithFormat:@"Dr. %@", [_self instanceOldFullName]];
+         }];
+    
+    STAssertNoThrow([sara FMS_overrideMethod:@selector(fullName)
+                                 oldSelector:@selector(instanceOldFullName)
+                         implementationBlock:^(Person *_self) {
+                             return [[_self instanceOldFullName] uppercaseString];
+                         }], @"Objects that override the same selector may share the old selector");
+    
+    STAssertEqualObjects([john fullName], @"Dr. John Smith", @"The override should call the original");
+    STAssertEqualObjects([sara fullName], @"SARA JONES", @"Each object should use its own override");
+    
+    STAssertEquals([token kind], FMSSwizzleTokenInstance, @"Should record a single-object override");
+    
+    [token restore];
+    
+    STAssertEqualObjects([john fullName], @"John Smith", @"The original should be back");
+    STAssertEqualObjects([sara fullName], @"SARA JONES", @"Other objects should keep their overrides");
+    STAssertFalse([token isActive], @"A restored token should be inactive");
+}
+
+- (void)testOverridingTwiceRequiresRestoring {
+    
+    Class cls = [Person freshSubclassNamed:@"InstanceTwicePerson"];
+    Person *john = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    FMSSwizzleToken *token = [john FMS_replaceMethod:@selector(fullName) withImplementationBlock:^(Person *_self) {
+        return @"Bob";
+    }];
+    
+    STAssertThrows([john FMS_replaceMethod:@selector(fullName) withImplementationBlock:^(Person *_self) {
+        return @"Jim";
+    }], @"An object can only override a selector once");
+    
+    [token restore];
+    
+    STAssertNoThrow([john FMS_replaceMethod:@selector(fullName) withImplementationBlock:^(Person *_self) {
+        return @"Jim";
+    }], @"Once restored, the selector can be overridden again");
+    
+    STAssertEqualObjects([john fullName], @"Jim", @"The new override should be used");
+    STAssertThrows([john FMS_replaceMethod:@selector(count) withImplementationBlock:^(id _self) {
+        return 0;
+    }], @"The method must exist");
+}
+
+- (void)testLaterClassSwizzlesShowThrough {
+    
+    Class cls = [Person freshSubclassNamed:@"InstanceLaterPerson"];
+    Person *john = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    Person *sara = [cls personWithFirstName:@"Sara" lastName:@"Jones" age:35];
+    
+    [john FMS_replaceMethod:@selector(fullName) withImplementationBlock:^(Person *_self) {
+        return @"Bob";
+    }];
+    [sara FMS_replaceMethod:@selector(firstName) withImplementationBlock:^(Person *_self) {
+        return @"Alice";
+    }];
+    
+    [cls FMS_replaceInstanceMethod:@selector(fullName) withImplementationBlock:^(Person *_self) {
+        return @"Class";
+    }];
+    
+    STAssertEqualObjects([john fullName], @"Bob", @"The object's own override should win");
+    STAssertEqualObjects([sara fullName], @"Class", @"Objects without an override should see the class's change");
+}
+
+@end
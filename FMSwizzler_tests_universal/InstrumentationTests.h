@@ -0,0 +1,10 @@
+//
+//  InstrumentationTests.h
+//  FMSSwizzler
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface InstrumentationTests : SenTestCase
+
+@end
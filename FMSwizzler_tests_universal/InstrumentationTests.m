@@ -0,0 +1,125 @@
+//
+//  InstrumentationTests.m
+//  FMSSwizzler
+//
+
+#import "InstrumentationTests.h"
+#import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+
+@interface InstrumentedMath : NSObject
+- (double)scale:(NSUInteger)value by:(NSInteger)factor;
+- (void)touch;
+- (NSUInteger)unsupported:(NSRange)range;
+@end
+
+@implementation InstrumentedMath
+
+- (double)scale:(NSUInteger)value by:(NSInteger)factor {
+    return (double)value * (double)factor;
+}
+
+- (void)touch {
+}
+
+- (NSUInteger)unsupported:(NSRange)range {
+    return range.length;
+}
+
+@end
+
+@implementation InstrumentationTests
+
+- (void)testInstrumentedCallsAreCounted {
+    
+    Class cls = [Person freshSubclassNamed:@"InstrumentedCountPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    STAssertNil([cls FMS_statisticsForInstanceMethod:@selector(fullNameWithTitle:)],
+                @"Methods that were never instrumented have no statistics");
+    
+    [cls FMS_instrumentInstanceMethod:@selector(fullNameWithTitle:)];
+    
+    for (NSUInteger call = 0; call < 100; call++) {
+        STAssertEqualObjects([person fullNameWithTitle:@"Mr."], @"Mr. John Smith", @"The original should still run");
+    }
+    
+    FMSMethodStatistics *statistics = [cls FMS_statisticsForInstanceMethod:@selector(fullNameWithTitle:)];
+    
+    STAssertEquals([statistics callCount], (uint64_t)100, @"Every call should be counted");
+    STAssertTrue([statistics totalNanoseconds] > 0, @"Calls should take some time");
+    
+    uint64_t bucketed = 0;
+    for (NSUInteger bucket = 0; bucket < FMSLatencyBucketCount; bucket++) {
+        bucketed += [statistics callCountForLatencyBucket:bucket];
+    }
+    
+    STAssertEquals(bucketed, (uint64_t)100, @"Every call should land in one histogram bucket");
+    STAssertTrue([statistics approximateNanosecondsAtPercentile:0.5] <= [statistics approximateNanosecondsAtPercentile:0.99],
+                 @"Percentiles should not decrease");
+}
+
+- (void)testCallsFromManyThreadsAreAggregated {
+    
+    Class cls = [Person freshSubclassNamed:@"InstrumentedThreadsPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    [cls FMS_instrumentInstanceMethod:@selector(canLegallyDrink)];
+    
+    dispatch_apply(16, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index) {
+        for (NSUInteger call = 0; call < 1000; call++) {
+            [person canLegallyDrink];
+        }
+    });
+    
+    STAssertEquals([[cls FMS_statisticsForInstanceMethod:@selector(canLegallyDrink)] callCount], (uint64_t)16000,
+                   @"Calls from every thread should be counted");
+}
+
+- (void)testInstrumentingScalarSignatures {
+    
+    InstrumentedMath *math = [[InstrumentedMath alloc] init];
+    
+    [InstrumentedMath FMS_instrumentInstanceMethod:@selector(scale:by:)];
+    [InstrumentedMath FMS_instrumentInstanceMethod:@selector(touch)];
+    
+    STAssertEquals([math scale:3 by:-2], -6.0, @"Arguments and double return values should pass through");
+    [math touch];
+    
+    STAssertEquals([[InstrumentedMath FMS_statisticsForInstanceMethod:@selector(scale:by:)] callCount], (uint64_t)1,
+                   @"The call should be counted");
+    STAssertEquals([[InstrumentedMath FMS_statisticsForInstanceMethod:@selector(touch)] callCount], (uint64_t)1,
+                   @"The call should be counted");
+}
+
+- (void)testRestoringInstrumentationKeepsStatistics {
+    
+    Class cls = [Person freshSubclassNamed:@"InstrumentedRestorePerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    FMSSwizzleToken *token = [cls FMS_instrumentInstanceMethod:@selector(fullName)];
+    STAssertThrows([cls FMS_instrumentInstanceMethod:@selector(fullName)], @"Should not instrument twice");
+    
+    [person fullName];
+    [token restore];
+    [person fullName];
+    
+    STAssertEquals([[cls FMS_statisticsForInstanceMethod:@selector(fullName)] callCount], (uint64_t)1,
+                   @"Calls after restoring should not be counted");
+    
+    [cls FMS_instrumentInstanceMethod:@selector(fullName)];
+    [person fullName];
+    
+    STAssertEquals([[cls FMS_statisticsForInstanceMethod:@selector(fullName)] callCount], (uint64_t)2,
+                   @"Instrumenting again should add to the same statistics");
+}
+
+#if !FMS_USE_LIBFFI
+- (void)testUnsupportedSignaturesThrow {
+    
+    STAssertThrows([InstrumentedMath FMS_instrumentInstanceMethod:@selector(unsupported:)],
+                   @"Struct arguments cannot be instrumented without libffi");
+}
+#endif
+
+@end
@@ -0,0 +1,10 @@
+//
+//  MethodCacheTests.h
+//  FMSSwizzler
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface MethodCacheTests : SenTestCase
+
+@end
@@ -0,0 +1,121 @@
+//
+//  MethodCacheTests.m
+//  FMSSwizzler
+//
+
+#import "MethodCacheTests.h"
+#import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+
+@implementation MethodCacheTests
+
+- (void)testPrewarmCountsImplementedSelectors {
+    
+    Class cls = [Person freshSubclassNamed:@"PrewarmedPerson"];
+    SEL selectors[] = {@selector(fullName), @selector(canLegallyDrink), @selector(count)};
+    
+    STAssertEquals([cls FMS_prewarmMethodCacheForSelectors:selectors count:3], (NSUInteger)2,
+                   @"Selectors the class doesn't respond to shouldn't be counted");
+    STAssertEquals([cls FMS_prewarmMethodCacheForSelectors:NULL count:0], (NSUInteger)0,
+                   @"Prewarming nothing should do nothing");
+    STAssertThrows([cls FMS_prewarmMethodCacheForSelectors:NULL count:1], @"A count needs a selector array");
+    
+    // Person implements fullName, fullNameWithTitle:, canLegallyDrink, getCMD and its three properties' accessors
+    // (plus whatever the compiler adds, such as .cxx_destruct).
+    STAssertTrue([cls FMS_prewarmMethodCache] >= 10, @"Every method below NSObject should be prewarmed");
+    STAssertFalse(class_respondsToSelector(cls, @selector(count)), @"Prewarming shouldn't add methods");
+}
+
+- (void)testSnapshotImplementationsCanBeCalledDirectly {
+    
+    Class cls = [Person freshSubclassNamed:@"SnapshotPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    SEL selectors[] = {@selector(canLegallyDrink), @selector(fullNameWithTitle:), @selector(count)};
+    
+    FMSIMPSnapshot *snapshot = [cls FMS_IMPSnapshotForSelectors:selectors count:3];
+    
+    STAssertEquals([snapshot targetClass], cls, @"The snapshot should remember its class");
+    STAssertEquals([snapshot count], (NSUInteger)3, @"Every selector should be in the snapshot");
+    STAssertTrue([snapshot isValid], @"A new snapshot should be valid");
+    STAssertEquals([snapshot selectors][1], @selector(fullNameWithTitle:), @"Selectors should keep their order");
+    STAssertTrue([snapshot implementations][2] == NULL, @"Missing methods should have no implementation");
+    
+    STAssertTrue([snapshot implementations][0] == [cls instanceMethodForSelector:@selector(canLegallyDrink)],
+                 @"The snapshot should hold the current implementation");
+    STAssertTrue([snapshot implementationForSelector:@selector(fullNameWithTitle:)] == [snapshot implementations][1],
+                 @"Looking up a selector should find its entry");
+    STAssertTrue([snapshot implementationForSelector:@selector(getCMD)] == NULL,
+                 @"Selectors that weren't asked for shouldn't be found");
+    
+    BOOL (*canLegallyDrink)(id, SEL) = (BOOL (*)(id, SEL))[snapshot implementations][0];
+    NSString *(*fullNameWithTitle)(id, SEL, NSString *) = (NSString *(*)(id, SEL, NSString *))[snapshot implementations][1];
+    
+    STAssertTrue(canLegallyDrink(person, @selector(canLegallyDrink)), @"The implementation should be callable");
+    STAssertEqualObjects(fullNameWithTitle(person, @selector(fullNameWithTitle:), @"Mr"), @"Mr John Smith",
+                         @"The implementation should get its arguments");
+}
+
+- (void)testSwizzlingInvalidatesSnapshots {
+    
+    Class superclass = [Person freshSubclassNamed:@"InvalidatedSuperPerson"];
+    Class cls = [superclass freshSubclassNamed:@"InvalidatedSubPerson"];
+    
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    SEL selectors[] = {@selector(fullName)};
+    
+    FMSIMPSnapshot *snapshot = [cls FMS_IMPSnapshotForSelectors:selectors count:1];
+    IMP original = [snapshot implementations][0];
+    
+    // A change to the superclass changes what the subclass inherits.
+    FMSSwizzleToken *token = [superclass FMS_replaceInstanceMethod:@selector(fullName)
+                                           withImplementationBlock:^NSString *(id _self) {
+                                               return @"Replaced";
+                                           }];
+    
+    STAssertFalse([snapshot isValid], @"Swizzling a superclass should invalidate the snapshot");
+    STAssertTrue([snapshot implementations][0] == original, @"An invalid snapshot shouldn't change");
+    
+    FMSIMPSnapshot *refreshed = [snapshot refreshedSnapshot];
+    NSString *(*fullName)(id, SEL) = (NSString *(*)(id, SEL))[refreshed implementations][0];
+    
+    STAssertTrue(refreshed != snapshot && [refreshed isValid], @"Refreshing should take a new snapshot");
+    STAssertEqualObjects(fullName(person, @selector(fullName)), @"Replaced", @"The new snapshot should see the swizzle");
+    STAssertEquals([refreshed refreshedSnapshot], refreshed, @"Refreshing a valid snapshot should return it");
+    
+    [token restore];
+    
+    STAssertFalse([refreshed isValid], @"Restoring should invalidate the snapshot");
+    STAssertTrue([[refreshed refreshedSnapshot] implementations][0] == original, @"Restoring should bring back the original");
+}
+
+- (void)testBatchesAndManualInvalidation {
+    
+    Class cls = [Person freshSubclassNamed:@"BatchInvalidatedPerson"];
+    
+    FMSIMPSnapshot *snapshot = [cls FMS_IMPSnapshot];
+    
+    STAssertTrue([snapshot implementationForSelector:@selector(fullName)] != NULL, @"Person's methods should be included");
+    STAssertTrue([snapshot implementationForSelector:@selector(description)] == NULL, @"NSObject's methods should be left out");
+    
+    [NSObject FMS_invalidateIMPSnapshots];
+    STAssertFalse([snapshot isValid], @"Invalidating by hand should invalidate every snapshot");
+    
+    snapshot = [snapshot refreshedSnapshot];
+    
+    [NSObject FMS_performSwizzleBatch:^(FMSSwizzleBatch *batch) {
+        [batch replaceInstanceMethod:@selector(getCMD)
+                             ofClass:cls
+             withImplementationBlock:^NSString *(id _self) {
+                 return @"batched";
+             }];
+    }];
+    
+    STAssertFalse([snapshot isValid], @"A batch should invalidate the snapshot");
+    
+    IMP getCMD = [[snapshot refreshedSnapshot] implementationForSelector:@selector(getCMD)];
+    STAssertEqualObjects(((NSString *(*)(id, SEL))getCMD)([[cls alloc] init], @selector(getCMD)), @"batched",
+                         @"The refreshed snapshot should see the batch");
+}
+
+@end
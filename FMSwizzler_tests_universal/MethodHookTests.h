@@ -0,0 +1,10 @@
+//
+//  MethodHookTests.h
+//  FMSSwizzler
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface MethodHookTests : SenTestCase
+
+@end
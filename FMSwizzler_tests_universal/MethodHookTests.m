@@ -0,0 +1,119 @@
+//
+//  MethodHookTests.m
+//  FMSSwizzler
+//
+
+#import "MethodHookTests.h"
+#import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+
+@interface HookedShapes : NSObject
+- (double)mix:(double)first with:(NSInteger)second and:(float)third;
+- (NSRange)rangeFrom:(NSUInteger)location length:(NSUInteger)length;
+- (NSUInteger)lengthOfRange:(NSRange)range;
++ (NSString *)describe:(NSInteger)value;
+@end
+
+@implementation HookedShapes
+
+- (double)mix:(double)first with:(NSInteger)second and:(float)third {
+    return first * (double)second + (double)third;
+}
+
+- (NSRange)rangeFrom:(NSUInteger)location length:(NSUInteger)length {
+    return NSMakeRange(location, length);
+}
+
+- (NSUInteger)lengthOfRange:(NSRange)range {
+    return range.length;
+}
+
++ (NSString *)describe:(NSInteger)value {
+    return [NSString stringWithFormat:@"value %ld", (long)value];
+}
+
+@end
+
+@implementation MethodHookTests
+
+- (void)testHooksRunAroundTheOriginal {
+    
+    Class cls = [Person freshSubclassNamed:@"HookedOrderPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    NSMutableArray *events = [NSMutableArray array];
+    
+    FMSSwizzleToken *token =
+    [cls FMS_hookInstanceMethod:@selector(setFirstName:)
+                         before:^(id receiver, SEL selector) {
+                             [events addObject:[NSString stringWithFormat:@"before %@ %@",
+                                                NSStringFromSelector(selector), [receiver firstName]]];
+                         }
+                          after:^(id receiver, SEL selector) {
+                              [events addObject:[NSString stringWithFormat:@"after %@", [receiver firstName]]];
+                          }];
+    
+    person.firstName = @"Bob";
+    
+    NSArray *expected = @[@"before setFirstName: John", @"after Bob"];
+    STAssertEqualObjects(events, expected, @"The hooks should run before and after the original");
+    
+    [token restore];
+    person.firstName = @"Jim";
+    
+    STAssertEquals([events count], (NSUInteger)2, @"Restored hooks should not run");
+    STAssertEqualObjects(person.firstName, @"Jim", @"The original should still work");
+}
+
+- (void)testHooksPassArgumentsAndReturnValuesThrough {
+    
+    HookedShapes *shapes = [[HookedShapes alloc] init];
+    __block NSUInteger calls = 0;
+    
+    FMSMethodHookBlock count = ^(id receiver, SEL selector) {
+        calls++;
+    };
+    
+    [HookedShapes FMS_hookInstanceMethod:@selector(mix:with:and:) before:count after:nil];
+    [HookedShapes FMS_hookInstanceMethod:@selector(rangeFrom:length:) before:nil after:count];
+    [HookedShapes FMS_hookClassMethod:@selector(describe:) before:count after:count];
+    
+    STAssertEquals([shapes mix:1.5 with:4 and:0.25f], 6.25, @"Mixed integer and floating point arguments should pass through");
+    STAssertTrue(NSEqualRanges([shapes rangeFrom:3 length:7], NSMakeRange(3, 7)), @"Struct return values should pass through");
+    STAssertEqualObjects([HookedShapes describe:-12], @"value -12", @"Class methods should be hooked too");
+    
+    STAssertEquals(calls, (NSUInteger)4, @"Every hook should have run");
+}
+
+- (void)testHookNeedsABlock {
+    
+    Class cls = [Person freshSubclassNamed:@"HookedEmptyPerson"];
+    
+    STAssertThrows([cls FMS_hookInstanceMethod:@selector(fullName) before:nil after:nil],
+                   @"A hook without blocks should be rejected");
+}
+
+- (void)testStructArguments {
+    
+    HookedShapes *shapes = [[HookedShapes alloc] init];
+    
+#if FMS_USE_LIBFFI
+    __block BOOL called = NO;
+    
+    [HookedShapes FMS_hookInstanceMethod:@selector(lengthOfRange:)
+                                  before:^(id receiver, SEL selector) {
+                                      called = YES;
+                                  }
+                                   after:nil];
+    
+    STAssertEquals([shapes lengthOfRange:NSMakeRange(2, 9)], (NSUInteger)9, @"libffi should pass struct arguments through");
+    STAssertTrue(called, @"The hook should have run");
+#else
+    STAssertThrows([HookedShapes FMS_hookInstanceMethod:@selector(lengthOfRange:)
+                                                 before:^(id receiver, SEL selector) {}
+                                                  after:nil],
+                   @"Struct arguments need libffi");
+    STAssertEquals([shapes lengthOfRange:NSMakeRange(2, 9)], (NSUInteger)9, @"A rejected hook should leave the method alone");
+#endif
+}
+
+@end
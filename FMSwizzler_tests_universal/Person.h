@@ -45,3 +45,19 @@
 - (NSString *)getCMD;
 
 @end
+
+@interface Person (FreshSubclasses)
+
+// Creates and registers a new subclass of the receiver. Tests that swizzle get a subclass of their own,
+// so their changes don't leak into the other test cases. Each name may only be used once.
++ (Class)freshSubclassNamed:(NSString *)name;
+
+@end
+
+@interface Person (RetiredImplementations)
+
+// Frees everything that has been restored so far, sitting out the grace period. Restored implementations are
+// otherwise only freed when something else is retired, so tests that check what restoring frees call this.
++ (void)drainRetiredImplementations;
+
+@end
@@ -30,6 +30,9 @@
 //    OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+#import <unistd.h>
 
 @implementation Person
 
@@ -62,3 +65,31 @@
 }
 
 @end
+
+@implementation Person (FreshSubclasses)
+
++ (Class)freshSubclassNamed:(NSString *)name {
+    
+    Class cls = objc_allocateClassPair(self, [name UTF8String], 0);
+    NSAssert(cls != Nil, @"Could not allocate %@; is the name already in use?", name);
+    
+    objc_registerClassPair(cls);
+    
+    return cls;
+}
+
+@end
+
+@implementation Person (RetiredImplementations)
+
++ (void)drainRetiredImplementations {
+    
+    NSDate *deadline = [NSDate dateWithTimeIntervalSinceNow:1.0];
+    
+    while ([NSObject FMS_retiredImplementationCount] > 0 && [deadline timeIntervalSinceNow] > 0) {
+        [NSObject FMS_reclaimRetiredImplementations];
+        usleep(1000);
+    }
+}
+
+@end
@@ -33,6 +33,7 @@
 #import "Person.h"
 #import "MonitorableObject.h"
 #import "NSObject+FMSSwizzler.h"
+#import <stdatomic.h>
 
 
 // This prevents compiler errors for non-declared methods
@@ -52,6 +53,62 @@
 @property (strong, nonatomic) id third;
 @property (strong, nonatomic) id fourth;
 
+@property (strong, nonatomic) id ivarRetain;
+@property (copy, nonatomic) id ivarCopy;
+@property (assign, nonatomic) BOOL ivarBool;
+@property (assign, nonatomic) NSInteger ivarInteger;
+@property (assign, nonatomic) double ivarDouble;
+@property (assign, nonatomic) NSRange ivarRange;
+
+@property (assign, nonatomic) NSRange pseudoRange;
+@property (assign, nonatomic) double slabDouble;
+@property (assign, nonatomic) double lateDouble;
+
+@property (copy, nonatomic) NSString *bulkName;
+@property (assign, nonatomic) NSInteger bulkCount;
+@property (assign, nonatomic) BOOL bulkFlag;
+
+@property (weak, nonatomic) id pseudoWeak;
+@property (strong) id pseudoRetainAtomic;
+@property (assign) BOOL pseudoBoolAtomic;
+@property (assign) NSInteger pseudoIntegerAtomic;
+@property (assign) NSUInteger pseudoUIntegerAtomic;
+@property (assign) float pseudoFloatAtomic;
+@property (assign) double pseudoDoubleAtomic;
+
+@property (weak, nonatomic) id ivarWeak;
+@property (strong) id ivarRetainAtomic;
+@property (assign) NSInteger ivarIntegerAtomic;
+
+@property (strong, nonatomic) id lazyObject;
+@property (assign, nonatomic) double lazyDouble;
+@property (assign, nonatomic) NSRange lazyRange;
+@property (assign) NSInteger lazyShared;
+
+@property (assign, nonatomic) double arenaDouble;
+@property (assign, nonatomic) NSRange arenaRange;
+@property (assign, nonatomic) NSInteger arenaLateInteger;
+
+@property (assign, nonatomic) NSInteger racingFirst;
+@property (assign, nonatomic) NSInteger racingSecond;
+@property (assign, nonatomic) NSInteger racingThird;
+@property (assign, nonatomic) NSInteger racingFourth;
+
+- (void)invalidateLazyObject;
+- (void)invalidateLazyDouble;
+
+@end
+
+// Writes an arena-backed pseudo property for the first time from its own dealloc.
+@interface ArenaDeallocPerson : Person
+@end
+
+@implementation ArenaDeallocPerson
+
+- (void)dealloc {
+    self.arenaDouble = 7.0;
+}
+
 @end
 
 @interface PseudoPropertyTests()
@@ -341,5 +398,512 @@
 
 }
 
+- (void)testUnicodePropertyNames
+{
+    FMSPseudoPropertyAdder adder = [Person FMS_generatePseudoPropertyAdderForType:FMSObjectRetain];
+    STAssertThrows(adder(@"\u00C9lan"), @"Upper case non-ASCII first letters should throw an exception");
+    STAssertThrows(adder(@"caf\u00E9 au lait"), @"Spaces should throw an exception");
+    
+    STAssertNoThrow(adder(@"\u00E9clair_2"), @"Lower case non-ASCII first letters should not throw an exception");
+    
+    // Names are interned after they have been validated, so a second class reuses the same name.
+    STAssertNoThrow([MonitorableObject FMS_generatePseudoPropertyAdderForType:FMSObjectRetain](@"\u00E9clair_2"),
+                    @"The same name can be added to a second class");
+}
+
+- (void)testStructPseudoProperties
+{
+    STAssertThrows(self.p1.pseudoRange = NSMakeRange(1, 2), @"We have not yet defined the setPseudoRange: method.");
+    
+    [Person FMS_generatePseudoPropertyAdderForType:FMSRange](@"pseudoRange");
+    
+    STAssertNoThrow(self.p1.pseudoRange = NSMakeRange(3, 12), @"We've dynamically added the setPseudoRange: method.");
+    
+    STAssertEquals(self.p1.pseudoRange, NSMakeRange(3, 12), @"pseudoRange should return the value we set");
+    STAssertEquals(self.p2.pseudoRange, NSMakeRange(0, 0), @"Should return an empty range by default");
+}
+
+- (void)testSlabGrowsWhenPropertiesAreAddedLater
+{
+    [Person FMS_generatePseudoPropertyAdderForType:FMSDouble](@"slabDouble");
+    self.p1.slabDouble = 1.5;
+    
+    // p1 already has a slab, which must grow to hold the new property.
+    [Person FMS_generatePseudoPropertyAdderForType:FMSDouble](@"lateDouble");
+    
+    STAssertEquals(self.p1.lateDouble, 0.0, @"should return 0.0 by default");
+    
+    self.p1.lateDouble = 2.5;
+    
+    STAssertEquals(self.p1.slabDouble, 1.5, @"Growing the slab should preserve existing values");
+    STAssertEquals(self.p1.lateDouble, 2.5, @"lateDouble should return the value we set");
+    STAssertEquals(self.p2.lateDouble, 0.0, @"Other objects should be unaffected");
+}
+
+- (void)testConcurrentFirstWritesToOneSlab
+{
+    [Person FMS_generatePseudoPropertyAdderForType:FMSInteger](@"racingFirst");
+    [Person FMS_generatePseudoPropertyAdderForType:FMSInteger](@"racingSecond");
+    [Person FMS_generatePseudoPropertyAdderForType:FMSInteger](@"racingThird");
+    [Person FMS_generatePseudoPropertyAdderForType:FMSInteger](@"racingFourth");
+    
+    NSUInteger lostValues = 0;
+    
+    for (NSUInteger round = 0; round < 500; round++) {
+        
+        Person *person = [Person personWithFirstName:@"Racing" lastName:@"Person" age:round];
+        
+        // Each thread writes a different property, so their first writes race to create the slab.
+        dispatch_apply(4, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index) {
+            switch (index) {
+                case 0: person.racingFirst = 1; break;
+                case 1: person.racingSecond = 2; break;
+                case 2: person.racingThird = 3; break;
+                default: person.racingFourth = 4; break;
+            }
+        });
+        
+        if (person.racingFirst != 1 || person.racingSecond != 2 || person.racingThird != 3 || person.racingFourth != 4) {
+            lostValues++;
+        }
+    }
+    
+    STAssertEquals(lostValues, (NSUInteger)0, @"Racing first writes should all land in the same slab");
+}
+
+- (void)testAddingPseudoPropertiesInBulk
+{
+    STAssertThrows(self.p1.bulkName = @"Name", @"We have not yet defined the setBulkName: method.");
+    
+    STAssertNoThrow([Person FMS_addPseudoProperties:@{@"bulkName": @(FMSObjectCopy),
+                                                      @"bulkCount": @(FMSInteger)}],
+                    @"This should not throw any exceptions");
+    
+    FMSPseudoPropertyDescriptor descriptors[] = {{@"bulkFlag", FMSBool}};
+    STAssertNoThrow([Person FMS_addPseudoPropertyDescriptors:descriptors count:1],
+                    @"This should not throw any exceptions");
+    
+    self.p1.bulkName = @"Name";
+    self.p1.bulkCount = 12;
+    self.p1.bulkFlag = YES;
+    
+    STAssertEqualObjects(self.p1.bulkName, @"Name", @"Should return the value we set");
+    STAssertEquals(self.p1.bulkCount, (NSInteger)12, @"Should return the value we set");
+    STAssertEquals(self.p1.bulkFlag, YES, @"Should return the value we set");
+    STAssertEqualObjects(self.p2.bulkName, nil, @"Should return nil by default");
+}
+
+- (void)testAddingPseudoPropertiesInBulkIsAtomic
+{
+    STAssertThrows([Person FMS_addPseudoProperties:@{@"atomicFirst": @(FMSObjectRetain),
+                                                     @"Atomic Second": @(FMSObjectRetain)}],
+                   @"An invalid name should throw an exception");
+    
+    STAssertThrows([Person FMS_addPseudoProperties:@{@"atomicFirst": @(FMSObjectRetain),
+                                                     @"lastName": @(FMSObjectRetain)}],
+                   @"An existing accessor should throw an exception");
+    
+    STAssertThrows([Person FMS_addPseudoProperties:@{@"atomicFirst": @(FMSObjectRetain),
+                                                     @"atomicSecond": @"notAType"}],
+                   @"An invalid type should throw an exception");
+    
+    STAssertFalse([Person instancesRespondToSelector:NSSelectorFromString(@"atomicFirst")],
+                  @"None of the properties should have been added");
+    STAssertFalse([Person instancesRespondToSelector:NSSelectorFromString(@"setAtomicFirst:")],
+                  @"None of the properties should have been added");
+}
+
+- (void)testIvarBackedPseudoProperties
+{
+    Class cls = [Person FMS_allocateSubclassWithPseudoProperties:@{@"ivarRetain": @(FMSObjectRetain),
+                                                                   @"ivarCopy": @(FMSObjectCopy),
+                                                                   @"ivarBool": @(FMSBool),
+                                                                   @"ivarInteger": @(FMSInteger),
+                                                                   @"ivarDouble": @(FMSDouble),
+                                                                   @"ivarRange": @(FMSRange)}];
+    
+    STAssertTrue([cls isSubclassOfClass:[Person class]], @"We should get back a subclass of Person");
+    STAssertThrows(self.p1.ivarDouble = 1.0, @"Person itself should not have the new properties");
+    
+    Person *person = [cls personWithFirstName:@"Tom" lastName:@"Brown" age:30];
+    Person *other = [cls personWithFirstName:@"Ann" lastName:@"White" age:31];
+    
+    NSMutableString *name = [@"Mutable" mutableCopy];
+    
+    STAssertNoThrow(person.ivarRetain = name, @"We've dynamically added the setIvarRetain: method.");
+    STAssertNoThrow(person.ivarCopy = name, @"We've dynamically added the setIvarCopy: method.");
+    STAssertNoThrow(person.ivarBool = YES, @"We've dynamically added the setIvarBool: method.");
+    STAssertNoThrow(person.ivarInteger = -42, @"We've dynamically added the setIvarInteger: method.");
+    STAssertNoThrow(person.ivarDouble = 12.5, @"We've dynamically added the setIvarDouble: method.");
+    STAssertNoThrow(person.ivarRange = NSMakeRange(5, 6), @"We've dynamically added the setIvarRange: method.");
+    
+    STAssertEquals(person.ivarRetain, (id)name, @"We should store the same instance that we passed in");
+    STAssertEqualObjects(person.ivarCopy, name, @"ivarCopy should return the value we assigned");
+    STAssertFalse(person.ivarCopy == name, @"The stored object and the original should be different instances");
+    STAssertEquals(person.ivarBool, YES, @"ivarBool should return the value we set");
+    STAssertEquals(person.ivarInteger, (NSInteger)-42, @"ivarInteger should return the value we set");
+    STAssertEquals(person.ivarDouble, 12.5, @"ivarDouble should return the value we set");
+    STAssertEquals(person.ivarRange, NSMakeRange(5, 6), @"ivarRange should return the value we set");
+    STAssertEqualObjects(person.firstName, @"Tom", @"firstName should continue to work");
+    
+    STAssertEqualObjects(other.ivarRetain, nil, @"Should return nil by default");
+    STAssertEquals(other.ivarInteger, (NSInteger)0, @"Should return 0 by default");
+    STAssertEquals(other.ivarDouble, 0.0, @"should return 0.0 by default");
+}
+
+- (void)testIvarBackedPseudoPropertiesReleaseValues
+{
+    __block BOOL deallocated = NO;
+    
+    Class cls = [Person FMS_allocateSubclassWithPseudoProperties:@{@"ivarRetain": @(FMSObjectRetain)}];
+    
+    @autoreleasepool {
+        
+        MonitorableObject *object = [[MonitorableObject alloc] initWithValue:0];
+        object.deallocBlock = ^(id _self) {
+            deallocated = YES;
+        };
+        
+        Person *person = [[cls alloc] init];
+        person.ivarRetain = object;
+        object = nil;
+        
+        STAssertFalse(deallocated, @"The person should still be retaining the object");
+        
+        person = nil;
+    }
+    
+    STAssertTrue(deallocated, @"Deallocating the person should release the object");
+}
+
+- (void)testIvarBackedPseudoPropertiesValidateFirst
+{
+    STAssertThrows([Person FMS_allocateSubclassWithPseudoProperties:@{@"ivarInteger": @(FMSInteger),
+                                                                      @"Invalid Name": @(FMSInteger)}],
+                   @"An invalid name should throw an exception");
+    
+    STAssertThrows([Person FMS_allocateSubclassWithPseudoProperties:@{@"firstName": @(FMSObjectRetain)}],
+                   @"Existing accessors should throw an exception");
+    
+    STAssertThrows([Person FMS_allocateSubclassWithPseudoProperties:@{@"ivarInteger": @(99)}],
+                   @"Invalid types should throw an exception");
+}
+
+- (void)testWeakPseudoProperties
+{
+    [Person FMS_generatePseudoPropertyAdderForType:FMSObjectWeak](@"pseudoWeak");
+    
+    STAssertEqualObjects(self.p1.pseudoWeak, nil, @"Should return nil by default");
+    
+    @autoreleasepool {
+        
+        MonitorableObject *object = [[MonitorableObject alloc] initWithValue:0];
+        self.p1.pseudoWeak = object;
+        
+        STAssertEquals(self.p1.pseudoWeak, (id)object, @"pseudoWeak should return the object we set");
+        STAssertEqualObjects(self.p2.pseudoWeak, nil, @"Other objects should be unaffected");
+        
+        object = nil;
+    }
+    
+    STAssertEqualObjects(self.p1.pseudoWeak, nil, @"The weak reference should be zeroed once the object is gone");
+}
+
+- (void)testAtomicPseudoProperties
+{
+    STAssertNoThrow([Person FMS_addPseudoProperties:@{@"pseudoRetainAtomic": @(FMSObjectRetainAtomic),
+                                                      @"pseudoBoolAtomic": @(FMSBoolAtomic),
+                                                      @"pseudoIntegerAtomic": @(FMSIntegerAtomic),
+                                                      @"pseudoUIntegerAtomic": @(FMSUnsignedIntegerAtomic),
+                                                      @"pseudoFloatAtomic": @(FMSFloatAtomic),
+                                                      @"pseudoDoubleAtomic": @(FMSDoubleAtomic)}],
+                    @"This should not throw any exceptions");
+    
+    STAssertEqualObjects(self.p1.pseudoRetainAtomic, nil, @"Should return nil by default");
+    STAssertEquals(self.p1.pseudoIntegerAtomic, (NSInteger)0, @"Should return 0 by default");
+    STAssertEquals(self.p1.pseudoDoubleAtomic, 0.0, @"should return 0.0 by default");
+    
+    self.p1.pseudoRetainAtomic = @"Value";
+    self.p1.pseudoBoolAtomic = YES;
+    self.p1.pseudoIntegerAtomic = -42;
+    self.p1.pseudoUIntegerAtomic = 42;
+    self.p1.pseudoFloatAtomic = 1.5f;
+    self.p1.pseudoDoubleAtomic = 2.5;
+    
+    STAssertEqualObjects(self.p1.pseudoRetainAtomic, @"Value", @"Should return the value we set");
+    STAssertEquals(self.p1.pseudoBoolAtomic, YES, @"Should return the value we set");
+    STAssertEquals(self.p1.pseudoIntegerAtomic, (NSInteger)-42, @"Should return the value we set");
+    STAssertEquals(self.p1.pseudoUIntegerAtomic, (NSUInteger)42, @"Should return the value we set");
+    STAssertEquals(self.p1.pseudoFloatAtomic, 1.5f, @"Should return the value we set");
+    STAssertEquals(self.p1.pseudoDoubleAtomic, 2.5, @"Should return the value we set");
+    STAssertEquals(self.p2.pseudoIntegerAtomic, (NSInteger)0, @"Other objects should be unaffected");
+    
+    // Readers racing writers must only ever see a value that was actually stored.
+    Person *shared = self.p2;
+    __block BOOL sawTornValue = NO;
+    
+    dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index) {
+        
+        for (NSInteger i = 0; i < 10000; i++) {
+            
+            if (index % 2 == 0) {
+                shared.pseudoRetainAtomic = [NSString stringWithFormat:@"%ld", (long)i];
+                shared.pseudoIntegerAtomic = (i % 2 == 0) ? -1 : 1;
+            } else {
+                
+                NSString *value = shared.pseudoRetainAtomic;
+                NSInteger number = shared.pseudoIntegerAtomic;
+                
+                if ((value != nil && [value length] == 0) || (number != 0 && number != 1 && number != -1)) {
+                    sawTornValue = YES;
+                }
+            }
+        }
+    });
+    
+    STAssertFalse(sawTornValue, @"Atomic accessors should never return a partially written value");
+}
+
+- (void)testIvarBackedWeakAndAtomicPseudoProperties
+{
+    Class cls = [Person FMS_allocateSubclassWithPseudoProperties:@{@"ivarWeak": @(FMSObjectWeak),
+                                                                   @"ivarRetainAtomic": @(FMSObjectRetainAtomic),
+                                                                   @"ivarIntegerAtomic": @(FMSIntegerAtomic)}];
+    
+    __block BOOL deallocated = NO;
+    Person *person = [[cls alloc] init];
+    
+    @autoreleasepool {
+        
+        MonitorableObject *weakObject = [[MonitorableObject alloc] initWithValue:0];
+        person.ivarWeak = weakObject;
+        
+        STAssertEquals(person.ivarWeak, (id)weakObject, @"ivarWeak should return the object we set");
+        
+        weakObject = nil;
+    }
+    
+    STAssertEqualObjects(person.ivarWeak, nil, @"The weak reference should be zeroed once the object is gone");
+    
+    person.ivarIntegerAtomic = 7;
+    STAssertEquals(person.ivarIntegerAtomic, (NSInteger)7, @"ivarIntegerAtomic should return the value we set");
+    
+    @autoreleasepool {
+        
+        MonitorableObject *object = [[MonitorableObject alloc] initWithValue:1];
+        object.deallocBlock = ^(id _self) {
+            deallocated = YES;
+        };
+        
+        person.ivarRetainAtomic = object;
+        person.ivarWeak = object;
+        object = nil;
+        
+        STAssertFalse(deallocated, @"The person should still be retaining the object");
+        
+        person = nil;
+    }
+    
+    STAssertTrue(deallocated, @"Deallocating the person should release the atomic object");
+}
+
+- (void)testLazyPseudoProperties
+{
+    __block NSUInteger objectCalls = 0;
+    __block NSUInteger doubleCalls = 0;
+    
+    [Person FMS_generateLazyPseudoPropertyAdderForType:FMSObjectRetain](@"lazyObject", ^id (id _self) {
+        objectCalls++;
+        return [NSString stringWithFormat:@"%@ %lu", [_self firstName], (unsigned long)objectCalls];
+    }, @selector(invalidateLazyObject));
+    
+    [Person FMS_generateLazyPseudoPropertyAdderForType:FMSDouble](@"lazyDouble", ^id (id _self) {
+        doubleCalls++;
+        return @(2.5);
+    }, @selector(invalidateLazyDouble));
+    
+    [Person FMS_generateLazyPseudoPropertyAdderForType:FMSRange](@"lazyRange", ^id (id _self) {
+        return [NSValue valueWithRange:NSMakeRange(4, 8)];
+    }, NULL);
+    
+    STAssertEqualObjects(self.p1.lazyObject, @"John 1", @"The first read should run the initializer");
+    STAssertEqualObjects(self.p1.lazyObject, @"John 1", @"Later reads should return the cached value");
+    STAssertEquals(objectCalls, (NSUInteger)1, @"The initializer should only run once");
+    
+    STAssertEquals(self.p1.lazyDouble, 2.5, @"Scalars should be unwrapped from the returned NSNumber");
+    STAssertEquals(self.p1.lazyDouble, 2.5, @"Later reads should return the cached value");
+    STAssertEquals(doubleCalls, (NSUInteger)1, @"The initializer should only run once");
+    STAssertEquals(self.p1.lazyRange, NSMakeRange(4, 8), @"Structs should be unwrapped from the returned NSValue");
+    
+    STAssertEqualObjects(self.p2.lazyObject, @"Sara 2", @"Each object should run the initializer once");
+    
+    [self.p1 invalidateLazyObject];
+    [self.p1 invalidateLazyDouble];
+    
+    STAssertEquals(objectCalls, (NSUInteger)2, @"Invalidating should not run the initializer");
+    STAssertEqualObjects(self.p1.lazyObject, @"John 3", @"Reading after invalidating should run the initializer again");
+    STAssertEquals(self.p1.lazyDouble, 2.5, @"Reading after invalidating should run the initializer again");
+    STAssertEquals(doubleCalls, (NSUInteger)2, @"Reading after invalidating should run the initializer again");
+    
+    self.p1.lazyDouble = 7.0;
+    self.p1.lazyObject = @"Set";
+    
+    STAssertEquals(self.p1.lazyDouble, 7.0, @"Setting a lazy property should replace the cached value");
+    STAssertEqualObjects(self.p1.lazyObject, @"Set", @"Setting a lazy property should replace the cached value");
+    STAssertEquals(objectCalls, (NSUInteger)3, @"Setting a lazy property should not run the initializer");
+    
+    STAssertThrows([Person FMS_generateLazyPseudoPropertyAdderForType:FMSObjectWeak],
+                   @"Weak properties can't be lazy");
+    STAssertThrows([Person FMS_generateLazyPseudoPropertyAdderForType:FMSInteger](@"lazyMissing", nil, NULL),
+                   @"Lazy properties need an initializer");
+    STAssertThrows([Person FMS_generateLazyPseudoPropertyAdderForType:FMSInteger](@"lazyOther", ^id (id _self) {
+        return nil;
+    }, @selector(firstName)), @"The invalidation selector must not already exist");
+}
+
+- (void)testLazyPseudoPropertiesInitializeOnce
+{
+    __block atomic_uint calls = 0;
+    
+    [Person FMS_generateLazyPseudoPropertyAdderForType:FMSIntegerAtomic](@"lazyShared", ^id (id _self) {
+        
+        atomic_fetch_add(&calls, 1);
+        
+        // Give the other threads a chance to pile up behind the initializer.
+        usleep(1000);
+        return @(42);
+    }, NULL);
+    
+    Person *shared = self.p1;
+    __block atomic_uint wrongValues = 0;
+    
+    dispatch_apply(16, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index) {
+        
+        if (shared.lazyShared != 42) {
+            atomic_fetch_add(&wrongValues, 1);
+        }
+    });
+    
+    STAssertEquals(atomic_load(&calls), 1U, @"The initializer should run exactly once");
+    STAssertEquals(atomic_load(&wrongValues), 0U, @"Every thread should see the initialized value");
+}
+
+
+- (void)testPseudoPropertyArenas
+{
+    [Person FMS_generatePseudoPropertyAdderForType:FMSDouble](@"arenaDouble");
+    [Person FMS_generatePseudoPropertyAdderForType:FMSRange](@"arenaRange");
+    
+    // p1 gets its slab on the heap before the scope starts.
+    self.p1.arenaDouble = 1.5;
+    
+    STAssertEquals([NSObject FMS_currentPseudoPropertyArenaSize], (NSUInteger)0, @"There is no arena outside a scope");
+    
+    __block NSUInteger outerSize = 0;
+    __block NSUInteger innerSize = 0;
+    __block Person *survivor = nil;
+    __block Person *grownSurvivor = nil;
+    
+    [NSObject FMS_performWithPseudoPropertyArena:^{
+        
+        STAssertEquals([NSObject FMS_currentPseudoPropertyArenaSize], (NSUInteger)0, @"Arenas should start empty");
+        
+        NSMutableArray *people = [NSMutableArray array];
+        
+        for (NSUInteger index = 0; index < 1000; index++) {
+            
+            Person *person = [Person personWithFirstName:@"Temp" lastName:@"Person" age:index];
+            person.arenaDouble = (double)index;
+            person.arenaRange = NSMakeRange(index, 2);
+            
+            [people addObject:person];
+        }
+        
+        outerSize = [NSObject FMS_currentPseudoPropertyArenaSize];
+        
+        [NSObject FMS_performWithPseudoPropertyArena:^{
+            
+            Person *inner = [Person personWithFirstName:@"Inner" lastName:@"Person" age:1];
+            inner.arenaDouble = 9.0;
+            
+            innerSize = [NSObject FMS_currentPseudoPropertyArenaSize];
+            STAssertEquals(inner.arenaDouble, 9.0, @"Nested scopes should store values");
+        }];
+        
+        STAssertEquals([NSObject FMS_currentPseudoPropertyArenaSize], outerSize, @"Ending a nested scope should restore the outer arena");
+        
+        // Adding a property gives the slab a new segment; the values already in it stay where they are.
+        [Person FMS_generatePseudoPropertyAdderForType:FMSInteger](@"arenaLateInteger");
+        
+        Person *grown = people[10];
+        grown.arenaLateInteger = -4;
+        
+        STAssertEquals(grown.arenaLateInteger, (NSInteger)-4, @"Grown arena slabs should store the new value");
+        STAssertEquals(grown.arenaDouble, 10.0, @"Grown arena slabs should keep the old values");
+        
+        for (NSUInteger index = 0; index < [people count]; index++) {
+            
+            Person *person = people[index];
+            
+            STAssertEquals(person.arenaDouble, (double)index, @"Arena-backed values should read back");
+            STAssertTrue(NSEqualRanges(person.arenaRange, NSMakeRange(index, 2)), @"Arena-backed structs should read back");
+        }
+        
+        self.p1.arenaDouble = 2.5;
+        
+        survivor = people[20];
+        grownSurvivor = grown;
+    }];
+    
+    STAssertTrue(outerSize > 0, @"Writing pseudo properties in a scope should use its arena");
+    STAssertTrue(innerSize > 0, @"Nested scopes should have arenas of their own");
+    STAssertEquals([NSObject FMS_currentPseudoPropertyArenaSize], (NSUInteger)0, @"Scopes should end with their blocks");
+    STAssertEquals(self.p1.arenaDouble, 2.5, @"Heap slabs should be unaffected by arenas");
+    
+    // The scope is gone, but the chunks that objects outlived it in are still there.
+    STAssertEquals(survivor.arenaDouble, 20.0, @"Objects that outlive the scope should keep their values");
+    STAssertTrue(NSEqualRanges(survivor.arenaRange, NSMakeRange(20, 2)), @"Objects that outlive the scope should keep their structs");
+    STAssertEquals(grownSurvivor.arenaDouble, 10.0, @"Grown slabs should keep the values from their first segment");
+    STAssertEquals(grownSurvivor.arenaLateInteger, (NSInteger)-4, @"Grown slabs should keep their later segments");
+    
+    survivor.arenaDouble = 21.0;
+    grownSurvivor.arenaLateInteger = 5;
+    
+    STAssertEquals(survivor.arenaDouble, 21.0, @"Objects that outlive the scope should still be writable");
+    STAssertEquals(grownSurvivor.arenaLateInteger, (NSInteger)5, @"Grown slabs should still be writable");
+    
+    // Objects first written on another thread use the heap, even while this thread has an arena.
+    __block Person *escaped = nil;
+    
+    [NSObject FMS_performWithPseudoPropertyArena:^{
+        
+        // dispatch_sync() may run the block on this thread, so wait for an asynchronous one instead.
+        dispatch_group_t group = dispatch_group_create();
+        
+        dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            escaped = [Person personWithFirstName:@"Other" lastName:@"Thread" age:3];
+            escaped.arenaDouble = 3.5;
+        });
+        
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+        
+        STAssertEquals([NSObject FMS_currentPseudoPropertyArenaSize], (NSUInteger)0, @"Other threads should not use this arena");
+    }];
+    
+    STAssertEquals(escaped.arenaDouble, 3.5, @"Heap slabs should survive the scope");
+    
+    STAssertThrows([NSObject FMS_performWithPseudoPropertyArena:^{
+        [NSException raise:NSGenericException format:@"Thrown from inside an arena scope"];
+    }], @"Exceptions should pass through the scope");
+    
+    STAssertEquals([NSObject FMS_currentPseudoPropertyArenaSize], (NSUInteger)0, @"Exceptions should end the scope");
+    
+    // An object may be given its slab while it is being deallocated.
+    STAssertNoThrow([NSObject FMS_performWithPseudoPropertyArena:^{
+        ArenaDeallocPerson *dying = [ArenaDeallocPerson personWithFirstName:@"Dying" lastName:@"Person" age:1];
+        dying.firstName = @"Still dying";
+    }], @"Objects that write pseudo properties from dealloc should be torn down normally");
+}
+
 
 @end
@@ -0,0 +1,10 @@
+//
+//  SamplingTests.h
+//  FMSSwizzler
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface SamplingTests : SenTestCase
+
+@end
@@ -0,0 +1,248 @@
+//
+//  SamplingTests.m
+//  FMSSwizzler
+//
+
+#import "SamplingTests.h"
+#import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+#import <stdatomic.h>
+
+@interface SampledShapes : NSObject
+- (NSRange)rangeFrom:(NSUInteger)location length:(NSUInteger)length;
+- (NSUInteger)lengthOfRange:(NSRange)range;
++ (NSInteger)twice:(NSInteger)value;
+@end
+
+@implementation SampledShapes
+
+- (NSRange)rangeFrom:(NSUInteger)location length:(NSUInteger)length {
+    return NSMakeRange(location, length);
+}
+
+- (NSUInteger)lengthOfRange:(NSRange)range {
+    return range.length;
+}
+
++ (NSInteger)twice:(NSInteger)value {
+    return value * 2;
+}
+
+@end
+
+@implementation SamplingTests
+
+- (void)testEveryNthCallIsSampled {
+    
+    Class cls = [Person freshSubclassNamed:@"SampledEveryNthPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    NSMutableArray *sampled = [NSMutableArray array];
+    
+    FMSSampler *sampler =
+    [cls FMS_hookInstanceMethod:@selector(setFirstName:)
+                   samplingRate:3
+                         before:nil
+                          after:^(id receiver, SEL selector) {
+                              [sampled addObject:[receiver firstName]];
+                          }];
+    
+    for (NSUInteger call = 1; call <= 9; call++) {
+        
+        NSString *name = [NSString stringWithFormat:@"Name %lu", (unsigned long)call];
+        person.firstName = name;
+        
+        STAssertEqualObjects(person.firstName, name, @"Every call should reach the original");
+    }
+    
+    NSArray *expected = @[@"Name 3", @"Name 6", @"Name 9"];
+    STAssertEqualObjects(sampled, expected, @"Every third call should run the hook");
+    STAssertEquals([sampler samplingRate], (NSUInteger)3, @"The sampler should report its rate");
+    STAssertFalse([sampler isRandomized], @"Samplers start in every-Nth mode");
+}
+
+- (void)testChangingTheRateWithoutReinstalling {
+    
+    Class cls = [Person freshSubclassNamed:@"SampledRatePerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block NSUInteger samples = 0;
+    
+    FMSSampler *sampler = [cls FMS_hookInstanceMethod:@selector(fullName)
+                                         samplingRate:0
+                                               before:^(id receiver, SEL selector) {
+                                                   samples++;
+                                               }
+                                                after:nil];
+    
+    IMP installed = method_getImplementation(class_getInstanceMethod(cls, @selector(fullName)));
+    
+    for (NSUInteger call = 0; call < 10; call++) [person fullName];
+    STAssertEquals(samples, (NSUInteger)0, @"A rate of 0 should never sample");
+    
+    sampler.samplingRate = 1;
+    for (NSUInteger call = 0; call < 10; call++) [person fullName];
+    STAssertEquals(samples, (NSUInteger)10, @"A rate of 1 should sample every call");
+    
+    sampler.samplingRate = 5;
+    for (NSUInteger call = 0; call < 10; call++) [person fullName];
+    STAssertEquals(samples, (NSUInteger)12, @"The new rate should apply from the next call");
+    
+    STAssertEquals(method_getImplementation(class_getInstanceMethod(cls, @selector(fullName))), installed,
+                   @"Changing the rate should not reinstall the hook");
+}
+
+- (void)testRandomizedSamplingAveragesTheRate {
+    
+    Class cls = [Person freshSubclassNamed:@"SampledRandomPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block NSUInteger samples = 0;
+    
+    FMSSampler *sampler = [cls FMS_hookInstanceMethod:@selector(canLegallyDrink)
+                                         samplingRate:1
+                                               before:^(id receiver, SEL selector) {
+                                                   samples++;
+                                               }
+                                                after:nil];
+    
+    [sampler setSamplingRate:20 randomized:YES];
+    STAssertTrue([sampler isRandomized], @"The sampler should be randomized");
+    
+    for (NSUInteger call = 0; call < 20000; call++) [person canLegallyDrink];
+    
+    // 1000 samples expected; the bounds are loose enough never to fail by chance.
+    STAssertTrue(samples > 700 && samples < 1300, @"Randomized sampling should average the rate (got %lu)", (unsigned long)samples);
+}
+
+- (void)testEachThreadCountsOnItsOwn {
+    
+    Class cls = [Person freshSubclassNamed:@"SampledThreadsPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block atomic_uint samples = 0;
+    
+    [cls FMS_hookInstanceMethod:@selector(canLegallyDrink)
+                   samplingRate:100
+                         before:^(id receiver, SEL selector) {
+                             atomic_fetch_add(&samples, 1);
+                         }
+                          after:nil];
+    
+    dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t index) {
+        for (NSUInteger call = 0; call < 1000; call++) {
+            [person canLegallyDrink];
+        }
+    });
+    
+    // However the iterations are spread over threads, each thread makes a multiple of 1000 calls and samples
+    // every 100th of its own.
+    STAssertEquals((NSUInteger)atomic_load(&samples), (NSUInteger)80, @"Every thread should sample at the rate");
+}
+
+- (void)testRestoringASampledHook {
+    
+    Class cls = [Person freshSubclassNamed:@"SampledRestorePerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block NSUInteger samples = 0;
+    
+    FMSSampler *sampler = [cls FMS_hookInstanceMethod:@selector(fullName)
+                                         samplingRate:1
+                                               before:^(id receiver, SEL selector) {
+                                                   samples++;
+                                               }
+                                                after:nil];
+    
+    STAssertNotNil([sampler token], @"The sampler should expose its token");
+    STAssertEqualObjects([person fullName], @"John Smith", @"The original should run when sampled");
+    
+    [[sampler token] restore];
+    
+    STAssertEqualObjects([person fullName], @"John Smith", @"The original should run after restoring");
+    STAssertEquals(samples, (NSUInteger)1, @"Restored hooks should not run");
+    STAssertFalse([[sampler token] isActive], @"The token should be restored");
+}
+
+- (void)testSamplersReusingASlotStartAfresh {
+    
+    Class cls = [Person freshSubclassNamed:@"SampledReusedSlotPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block NSUInteger samples = 0;
+    
+    @autoreleasepool {
+        
+        FMSSampler *sampler = [cls FMS_hookInstanceMethod:@selector(fullName)
+                                             samplingRate:3
+                                                   before:nil
+                                                    after:nil];
+        
+        // Leave this thread's countdown one call away from a sample.
+        [person fullName];
+        [person fullName];
+        
+        [[sampler token] restore];
+        sampler = nil;
+    }
+    
+    // Once the old sampler is freed, its slot goes to the next one.
+    [Person drainRetiredImplementations];
+    
+    [cls FMS_hookInstanceMethod:@selector(fullName)
+                   samplingRate:3
+                         before:^(id receiver, SEL selector) {
+                             samples++;
+                         }
+                          after:nil];
+    
+    [person fullName];
+    STAssertEquals(samples, (NSUInteger)0, @"A new sampler should not pick up the old sampler's countdown");
+    
+    [person fullName];
+    [person fullName];
+    STAssertEquals(samples, (NSUInteger)1, @"The third call should be sampled");
+}
+
+- (void)testSampledSignatures {
+    
+    SampledShapes *shapes = [[SampledShapes alloc] init];
+    __block NSUInteger samples = 0;
+    
+    FMSMethodHookBlock count = ^(id receiver, SEL selector) {
+        samples++;
+    };
+    
+    [SampledShapes FMS_hookInstanceMethod:@selector(rangeFrom:length:) samplingRate:2 before:count after:nil];
+    [SampledShapes FMS_hookClassMethod:@selector(twice:) samplingRate:2 before:nil after:count];
+    
+    for (NSUInteger call = 0; call < 4; call++) {
+        STAssertTrue(NSEqualRanges([shapes rangeFrom:call length:7], NSMakeRange(call, 7)),
+                     @"Struct return values should pass through, sampled or not");
+        STAssertEquals([SampledShapes twice:-(NSInteger)call], -2 * (NSInteger)call, @"Class methods should pass through");
+    }
+    
+    STAssertEquals(samples, (NSUInteger)4, @"Every other call to each method should be sampled");
+    STAssertThrows([SampledShapes FMS_hookInstanceMethod:@selector(lengthOfRange:) samplingRate:1 before:count after:nil],
+                   @"Sampling needs a precompiled trampoline");
+}
+
+- (void)testSampledInstrumentation {
+    
+    Class cls = [Person freshSubclassNamed:@"SampledInstrumentedPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    FMSSampler *sampler = [cls FMS_instrumentInstanceMethod:@selector(fullNameWithTitle:) samplingRate:4];
+    STAssertThrows([cls FMS_instrumentInstanceMethod:@selector(fullNameWithTitle:)], @"Should not instrument twice");
+    
+    for (NSUInteger call = 0; call < 40; call++) {
+        STAssertEqualObjects([person fullNameWithTitle:@"Dr."], @"Dr. John Smith", @"The original should still run");
+    }
+    
+    STAssertEquals([[cls FMS_statisticsForInstanceMethod:@selector(fullNameWithTitle:)] callCount], (uint64_t)10,
+                   @"Only the sampled calls should be timed");
+    
+    [[sampler token] restore];
+    [cls FMS_instrumentInstanceMethod:@selector(fullNameWithTitle:)];
+    [person fullNameWithTitle:@"Dr."];
+    
+    STAssertEquals([[cls FMS_statisticsForInstanceMethod:@selector(fullNameWithTitle:)] callCount], (uint64_t)11,
+                   @"Unsampled instrumentation should add to the same statistics");
+}
+
+@end
@@ -0,0 +1,10 @@
+//
+//  SwizzleBatchTests.h
+//  FMSSwizzler
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface SwizzleBatchTests : SenTestCase
+
+@end
@@ -0,0 +1,183 @@
+//
+//  SwizzleBatchTests.m
+//  FMSSwizzler
+//
+
+#import "SwizzleBatchTests.h"
+#import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+#import <objc/message.h>
+
+// This prevents compiler errors for non-declared methods
+@interface NSObject(SwizzleBatchTests)
+
+- (NSString *)batchAliasedFullName;
+- (NSString *)batchInheritedFullName;
+- (NSString *)batchOutsideFullName;
+
+@end
+
+@implementation SwizzleBatchTests
+
+- (void)wrapFullNameOfClass:(Class)cls inBatch:(FMSSwizzleBatch *)batch oldSelector:(NSString *)oldName with:(NSString *)marker {
+    
+    SEL oldSelector = NSSelectorFromString(oldName);
+    
+    [batch overrideInstanceMethod:@selector(fullName)
+                          ofClass:cls
+                      oldSelector:oldSelector
+              implementationBlock:^(Person *_self) {
+                  NSString *inner = ((NSString *(*)(id, SEL))objc_msgSend)(_self, oldSelector);
+                  return [NSString stringWithFormat:@"%@(%@)", marker, inner];
+              }];
+}
+
+- (void)testApplyingABatchAcrossClasses {
+    
+    Class first = [Person freshSubclassNamed:@"BatchFirstPerson"];
+    Class second = [Person freshSubclassNamed:@"BatchSecondPerson"];
+    Person *firstPerson = [first personWithFirstName:@"John" lastName:@"Smith" age:42];
+    Person *secondPerson = [second personWithFirstName:@"Sara" lastName:@"Jones" age:35];
+    
+    FMSSwizzleBatchResult *result = [NSObject FMS_performSwizzleBatch:^(FMSSwizzleBatch *batch) {
+        
+        [batch aliasInstanceMethod:@selector(fullName) ofClass:first newSelector:@selector(batchAliasedFullName)];
+        [self wrapFullNameOfClass:first inBatch:batch oldSelector:@"batchFullName1" with:@"a"];
+        [self wrapFullNameOfClass:first inBatch:batch oldSelector:@"batchFullName2" with:@"b"];
+        [batch replaceInstanceMethod:@selector(fullName) ofClass:second withImplementationBlock:^(Person *_self) {
+            return @"Bob";
+        }];
+    }];
+    
+    STAssertEqualObjects([firstPerson fullName], @"b(a(John Smith))", @"Both overrides should run, in order");
+    STAssertEqualObjects([firstPerson batchAliasedFullName], @"John Smith", @"The alias should see the original");
+    STAssertEqualObjects([secondPerson fullName], @"Bob", @"The replacement should be installed");
+    
+    STAssertEquals([[result tokens] count], (NSUInteger)4, @"There should be a token for each swizzle");
+    STAssertEquals([result classCount], (NSUInteger)2, @"Two classes were changed");
+    
+    // fullName is written once per class, plus the three aliases. One at a time, this would take six writes.
+    STAssertEquals([result methodsTouched], (NSUInteger)5, @"Each method should only be written once");
+    
+    [[result tokens][2] restore];
+    STAssertEqualObjects([firstPerson fullName], @"a(John Smith)", @"Batch tokens should restore like any other");
+    
+    [[result tokens][1] restore];
+    STAssertEqualObjects([firstPerson fullName], @"John Smith", @"The original should be back");
+}
+
+- (void)testSwizzlingMethodsInheritedFromOutsideTheBatch {
+    
+    // Only the subclass is in the batch; fullName comes from Person, which has no pending changes.
+    Class cls = [Person freshSubclassNamed:@"BatchInheritedPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    STAssertTrue(class_getInstanceMethod(cls, @selector(fullName)) == class_getInstanceMethod([Person class], @selector(fullName)),
+                 @"The method should only be inherited before the batch");
+    
+    [NSObject FMS_performSwizzleBatch:^(FMSSwizzleBatch *batch) {
+        
+        [batch aliasInstanceMethod:@selector(fullName) ofClass:cls newSelector:@selector(batchOutsideFullName)];
+        [batch replaceInstanceMethod:@selector(fullName) ofClass:cls withImplementationBlock:^(Person *_self) {
+            return @"Replaced";
+        }];
+    }];
+    
+    STAssertEqualObjects([person fullName], @"Replaced", @"The inherited method should be replaced on the subclass");
+    STAssertEqualObjects([person batchOutsideFullName], @"John Smith", @"The alias should reach the inherited original");
+    STAssertEqualObjects([[Person personWithFirstName:@"Sara" lastName:@"Jones" age:35] fullName], @"Sara Jones",
+                         @"The superclass should be unchanged");
+}
+
+- (void)testSwizzlesApplyInTheOrderTheyWereAdded {
+    
+    Class superclass = [Person freshSubclassNamed:@"BatchOrderSuperPerson"];
+    Class subclass = [superclass freshSubclassNamed:@"BatchOrderSubPerson"];
+    Person *person = [subclass personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    // The subclass comes first in the batch, even though its superclass is deeper in the hierarchy.
+    [NSObject FMS_performSwizzleBatch:^(FMSSwizzleBatch *batch) {
+        
+        [batch aliasInstanceMethod:@selector(fullName) ofClass:subclass newSelector:@selector(batchInheritedFullName)];
+        [batch replaceInstanceMethod:@selector(fullName) ofClass:superclass withImplementationBlock:^(Person *_self) {
+            return @"Bob";
+        }];
+    }];
+    
+    STAssertEqualObjects([person fullName], @"Bob", @"The subclass should inherit the replacement");
+    STAssertEqualObjects([person batchInheritedFullName], @"John Smith",
+                         @"The alias was added before the replacement, so it should call the original");
+}
+
+- (void)testAnInvalidSwizzleLeavesEveryClassUnchanged {
+    
+    Class cls = [Person freshSubclassNamed:@"BatchInvalidPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    STAssertThrowsSpecificNamed([NSObject FMS_performSwizzleBatch:^(FMSSwizzleBatch *batch) {
+        
+        [batch replaceInstanceMethod:@selector(fullName) ofClass:cls withImplementationBlock:^(Person *_self) {
+            return @"Bob";
+        }];
+        [batch aliasInstanceMethod:@selector(count) ofClass:cls newSelector:@selector(batchMissingCount)];
+    }], NSException, NSInvalidArgumentException, @"A missing method should reject the whole batch");
+    
+    STAssertEqualObjects([person fullName], @"John Smith", @"The valid swizzle should not have been applied");
+    
+    STAssertThrows([NSObject FMS_performSwizzleBatch:^(FMSSwizzleBatch *batch) {
+        
+        [batch aliasInstanceMethod:@selector(setFirstName:) ofClass:cls newSelector:@selector(batchNoArguments)];
+    }], @"Selectors with different argument counts should be rejected");
+    
+    STAssertThrows([NSObject FMS_performSwizzleBatch:^(FMSSwizzleBatch *batch) {
+        
+        [batch aliasInstanceMethod:@selector(fullName) ofClass:cls newSelector:@selector(batchDuplicateAlias)];
+        [batch aliasInstanceMethod:@selector(firstName) ofClass:cls newSelector:@selector(batchDuplicateAlias)];
+    }], @"An alias can't be added twice in one batch");
+    
+    STAssertFalse([cls instancesRespondToSelector:@selector(batchDuplicateAlias)],
+                  @"A rejected batch should not add any methods");
+}
+
+- (void)testBatchingClassMethods {
+    
+    Class cls = [Person freshSubclassNamed:@"BatchClassMethodPerson"];
+    
+    FMSSwizzleBatchResult *result = [NSObject FMS_performSwizzleBatch:^(FMSSwizzleBatch *batch) {
+        
+        [batch overrideClassMethod:@selector(personWithFirstName:lastName:age:)
+                           ofClass:cls
+                       oldSelector:@selector(batchPersonWithFirstName:lastName:age:)
+               implementationBlock:^(id _self, NSString *firstName, NSString *lastName, NSUInteger age) {
+                   
+                   return ((Person *(*)(id, SEL, NSString *, NSString *, NSUInteger))objc_msgSend)
+                   (_self, @selector(batchPersonWithFirstName:lastName:age:), firstName, lastName, age + 1);
+               }];
+    }];
+    
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    STAssertEquals(person.age, (NSUInteger)43, @"The class method override should be installed");
+    
+    [[result tokens][0] restore];
+    
+    person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    STAssertEquals(person.age, (NSUInteger)42, @"The original class method should be back");
+}
+
+- (void)testBatchesCantBeChangedOnceApplied {
+    
+    __block FMSSwizzleBatch *escaped = nil;
+    
+    FMSSwizzleBatchResult *result = [NSObject FMS_performSwizzleBatch:^(FMSSwizzleBatch *batch) {
+        escaped = batch;
+    }];
+    
+    STAssertEquals([[result tokens] count], (NSUInteger)0, @"An empty batch should do nothing");
+    STAssertEquals([result methodsTouched], (NSUInteger)0, @"An empty batch should do nothing");
+    
+    STAssertThrows([escaped replaceInstanceMethod:@selector(fullName) ofClass:[Person class] withImplementationBlock:^{}],
+                   @"Adding to an applied batch should throw");
+}
+
+@end
@@ -0,0 +1,10 @@
+//
+//  SwizzleRecordTests.h
+//  FMSSwizzler
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface SwizzleRecordTests : SenTestCase
+
+@end
@@ -0,0 +1,127 @@
+//
+//  SwizzleRecordTests.m
+//  FMSSwizzler
+//
+
+#import "SwizzleRecordTests.h"
+#import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+
+// This prevents compiler errors for non-declared methods
+@interface NSObject(SwizzleRecordTests)
+
+- (NSString *)recordedOldFullName;
+
+@end
+
+@implementation SwizzleRecordTests
+
+- (NSArray *)recordsForClass:(Class)cls {
+    
+    NSMutableArray *records = [NSMutableArray array];
+    
+    for (FMSSwizzleRecord *record in [NSObject FMS_activeSwizzleRecords]) {
+        if ([[record className] isEqualToString:NSStringFromClass(cls)]) {
+            [records addObject:record];
+        }
+    }
+    
+    return records;
+}
+
+- (void)testSwizzlesAreRecordedUntilRestored {
+    
+    Class cls = [Person freshSubclassNamed:@"RecordedPerson"];
+    IMP original = class_getMethodImplementation(cls, @selector(fullName));
+    
+    STAssertEquals([[self recordsForClass:cls] count], (NSUInteger)0, @"Nothing has been swizzled yet");
+    
+    FMSSwizzleToken *token = [cls FMS_overrideInstanceMethod:@selector(fullName)
+                                                 oldSelector:@selector(recordedOldFullName)
+                                         implementationBlock:^(Person *_self) {
+                                             return [[_self recordedOldFullName] uppercaseString];
+                                         }];
+    
+    NSArray *records = [self recordsForClass:cls];
+    STAssertEquals([records count], (NSUInteger)1, @"The override should be recorded");
+    
+    FMSSwizzleRecord *record = [records lastObject];
+    STAssertEquals([record kind], FMSSwizzleRecordOverride, @"The record should be an override");
+    STAssertEqualObjects([record kindName], @"override", @"The record should be an override");
+    STAssertEquals([record selector], @selector(fullName), @"The record should name the selector");
+    STAssertEqualObjects([record typeEncoding],
+                         @(method_getTypeEncoding(class_getInstanceMethod([Person class], @selector(fullName)))),
+                         @"The record should carry the method's type encoding");
+    STAssertEquals([record originalImplementation], original, @"The record should keep the original IMP");
+    STAssertEquals([record installedImplementation], [token installedImplementation], @"The record should keep the new IMP");
+    STAssertFalse([record isClassMethod], @"This is an instance method");
+    STAssertTrue([record installNanoseconds] > 0, @"The record should have an install time");
+    
+    [token restore];
+    
+    STAssertEquals([[self recordsForClass:cls] count], (NSUInteger)0, @"Restoring the token should remove the record");
+}
+
+- (void)testGeneratedClassesAndPseudoPropertiesAreRecorded {
+    
+    Class generated = [Person FMS_allocateSubclassWithPseudoProperties:@{@"recordedCount": @(FMSInteger)}];
+    
+    BOOL sawClass = NO;
+    BOOL sawProperty = NO;
+    
+    for (FMSSwizzleRecord *record in [self recordsForClass:generated]) {
+        
+        if ([record kind] == FMSSwizzleRecordGeneratedClass) {
+            sawClass = YES;
+            STAssertEqualObjects([record baseClassName], @"Person", @"The record should name the class it came from");
+        }
+        
+        if ([record kind] == FMSSwizzleRecordPseudoProperty) {
+            sawProperty = YES;
+            STAssertEqualObjects(NSStringFromSelector([record selector]), @"recordedCount", @"The getter should be recorded");
+            STAssertEqualObjects([record typeEncoding], @(@encode(NSInteger)), @"The property type should be recorded");
+        }
+    }
+    
+    STAssertTrue(sawClass, @"The generated class should be recorded");
+    STAssertTrue(sawProperty, @"The pseudo property should be recorded");
+}
+
+- (void)testExportingRecords {
+    
+    Class cls = [Person freshSubclassNamed:@"ExportedPerson"];
+    FMSSwizzleToken *token = [cls FMS_replaceInstanceMethod:@selector(fullName) withImplementationBlock:^(id _self) {
+        return @"Replaced";
+    }];
+    
+    NSDictionary *document = [NSJSONSerialization JSONObjectWithData:[NSObject FMS_swizzleRecordsJSON] options:0 error:NULL];
+    STAssertEqualObjects(document[@"version"], @(FMSSwizzleRecordSnapshotVersion), @"The JSON should carry its version");
+    
+    NSDictionary *exported = nil;
+    
+    for (NSDictionary *object in document[@"records"]) {
+        if ([object[@"class"] isEqualToString:@"ExportedPerson"]) {
+            exported = object;
+        }
+    }
+    
+    STAssertEqualObjects(exported[@"kind"], @"replace", @"The replacement should be exported");
+    STAssertEqualObjects(exported[@"selector"], @"fullName", @"The selector should be exported");
+    
+    NSData *snapshot = [NSObject FMS_swizzleRecordSnapshot];
+    const uint8_t *bytes = [snapshot bytes];
+    
+    uint32_t version;
+    uint32_t count;
+    memcpy(&version, bytes + 4, sizeof(version));
+    memcpy(&count, bytes + 8, sizeof(count));
+    
+    STAssertTrue(memcmp(bytes, FMSSwizzleRecordSnapshotMagic, 4) == 0, @"The snapshot should start with the magic bytes");
+    STAssertEquals(version, (uint32_t)FMSSwizzleRecordSnapshotVersion, @"The snapshot should carry its version");
+    STAssertTrue(count > 0, @"The snapshot should include the replacement");
+    
+    [token restore];
+}
+
+@end
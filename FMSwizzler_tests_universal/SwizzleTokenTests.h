@@ -0,0 +1,10 @@
+//
+//  SwizzleTokenTests.h
+//  FMSSwizzler
+//
+
+#import <SenTestingKit/SenTestingKit.h>
+
+@interface SwizzleTokenTests : SenTestCase
+
+@end
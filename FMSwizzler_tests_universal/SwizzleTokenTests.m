@@ -0,0 +1,258 @@
+//
+//  SwizzleTokenTests.m
+//  FMSSwizzler
+//
+
+#import "SwizzleTokenTests.h"
+#import "Person.h"
+#import "NSObject+FMSSwizzler.h"
+#import <objc/runtime.h>
+#import <objc/message.h>
+#import <unistd.h>
+
+@implementation SwizzleTokenTests
+
+- (FMSSwizzleToken *)wrapFullNameOfClass:(Class)cls oldSelector:(NSString *)oldName with:(NSString *)marker {
+    
+    SEL oldSelector = NSSelectorFromString(oldName);
+    
+    return [cls FMS_overrideInstanceMethod:@selector(fullName)
+                               oldSelector:oldSelector
+                       implementationBlock:^(Person *_self) {
+                           NSString *inner = ((NSString *(*)(id, SEL))objc_msgSend)(_self, oldSelector);
+                           return [NSString stringWithFormat:@"%@(%@)", marker, inner];
+                       }];
+}
+
+- (void)testRestoringAReplacement {
+    
+    Class cls = [Person freshSubclassNamed:@"TokenReplacePerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    FMSSwizzleToken *token = [cls FMS_replaceInstanceMethod:@selector(fullName)
+                                    withImplementationBlock:^(Person *_self) {
+                                        return @"Bob";
+                                    }];
+    
+    STAssertEqualObjects([person fullName], @"Bob", @"The replacement should be installed");
+    STAssertTrue([token isActive], @"A new token should be active");
+    STAssertEquals([token kind], FMSSwizzleTokenReplace, @"Should record a replacement");
+    STAssertEquals([token targetClass], cls, @"Should record the modified class");
+    
+    [token restore];
+    
+    STAssertEqualObjects([person fullName], @"John Smith", @"The original should be back");
+    STAssertFalse([token isActive], @"A restored token should be inactive");
+    STAssertNoThrow([token restore], @"Restoring twice should do nothing");
+}
+
+- (void)testRestoringOverridesInLIFOOrder {
+    
+    Class cls = [Person freshSubclassNamed:@"TokenLIFOPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    FMSSwizzleToken *first = [self wrapFullNameOfClass:cls oldSelector:@"lifoFullName1" with:@"a"];
+    FMSSwizzleToken *second = [self wrapFullNameOfClass:cls oldSelector:@"lifoFullName2" with:@"b"];
+    
+    STAssertEqualObjects([person fullName], @"b(a(John Smith))", @"Both overrides should run");
+    
+    [second restore];
+    STAssertEqualObjects([person fullName], @"a(John Smith)", @"Only the first override should remain");
+    
+    [first restore];
+    STAssertEqualObjects([person fullName], @"John Smith", @"The original should be back");
+}
+
+- (void)testRestoringAnOverrideFromTheMiddleOfTheStack {
+    
+    Class cls = [Person freshSubclassNamed:@"TokenMiddlePerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    FMSSwizzleToken *first = [self wrapFullNameOfClass:cls oldSelector:@"middleFullName1" with:@"a"];
+    FMSSwizzleToken *second = [self wrapFullNameOfClass:cls oldSelector:@"middleFullName2" with:@"b"];
+    FMSSwizzleToken *third = [self wrapFullNameOfClass:cls oldSelector:@"middleFullName3" with:@"c"];
+    
+    [second restore];
+    STAssertEqualObjects([person fullName], @"c(a(John Smith))", @"The middle override should be skipped");
+    
+    [first restore];
+    STAssertEqualObjects([person fullName], @"c(John Smith)", @"The bottom override should be skipped");
+    
+    [third restore];
+    STAssertEqualObjects([person fullName], @"John Smith", @"The original should be back");
+}
+
+- (void)testRestoringAnOverrideLetsTheAliasBeReused {
+    
+    Class cls = [Person freshSubclassNamed:@"TokenReusePerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    for (NSUInteger round = 0; round < 3; round++) {
+        
+        FMSSwizzleToken *token = [self wrapFullNameOfClass:cls oldSelector:@"reusedFullName" with:@"x"];
+        STAssertEqualObjects([person fullName], @"x(John Smith)", @"The override should run");
+        
+        [token restore];
+        STAssertEqualObjects([person fullName], @"John Smith", @"The original should be back");
+    }
+    
+    STAssertThrows(((NSString *(*)(id, SEL))objc_msgSend)(person, NSSelectorFromString(@"reusedFullName")),
+                   @"A retired alias should not be callable");
+}
+
+- (void)testRestoringAClassMethodOverride {
+    
+    Class cls = [Person freshSubclassNamed:@"TokenClassMethodPerson"];
+    SEL selector = @selector(personWithFirstName:lastName:age:);
+    SEL oldSelector = NSSelectorFromString(@"tokenPersonWithFirstName:lastName:age:");
+    
+    FMSSwizzleToken *token =
+    [cls FMS_overrideClassMethod:selector
+                     oldSelector:oldSelector
+             implementationBlock:^(id _self, NSString *firstName, NSString *lastName, NSUInteger age) {
+                 return ((id (*)(id, SEL, NSString *, NSString *, NSUInteger))objc_msgSend)
+                 (_self, oldSelector, [firstName uppercaseString], lastName, age);
+             }];
+    
+    STAssertEqualObjects([[cls personWithFirstName:@"John" lastName:@"Smith" age:42] firstName], @"JOHN",
+                         @"The override should run");
+    STAssertEquals([token targetClass], object_getClass(cls), @"Class methods should record the metaclass");
+    
+    [token restore];
+    
+    STAssertEqualObjects([[cls personWithFirstName:@"John" lastName:@"Smith" age:42] firstName], @"John",
+                         @"The original should be back");
+}
+
+- (void)testRestoringAfterAnOutsideChangeThrows {
+    
+    Class cls = [Person freshSubclassNamed:@"TokenOutsidePerson"];
+    
+    FMSSwizzleToken *token = [cls FMS_replaceInstanceMethod:@selector(fullName)
+                                    withImplementationBlock:^(Person *_self) {
+                                        return @"Bob";
+                                    }];
+    
+    IMP outside = imp_implementationWithBlock(^(Person *_self) {
+        return @"Alice";
+    });
+    class_replaceMethod(cls, @selector(fullName), outside, "@@:");
+    
+    STAssertThrows([token restore], @"Should refuse to clobber a change made outside FMSSwizzler");
+    STAssertTrue([token isActive], @"A failed restore should leave the token active");
+}
+
+- (void)testRestoringAnInheritedMethodDefersToTheSuperclassAgain {
+    
+    Class superclass = [Person freshSubclassNamed:@"TokenInheritedSuperPerson"];
+    Class cls = [superclass freshSubclassNamed:@"TokenInheritedSubPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    FMSSwizzleToken *token = [cls FMS_replaceInstanceMethod:@selector(fullName)
+                                    withImplementationBlock:^(Person *_self) {
+                                        return @"Bob";
+                                    }];
+    [token restore];
+    
+    STAssertEqualObjects([person fullName], @"John Smith", @"The inherited method should be back");
+    
+    // A change to the superclass after the restore must reach the subclass, as it would have before the swizzle.
+    FMSSwizzleToken *superToken = [superclass FMS_replaceInstanceMethod:@selector(fullName)
+                                                withImplementationBlock:^(Person *_self) {
+                                                    return @"Super";
+                                                }];
+    
+    STAssertEqualObjects([person fullName], @"Super", @"The subclass should not keep a stale copy of the old IMP");
+    
+    [superToken restore];
+    STAssertEqualObjects([person fullName], @"John Smith", @"The superclass's original should show through");
+}
+
+- (void)testRestoredImplementationsAreFreedAfterAGracePeriod {
+    
+    Class cls = [Person freshSubclassNamed:@"TokenReclaimPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    
+    [Person drainRetiredImplementations];
+    
+    FMSSwizzleToken *token = [cls FMS_replaceInstanceMethod:@selector(fullName)
+                                    withImplementationBlock:^(Person *_self) {
+                                        return @"Bob";
+                                    }];
+    
+    IMP replacement = [token installedImplementation];
+    [token restore];
+    
+    STAssertEquals([NSObject FMS_retiredImplementationCount], (NSUInteger)1, @"Restoring should retire the replacement");
+    
+    // A call that was already inside the replacement when it was restored can still finish.
+    NSString *inFlight = ((NSString *(*)(id, SEL))replacement)(person, @selector(fullName));
+    STAssertEqualObjects(inFlight, @"Bob", @"A retired replacement should keep working until it is freed");
+    
+    [Person drainRetiredImplementations];
+    STAssertEquals([NSObject FMS_retiredImplementationCount], (NSUInteger)0, @"The replacement should be freed once no call can be using it");
+}
+
+- (void)testRestoredImplementationsWaitForCallsStillInsideThem {
+    
+    Class cls = [Person freshSubclassNamed:@"TokenInFlightPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block FMSSwizzleToken *token = nil;
+    __block NSUInteger retiredWhileInside = 0;
+    
+    [Person drainRetiredImplementations];
+    
+    token = [cls FMS_replaceInstanceMethod:@selector(fullName)
+                   withImplementationBlock:^(Person *_self) {
+                       
+                       [token restore];
+                       
+                       // This call is still counted, so however long it takes, its own block is not freed under it.
+                       usleep(50000);
+                       [NSObject FMS_reclaimRetiredImplementations];
+                       usleep(50000);
+                       [NSObject FMS_reclaimRetiredImplementations];
+                       
+                       retiredWhileInside = [NSObject FMS_retiredImplementationCount];
+                       return @"Bob";
+                   }];
+    
+    STAssertEqualObjects([person fullName], @"Bob", @"The call that restored the replacement should finish");
+    STAssertEquals(retiredWhileInside, (NSUInteger)1, @"The replacement should not be freed while a call is inside it");
+    
+    [Person drainRetiredImplementations];
+    STAssertEquals([NSObject FMS_retiredImplementationCount], (NSUInteger)0, @"The replacement should be freed once the call returned");
+}
+
+- (void)testAStackLeftBehindByAnOutsideChangeKeepsWorking {
+    
+    Class cls = [Person freshSubclassNamed:@"TokenAbandonedPerson"];
+    Person *person = [cls personWithFirstName:@"John" lastName:@"Smith" age:42];
+    __block NSUInteger hookCalls = 0;
+    
+    @autoreleasepool {
+        
+        [cls FMS_hookInstanceMethod:@selector(fullName)
+                             before:^(id receiver, SEL selector) { hookCalls++; }
+                              after:nil];
+        
+        // Wrap the hook from outside FMSSwizzler, then hook again on top. The hook's stack is left behind.
+        IMP hooked = method_getImplementation(class_getInstanceMethod(cls, @selector(fullName)));
+        IMP outside = imp_implementationWithBlock(^(Person *_self) {
+            return ((NSString *(*)(id, SEL))hooked)(_self, @selector(fullName));
+        });
+        class_replaceMethod(cls, @selector(fullName), outside, "@@:");
+        
+        [cls FMS_hookInstanceMethod:@selector(fullName)
+                             before:^(id receiver, SEL selector) { hookCalls++; }
+                              after:nil];
+    }
+    
+    [Person drainRetiredImplementations];
+    
+    // The first hook's trampoline still reads its token on every call.
+    STAssertEqualObjects([person fullName], @"John Smith", @"The original should still run");
+    STAssertEquals(hookCalls, (NSUInteger)2, @"Both hooks should run");
+}
+
+@end